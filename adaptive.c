@@ -0,0 +1,186 @@
+#include "adaptive.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct BlockRank {
+    uint64_t energy;
+    uint32_t index;
+} BLOCK_RANK;
+
+// Sample value with the LSB slot cleared, so encoder and decoder see the same thing
+static inline int32_t maskedSample(const uint8_t* p, uint32_t stride) {
+    switch (stride) {
+    case 1:
+        return (int32_t)(p[0] & 0xFE) - 128;
+    case 2:
+        return (int16_t)((p[0] & 0xFE) | (p[1] << 8));
+    default:
+        // 32-bit: the top half is plenty to rank blocks and keeps the squares in range
+        return (int16_t)(p[2] | (p[3] << 8));
+    }
+}
+
+static void bmpEnergy(const CARRIER_LAYOUT* layout, const uint8_t* data, uint64_t numBlocks, uint64_t* energy) {
+    uint32_t left = layout->channels;
+    uint32_t up = layout->rowSize;
+    for (uint64_t b = 0; b < numBlocks; b++) {
+        uint64_t start = b * ADAPTIVE_BLOCK_SLOTS;
+        uint32_t sum = 0;
+        if (start >= up && start >= left) {
+            // whole window has a left and an upper neighbour: straight-line loop, vectorizes
+            const uint8_t* p = data + start;
+            const uint8_t* l = p - left;
+            const uint8_t* u = p - up;
+            for (int i = 0; i < ADAPTIVE_BLOCK_SLOTS; i++) {
+                int32_t v = p[i] & 0xFE;
+                sum += abs(v - (l[i] & 0xFE)) + abs(v - (u[i] & 0xFE));
+            }
+        }
+        else {
+            for (uint64_t i = start; i < start + ADAPTIVE_BLOCK_SLOTS; i++) {
+                int32_t v = data[i] & 0xFE;
+                if (i >= left) sum += abs(v - (data[i - left] & 0xFE));
+                if (i >= up) sum += abs(v - (data[i - up] & 0xFE));
+            }
+        }
+        energy[b] = sum;
+    }
+}
+
+static void wavEnergy(const CARRIER_LAYOUT* layout, const uint8_t* data, uint64_t numBlocks, uint64_t* energy) {
+    uint32_t stride = layout->stride;
+    uint32_t channels = layout->channels;
+    int32_t window[ADAPTIVE_BLOCK_SLOTS + 16];
+    for (uint64_t b = 0; b < numBlocks; b++) {
+        uint64_t start = b * ADAPTIVE_BLOCK_SLOTS;
+        // previous sample of the same channel for the first few slots
+        for (uint32_t i = 0; i < channels && i < 16; i++) {
+            window[i] = start >= channels ? maskedSample(data + (start - channels + i) * stride, stride) : 0;
+        }
+        for (int i = 0; i < ADAPTIVE_BLOCK_SLOTS; i++) {
+            window[channels + i] = maskedSample(data + (start + i) * stride, stride);
+        }
+        int64_t sum = 0;
+        for (int i = 0; i < ADAPTIVE_BLOCK_SLOTS; i++) {
+            int64_t diff = window[channels + i] - window[i];
+            sum += diff * diff;
+        }
+        energy[b] = (uint64_t)sum;
+    }
+}
+
+uint64_t* adaptiveEnergyMap(const CARRIER_LAYOUT* layout, const uint8_t* data, uint64_t* numBlocks) {
+    uint64_t numSlots = layout->dataSize / layout->stride;
+    *numBlocks = numSlots / ADAPTIVE_BLOCK_SLOTS;
+    if (layout->channels > 16) {
+        fprintf(stderr, "Error: Too many channels for adaptive mode!\n");
+        return NULL;
+    }
+    uint64_t* energy = (uint64_t*)malloc((*numBlocks + 1) * sizeof(uint64_t));
+    if (energy == NULL) {
+        fprintf(stderr, "Could not allocate energy map!\n");
+        return NULL;
+    }
+    if (layout->type == TYPE_BMP) {
+        bmpEnergy(layout, data, *numBlocks, energy);
+    }
+    else {
+        wavEnergy(layout, data, *numBlocks, energy);
+    }
+    return energy;
+}
+
+static int compareRank(const void* a, const void* b) {
+    const BLOCK_RANK* x = (const BLOCK_RANK*)a;
+    const BLOCK_RANK* y = (const BLOCK_RANK*)b;
+    if (x->energy != y->energy) return x->energy < y->energy ? 1 : -1;
+    return x->index < y->index ? -1 : (x->index > y->index);
+}
+
+uint32_t* adaptiveBlockOrder(const CARRIER_LAYOUT* layout, const uint8_t* data, uint64_t* numBlocks) {
+    uint64_t* energy = adaptiveEnergyMap(layout, data, numBlocks);
+    if (energy == NULL) return NULL;
+    BLOCK_RANK* ranks = (BLOCK_RANK*)malloc((*numBlocks + 1) * sizeof(BLOCK_RANK));
+    uint32_t* order = (uint32_t*)malloc((*numBlocks + 1) * sizeof(uint32_t));
+    if (ranks == NULL || order == NULL) {
+        fprintf(stderr, "Could not allocate block order!\n");
+        free(energy);
+        free(ranks);
+        free(order);
+        return NULL;
+    }
+    for (uint64_t b = 0; b < *numBlocks; b++) {
+        ranks[b].energy = energy[b];
+        ranks[b].index = (uint32_t)b;
+    }
+    qsort(ranks, (size_t)*numBlocks, sizeof(BLOCK_RANK), compareRank);
+    for (uint64_t b = 0; b < *numBlocks; b++) {
+        order[b] = ranks[b].index;
+    }
+    free(ranks);
+    free(energy);
+    return order;
+}
+
+// j'th bit of the adaptive stream lives at this byte of the carrier data
+static inline uint64_t slotOffset(const CARRIER_LAYOUT* layout, const uint32_t* order, uint64_t j) {
+    return ((uint64_t)order[j / ADAPTIVE_BLOCK_SLOTS] * ADAPTIVE_BLOCK_SLOTS + j % ADAPTIVE_BLOCK_SLOTS) * layout->stride;
+}
+
+int encodeAdaptive(const CARRIER_LAYOUT* layout, uint8_t* data, FILE* input_file) {
+    uint64_t length;
+    uint8_t* payload = readPayload(input_file, &length);
+    if (payload == NULL) return -1;
+    uint64_t numBlocks;
+    uint32_t* order = adaptiveBlockOrder(layout, data, &numBlocks);
+    if (order == NULL) {
+        free(payload);
+        return -1;
+    }
+    uint64_t totalBits = (length + 4) * 8;
+    if (length > 0xFFFFFFFFu || totalBits > numBlocks * ADAPTIVE_BLOCK_SLOTS) {
+        fprintf(stderr, "ERROR: Encode data too large!\n");
+        fprintf(stderr, "payload bits: %llu | max bits: %llu\n",
+            (unsigned long long)totalBits, (unsigned long long)(numBlocks * ADAPTIVE_BLOCK_SLOTS));
+        free(order);
+        free(payload);
+        return -1;
+    }
+    uint8_t header[4] = { (uint8_t)length, (uint8_t)(length >> 8), (uint8_t)(length >> 16), (uint8_t)(length >> 24) };
+    for (uint64_t j = 0; j < totalBits; j++) {
+        uint64_t byteIndex = j / 8;
+        uint8_t curChar = byteIndex < 4 ? header[byteIndex] : payload[byteIndex - 4];
+        uint64_t offset = slotOffset(layout, order, j);
+        data[offset] = (data[offset] & 0xFE) | ((curChar >> (j % 8)) & 1);
+    }
+    free(order);
+    free(payload);
+    return 0;
+}
+
+int decodeAdaptive(const CARRIER_LAYOUT* layout, const uint8_t* data, FILE* output_file) {
+    uint64_t numBlocks;
+    uint32_t* order = adaptiveBlockOrder(layout, data, &numBlocks);
+    if (order == NULL) return -1;
+    uint64_t capacityBits = numBlocks * ADAPTIVE_BLOCK_SLOTS;
+    uint64_t j = 0;
+    uint32_t length = 0;
+    for (; j < 32 && j < capacityBits; j++) {
+        length |= (uint32_t)(data[slotOffset(layout, order, j)] & 1) << j;
+    }
+    if (((uint64_t)length + 4) * 8 > capacityBits) {
+        fprintf(stderr, "Error: No adaptive payload found (bad length %u)\n", length);
+        free(order);
+        return -1;
+    }
+    uint8_t curChar = 0;
+    for (; j < ((uint64_t)length + 4) * 8; j++) {
+        curChar |= (data[slotOffset(layout, order, j)] & 1) << (j % 8);
+        if (j % 8 == 7) {
+            fputc(curChar, output_file);
+            curChar = 0;
+        }
+    }
+    free(order);
+    return 0;
+}
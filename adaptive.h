@@ -0,0 +1,24 @@
+//
+// Content-adaptive embedding: payload bits go into the busiest blocks of the carrier first.
+//
+#ifndef STEG_ADAPTIVE_H
+#define STEG_ADAPTIVE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "carrier.h"
+
+// LSB slots per block of the energy map
+#define ADAPTIVE_BLOCK_SLOTS 64
+
+// Energy of every block, computed only from bits the embedding never touches.
+// BMP: horizontal + vertical gradient per channel. WAV: short-time energy of the differenced signal.
+uint64_t* adaptiveEnergyMap(const CARRIER_LAYOUT* layout, const uint8_t* data, uint64_t* numBlocks);
+// Block indices ordered from highest to lowest energy (ties keep carrier order)
+uint32_t* adaptiveBlockOrder(const CARRIER_LAYOUT* layout, const uint8_t* data, uint64_t* numBlocks);
+
+// Embed a 32-bit length followed by the payload, walking the blocks in energy order
+int encodeAdaptive(const CARRIER_LAYOUT* layout, uint8_t* data, FILE* input_file);
+// Rebuild the energy order and pull the payload back out
+int decodeAdaptive(const CARRIER_LAYOUT* layout, const uint8_t* data, FILE* output_file);
+#endif //STEG_ADAPTIVE_H
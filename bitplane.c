@@ -0,0 +1,314 @@
+#include "bitplane.h"
+#include "bmp.h"
+#include "carrier.h"
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define STEG_BITPLANE_SSE2
+#endif
+
+// Fixed-point resampling weights, in 1/256ths of a pixel
+#define RESAMPLE_ONE 256
+
+typedef struct PlaneImage {
+    uint32_t width;
+    uint32_t height;
+    int topDown;         // negative height in the header: first stored row is the top one
+    uint32_t channels;   // bytes per pixel, 3 or 4
+    uint64_t rowStride;  // bytes per stored row, padding included
+    uint32_t dataOffset;
+} PLANE_IMAGE;
+
+// The secret image, scaled to the cover's width one row at a time and cached by row
+typedef struct Resampler {
+    FILE* file;
+    PLANE_IMAGE image;
+    uint32_t outWidth;
+    uint32_t outChannels;
+    uint32_t* left;     // per output pixel: left source pixel and the weight of the one after it
+    uint16_t* weight;
+    uint8_t* raw;       // one stored secret row
+    uint8_t* rows[2];   // resampled rows, slot = secret row & 1
+    int64_t cached[2];
+} RESAMPLER;
+
+static int readImageHeader(FILE* file, uint8_t* header, PLANE_IMAGE* image, const char* what) {
+    BMP_FILE_HEADER fileHeader;
+    BMP_INFO_HEADER infoHeader;
+    if (fread(header, 1, BMP_HEADER_SIZE, file) != BMP_HEADER_SIZE) {
+        fprintf(stderr, "Error: %s is not a BMP file\n", what);
+        return 0;
+    }
+    memcpy(&fileHeader, header, sizeof(BMP_FILE_HEADER));
+    memcpy(&infoHeader, header + sizeof(BMP_FILE_HEADER), sizeof(BMP_INFO_HEADER));
+    int32_t height = (int32_t)infoHeader.height;
+    if (fileHeader.signature != 0x4D42 || fileHeader.dataOffset < BMP_HEADER_SIZE || infoHeader.width == 0 || height == 0) {
+        fprintf(stderr, "Error: %s is not a BMP file\n", what);
+        return 0;
+    }
+    if (infoHeader.compressionType != 0 || (infoHeader.bitsPerPixel != 24 && infoHeader.bitsPerPixel != 32)) {
+        fprintf(stderr, "Error: %s must be an uncompressed 24- or 32-bit BMP\n", what);
+        return 0;
+    }
+    image->width = infoHeader.width;
+    image->height = (uint32_t)(height < 0 ? -(int64_t)height : height);
+    image->topDown = height < 0;
+    image->channels = infoHeader.bitsPerPixel / 8;
+    image->rowStride = ((uint64_t)image->width * infoHeader.bitsPerPixel + 31) / 32 * 4;
+    image->dataOffset = fileHeader.dataOffset;
+    return 1;
+}
+
+// Copy count bytes (or everything left, if count is UINT64_MAX) from in to out
+static int copyBytes(FILE* in, FILE* out, uint64_t count) {
+    uint8_t buffer[64 * 1024];
+    while (count > 0) {
+        size_t want = count < sizeof(buffer) ? (size_t)count : sizeof(buffer);
+        size_t got = fread(buffer, 1, want, in);
+        if (got > 0 && fwrite(buffer, 1, got, out) != got) return 0;
+        if (got < want) return count == UINT64_MAX || ferror(in) ? !ferror(in) : 0;
+        if (count != UINT64_MAX) count -= got;
+    }
+    return 1;
+}
+
+// Image row y (0 = top) is stored at this row of the pixel data
+static inline uint64_t storedRow(const PLANE_IMAGE* image, uint32_t y) {
+    return image->topDown ? y : image->height - 1 - y;
+}
+
+// Centre-aligned bilinear source position of each of outSize samples, as an index and a 1/256 weight
+static void resampleTable(uint32_t inSize, uint32_t outSize, uint32_t* left, uint16_t* weight) {
+    for (uint32_t i = 0; i < outSize; i++) {
+        int64_t position = ((int64_t)(2 * i + 1) * inSize * RESAMPLE_ONE) / (2 * (int64_t)outSize) - RESAMPLE_ONE / 2;
+        if (position < 0) position = 0;
+        uint32_t index = (uint32_t)(position / RESAMPLE_ONE);
+        left[i] = index < inSize - 1 ? index : inSize - 1;
+        weight[i] = index < inSize - 1 ? (uint16_t)(position % RESAMPLE_ONE) : 0;
+    }
+}
+
+// out = a + (b - a) * w / 256, for whole rows (the vertical half of the resampler)
+static void blendRows(uint8_t* out, const uint8_t* a, const uint8_t* b, uint32_t w, size_t count) {
+    size_t i = 0;
+    if (w == 0) {
+        memcpy(out, a, count);
+        return;
+    }
+#ifdef STEG_BITPLANE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i wb = _mm_set1_epi16((short)w);
+    const __m128i wa = _mm_set1_epi16((short)(RESAMPLE_ONE - w));
+    const __m128i round = _mm_set1_epi16(RESAMPLE_ONE / 2);
+    for (; i + 16 <= count; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        // a * (256 - w) + b * w stays below 2^16, so unsigned 16-bit lanes are enough
+        __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), wa),
+            _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), wb)), round);
+        __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), wa),
+            _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), wb)), round);
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+    }
+#endif
+    for (; i < count; i++) out[i] = (uint8_t)((a[i] * (RESAMPLE_ONE - w) + b[i] * w + RESAMPLE_ONE / 2) >> 8);
+}
+
+// cover = (cover & ~low) | (secret >> (8 - bits)): the secret's top planes into the cover's bottom ones
+static void packPlanes(uint8_t* cover, const uint8_t* secret, int bits, size_t count) {
+    uint8_t low = (uint8_t)((1 << bits) - 1);
+    size_t i = 0;
+#ifdef STEG_BITPLANE_SSE2
+    const __m128i lowMask = _mm_set1_epi8((char)low);
+    for (; i + 16 <= count; i += 16) {
+        // 16-bit shift; the mask drops what crossed over from the neighbouring byte
+        __m128i planes = _mm_and_si128(_mm_srli_epi16(_mm_loadu_si128((const __m128i*)(secret + i)), 8 - bits), lowMask);
+        __m128i kept = _mm_andnot_si128(lowMask, _mm_loadu_si128((const __m128i*)(cover + i)));
+        _mm_storeu_si128((__m128i*)(cover + i), _mm_or_si128(kept, planes));
+    }
+#endif
+    for (; i < count; i++) cover[i] = (uint8_t)((cover[i] & ~low) | (secret[i] >> (8 - bits)));
+}
+
+// Shift the bottom planes back to the top, repeating them below so full-scale values stay full-scale
+static void unpackPlanes(uint8_t* data, int bits, size_t count) {
+    size_t i = 0;
+#ifdef STEG_BITPLANE_SSE2
+    const __m128i highMask = _mm_set1_epi8((char)(0xFF << (8 - bits)));
+    for (; i + 16 <= count; i += 16) {
+        __m128i planes = _mm_and_si128(_mm_slli_epi16(_mm_loadu_si128((const __m128i*)(data + i)), 8 - bits), highMask);
+        __m128i value = planes;
+        for (int shift = bits; shift < 8; shift += bits) {
+            value = _mm_or_si128(value, _mm_and_si128(_mm_srli_epi16(planes, shift), _mm_set1_epi8((char)(0xFF >> shift))));
+        }
+        _mm_storeu_si128((__m128i*)(data + i), value);
+    }
+#endif
+    for (; i < count; i++) {
+        uint8_t planes = (uint8_t)(data[i] << (8 - bits));
+        uint8_t value = planes;
+        for (int shift = bits; shift < 8; shift += bits) value |= planes >> shift;
+        data[i] = value;
+    }
+}
+
+static int initResampler(RESAMPLER* r, FILE* secret, uint32_t outWidth, uint32_t outChannels) {
+    uint8_t header[BMP_HEADER_SIZE];
+    memset(r, 0, sizeof(RESAMPLER));
+    if (!readImageHeader(secret, header, &r->image, "Secret image")) return 0;
+    r->file = secret;
+    r->outWidth = outWidth;
+    r->outChannels = outChannels;
+    r->left = (uint32_t*)malloc(sizeof(uint32_t) * outWidth);
+    r->weight = (uint16_t*)malloc(sizeof(uint16_t) * outWidth);
+    r->raw = (uint8_t*)malloc((size_t)r->image.rowStride);
+    r->rows[0] = (uint8_t*)malloc((size_t)outWidth * outChannels);
+    r->rows[1] = (uint8_t*)malloc((size_t)outWidth * outChannels);
+    r->cached[0] = r->cached[1] = -1;
+    if (r->left == NULL || r->weight == NULL || r->raw == NULL || r->rows[0] == NULL || r->rows[1] == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 0;
+    }
+    resampleTable(r->image.width, outWidth, r->left, r->weight);
+    return 1;
+}
+
+static void freeResampler(RESAMPLER* r) {
+    free(r->left);
+    free(r->weight);
+    free(r->raw);
+    free(r->rows[0]);
+    free(r->rows[1]);
+}
+
+// Secret row y scaled to the output width, with the cover's channel layout (missing alpha reads as opaque)
+static const uint8_t* resampledRow(RESAMPLER* r, uint32_t y) {
+    int slot = y & 1;
+    if (r->cached[slot] == (int64_t)y) return r->rows[slot];
+    const PLANE_IMAGE* image = &r->image;
+    if (fseek(r->file, (long)(image->dataOffset + storedRow(image, y) * image->rowStride), SEEK_SET) != 0
+        || fread(r->raw, 1, (size_t)image->rowStride, r->file) != image->rowStride) {
+        fprintf(stderr, "Error: Secret image is truncated\n");
+        return NULL;
+    }
+    uint8_t* out = r->rows[slot];
+    uint32_t inChannels = image->channels;
+    for (uint32_t x = 0; x < r->outWidth; x++) {
+        const uint8_t* a = r->raw + (size_t)r->left[x] * inChannels;
+        const uint8_t* b = r->left[x] + 1 < image->width ? a + inChannels : a;
+        uint32_t w = r->weight[x];
+        for (uint32_t c = 0; c < r->outChannels; c++) {
+            out[c] = c < inChannels ? (uint8_t)((a[c] * (RESAMPLE_ONE - w) + b[c] * w + RESAMPLE_ONE / 2) >> 8) : 0xFF;
+        }
+        out += r->outChannels;
+    }
+    r->cached[slot] = y;
+    return r->rows[slot];
+}
+
+int encodePlanes(FILE* cover, FILE* secret, FILE* output, int bits, DISTORTION_METRICS* metrics) {
+    uint8_t header[BMP_HEADER_SIZE];
+    PLANE_IMAGE image;
+    RESAMPLER resampler;
+    if (!readImageHeader(cover, header, &image, "Cover image")) return -1;
+    if (!initResampler(&resampler, secret, image.width, image.channels)) {
+        freeResampler(&resampler);
+        return -1;
+    }
+    if (metrics != NULL) {
+        CARRIER_LAYOUT layout = { TYPE_BMP, image.dataOffset, 0, 1, image.channels, 0 };
+        metricsInit(metrics, &layout);
+    }
+    size_t pixelBytes = (size_t)image.width * image.channels;
+    uint8_t* row = (uint8_t*)malloc((size_t)image.rowStride);
+    uint8_t* scaled = (uint8_t*)malloc(pixelBytes);
+    uint8_t* original = metrics != NULL ? (uint8_t*)malloc(pixelBytes) : NULL;
+    int result = -1;
+    if (row == NULL || scaled == NULL || (metrics != NULL && original == NULL)) {
+        fprintf(stderr, "Error: Out of memory\n");
+    }
+    else if (fwrite(header, 1, BMP_HEADER_SIZE, output) != BMP_HEADER_SIZE
+        || !copyBytes(cover, output, image.dataOffset - BMP_HEADER_SIZE)) {
+        fprintf(stderr, "Error: Failed to copy the cover header\n");
+    }
+    else {
+        result = 0;
+        for (uint32_t stored = 0; stored < image.height && result == 0; stored++) {
+            uint32_t y = (uint32_t)storedRow(&image, stored);
+            // centre-aligned source row and the weight of the one below it
+            int64_t position = ((int64_t)(2 * y + 1) * resampler.image.height * RESAMPLE_ONE) / (2 * (int64_t)image.height) - RESAMPLE_ONE / 2;
+            if (position < 0) position = 0;
+            uint32_t top = (uint32_t)(position / RESAMPLE_ONE);
+            uint32_t weight = (uint32_t)(position % RESAMPLE_ONE);
+            if (top >= resampler.image.height - 1) {
+                top = resampler.image.height - 1;
+                weight = 0;
+            }
+            const uint8_t* a = resampledRow(&resampler, top);
+            const uint8_t* b = weight ? resampledRow(&resampler, top + 1) : a;
+            if (a == NULL || b == NULL) {
+                result = -1;
+                break;
+            }
+            if (fread(row, 1, (size_t)image.rowStride, cover) != image.rowStride) {
+                fprintf(stderr, "Error: Cover image is truncated\n");
+                result = -1;
+                break;
+            }
+            blendRows(scaled, a, b, weight, pixelBytes);
+            if (original != NULL) memcpy(original, row, pixelBytes);
+            packPlanes(row, scaled, bits, pixelBytes);
+            if (metrics != NULL) metricsAccumulate(metrics, original, row, pixelBytes);
+            if (fwrite(row, 1, (size_t)image.rowStride, output) != image.rowStride) {
+                fprintf(stderr, "Error: Failed to write the encoded image\n");
+                result = -1;
+            }
+        }
+        // anything after the pixel data goes through as is
+        if (result == 0 && !copyBytes(cover, output, UINT64_MAX)) {
+            fprintf(stderr, "Error: Failed to write the encoded image\n");
+            result = -1;
+        }
+    }
+    if (result == 0) {
+        fprintf(stderr, "|| Secret image: %ux%u scaled to %ux%u, top %d bit-plane%s\n", resampler.image.width,
+            resampler.image.height, image.width, image.height, bits, bits == 1 ? "" : "s");
+    }
+    free(row);
+    free(scaled);
+    free(original);
+    freeResampler(&resampler);
+    return result;
+}
+
+int decodePlanes(FILE* carrier, FILE* output, int bits) {
+    uint8_t header[BMP_HEADER_SIZE];
+    PLANE_IMAGE image;
+    if (!readImageHeader(carrier, header, &image, "Carrier")) return -1;
+    uint8_t* row = (uint8_t*)malloc((size_t)image.rowStride);
+    if (row == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return -1;
+    }
+    int result = 0;
+    if (fwrite(header, 1, BMP_HEADER_SIZE, output) != BMP_HEADER_SIZE
+        || !copyBytes(carrier, output, image.dataOffset - BMP_HEADER_SIZE)) {
+        fprintf(stderr, "Error: Failed to write the recovered image\n");
+        result = -1;
+    }
+    for (uint32_t stored = 0; stored < image.height && result == 0; stored++) {
+        if (fread(row, 1, (size_t)image.rowStride, carrier) != image.rowStride) {
+            fprintf(stderr, "Error: Carrier image is truncated\n");
+            result = -1;
+            break;
+        }
+        unpackPlanes(row, bits, (size_t)image.width * image.channels);
+        if (fwrite(row, 1, (size_t)image.rowStride, output) != image.rowStride) {
+            fprintf(stderr, "Error: Failed to write the recovered image\n");
+            result = -1;
+        }
+    }
+    free(row);
+    return result;
+}
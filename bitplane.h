@@ -0,0 +1,20 @@
+//
+// Image-in-image mode: the top bit-planes of a secret BMP, resampled to the cover's size, replace the bottom
+// bit-planes of the cover. Both images are processed a row at a time.
+//
+#ifndef STEG_BITPLANE_H
+#define STEG_BITPLANE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "metrics.h"
+
+#define BITPLANE_DEFAULT_BITS 3
+#define BITPLANE_MAX_BITS 7
+
+// Hide secret (a seekable 24/32-bit BMP file) in the low bits planes of the 24/32-bit BMP cover.
+// metrics may be NULL; otherwise it is filled in as rows go by.
+int encodePlanes(FILE* cover, FILE* secret, FILE* output, int bits, DISTORTION_METRICS* metrics);
+// Shift the low bits planes of carrier back up, writing the recovered image as a BMP the size of the cover
+int decodePlanes(FILE* carrier, FILE* output, int bits);
+#endif //STEG_BITPLANE_H
@@ -0,0 +1,180 @@
+#include "blockindex.h"
+#include "mapfile.h"
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t crcTable[256];
+static int crcTableReady = 0;
+
+static void buildCrcTable() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crcTable[i] = c;
+    }
+    crcTableReady = 1;
+}
+
+// CRC-32 (IEEE), pass 0 to start
+uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t len) {
+    if (!crcTableReady) buildCrcTable();
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void put32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t dataStart(const INDEX_HEADER* header) {
+    return INDEX_HEADER_SIZE + 4 * (uint64_t)header->blockCount;
+}
+
+int encodeIndexed(const CARRIER_LAYOUT* layout, uint8_t* data, FILE* input_file) {
+    uint64_t capacity = layout->dataSize / layout->stride / 8;
+    if (fseek(input_file, 0, SEEK_END) != 0) {
+        fprintf(stderr, "Error: Indexed mode needs a seekable payload file\n");
+        return -1;
+    }
+    long end = ftell(input_file);
+    fseek(input_file, 0, SEEK_SET);
+    if (end < 0) return -1;
+
+    INDEX_HEADER header;
+    header.blockSize = INDEX_BLOCK_SIZE;
+    header.length = (uint64_t)end;
+    header.blockCount = (uint32_t)((header.length + INDEX_BLOCK_SIZE - 1) / INDEX_BLOCK_SIZE);
+    if (header.length > capacity || dataStart(&header) + header.length > capacity) {
+        fprintf(stderr, "ERROR: Encode data too large!\n");
+        fprintf(stderr, "payload + index bytes: %llu | max bytes: %llu\n",
+            (unsigned long long)(dataStart(&header) + header.length), (unsigned long long)capacity);
+        return -1;
+    }
+
+    uint8_t* index = (uint8_t*)malloc(4 * (size_t)header.blockCount + 1);
+    uint8_t* block = (uint8_t*)malloc(INDEX_BLOCK_SIZE);
+    if (index == NULL || block == NULL) {
+        fprintf(stderr, "Could not allocate block index!\n");
+        free(index);
+        free(block);
+        return -1;
+    }
+    uint64_t position = dataStart(&header);
+    for (uint32_t b = 0; b < header.blockCount; b++) {
+        size_t n = fread(block, 1, INDEX_BLOCK_SIZE, input_file);
+        if (n == 0 || (n < INDEX_BLOCK_SIZE && b + 1 < header.blockCount)) {
+            fprintf(stderr, "Error: Payload file changed while encoding\n");
+            free(index);
+            free(block);
+            return -1;
+        }
+        put32(index + 4 * (size_t)b, crc32Update(0, block, n));
+        lsbEmbedBytes(data, layout->stride, position, block, n);
+        position += n;
+    }
+
+    uint8_t headerBytes[INDEX_HEADER_SIZE];
+    put32(headerBytes, INDEX_MAGIC);
+    put32(headerBytes + 4, header.blockSize);
+    put32(headerBytes + 8, (uint32_t)header.length);
+    put32(headerBytes + 12, (uint32_t)(header.length >> 32));
+    put32(headerBytes + 16, header.blockCount);
+    put32(headerBytes + 20, crc32Update(0, headerBytes, 20));
+    lsbEmbedBytes(data, layout->stride, 0, headerBytes, INDEX_HEADER_SIZE);
+    lsbEmbedBytes(data, layout->stride, INDEX_HEADER_SIZE, index, 4 * (size_t)header.blockCount);
+    free(index);
+    free(block);
+    return 0;
+}
+
+static int readIndexHeader(const CARRIER_LAYOUT* layout, const uint8_t* data, uint64_t capacity, INDEX_HEADER* header) {
+    uint8_t headerBytes[INDEX_HEADER_SIZE];
+    if (capacity < INDEX_HEADER_SIZE) {
+        fprintf(stderr, "Error: Carrier too small to hold an indexed payload!\n");
+        return 0;
+    }
+    lsbExtractBytes(data, layout->stride, 0, headerBytes, INDEX_HEADER_SIZE);
+    if (get32(headerBytes) != INDEX_MAGIC || get32(headerBytes + 20) != crc32Update(0, headerBytes, 20)) {
+        fprintf(stderr, "Error: No indexed payload found (was it encoded with -i?)\n");
+        return 0;
+    }
+    header->blockSize = get32(headerBytes + 4);
+    header->length = get32(headerBytes + 8) | ((uint64_t)get32(headerBytes + 12) << 32);
+    header->blockCount = get32(headerBytes + 16);
+    if (header->blockSize == 0
+        || header->blockCount != (header->length + header->blockSize - 1) / header->blockSize
+        || header->length > capacity || dataStart(header) + header->length > capacity) {
+        fprintf(stderr, "Error: Corrupted block index header\n");
+        return 0;
+    }
+    return 1;
+}
+
+int decodeIndexedRange(const CARRIER_LAYOUT* layout, const uint8_t* data, uint64_t offset, uint64_t length, FILE* output_file) {
+    uint64_t capacity = layout->dataSize / layout->stride / 8;
+    INDEX_HEADER header;
+    if (!readIndexHeader(layout, data, capacity, &header)) return -1;
+    if (offset > header.length) {
+        fprintf(stderr, "Error: Range starts past the end of the payload (%llu bytes)\n",
+            (unsigned long long)header.length);
+        return -1;
+    }
+    if (length > header.length - offset) length = header.length - offset;
+    if (length == 0) return 0;
+
+    uint8_t* block = (uint8_t*)malloc(header.blockSize);
+    if (block == NULL) {
+        fprintf(stderr, "Could not allocate block buffer!\n");
+        return -1;
+    }
+    uint64_t first = offset / header.blockSize;
+    uint64_t last = (offset + length - 1) / header.blockSize;
+    for (uint64_t b = first; b <= last; b++) {
+        // block position and its index entry are both computed, nothing before them is read
+        uint64_t blockStart = b * header.blockSize;
+        size_t n = header.length - blockStart < header.blockSize ? (size_t)(header.length - blockStart) : header.blockSize;
+        uint8_t stored[4];
+        lsbExtractBytes(data, layout->stride, INDEX_HEADER_SIZE + 4 * b, stored, 4);
+        lsbExtractBytes(data, layout->stride, dataStart(&header) + blockStart, block, n);
+        if (crc32Update(0, block, n) != get32(stored)) {
+            fprintf(stderr, "Error: Block %llu failed its checksum\n", (unsigned long long)b);
+            free(block);
+            return -1;
+        }
+        uint64_t from = b == first ? offset - blockStart : 0;
+        uint64_t to = b == last ? offset + length - blockStart : n;
+        if (fwrite(block + from, 1, (size_t)(to - from), output_file) != to - from) {
+            fprintf(stderr, "Error: Failed writing decoded data\n");
+            free(block);
+            return -1;
+        }
+    }
+    free(block);
+    return 0;
+}
+
+int decodeIndexedFile(int type, const char* carrierPath, uint64_t offset, uint64_t length, FILE* output_file) {
+    MAPPED_FILE map;
+    if (!mapFile(carrierPath, 0, &map)) return -1;
+    CARRIER_LAYOUT layout;
+    if (map.size < carrierPeekSize(type) || !parseCarrierHeader(type, map.data, map.size, &layout)) {
+        fprintf(stderr, "Error: Could not read carrier header!\n");
+        unmapFile(&map);
+        return -1;
+    }
+    // only the pages under the requested blocks get faulted in
+    uint64_t available = map.size > layout.headerSize ? map.size - layout.headerSize : 0;
+    if (layout.dataSize > available) layout.dataSize = available;
+    int result = decodeIndexedRange(&layout, map.data + layout.headerSize, offset, length, output_file);
+    unmapFile(&map);
+    return result;
+}
@@ -0,0 +1,37 @@
+//
+// Indexed layout: the payload is split into fixed-size blocks with a CRC index in front,
+// so any byte range can be pulled out of the carrier without walking everything before it.
+//
+#ifndef STEG_BLOCKINDEX_H
+#define STEG_BLOCKINDEX_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "carrier.h"
+
+// Payload bytes per indexed block
+#define INDEX_BLOCK_SIZE 4096
+// magic | block size | payload length | block count | header CRC
+#define INDEX_HEADER_SIZE 24
+#define INDEX_MAGIC 0x31584953 // "SIX1"
+// Range length meaning "up to the end of the payload"
+#define INDEX_TO_END UINT64_MAX
+
+// Layout in the sequential LSB slots:
+//   header (INDEX_HEADER_SIZE) | CRC32 of each block (4 * blockCount) | blocks
+// Block b starts at payload byte INDEX_HEADER_SIZE + 4 * blockCount + b * blockSize.
+typedef struct IndexHeader {
+    uint32_t blockSize;
+    uint64_t length;     // payload bytes
+    uint32_t blockCount;
+} INDEX_HEADER;
+
+uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t len);
+
+// Embed input_file (must be seekable) in the indexed layout
+int encodeIndexed(const CARRIER_LAYOUT* layout, uint8_t* data, FILE* input_file);
+// Write payload bytes [offset, offset + length) to output_file, touching only the blocks that cover them
+int decodeIndexedRange(const CARRIER_LAYOUT* layout, const uint8_t* data, uint64_t offset, uint64_t length, FILE* output_file);
+// decodeIndexedRange on a memory-mapped carrier file
+int decodeIndexedFile(int type, const char* carrierPath, uint64_t offset, uint64_t length, FILE* output_file);
+#endif //STEG_BLOCKINDEX_H
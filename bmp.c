@@ -1,13 +1,15 @@
 #include "bmp.h"
+#include "crypto.h"
+#include "fec.h"
 
 int initializeBMP(BMP_FILE* bmp, uint32_t width, uint32_t height, uint16_t bpp) {
 	initBmpInfoHeader(bmp, width, height, bpp);
 	initBmpFileHeader(bmp);
-	int imageSizeBytes = (width * height * (bpp / 8)) + 54 + 84;
+	uint64_t imageSizeBytes = bmpDataSize(bmp) + 54 + 84;
 	// round up to nearest multiple of 4
 	imageSizeBytes += (imageSizeBytes % 4);
 	// allocate pixel data
-	bmp->data = (uint8_t*) malloc(imageSizeBytes * sizeof(uint8_t));
+	bmp->data = (uint8_t*) malloc((size_t)imageSizeBytes * sizeof(uint8_t));
 	return 0;
 }
 int initBmpInfoHeader(BMP_FILE* bmp, uint32_t width, uint32_t height, uint16_t bpp) {
@@ -28,6 +30,10 @@ int initBmpInfoHeader(BMP_FILE* bmp, uint32_t width, uint32_t height, uint16_t b
 	return 1;
 }
 
+uint64_t bmpDataSize(const BMP_FILE* bmp) {
+	return (uint64_t)bmp->info_header.width * bmp->info_header.height * (bmp->info_header.bitsPerPixel / 8);
+}
+
 void freeBMP(BMP_FILE* bmp) {
 	free(bmp->data);
 	free(bmp);
@@ -39,8 +45,10 @@ int initBmpFileHeader(BMP_FILE* bmp) {
 	}
 	BMP_FILE_HEADER* header = &(bmp->file_header);
 	header->signature = 0x4D42;
-	// width * height * bpp
-	header->fileSize = 	bmp->info_header.width * bmp->info_header.height * bmp->info_header.bitsPerPixel;
+	// headers + width * height * bytes per pixel
+	uint64_t fileSize = 54 + bmpDataSize(bmp);
+	// the field is only 32 bits; readers go by width/height for anything bigger
+	header->fileSize = fileSize > 0xFFFFFFFF ? 0 : (uint32_t)fileSize;
 	header->reserved1 = 0x0000;
 	header->reserved2 = 0x0000;
 	header->dataOffset = 54;
@@ -49,11 +57,11 @@ int initBmpFileHeader(BMP_FILE* bmp) {
 }
 
 
-int writeToBMP(int byte, BMP_FILE* bmp, uint32_t value)
+int writeToBMP(uint64_t byte, BMP_FILE* bmp, uint32_t value)
 {
-	int byteArraySize = bmp->info_header.width * bmp->info_header.height * (bmp->info_header.bitsPerPixel / 8);
+	uint64_t byteArraySize = bmpDataSize(bmp);
 
-	if (byte > byteArraySize) {
+	if (byte >= byteArraySize) {
 		printf("Error: Tried writing outside file bounds!\n");
 	}
 	bmp->data[byte] = value;
@@ -62,20 +70,20 @@ int writeToBMP(int byte, BMP_FILE* bmp, uint32_t value)
 
 int encodeToFile_BMP(BMP_FILE* bmp, const char* text) {
 	if (text == NULL) return 0;
-	int stringLengthBits = (strlen(text) + 1) * 8; // string length (including null)
+	uint64_t stringLengthBits = ((uint64_t)strlen(text) + 1) * 8; // string length (including null)
 
 	char curChar = '\0';
 	uint8_t currentByte = 0;
-	uint32_t maxBits = bmp->info_header.width * bmp->info_header.height * bmp->info_header.bitsPerPixel;
+	uint64_t maxBits = bmpDataSize(bmp);
 	if (stringLengthBits >= maxBits) {
 		printf("ERROR: Encode data too large!\n");
-		printf("string bits: %d | max bits: %d\n", stringLengthBits, maxBits);
+		printf("string bits: %llu | max bits: %llu\n", (unsigned long long)stringLengthBits, (unsigned long long)maxBits);
 		return 0;
 	}
 	int charBitIndex = 0;
 	int value = 0;
 	// keep track of which bit we're on, and encode that into the sample
-	for (int i = 0; i < stringLengthBits; i++) {
+	for (uint64_t i = 0; i < stringLengthBits; i++) {
 		// get current sample
 		currentByte = bmp->data[i];
 		// get i'th bit of string
@@ -88,14 +96,20 @@ int encodeToFile_BMP(BMP_FILE* bmp, const char* text) {
 	return 1;
 }
 
-int encode_File_ToFile_BMP(BMP_FILE* bmp, FILE* infile)
+int encode_File_ToFile_BMP(BMP_FILE* bmp, FILE* infile, const char* passphrase, int parity)
 {
+	if (parity > 0) {
+		return fecEmbedPayload(bmp->data, 1, bmpDataSize(bmp), infile, parity);
+	}
+	if (passphrase != NULL) {
+		return sealPayload(bmp->data, 1, bmpDataSize(bmp), infile, passphrase);
+	}
 	char curChar = '\0';
 	uint8_t currentByte = 0;
 	int charBitIndex = 0;
 	int value = 0;
 	int size_read = 0;
-	int progress = 0;
+	uint64_t progress = 0;
 	while (!feof(infile)) {
 		// read a character into the file
 		size_read = fread(&curChar, 1, 1, infile);
@@ -107,7 +121,7 @@ int encode_File_ToFile_BMP(BMP_FILE* bmp, FILE* infile)
 			value = (curChar >> i) & 1;
 			currentByte = currentByte & 0xFE | value;
 			// encode into BMP
-			printf("Writing %d to index %d\n", value, progress + i);
+			printf("Writing %d to index %llu\n", value, (unsigned long long)(progress + i));
 			writeToBMP(progress + i, bmp, currentByte);
 		}
 		progress += 8;
@@ -116,22 +130,39 @@ int encode_File_ToFile_BMP(BMP_FILE* bmp, FILE* infile)
 	return 0;
 }
 
-int decode_ToFile_FromFile_BMP(const char* path, const char* output_path) {
+int decode_ToFile_FromFile_BMP(const char* path, const char* output_path, const char* passphrase, int parity) {
 	BMP_FILE* bmp = malloc(sizeof(BMP_FILE));
+	if (bmp == NULL) {
+		printf("Could not read BMP file!\n");
+		return -1;
+	}
 	FILE* outfile = fopen(output_path, "w+b");
-	readBMPFromFile(path, bmp);
+	if (outfile == NULL) {
+		printf("Error: Failed to open %s\n", output_path);
+		free(bmp);
+		return -1;
+	}
+	if (!readBMPFromFile(path, bmp)) {
+		printf("Could not read BMP file!\n");
+		fclose(outfile);
+		free(bmp);
+		return -1;
+	}
+	if (passphrase != NULL || parity > 0) {
+		int result = parity > 0 ? fecExtractPayload(bmp->data, 1, bmpDataSize(bmp), outfile)
+			: openPayload(bmp->data, 1, bmpDataSize(bmp), outfile, passphrase);
+		fclose(outfile);
+		freeBMP(bmp);
+		return result;
+	}
 	
 	char curChar = '\0';
 	int charBitIndex = 0;
 	uint8_t currentByte = 0;
 	int value = 0;
 
-	if (bmp == NULL) {
-		printf("Could not read BMP file!\n");
-		return -1;
-	}
-	uint32_t numBytes = bmp->info_header.height * bmp->info_header.width * (bmp->info_header.bitsPerPixel / 8);
-	for (int i = 0; i < numBytes; i++) {
+	uint64_t numBytes = bmpDataSize(bmp);
+	for (uint64_t i = 0; i < numBytes; i++) {
 		currentByte = bmp->data[i];
 		value = currentByte & 1; // get LSB of byte
 		curChar |= value << charBitIndex;
@@ -148,6 +179,8 @@ int decode_ToFile_FromFile_BMP(const char* path, const char* output_path) {
 			curChar = '\0';
 		}
 	}
+	fclose(outfile);
+	freeBMP(bmp);
 	return 0;
 }
 
@@ -166,8 +199,8 @@ int decodeFromFile_BMP(const char* path) {
 		printf("Could not read BMP file!\n");
 		return -1;
 	}
-	uint32_t numBytes = bmp->info_header.height * bmp->info_header.width * (bmp->info_header.bitsPerPixel / 8);
-	for (int i = 0; i < numBytes; i++) {
+	uint64_t numBytes = bmpDataSize(bmp);
+	for (uint64_t i = 0; i < numBytes; i++) {
 		currentByte = bmp->data[i];
 		value = currentByte & 1; // get LSB of byte
 		curChar |= value << charBitIndex;
@@ -188,17 +221,28 @@ int decodeFromFile_BMP(const char* path) {
 
 int writeBmpToFile(const char* path, BMP_FILE* bmp) {
 	FILE* outFile;
-	fopen_s(&outFile, path, "w+b");
+	outFile = fopen(path, "w+b");
 
 	if (outFile == NULL) {
 		printf("Failed to open %s!\n", path);
 		return 0;
 	}
-	int byteArraySize = bmp->info_header.width * bmp->info_header.height * (bmp->info_header.bitsPerPixel / 8);
+	uint64_t byteArraySize = bmpDataSize(bmp);
 	// write data to BMP file
 	fwrite(&(bmp->file_header), sizeof(BMP_FILE_HEADER), 1, outFile);
 	fwrite(&(bmp->info_header), sizeof(BMP_INFO_HEADER), 1, outFile);
-	fwrite(bmp->data, byteArraySize, 1, outFile);
+	// a piece at a time, images can be bigger than 2^31 bytes
+	uint64_t written = 0;
+	while (written < byteArraySize) {
+		uint64_t piece = byteArraySize - written;
+		if (piece > (1u << 30)) piece = 1u << 30;
+		if (fwrite(bmp->data + written, (size_t)piece, 1, outFile) != 1) {
+			printf("Failed writing %s!\n", path);
+			fclose(outFile);
+			return 0;
+		}
+		written += piece;
+	}
 
 	fclose(outFile);
 
@@ -206,7 +250,7 @@ int writeBmpToFile(const char* path, BMP_FILE* bmp) {
 }
 int readBMPFromFile(const char* path, BMP_FILE* output) {
 	FILE* inFile;
-	fopen_s(&inFile, path, "r+b");
+	inFile = fopen(path, "r+b");
 
 	if (inFile == NULL) {
 		printf("Failed to open %s!\n", path);
@@ -217,8 +261,10 @@ int readBMPFromFile(const char* path, BMP_FILE* output) {
 	fread(&(output->file_header), sizeof(BMP_FILE_HEADER), 1, inFile);
 	// read info header
 	fread(&(output->info_header), sizeof(BMP_INFO_HEADER), 1, inFile);
+	output->data = NULL;
 	if (output->info_header.compressionType != 0) {
 		printf("ERROR: Compressed BMP files aren't supported.\n");
+		fclose(inFile);
 		return 0;
 	}
 	// read past data offset to start of image data, if there's anything in between
@@ -226,14 +272,23 @@ int readBMPFromFile(const char* path, BMP_FILE* output) {
 	// allocate space for byte array
 		// read to byte array (size: width * height * bits per pixel)
 	
-	int byteArraySize = output->info_header.width * output->info_header.height * (output->info_header.bitsPerPixel / 8);
+	uint64_t byteArraySize = bmpDataSize(output);
 
-	output->data = (uint8_t*)malloc(byteArraySize);
+	output->data = (uint8_t*)malloc((size_t)byteArraySize);
 	if (output->data != NULL) {
-		fread(output->data, byteArraySize, 1, inFile);
+		uint64_t dataRead = 0;
+		while (dataRead < byteArraySize) {
+			uint64_t piece = byteArraySize - dataRead;
+			if (piece > (1u << 30)) piece = 1u << 30;
+			size_t n = fread(output->data + dataRead, 1, (size_t)piece, inFile);
+			if (n == 0) break;
+			dataRead += n;
+		}
 	}
 	else {
 		printf("Could not allocate byte array!\n");
+		fclose(inFile);
+		return 0;
 	}
 	fclose(inFile);
 
@@ -50,6 +50,11 @@ typedef struct BitMapInfoHeader {
 	// Color Table (4 * numCOlors) bytes if bpp < 8
 } BMP_INFO_HEADER;
 #pragma pack()
+// compressionType values
+#define BMP_RGB 0
+#define BMP_RLE8 1
+#define BMP_RLE4 2
+
 typedef struct BitmapFile {
 	BMP_FILE_HEADER file_header;
 	BMP_INFO_HEADER info_header;
@@ -61,12 +66,16 @@ typedef struct BitmapFile {
 int initializeBMP(BMP_FILE* bmp, uint32_t width, uint32_t height, uint16_t bpp);
 int initBmpInfoHeader(BMP_FILE* bmp, uint32_t width, uint32_t height, uint16_t bpp);
 int initBmpFileHeader(BMP_FILE* bmp);
-int writeToBMP(int byte, BMP_FILE* bmp, uint32_t value);
+int writeToBMP(uint64_t byte, BMP_FILE* bmp, uint32_t value);
+// Bytes of pixel data (width * height * bytes per pixel), 64-bit so large images don't overflow
+uint64_t bmpDataSize(const BMP_FILE* bmp);
 
 int encodeToFile_BMP(BMP_FILE* bmp, const char* text);
-int encode_File_ToFile_BMP(BMP_FILE* bmp, FILE* infile);
+// passphrase encrypts the payload (ChaCha20-Poly1305), NULL embeds it as is;
+// parity > 0 Reed-Solomon codes it instead, with that many parity bytes per codeword
+int encode_File_ToFile_BMP(BMP_FILE* bmp, FILE* infile, const char* passphrase, int parity);
 
-int decode_ToFile_FromFile_BMP(const char* path, const char* output_path);
+int decode_ToFile_FromFile_BMP(const char* path, const char* output_path, const char* passphrase, int parity);
 int decodeFromFile_BMP(const char* path);
 void freeBMP(BMP_FILE* bmp);
 int writeBmpToFile(const char* path, BMP_FILE* bmp);
@@ -0,0 +1,175 @@
+#include "carrier.h"
+#include "wave.h"
+#include "bmp.h"
+
+int detectCarrierType(const uint8_t* header, uint64_t length) {
+    if (length >= 12 && memcmp(header + 8, "WAVE", 4) == 0
+        && (memcmp(header, "RIFF", 4) == 0 || memcmp(header, "RF64", 4) == 0 || memcmp(header, "BW64", 4) == 0)) {
+        return TYPE_WAV;
+    }
+    if (length >= 2 && header[0] == 'B' && header[1] == 'M') return TYPE_BMP;
+    return -1;
+}
+
+uint32_t carrierPeekSize(int type) {
+    return type == TYPE_WAV ? WAV_HEADER_SIZE : BMP_HEADER_SIZE;
+}
+
+uint32_t carrierHeaderNeeded(int type, const uint8_t* header) {
+    if (type == TYPE_WAV && (memcmp(header, "RF64", 4) == 0 || memcmp(header, "BW64", 4) == 0)) {
+        // RIFF header, ds64 (8 + ChunkSize bytes), then fmt and the data chunk header
+        uint32_t ds64Size;
+        memcpy(&ds64Size, header + 16, sizeof(uint32_t));
+        uint64_t needed = ds64Size < 28 ? RF64_HEADER_SIZE : 12 + 8 + (uint64_t)ds64Size + 32;
+        return needed < RF64_MAX_HEADER_SIZE ? (uint32_t)needed : RF64_MAX_HEADER_SIZE;
+    }
+    return carrierPeekSize(type);
+}
+
+// Same checks as readFromFile_WAV / readBMPFromFile, but on a header already in memory.
+int parseCarrierHeader(int type, const uint8_t* header, uint64_t length, CARRIER_LAYOUT* layout) {
+    if (length < carrierPeekSize(type) || length < carrierHeaderNeeded(type, header)) {
+        fprintf(stderr, "Error: Carrier header is truncated!\n");
+        return 0;
+    }
+    layout->type = type;
+    if (type == TYPE_WAV) {
+        RIFF_CHUNK riff;
+        DS64_CHUNK ds64 = { 0 };
+        FMT_CHUNK fmt;
+        uint32_t dataID, dataSize;
+        memcpy(&riff, header, sizeof(RIFF_CHUNK));
+        int rf64 = riff.ChunkID == RF64_ID || riff.ChunkID == BW64_ID;
+        uint64_t fmtOffset = 12;
+        if (rf64) {
+            // a ds64 chunk sits between the RIFF header and fmt, possibly with a table after its fixed fields
+            memcpy(&ds64, header + 12, sizeof(DS64_CHUNK));
+            if (ds64.ChunkID != DS64_ID || ds64.ChunkSize < 28) {
+                fprintf(stderr, "Error: RF64 file without a valid ds64 chunk!\n");
+                return 0;
+            }
+            fmtOffset = 12 + 8 + (uint64_t)ds64.ChunkSize;
+            if (length < fmtOffset + 32) {
+                fprintf(stderr, "Error: Carrier header is truncated!\n");
+                return 0;
+            }
+        }
+        memcpy(&fmt, header + fmtOffset, sizeof(FMT_CHUNK));
+        memcpy(&dataID, header + fmtOffset + 24, sizeof(uint32_t));
+        memcpy(&dataSize, header + fmtOffset + 28, sizeof(uint32_t));
+        if ((riff.ChunkID != RIFF_ID && !rf64) || riff.Format != 0x45564157) {
+            fprintf(stderr, "Invalid ChunkID or Format!\n");
+            return 0;
+        }
+        if (fmt.Subchunk1ID != 0x20746D66 || fmt.Subchunk1Size != 16) {
+            fprintf(stderr, "Error: Invalid FMT chunk or size! (files should be in PCM format.)\n");
+            return 0;
+        }
+        if (fmt.BitsPerSample != 8 && fmt.BitsPerSample != 16 && fmt.BitsPerSample != 32) {
+            fprintf(stderr, "Error: WAV files that aren't 8, 16, or 32-bit aren't supported.\n");
+            return 0;
+        }
+        if (dataID != 0x61746164) {
+            fprintf(stderr, "Bad DATA chunk header!\n");
+            return 0;
+        }
+        layout->headerSize = fmtOffset + 32;
+        layout->dataSize = (rf64 && dataSize == 0xFFFFFFFF) ? ds64.DataSize : dataSize;
+        layout->stride = fmt.BitsPerSample / 8;
+        layout->channels = fmt.NumChannels > 0 ? fmt.NumChannels : 1;
+        layout->rowSize = 0;
+    }
+    else if (type == TYPE_BMP) {
+        BMP_FILE_HEADER fileHeader;
+        BMP_INFO_HEADER infoHeader;
+        memcpy(&fileHeader, header, sizeof(BMP_FILE_HEADER));
+        memcpy(&infoHeader, header + sizeof(BMP_FILE_HEADER), sizeof(BMP_INFO_HEADER));
+        if (fileHeader.signature != 0x4D42) {
+            fprintf(stderr, "Error: Not a BMP file!\n");
+            return 0;
+        }
+        if (infoHeader.compressionType != 0) {
+            fprintf(stderr, "ERROR: Compressed BMP files aren't supported.\n");
+            return 0;
+        }
+        if (fileHeader.dataOffset < BMP_HEADER_SIZE) {
+            fprintf(stderr, "Error: Bad BMP data offset!\n");
+            return 0;
+        }
+        layout->headerSize = fileHeader.dataOffset;
+        layout->dataSize = (uint64_t)infoHeader.width * infoHeader.height * (infoHeader.bitsPerPixel / 8);
+        layout->stride = 1;
+        layout->channels = infoHeader.bitsPerPixel >= 8 ? infoHeader.bitsPerPixel / 8 : 1;
+        layout->rowSize = infoHeader.width * (infoHeader.bitsPerPixel / 8);
+    }
+    else {
+        return 0;
+    }
+    return 1;
+}
+
+void layoutFromWAV(const WAV_FILE* wav, CARRIER_LAYOUT* layout) {
+    layout->type = TYPE_WAV;
+    layout->headerSize = WAV_HEADER_SIZE;
+    if (wav->isRF64) {
+        // same as parseCarrierHeader: the ds64 chunk may carry a table past its 28 fixed bytes
+        layout->headerSize = wav->DS64.ChunkSize >= 28 ? 12 + 8 + (uint64_t)wav->DS64.ChunkSize + 32 : RF64_HEADER_SIZE;
+    }
+    layout->dataSize = wav->DATA.dataSize;
+    layout->stride = wav->FMT.BitsPerSample / 8;
+    layout->channels = wav->FMT.NumChannels > 0 ? wav->FMT.NumChannels : 1;
+    layout->rowSize = 0;
+}
+
+void layoutFromBMP(const BMP_FILE* bmp, CARRIER_LAYOUT* layout) {
+    uint32_t bytesPerPixel = bmp->info_header.bitsPerPixel / 8;
+    layout->type = TYPE_BMP;
+    layout->headerSize = bmp->file_header.dataOffset;
+    layout->dataSize = bmpDataSize(bmp);
+    layout->stride = 1;
+    layout->channels = bytesPerPixel > 0 ? bytesPerPixel : 1;
+    layout->rowSize = bmp->info_header.width * bytesPerPixel;
+}
+
+void lsbEmbedBytes(uint8_t* data, uint32_t stride, uint64_t firstByte, const uint8_t* bytes, size_t count) {
+    uint8_t* slots = data + firstByte * 8 * stride;
+    for (size_t i = 0; i < count; i++) {
+        for (int bit = 0; bit < 8; bit++) {
+            slots[bit * stride] = (slots[bit * stride] & 0xFE) | ((bytes[i] >> bit) & 1);
+        }
+        slots += 8 * stride;
+    }
+}
+
+void lsbExtractBytes(const uint8_t* data, uint32_t stride, uint64_t firstByte, uint8_t* bytes, size_t count) {
+    const uint8_t* slots = data + firstByte * 8 * stride;
+    for (size_t i = 0; i < count; i++) {
+        uint8_t value = 0;
+        for (int bit = 0; bit < 8; bit++) {
+            value |= (slots[bit * stride] & 1) << bit;
+        }
+        bytes[i] = value;
+        slots += 8 * stride;
+    }
+}
+
+uint8_t* readPayload(FILE* input_file, uint64_t* length) {
+    size_t capacity = 4096;
+    size_t size = 0;
+    uint8_t* buffer = (uint8_t*)malloc(capacity);
+    while (buffer != NULL) {
+        size_t n = fread(buffer + size, 1, capacity - size, input_file);
+        size += n;
+        if (size < capacity) break;
+        capacity *= 2;
+        uint8_t* grown = (uint8_t*)realloc(buffer, capacity);
+        if (grown == NULL) free(buffer);
+        buffer = grown;
+    }
+    if (buffer == NULL) {
+        fprintf(stderr, "Could not allocate payload buffer!\n");
+        return NULL;
+    }
+    *length = size;
+    return buffer;
+}
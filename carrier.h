@@ -0,0 +1,55 @@
+//
+// Carrier layout shared by the streaming engines.
+//
+#ifndef STEG_CARRIER_H
+#define STEG_CARRIER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+enum FileTypes {
+    TYPE_WAV,
+    TYPE_BMP,
+    TYPE_Y4M, // frame-structured, handled by y4m.c rather than CARRIER_LAYOUT
+    TYPE_JPEG // entropy-coded, handled by jpeg.c
+};
+
+// Size of the fixed header read before the layout can be parsed.
+#define WAV_HEADER_SIZE 44
+#define BMP_HEADER_SIZE 54
+// RIFF + ds64 + fmt + data headers of an RF64/BW64 file
+#define RF64_HEADER_SIZE 80
+// ds64 may carry a table of chunk sizes after its 28 fixed bytes; streamed headers are read up to this size
+#define RF64_MAX_HEADER_SIZE 4096
+
+typedef struct CarrierLayout {
+    int type;           // TYPE_WAV or TYPE_BMP
+    uint64_t headerSize; // bytes before the sample/pixel data
+    uint64_t dataSize;   // bytes of sample/pixel data
+    uint32_t stride;     // bytes between LSB slots (bytes per sample for WAV, 1 for BMP)
+    uint32_t channels;   // interleaved channels (WAV channels, BMP bytes per pixel)
+    uint32_t rowSize;    // bytes per image row (BMP only, 0 for WAV)
+} CARRIER_LAYOUT;
+
+// Guess the carrier type from its magic bytes, -1 if it's neither
+int detectCarrierType(const uint8_t* header, uint64_t length);
+// Number of header bytes to read before calling carrierHeaderNeeded
+uint32_t carrierPeekSize(int type);
+// Number of header bytes parseCarrierHeader needs, given the first carrierPeekSize bytes (RF64 needs more)
+uint32_t carrierHeaderNeeded(int type, const uint8_t* header);
+// Parse a WAV or BMP header from memory. Returns 1 on success.
+int parseCarrierHeader(int type, const uint8_t* header, uint64_t length, CARRIER_LAYOUT* layout);
+struct WaveFile;
+struct BitmapFile;
+// Layout of a carrier already loaded by readFromFile_WAV / readBMPFromFile
+void layoutFromWAV(const struct WaveFile* wav, CARRIER_LAYOUT* layout);
+void layoutFromBMP(const struct BitmapFile* bmp, CARRIER_LAYOUT* layout);
+// Read all of input_file into a malloc'd buffer (NULL on failure)
+uint8_t* readPayload(FILE* input_file, uint64_t* length);
+// Spread count bytes into the sequential LSB slots (stride bytes apart), starting at payload byte firstByte
+void lsbEmbedBytes(uint8_t* data, uint32_t stride, uint64_t firstByte, const uint8_t* bytes, size_t count);
+// Gather count bytes back out of the sequential LSB slots
+void lsbExtractBytes(const uint8_t* data, uint32_t stride, uint64_t firstByte, uint8_t* bytes, size_t count);
+#endif //STEG_CARRIER_H
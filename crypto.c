@@ -0,0 +1,570 @@
+#ifdef _WIN32
+#define _CRT_RAND_S
+#endif
+#include "crypto.h"
+#include "carrier.h"
+#include <string.h>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define STEG_CHACHA_SSE2 1
+#endif
+
+static inline uint32_t load32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void store32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static inline void store64(uint8_t* p, uint64_t v) {
+    store32(p, (uint32_t)v);
+    store32(p + 4, (uint32_t)(v >> 32));
+}
+
+static inline uint32_t rotl32(uint32_t v, int n) {
+    return (v << n) | (v >> (32 - n));
+}
+
+static inline uint32_t rotr32(uint32_t v, int n) {
+    return (v >> n) | (v << (32 - n));
+}
+
+// ---- SHA-256 ----
+
+static const uint32_t sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static void sha256Compress(uint32_t state[8], const uint8_t block[64]) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16)
+            | ((uint32_t)block[i * 4 + 2] << 8) | block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t S1 = rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + S1 + ch + sha256K[i] + w[i];
+        uint32_t S0 = rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = S0 + maj;
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+void sha256Init(SHA256_CTX* ctx) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(ctx->state, initial, sizeof(initial));
+    ctx->length = 0;
+    ctx->used = 0;
+}
+
+void sha256Update(SHA256_CTX* ctx, const uint8_t* data, size_t len) {
+    ctx->length += len;
+    while (len > 0) {
+        if (ctx->used == 0 && len >= 64) {
+            sha256Compress(ctx->state, data);
+            data += 64;
+            len -= 64;
+            continue;
+        }
+        size_t take = 64 - ctx->used < len ? 64 - ctx->used : len;
+        memcpy(ctx->buffer + ctx->used, data, take);
+        ctx->used += take;
+        data += take;
+        len -= take;
+        if (ctx->used == 64) {
+            sha256Compress(ctx->state, ctx->buffer);
+            ctx->used = 0;
+        }
+    }
+}
+
+void sha256Final(SHA256_CTX* ctx, uint8_t digest[32]) {
+    uint64_t bits = ctx->length * 8;
+    uint8_t pad = 0x80;
+    sha256Update(ctx, &pad, 1);
+    pad = 0;
+    while (ctx->used != 56) {
+        sha256Update(ctx, &pad, 1);
+    }
+    uint8_t lengthBytes[8];
+    for (int i = 0; i < 8; i++) {
+        lengthBytes[i] = (uint8_t)(bits >> (56 - 8 * i));
+    }
+    sha256Update(ctx, lengthBytes, 8);
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = (uint8_t)(ctx->state[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t)(ctx->state[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t)(ctx->state[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t)ctx->state[i];
+    }
+}
+
+void deriveKey(const char* passphrase, const uint8_t salt[STEG_SALT_SIZE], uint32_t iterations, uint8_t key[STEG_KEY_SIZE]) {
+    uint8_t keyBlock[64] = { 0 };
+    size_t passLength = strlen(passphrase);
+    if (passLength > 64) {
+        SHA256_CTX hashed;
+        sha256Init(&hashed);
+        sha256Update(&hashed, (const uint8_t*)passphrase, passLength);
+        sha256Final(&hashed, keyBlock);
+    }
+    else {
+        memcpy(keyBlock, passphrase, passLength);
+    }
+    // HMAC inner/outer states are the same every iteration, so hash the pads once
+    uint8_t pad[64];
+    SHA256_CTX inner, outer;
+    for (int i = 0; i < 64; i++) pad[i] = keyBlock[i] ^ 0x36;
+    sha256Init(&inner);
+    sha256Update(&inner, pad, 64);
+    for (int i = 0; i < 64; i++) pad[i] = keyBlock[i] ^ 0x5c;
+    sha256Init(&outer);
+    sha256Update(&outer, pad, 64);
+
+    uint8_t u[32];
+    SHA256_CTX ctx = inner;
+    static const uint8_t blockIndex[4] = { 0, 0, 0, 1 };
+    sha256Update(&ctx, salt, STEG_SALT_SIZE);
+    sha256Update(&ctx, blockIndex, 4);
+    sha256Final(&ctx, u);
+    ctx = outer;
+    sha256Update(&ctx, u, 32);
+    sha256Final(&ctx, u);
+    memcpy(key, u, STEG_KEY_SIZE);
+    for (uint32_t i = 1; i < iterations; i++) {
+        ctx = inner;
+        sha256Update(&ctx, u, 32);
+        sha256Final(&ctx, u);
+        ctx = outer;
+        sha256Update(&ctx, u, 32);
+        sha256Final(&ctx, u);
+        for (int j = 0; j < STEG_KEY_SIZE; j++) key[j] ^= u[j];
+    }
+    memset(keyBlock, 0, sizeof(keyBlock));
+    memset(pad, 0, sizeof(pad));
+}
+
+// ---- ChaCha20 ----
+
+#define QUARTER_ROUND(a, b, c, d) \
+    a += b; d ^= a; d = rotl32(d, 16); \
+    c += d; b ^= c; b = rotl32(b, 12); \
+    a += b; d ^= a; d = rotl32(d, 8); \
+    c += d; b ^= c; b = rotl32(b, 7);
+
+#ifdef STEG_CHACHA_SSE2
+#define ROTL128(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+#define QUARTER_ROUND128(a, b, c, d) \
+    a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = ROTL128(d, 16); \
+    c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = ROTL128(b, 12); \
+    a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = ROTL128(d, 8); \
+    c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = ROTL128(b, 7);
+
+// Four blocks side by side: lane j of v[i] is word i of block counter + j
+static void chacha20Blocks4(const uint32_t state[16], uint8_t out[256]) {
+    __m128i v[16], original[16];
+    for (int i = 0; i < 16; i++) {
+        v[i] = _mm_set1_epi32((int)state[i]);
+    }
+    v[12] = _mm_add_epi32(v[12], _mm_set_epi32(3, 2, 1, 0));
+    memcpy(original, v, sizeof(v));
+    for (int round = 0; round < 10; round++) {
+        QUARTER_ROUND128(v[0], v[4], v[8], v[12]);
+        QUARTER_ROUND128(v[1], v[5], v[9], v[13]);
+        QUARTER_ROUND128(v[2], v[6], v[10], v[14]);
+        QUARTER_ROUND128(v[3], v[7], v[11], v[15]);
+        QUARTER_ROUND128(v[0], v[5], v[10], v[15]);
+        QUARTER_ROUND128(v[1], v[6], v[11], v[12]);
+        QUARTER_ROUND128(v[2], v[7], v[8], v[13]);
+        QUARTER_ROUND128(v[3], v[4], v[9], v[14]);
+    }
+    for (int i = 0; i < 16; i += 4) {
+        __m128i a = _mm_add_epi32(v[i], original[i]);
+        __m128i b = _mm_add_epi32(v[i + 1], original[i + 1]);
+        __m128i c = _mm_add_epi32(v[i + 2], original[i + 2]);
+        __m128i d = _mm_add_epi32(v[i + 3], original[i + 3]);
+        // transpose so each register holds 4 consecutive words of one block
+        __m128i t0 = _mm_unpacklo_epi32(a, b);
+        __m128i t1 = _mm_unpacklo_epi32(c, d);
+        __m128i t2 = _mm_unpackhi_epi32(a, b);
+        __m128i t3 = _mm_unpackhi_epi32(c, d);
+        _mm_storeu_si128((__m128i*)(out + 0 * 64 + i * 4), _mm_unpacklo_epi64(t0, t1));
+        _mm_storeu_si128((__m128i*)(out + 1 * 64 + i * 4), _mm_unpackhi_epi64(t0, t1));
+        _mm_storeu_si128((__m128i*)(out + 2 * 64 + i * 4), _mm_unpacklo_epi64(t2, t3));
+        _mm_storeu_si128((__m128i*)(out + 3 * 64 + i * 4), _mm_unpackhi_epi64(t2, t3));
+    }
+}
+#else
+static void chacha20Block(const uint32_t state[16], uint8_t out[64]) {
+    uint32_t x[16];
+    memcpy(x, state, sizeof(x));
+    for (int round = 0; round < 10; round++) {
+        QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+        QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+        QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+        QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+        QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+        QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+        QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+        QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; i++) {
+        store32(out + i * 4, x[i] + state[i]);
+    }
+}
+
+static void chacha20Blocks4(const uint32_t state[16], uint8_t out[256]) {
+    uint32_t block[16];
+    memcpy(block, state, sizeof(block));
+    for (int j = 0; j < 4; j++) {
+        chacha20Block(block, out + j * 64);
+        block[12]++;
+    }
+}
+#endif
+
+void chacha20Init(CHACHA20_CTX* ctx, const uint8_t key[STEG_KEY_SIZE], const uint8_t nonce[STEG_NONCE_SIZE], uint32_t counter) {
+    ctx->state[0] = 0x61707865; // "expand 32-byte k"
+    ctx->state[1] = 0x3320646e;
+    ctx->state[2] = 0x79622d32;
+    ctx->state[3] = 0x6b206574;
+    for (int i = 0; i < 8; i++) {
+        ctx->state[4 + i] = load32(key + i * 4);
+    }
+    ctx->state[12] = counter;
+    ctx->state[13] = load32(nonce);
+    ctx->state[14] = load32(nonce + 4);
+    ctx->state[15] = load32(nonce + 8);
+    ctx->used = sizeof(ctx->keystream);
+}
+
+static void chacha20Refill(CHACHA20_CTX* ctx) {
+    chacha20Blocks4(ctx->state, ctx->keystream);
+    ctx->state[12] += 4;
+    ctx->used = 0;
+}
+
+void chacha20Xor(CHACHA20_CTX* ctx, uint8_t* data, size_t len) {
+    while (len > 0) {
+        if (ctx->used == sizeof(ctx->keystream)) chacha20Refill(ctx);
+        size_t take = sizeof(ctx->keystream) - ctx->used;
+        if (take > len) take = len;
+        const uint8_t* stream = ctx->keystream + ctx->used;
+        for (size_t i = 0; i < take; i++) {
+            data[i] ^= stream[i];
+        }
+        ctx->used += take;
+        data += take;
+        len -= take;
+    }
+}
+
+void chacha20Keystream(CHACHA20_CTX* ctx, uint8_t* out, size_t len) {
+    memset(out, 0, len);
+    chacha20Xor(ctx, out, len);
+}
+
+// ---- Poly1305 (26-bit limbs) ----
+
+void poly1305Init(POLY1305_CTX* ctx, const uint8_t key[32]) {
+    ctx->r[0] = load32(key) & 0x3ffffff;
+    ctx->r[1] = (load32(key + 3) >> 2) & 0x3ffff03;
+    ctx->r[2] = (load32(key + 6) >> 4) & 0x3ffc0ff;
+    ctx->r[3] = (load32(key + 9) >> 6) & 0x3f03fff;
+    ctx->r[4] = (load32(key + 12) >> 8) & 0x00fffff;
+    for (int i = 0; i < 5; i++) ctx->h[i] = 0;
+    for (int i = 0; i < 4; i++) ctx->pad[i] = load32(key + 16 + i * 4);
+    ctx->used = 0;
+}
+
+static void poly1305Blocks(POLY1305_CTX* ctx, const uint8_t* m, size_t bytes, uint32_t hibit) {
+    const uint32_t r0 = ctx->r[0], r1 = ctx->r[1], r2 = ctx->r[2], r3 = ctx->r[3], r4 = ctx->r[4];
+    const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+    uint32_t h0 = ctx->h[0], h1 = ctx->h[1], h2 = ctx->h[2], h3 = ctx->h[3], h4 = ctx->h[4];
+    while (bytes >= 16) {
+        h0 += load32(m) & 0x3ffffff;
+        h1 += (load32(m + 3) >> 2) & 0x3ffffff;
+        h2 += (load32(m + 6) >> 4) & 0x3ffffff;
+        h3 += (load32(m + 9) >> 6) & 0x3ffffff;
+        h4 += (load32(m + 12) >> 8) | hibit;
+
+        uint64_t d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3 + (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+        uint64_t d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4 + (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+        uint64_t d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0 + (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+        uint64_t d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1 + (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+        uint64_t d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2 + (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+        uint32_t c = (uint32_t)(d0 >> 26); h0 = (uint32_t)d0 & 0x3ffffff;
+        d1 += c; c = (uint32_t)(d1 >> 26); h1 = (uint32_t)d1 & 0x3ffffff;
+        d2 += c; c = (uint32_t)(d2 >> 26); h2 = (uint32_t)d2 & 0x3ffffff;
+        d3 += c; c = (uint32_t)(d3 >> 26); h3 = (uint32_t)d3 & 0x3ffffff;
+        d4 += c; c = (uint32_t)(d4 >> 26); h4 = (uint32_t)d4 & 0x3ffffff;
+        h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+        h1 += c;
+
+        m += 16;
+        bytes -= 16;
+    }
+    ctx->h[0] = h0;
+    ctx->h[1] = h1;
+    ctx->h[2] = h2;
+    ctx->h[3] = h3;
+    ctx->h[4] = h4;
+}
+
+void poly1305Update(POLY1305_CTX* ctx, const uint8_t* data, size_t len) {
+    if (ctx->used > 0) {
+        size_t take = 16 - ctx->used < len ? 16 - ctx->used : len;
+        memcpy(ctx->buffer + ctx->used, data, take);
+        ctx->used += take;
+        data += take;
+        len -= take;
+        if (ctx->used < 16) return;
+        poly1305Blocks(ctx, ctx->buffer, 16, 1u << 24);
+        ctx->used = 0;
+    }
+    size_t whole = len & ~(size_t)15;
+    if (whole > 0) {
+        poly1305Blocks(ctx, data, whole, 1u << 24);
+        data += whole;
+        len -= whole;
+    }
+    if (len > 0) {
+        memcpy(ctx->buffer, data, len);
+        ctx->used = len;
+    }
+}
+
+void poly1305Final(POLY1305_CTX* ctx, uint8_t tag[STEG_TAG_SIZE]) {
+    if (ctx->used > 0) {
+        ctx->buffer[ctx->used++] = 1;
+        while (ctx->used < 16) ctx->buffer[ctx->used++] = 0;
+        poly1305Blocks(ctx, ctx->buffer, 16, 0);
+    }
+    uint32_t h0 = ctx->h[0], h1 = ctx->h[1], h2 = ctx->h[2], h3 = ctx->h[3], h4 = ctx->h[4];
+    uint32_t c;
+    c = h1 >> 26; h1 &= 0x3ffffff;
+    h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+    h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+    h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+    h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+    h1 += c;
+
+    // h - p, and pick it if it didn't go negative
+    uint32_t g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+    uint32_t g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+    uint32_t g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+    uint32_t g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+    uint32_t g4 = h4 + c - (1u << 26);
+    uint32_t mask = (g4 >> 31) - 1;
+    h0 = (h0 & ~mask) | (g0 & mask);
+    h1 = (h1 & ~mask) | (g1 & mask);
+    h2 = (h2 & ~mask) | (g2 & mask);
+    h3 = (h3 & ~mask) | (g3 & mask);
+    h4 = (h4 & ~mask) | (g4 & mask);
+
+    h0 = h0 | (h1 << 26);
+    h1 = (h1 >> 6) | (h2 << 20);
+    h2 = (h2 >> 12) | (h3 << 14);
+    h3 = (h3 >> 18) | (h4 << 8);
+
+    uint64_t f = (uint64_t)h0 + ctx->pad[0];
+    store32(tag, (uint32_t)f);
+    f = (uint64_t)h1 + ctx->pad[1] + (f >> 32);
+    store32(tag + 4, (uint32_t)f);
+    f = (uint64_t)h2 + ctx->pad[2] + (f >> 32);
+    store32(tag + 8, (uint32_t)f);
+    f = (uint64_t)h3 + ctx->pad[3] + (f >> 32);
+    store32(tag + 12, (uint32_t)f);
+    memset(ctx, 0, sizeof(POLY1305_CTX));
+}
+
+// ---- ChaCha20-Poly1305 AEAD ----
+
+static void polyPad16(POLY1305_CTX* poly, uint64_t length) {
+    static const uint8_t zeros[16] = { 0 };
+    if (length % 16 != 0) poly1305Update(poly, zeros, 16 - (size_t)(length % 16));
+}
+
+void cipherInit(STEG_CIPHER* cipher, const uint8_t key[STEG_KEY_SIZE], const uint8_t nonce[STEG_NONCE_SIZE], const uint8_t* aad, size_t aadLength) {
+    // block 0 makes the Poly1305 key, encryption starts at block 1
+    uint8_t polyKey[64];
+    chacha20Init(&cipher->chacha, key, nonce, 0);
+    chacha20Keystream(&cipher->chacha, polyKey, 64);
+    poly1305Init(&cipher->poly, polyKey);
+    memset(polyKey, 0, sizeof(polyKey));
+    chacha20Init(&cipher->chacha, key, nonce, 1);
+    poly1305Update(&cipher->poly, aad, aadLength);
+    polyPad16(&cipher->poly, aadLength);
+    cipher->aadLength = aadLength;
+    cipher->textLength = 0;
+}
+
+void cipherEncrypt(STEG_CIPHER* cipher, uint8_t* data, size_t len) {
+    chacha20Xor(&cipher->chacha, data, len);
+    poly1305Update(&cipher->poly, data, len);
+    cipher->textLength += len;
+}
+
+void cipherDecrypt(STEG_CIPHER* cipher, uint8_t* data, size_t len) {
+    poly1305Update(&cipher->poly, data, len);
+    chacha20Xor(&cipher->chacha, data, len);
+    cipher->textLength += len;
+}
+
+void cipherFinish(STEG_CIPHER* cipher, uint8_t tag[STEG_TAG_SIZE]) {
+    uint8_t lengths[16];
+    polyPad16(&cipher->poly, cipher->textLength);
+    store64(lengths, cipher->aadLength);
+    store64(lengths + 8, cipher->textLength);
+    poly1305Update(&cipher->poly, lengths, 16);
+    poly1305Final(&cipher->poly, tag);
+    memset(&cipher->chacha, 0, sizeof(CHACHA20_CTX));
+}
+
+int randomBytes(uint8_t* buffer, size_t len) {
+#ifdef _WIN32
+    for (size_t i = 0; i < len; i++) {
+        unsigned int value;
+        if (rand_s(&value) != 0) return 0;
+        buffer[i] = (uint8_t)value;
+    }
+    return 1;
+#else
+    FILE* source = fopen("/dev/urandom", "rb");
+    if (source == NULL) {
+        fprintf(stderr, "Error: No random source available!\n");
+        return 0;
+    }
+    size_t n = fread(buffer, 1, len, source);
+    fclose(source);
+    return n == len;
+#endif
+}
+
+// ---- sealed payloads in a carrier ----
+
+#define SEAL_CHUNK_SIZE 4096
+
+int sealPayload(uint8_t* data, uint32_t stride, uint64_t numSlots, FILE* input_file, const char* passphrase) {
+    uint8_t header[SEAL_HEADER_SIZE];
+    uint8_t key[STEG_KEY_SIZE];
+    uint64_t capacity = numSlots / 8;
+    if (capacity < SEAL_HEADER_SIZE + STEG_TAG_SIZE) {
+        fprintf(stderr, "ERROR: Carrier too small for an encrypted payload!\n");
+        return -1;
+    }
+    if (!randomBytes(header, STEG_SALT_SIZE + STEG_NONCE_SIZE)) return -1;
+    deriveKey(passphrase, header, STEG_KDF_ITERATIONS, key);
+
+    STEG_CIPHER cipher;
+    // salt and nonce are authenticated; the length is covered by the tag's length block
+    cipherInit(&cipher, key, header + STEG_SALT_SIZE, header, STEG_SALT_SIZE + STEG_NONCE_SIZE);
+    memset(key, 0, sizeof(key));
+
+    uint8_t chunk[SEAL_CHUNK_SIZE];
+    uint64_t position = SEAL_HEADER_SIZE; // payload byte being written
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), input_file)) > 0) {
+        if (position + n + STEG_TAG_SIZE > capacity) {
+            fprintf(stderr, "ERROR: Encode data too large!\n");
+            return -1;
+        }
+        // keystream XOR and bit spreading in the same pass over the chunk
+        cipherEncrypt(&cipher, chunk, n);
+        lsbEmbedBytes(data, stride, position, chunk, n);
+        position += n;
+    }
+    uint64_t length = position - SEAL_HEADER_SIZE;
+    uint8_t tag[STEG_TAG_SIZE];
+    cipherFinish(&cipher, tag);
+    lsbEmbedBytes(data, stride, position, tag, STEG_TAG_SIZE);
+    // length is only known now, so the header goes in last
+    store64(header + STEG_SALT_SIZE + STEG_NONCE_SIZE, length);
+    lsbEmbedBytes(data, stride, 0, header, SEAL_HEADER_SIZE);
+    return 0;
+}
+
+int openPayload(const uint8_t* data, uint32_t stride, uint64_t numSlots, FILE* output_file, const char* passphrase) {
+    uint8_t header[SEAL_HEADER_SIZE];
+    uint8_t key[STEG_KEY_SIZE];
+    uint64_t capacity = numSlots / 8;
+    if (capacity < SEAL_HEADER_SIZE + STEG_TAG_SIZE) {
+        fprintf(stderr, "Error: Carrier too small to hold an encrypted payload!\n");
+        return -1;
+    }
+    lsbExtractBytes(data, stride, 0, header, SEAL_HEADER_SIZE);
+    uint64_t length = (uint64_t)load32(header + 28) | ((uint64_t)load32(header + 32) << 32);
+    if (length > capacity - SEAL_HEADER_SIZE - STEG_TAG_SIZE) {
+        fprintf(stderr, "Error: No encrypted payload found (wrong passphrase or corrupted data)\n");
+        return -1;
+    }
+    uint8_t* plain = (uint8_t*)malloc(length > 0 ? (size_t)length : 1);
+    if (plain == NULL) {
+        fprintf(stderr, "Could not allocate payload buffer!\n");
+        return -1;
+    }
+    deriveKey(passphrase, header, STEG_KDF_ITERATIONS, key);
+    STEG_CIPHER cipher;
+    cipherInit(&cipher, key, header + STEG_SALT_SIZE, header, STEG_SALT_SIZE + STEG_NONCE_SIZE);
+    memset(key, 0, sizeof(key));
+    for (uint64_t done = 0; done < length; done += SEAL_CHUNK_SIZE) {
+        size_t n = length - done < SEAL_CHUNK_SIZE ? (size_t)(length - done) : SEAL_CHUNK_SIZE;
+        lsbExtractBytes(data, stride, SEAL_HEADER_SIZE + done, plain + done, n);
+        cipherDecrypt(&cipher, plain + done, n);
+    }
+    uint8_t tag[STEG_TAG_SIZE], stored[STEG_TAG_SIZE];
+    cipherFinish(&cipher, tag);
+    lsbExtractBytes(data, stride, SEAL_HEADER_SIZE + length, stored, STEG_TAG_SIZE);
+    uint8_t diff = 0;
+    for (int i = 0; i < STEG_TAG_SIZE; i++) {
+        diff |= tag[i] ^ stored[i];
+    }
+    if (diff != 0) {
+        fprintf(stderr, "Error: Authentication failed (wrong passphrase or corrupted data)\n");
+        memset(plain, 0, (size_t)length);
+        free(plain);
+        return -1;
+    }
+    fwrite(plain, 1, (size_t)length, output_file);
+    memset(plain, 0, (size_t)length);
+    free(plain);
+    return 0;
+}
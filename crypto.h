@@ -0,0 +1,80 @@
+//
+// Payload encryption: PBKDF2-HMAC-SHA256 key derivation, ChaCha20-Poly1305 (RFC 8439).
+//
+#ifndef STEG_CRYPTO_H
+#define STEG_CRYPTO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define STEG_KEY_SIZE 32
+#define STEG_SALT_SIZE 16
+#define STEG_NONCE_SIZE 12
+#define STEG_TAG_SIZE 16
+#define STEG_KDF_ITERATIONS 100000
+
+// Sealed payload layout in the carrier: salt | nonce | 64-bit length | ciphertext | tag
+#define SEAL_HEADER_SIZE (STEG_SALT_SIZE + STEG_NONCE_SIZE + 8)
+
+typedef struct Sha256 {
+    uint32_t state[8];
+    uint64_t length;
+    uint8_t buffer[64];
+    size_t used;
+} SHA256_CTX;
+
+typedef struct Poly1305 {
+    uint32_t r[5];
+    uint32_t h[5];
+    uint32_t pad[4];
+    uint8_t buffer[16];
+    size_t used;
+} POLY1305_CTX;
+
+// ChaCha20 keystream, generated four blocks at a time
+typedef struct ChaCha20 {
+    uint32_t state[16];
+    uint8_t keystream[256];
+    size_t used;
+} CHACHA20_CTX;
+
+// Streaming AEAD: data goes through in as many pieces as needed
+typedef struct StegCipher {
+    CHACHA20_CTX chacha;
+    POLY1305_CTX poly;
+    uint64_t aadLength;
+    uint64_t textLength;
+} STEG_CIPHER;
+
+void sha256Init(SHA256_CTX* ctx);
+void sha256Update(SHA256_CTX* ctx, const uint8_t* data, size_t len);
+void sha256Final(SHA256_CTX* ctx, uint8_t digest[32]);
+// PBKDF2-HMAC-SHA256, one 32-byte output block
+void deriveKey(const char* passphrase, const uint8_t salt[STEG_SALT_SIZE], uint32_t iterations, uint8_t key[STEG_KEY_SIZE]);
+
+void chacha20Init(CHACHA20_CTX* ctx, const uint8_t key[STEG_KEY_SIZE], const uint8_t nonce[STEG_NONCE_SIZE], uint32_t counter);
+// XOR the next len bytes of keystream into data
+void chacha20Xor(CHACHA20_CTX* ctx, uint8_t* data, size_t len);
+// Write the next len bytes of raw keystream
+void chacha20Keystream(CHACHA20_CTX* ctx, uint8_t* out, size_t len);
+
+void poly1305Init(POLY1305_CTX* ctx, const uint8_t key[32]);
+void poly1305Update(POLY1305_CTX* ctx, const uint8_t* data, size_t len);
+void poly1305Final(POLY1305_CTX* ctx, uint8_t tag[STEG_TAG_SIZE]);
+
+void cipherInit(STEG_CIPHER* cipher, const uint8_t key[STEG_KEY_SIZE], const uint8_t nonce[STEG_NONCE_SIZE], const uint8_t* aad, size_t aadLength);
+// Encrypt in place and authenticate the ciphertext
+void cipherEncrypt(STEG_CIPHER* cipher, uint8_t* data, size_t len);
+// Authenticate the ciphertext and decrypt in place
+void cipherDecrypt(STEG_CIPHER* cipher, uint8_t* data, size_t len);
+void cipherFinish(STEG_CIPHER* cipher, uint8_t tag[STEG_TAG_SIZE]);
+
+// Fill buffer from the OS random source. Returns 1 on success.
+int randomBytes(uint8_t* buffer, size_t len);
+
+// Encrypt input_file into the LSB slots of data (stride bytes apart) in one pass.
+int sealPayload(uint8_t* data, uint32_t stride, uint64_t numSlots, FILE* input_file, const char* passphrase);
+// Decrypt and verify a sealed payload. Nothing is written unless the tag checks out.
+int openPayload(const uint8_t* data, uint32_t stride, uint64_t numSlots, FILE* output_file, const char* passphrase);
+#endif //STEG_CRYPTO_H
@@ -0,0 +1,441 @@
+#include "fec.h"
+#include "carrier.h"
+#include <stdlib.h>
+#include <string.h>
+// pshufb needs SSSE3 (and AVX2 for 32-byte vectors), which aren't in the x86-64 baseline, so those kernels are
+// compiled per function and picked at run time
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define STEG_FEC_SSSE3
+#endif
+
+// GF(256) with the primitive polynomial x^8 + x^4 + x^3 + x^2 + 1, generator alpha = 2
+#define GF_POLYNOMIAL 0x11D
+
+static uint8_t gfExp[512];
+static uint8_t gfLog[256];
+// Split multiplication tables: c * x = split[c][x & 15] ^ split[c][16 + (x >> 4)]
+static uint8_t gfSplit[256][32];
+static int gfReady = 0;
+#ifdef STEG_FEC_SSSE3
+static int haveSsse3 = 0;
+static int haveAvx2 = 0;
+#endif
+
+static void gfInit(void) {
+    if (gfReady) return;
+    int x = 1;
+    for (int i = 0; i < 255; i++) {
+        gfExp[i] = (uint8_t)x;
+        gfLog[x] = (uint8_t)i;
+        x <<= 1;
+        if (x & 0x100) x ^= GF_POLYNOMIAL;
+    }
+    for (int i = 255; i < 512; i++) gfExp[i] = gfExp[i - 255];
+    for (int c = 0; c < 256; c++) {
+        for (int v = 0; v < 16; v++) {
+            gfSplit[c][v] = c && v ? gfExp[gfLog[c] + gfLog[v]] : 0;
+            gfSplit[c][16 + v] = c && v ? gfExp[gfLog[c] + gfLog[v << 4]] : 0;
+        }
+    }
+#ifdef STEG_FEC_SSSE3
+    __builtin_cpu_init();
+    haveSsse3 = __builtin_cpu_supports("ssse3");
+    haveAvx2 = __builtin_cpu_supports("avx2");
+#endif
+    gfReady = 1;
+}
+
+static inline uint8_t gfMul(uint8_t a, uint8_t b) {
+    return a && b ? gfExp[gfLog[a] + gfLog[b]] : 0;
+}
+
+static inline uint8_t gfDiv(uint8_t a, uint8_t b) {
+    return a ? gfExp[gfLog[a] + 255 - gfLog[b]] : 0;
+}
+
+// alpha^power for any power, negative included
+static inline uint8_t gfPow(int power) {
+    power %= 255;
+    return gfExp[power < 0 ? power + 255 : power];
+}
+
+#ifdef STEG_FEC_SSSE3
+__attribute__((target("ssse3")))
+static size_t gfMulRegionSSSE3(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len, int accumulate) {
+    const __m128i lo = _mm_loadu_si128((const __m128i*)gfSplit[c]);
+    const __m128i hi = _mm_loadu_si128((const __m128i*)(gfSplit[c] + 16));
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i product = _mm_xor_si128(_mm_shuffle_epi8(lo, _mm_and_si128(v, mask)),
+            _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(v, 4), mask)));
+        if (accumulate) product = _mm_xor_si128(product, _mm_loadu_si128((const __m128i*)(dst + i)));
+        _mm_storeu_si128((__m128i*)(dst + i), product);
+    }
+    return i;
+}
+
+__attribute__((target("ssse3")))
+static size_t gfHornerRegionSSSE3(uint8_t* acc, const uint8_t* src, uint8_t c, size_t len) {
+    const __m128i lo = _mm_loadu_si128((const __m128i*)gfSplit[c]);
+    const __m128i hi = _mm_loadu_si128((const __m128i*)(gfSplit[c] + 16));
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(acc + i));
+        __m128i product = _mm_xor_si128(_mm_shuffle_epi8(lo, _mm_and_si128(v, mask)),
+            _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(v, 4), mask)));
+        _mm_storeu_si128((__m128i*)(acc + i), _mm_xor_si128(product, _mm_loadu_si128((const __m128i*)(src + i))));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t gfMulRegionAVX2(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len, int accumulate) {
+    const __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)gfSplit[c]));
+    const __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(gfSplit[c] + 16)));
+    const __m256i mask = _mm256_set1_epi8(0x0F);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i product = _mm256_xor_si256(_mm256_shuffle_epi8(lo, _mm256_and_si256(v, mask)),
+            _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(v, 4), mask)));
+        if (accumulate) product = _mm256_xor_si256(product, _mm256_loadu_si256((const __m256i*)(dst + i)));
+        _mm256_storeu_si256((__m256i*)(dst + i), product);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t gfHornerRegionAVX2(uint8_t* acc, const uint8_t* src, uint8_t c, size_t len) {
+    const __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)gfSplit[c]));
+    const __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(gfSplit[c] + 16)));
+    const __m256i mask = _mm256_set1_epi8(0x0F);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(acc + i));
+        __m256i product = _mm256_xor_si256(_mm256_shuffle_epi8(lo, _mm256_and_si256(v, mask)),
+            _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(v, 4), mask)));
+        _mm256_storeu_si256((__m256i*)(acc + i), _mm256_xor_si256(product, _mm256_loadu_si256((const __m256i*)(src + i))));
+    }
+    return i;
+}
+#endif
+
+// dst = c * src, or dst ^= c * src when accumulating
+static void gfMulRegion(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len, int accumulate) {
+    size_t i = 0;
+#ifdef STEG_FEC_SSSE3
+    if (haveAvx2) i = gfMulRegionAVX2(dst, src, c, len, accumulate);
+    else if (haveSsse3) i = gfMulRegionSSSE3(dst, src, c, len, accumulate);
+#endif
+    const uint8_t* split = gfSplit[c];
+    for (; i < len; i++) {
+        uint8_t product = split[src[i] & 15] ^ split[16 + (src[i] >> 4)];
+        dst[i] = accumulate ? dst[i] ^ product : product;
+    }
+}
+
+// acc = c * acc ^ src: one Horner step of a syndrome for every codeword in the row
+static void gfHornerRegion(uint8_t* acc, const uint8_t* src, uint8_t c, size_t len) {
+    size_t i = 0;
+#ifdef STEG_FEC_SSSE3
+    if (haveAvx2) i = gfHornerRegionAVX2(acc, src, c, len);
+    else if (haveSsse3) i = gfHornerRegionSSSE3(acc, src, c, len);
+#endif
+    const uint8_t* split = gfSplit[c];
+    for (; i < len; i++) acc[i] = split[acc[i] & 15] ^ split[16 + (acc[i] >> 4)] ^ src[i];
+}
+
+// Generator polynomial (x - alpha^0)...(x - alpha^(parity-1)), highest power first, gen[0] = 1
+static void buildGenerator(uint8_t* gen, int parity) {
+    memset(gen, 0, parity + 1);
+    gen[0] = 1;
+    for (int i = 0; i < parity; i++) {
+        uint8_t root = gfExp[i];
+        for (int j = i + 1; j > 0; j--) gen[j] ^= gfMul(root, gen[j - 1]);
+    }
+}
+
+// Systematic encode of a single (possibly shortened) codeword
+static void encodeCodeword(const uint8_t* data, int length, uint8_t* parityBytes, int parity, const uint8_t* gen) {
+    memset(parityBytes, 0, parity);
+    for (int i = 0; i < length; i++) {
+        uint8_t feedback = data[i] ^ parityBytes[0];
+        memmove(parityBytes, parityBytes + 1, parity - 1);
+        parityBytes[parity - 1] = 0;
+        if (feedback == 0) continue;
+        for (int j = 0; j < parity; j++) parityBytes[j] ^= gfMul(gen[j + 1], feedback);
+    }
+}
+
+// Berlekamp-Massey, Chien search and Forney for one codeword of length n (first byte = highest power).
+// Returns the number of errors found (their positions and magnitudes filled in), or -1 if uncorrectable.
+static int locateErrors(const uint8_t* syndromes, int parity, int n, int* positions, uint8_t* magnitudes) {
+    uint8_t locator[FEC_MAX_PARITY + 1] = { 1 };
+    uint8_t previous[FEC_MAX_PARITY + 1] = { 1 };
+    uint8_t temp[FEC_MAX_PARITY + 1];
+    int errors = 0;
+    int shift = 1;
+    uint8_t lastDiscrepancy = 1;
+    for (int r = 0; r < parity; r++) {
+        uint8_t discrepancy = syndromes[r];
+        for (int i = 1; i <= errors; i++) discrepancy ^= gfMul(locator[i], syndromes[r - i]);
+        if (discrepancy == 0) {
+            shift++;
+            continue;
+        }
+        uint8_t scale = gfDiv(discrepancy, lastDiscrepancy);
+        if (2 * errors <= r) {
+            memcpy(temp, locator, sizeof(temp));
+            for (int i = 0; i + shift <= parity; i++) locator[i + shift] ^= gfMul(scale, previous[i]);
+            errors = r + 1 - errors;
+            memcpy(previous, temp, sizeof(previous));
+            lastDiscrepancy = discrepancy;
+            shift = 1;
+        }
+        else {
+            for (int i = 0; i + shift <= parity; i++) locator[i + shift] ^= gfMul(scale, previous[i]);
+            shift++;
+        }
+    }
+    if (2 * errors > parity) return -1;
+    // evaluator = syndromes * locator mod x^parity
+    uint8_t evaluator[FEC_MAX_PARITY];
+    for (int i = 0; i < parity; i++) {
+        uint8_t sum = 0;
+        for (int j = 0; j <= i && j <= errors; j++) sum ^= gfMul(locator[j], syndromes[i - j]);
+        evaluator[i] = sum;
+    }
+    int found = 0;
+    for (int i = 0; i < n && found <= errors; i++) {
+        int power = n - 1 - i;
+        uint8_t inverse = gfPow(-power);
+        uint8_t value = 0;
+        uint8_t term = 1;
+        for (int t = 0; t <= errors; t++) {
+            value ^= gfMul(locator[t], term);
+            term = gfMul(term, inverse);
+        }
+        if (value != 0) continue;
+        if (found == errors) return -1;
+        uint8_t omega = 0, derivative = 0;
+        term = 1;
+        for (int t = 0; t < parity; t++) {
+            omega ^= gfMul(evaluator[t], term);
+            // formal derivative: only odd powers survive in characteristic 2
+            if ((t & 1) == 0 && t + 1 <= errors) derivative ^= gfMul(locator[t + 1], term);
+            term = gfMul(term, inverse);
+        }
+        if (derivative == 0) return -1;
+        positions[found] = i;
+        magnitudes[found] = gfMul(gfPow(power), gfDiv(omega, derivative));
+        found++;
+    }
+    return found == errors ? errors : -1;
+}
+
+// Correct a single codeword held contiguously. Returns bytes corrected or -1.
+static int correctCodeword(uint8_t* codeword, int n, int parity) {
+    uint8_t syndromes[FEC_MAX_PARITY];
+    int nonzero = 0;
+    for (int j = 0; j < parity; j++) {
+        uint8_t s = 0;
+        uint8_t root = gfExp[j];
+        for (int i = 0; i < n; i++) s = gfMul(s, root) ^ codeword[i];
+        syndromes[j] = s;
+        nonzero |= s;
+    }
+    if (!nonzero) return 0;
+    int positions[FEC_MAX_PARITY / 2];
+    uint8_t magnitudes[FEC_MAX_PARITY / 2];
+    int errors = locateErrors(syndromes, parity, n, positions, magnitudes);
+    for (int e = 0; e < errors; e++) codeword[positions[e]] ^= magnitudes[e];
+    return errors;
+}
+
+uint64_t fecCapacity(uint64_t capacity, int parity) {
+    if (capacity < FEC_HEADER_SIZE) return 0;
+    return (capacity - FEC_HEADER_SIZE) / FEC_CODEWORD * (uint64_t)(FEC_CODEWORD - parity);
+}
+
+void fecEncodeInterleaved(uint8_t* stream, uint64_t codewords, int parity) {
+    gfInit();
+    uint8_t gen[FEC_MAX_PARITY + 1];
+    buildGenerator(gen, parity);
+    int dataRows = FEC_CODEWORD - parity;
+    // the remainder registers of FEC_STRIP codewords at a time, as a ring of rows
+    uint8_t* registers = (uint8_t*)malloc((size_t)(parity + 1) * FEC_STRIP);
+    if (registers == NULL) {
+        // no room for the strips, fall back to one codeword at a time
+        uint8_t codeword[FEC_CODEWORD];
+        for (uint64_t j = 0; j < codewords; j++) {
+            for (int i = 0; i < dataRows; i++) codeword[i] = stream[i * codewords + j];
+            encodeCodeword(codeword, dataRows, codeword + dataRows, parity, gen);
+            for (int i = dataRows; i < FEC_CODEWORD; i++) stream[i * codewords + j] = codeword[i];
+        }
+        return;
+    }
+    uint8_t* feedback = registers + (size_t)parity * FEC_STRIP;
+    for (uint64_t start = 0; start < codewords; start += FEC_STRIP) {
+        size_t width = codewords - start < FEC_STRIP ? (size_t)(codewords - start) : FEC_STRIP;
+        int head = 0;
+        memset(registers, 0, (size_t)parity * FEC_STRIP);
+        for (int i = 0; i < dataRows; i++) {
+            const uint8_t* row = stream + i * codewords + start;
+            uint8_t* first = registers + (size_t)head * FEC_STRIP;
+            for (size_t j = 0; j < width; j++) feedback[j] = row[j] ^ first[j];
+            // shift by one register: the old head becomes the new tail, set outright
+            head = (head + 1) % parity;
+            for (int k = 0; k < parity; k++) {
+                uint8_t* reg = registers + (size_t)((head + k) % parity) * FEC_STRIP;
+                gfMulRegion(reg, feedback, gen[k + 1], width, k != parity - 1);
+            }
+        }
+        for (int k = 0; k < parity; k++) {
+            memcpy(stream + (uint64_t)(dataRows + k) * codewords + start, registers + (size_t)((head + k) % parity) * FEC_STRIP, width);
+        }
+    }
+    free(registers);
+}
+
+int64_t fecCorrectInterleaved(uint8_t* stream, uint64_t codewords, int parity, uint64_t* failed) {
+    gfInit();
+    *failed = 0;
+    uint8_t* syndromes = (uint8_t*)malloc((size_t)parity * FEC_STRIP);
+    if (syndromes == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        *failed = codewords;
+        return -1;
+    }
+    int64_t corrected = 0;
+    for (uint64_t start = 0; start < codewords; start += FEC_STRIP) {
+        size_t width = codewords - start < FEC_STRIP ? (size_t)(codewords - start) : FEC_STRIP;
+        // syndromes of every codeword in the strip, by Horner's rule down the rows
+        memset(syndromes, 0, (size_t)parity * FEC_STRIP);
+        for (int i = 0; i < FEC_CODEWORD; i++) {
+            const uint8_t* row = stream + i * codewords + start;
+            for (int j = 0; j < parity; j++) gfHornerRegion(syndromes + (size_t)j * FEC_STRIP, row, gfExp[j], width);
+        }
+        for (size_t w = 0; w < width; w++) {
+            uint8_t own[FEC_MAX_PARITY];
+            uint8_t nonzero = 0;
+            for (int j = 0; j < parity; j++) {
+                own[j] = syndromes[(size_t)j * FEC_STRIP + w];
+                nonzero |= own[j];
+            }
+            if (!nonzero) continue;
+            int positions[FEC_MAX_PARITY / 2];
+            uint8_t magnitudes[FEC_MAX_PARITY / 2];
+            int errors = locateErrors(own, parity, FEC_CODEWORD, positions, magnitudes);
+            if (errors < 0) {
+                (*failed)++;
+                continue;
+            }
+            for (int e = 0; e < errors; e++) stream[(uint64_t)positions[e] * codewords + start + w] ^= magnitudes[e];
+            corrected += errors;
+        }
+    }
+    free(syndromes);
+    return *failed ? -1 : corrected;
+}
+
+int fecEmbedPayload(uint8_t* data, uint32_t stride, uint64_t numSlots, FILE* input_file, int parity) {
+    gfInit();
+    uint64_t length;
+    uint8_t* payload = readPayload(input_file, &length);
+    if (payload == NULL) {
+        fprintf(stderr, "Error: Failed to read payload\n");
+        return -1;
+    }
+    uint64_t dataRows = FEC_CODEWORD - parity;
+    uint64_t codewords = (length + dataRows - 1) / dataRows;
+    if (length > fecCapacity(numSlots / 8, parity)) {
+        fprintf(stderr, "ERROR: Encode data too large! %llu bytes fit with %d parity bytes per codeword\n",
+            (unsigned long long)fecCapacity(numSlots / 8, parity), parity);
+        free(payload);
+        return -1;
+    }
+    uint8_t* stream = (uint8_t*)calloc(codewords ? codewords * FEC_CODEWORD : 1, 1);
+    if (stream == NULL) {
+        fprintf(stderr, "Could not allocate payload buffer!\n");
+        free(payload);
+        return -1;
+    }
+    // codeword j holds payload bytes j*dataRows..; its byte i sits in row i
+    for (uint64_t j = 0; j < codewords; j++) {
+        uint64_t first = j * dataRows;
+        uint64_t count = length - first < dataRows ? length - first : dataRows;
+        for (uint64_t i = 0; i < count; i++) stream[i * codewords + j] = payload[first + i];
+    }
+    free(payload);
+    fecEncodeInterleaved(stream, codewords, parity);
+
+    uint8_t header[FEC_HEADER_SIZE] = { 0 };
+    uint8_t gen[FEC_HEADER_PARITY + 1];
+    memcpy(header, FEC_MAGIC, 4);
+    header[4] = (uint8_t)parity;
+    for (int i = 0; i < 8; i++) header[8 + i] = (uint8_t)(length >> (8 * i));
+    buildGenerator(gen, FEC_HEADER_PARITY);
+    encodeCodeword(header, FEC_HEADER_DATA, header + FEC_HEADER_DATA, FEC_HEADER_PARITY, gen);
+    lsbEmbedBytes(data, stride, 0, header, FEC_HEADER_SIZE);
+    lsbEmbedBytes(data, stride, FEC_HEADER_SIZE, stream, (size_t)(codewords * FEC_CODEWORD));
+    free(stream);
+    printf("|| FEC: %llu codewords, %d parity bytes each (corrects up to %d bad bytes per codeword)\n",
+        (unsigned long long)codewords, parity, parity / 2);
+    return 0;
+}
+
+int fecExtractPayload(const uint8_t* data, uint32_t stride, uint64_t numSlots, FILE* output_file) {
+    gfInit();
+    uint64_t capacity = numSlots / 8;
+    uint8_t header[FEC_HEADER_SIZE];
+    if (capacity < FEC_HEADER_SIZE) {
+        fprintf(stderr, "Error: Carrier too small to hold an error-corrected payload!\n");
+        return -1;
+    }
+    lsbExtractBytes(data, stride, 0, header, FEC_HEADER_SIZE);
+    int headerErrors = correctCodeword(header, FEC_HEADER_SIZE, FEC_HEADER_PARITY);
+    int parity = header[4];
+    uint64_t length = 0;
+    for (int i = 0; i < 8; i++) length |= (uint64_t)header[8 + i] << (8 * i);
+    if (headerErrors < 0 || memcmp(header, FEC_MAGIC, 4) != 0 || parity < FEC_MIN_PARITY || parity > FEC_MAX_PARITY
+        || length > fecCapacity(capacity, parity)) {
+        fprintf(stderr, "Error: No error-corrected payload found (or its header is damaged beyond repair)\n");
+        return -1;
+    }
+    uint64_t dataRows = FEC_CODEWORD - parity;
+    uint64_t codewords = (length + dataRows - 1) / dataRows;
+    uint8_t* stream = (uint8_t*)malloc(codewords ? codewords * FEC_CODEWORD : 1);
+    uint8_t* payload = (uint8_t*)malloc(length ? length : 1);
+    if (stream == NULL || payload == NULL) {
+        fprintf(stderr, "Could not allocate payload buffer!\n");
+        free(stream);
+        free(payload);
+        return -1;
+    }
+    lsbExtractBytes(data, stride, FEC_HEADER_SIZE, stream, (size_t)(codewords * FEC_CODEWORD));
+    uint64_t failed;
+    int64_t corrected = fecCorrectInterleaved(stream, codewords, parity, &failed);
+    if (corrected < 0) {
+        fprintf(stderr, "Error: %llu of %llu codewords have more than %d damaged bytes, payload not recovered\n",
+            (unsigned long long)failed, (unsigned long long)codewords, parity / 2);
+        free(stream);
+        free(payload);
+        return -1;
+    }
+    for (uint64_t j = 0; j < codewords; j++) {
+        uint64_t first = j * dataRows;
+        uint64_t count = length - first < dataRows ? length - first : dataRows;
+        for (uint64_t i = 0; i < count; i++) payload[first + i] = stream[i * codewords + j];
+    }
+    free(stream);
+    if (corrected + headerErrors > 0) {
+        printf("|| FEC: corrected %lld damaged bytes\n", (long long)(corrected + headerErrors));
+    }
+    int result = fwrite(payload, 1, (size_t)length, output_file) == length ? 0 : -1;
+    free(payload);
+    return result;
+}
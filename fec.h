@@ -0,0 +1,39 @@
+//
+// Reed-Solomon forward error correction over GF(256), with the codewords interleaved byte by byte so a run of
+// damaged carrier bytes is spread thinly over many codewords.
+//
+#ifndef STEG_FEC_H
+#define STEG_FEC_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Codeword length; each carries 255 - parity payload bytes and corrects parity / 2 damaged bytes
+#define FEC_CODEWORD 255
+#define FEC_DEFAULT_PARITY 32
+#define FEC_MIN_PARITY 2
+#define FEC_MAX_PARITY 128
+
+// Carrier layout: header codeword (magic | parity | reserved | 64-bit length, then its own parity) | interleaved codewords
+#define FEC_MAGIC "RSFC"
+#define FEC_HEADER_DATA 16
+#define FEC_HEADER_PARITY 16
+#define FEC_HEADER_SIZE (FEC_HEADER_DATA + FEC_HEADER_PARITY)
+
+// Codewords per strip when encoding or checking; keeps the working rows in cache
+#define FEC_STRIP 1024
+
+// Payload bytes a carrier with capacity bytes of LSB slots can hold at this parity
+uint64_t fecCapacity(uint64_t capacity, int parity);
+// Parity rows of codewords interleaved column-wise: stream holds FEC_CODEWORD rows of `codewords` bytes,
+// the first FEC_CODEWORD - parity of them data
+void fecEncodeInterleaved(uint8_t* stream, uint64_t codewords, int parity);
+// Correct interleaved codewords in place. Returns the number of bytes corrected, or -1 if any codeword
+// had more errors than it can correct (*failed says how many).
+int64_t fecCorrectInterleaved(uint8_t* stream, uint64_t codewords, int parity, uint64_t* failed);
+
+// Reed-Solomon encode input_file into the LSB slots of data (stride bytes apart)
+int fecEmbedPayload(uint8_t* data, uint32_t stride, uint64_t numSlots, FILE* input_file, int parity);
+// Correct and extract a payload embedded by fecEmbedPayload. Nothing is written if it can't be corrected.
+int fecExtractPayload(const uint8_t* data, uint32_t stride, uint64_t numSlots, FILE* output_file);
+#endif //STEG_FEC_H
@@ -0,0 +1,256 @@
+#include "fft.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define STEG_FFT_SSE 1
+#endif
+
+#define FFT_PI 3.14159265358979323846
+
+FFT_PLAN* fftCreatePlan(int size) {
+    if (size < 8 || (size & (size - 1)) != 0) return NULL;
+    FFT_PLAN* plan = (FFT_PLAN*)calloc(1, sizeof(FFT_PLAN));
+    if (plan == NULL) return NULL;
+    plan->size = size;
+    plan->half = size / 2;
+    int n = plan->half;
+    while (n >= 4) {
+        plan->numStages++;
+        n /= 4;
+    }
+    plan->finalRadix2 = n == 2;
+
+    // twiddles: 6 * n/4 per stage adds up to less than 2 * half; then the real split and four work arrays
+    size_t floats = (size_t)plan->half * 2 + (size_t)plan->half * 2 + (size_t)plan->half * 4 + 16;
+    plan->memory = (float*)malloc(floats * sizeof(float));
+    plan->stages = (FFT_STAGE*)calloc(plan->numStages + 1, sizeof(FFT_STAGE));
+    if (plan->memory == NULL || plan->stages == NULL) {
+        fftDestroyPlan(plan);
+        return NULL;
+    }
+    float* next = plan->memory;
+    n = plan->half;
+    int stride = 1;
+    for (int s = 0; s < plan->numStages; s++) {
+        FFT_STAGE* stage = &plan->stages[s];
+        int m = n / 4;
+        stage->n = n;
+        stage->stride = stride;
+        stage->w1r = next; next += m;
+        stage->w1i = next; next += m;
+        stage->w2r = next; next += m;
+        stage->w2i = next; next += m;
+        stage->w3r = next; next += m;
+        stage->w3i = next; next += m;
+        for (int p = 0; p < m; p++) {
+            double angle = -2.0 * FFT_PI * p / n;
+            stage->w1r[p] = (float)cos(angle);
+            stage->w1i[p] = (float)sin(angle);
+            stage->w2r[p] = (float)cos(2.0 * angle);
+            stage->w2i[p] = (float)sin(2.0 * angle);
+            stage->w3r[p] = (float)cos(3.0 * angle);
+            stage->w3i[p] = (float)sin(3.0 * angle);
+        }
+        n = m;
+        stride *= 4;
+    }
+    plan->realTwr = next; next += plan->half;
+    plan->realTwi = next; next += plan->half;
+    for (int k = 0; k < plan->half; k++) {
+        double angle = -2.0 * FFT_PI * k / size;
+        plan->realTwr[k] = (float)cos(angle);
+        plan->realTwi[k] = (float)sin(angle);
+    }
+    plan->zr = next; next += plan->half;
+    plan->zi = next; next += plan->half;
+    plan->yr = next; next += plan->half;
+    plan->yi = next;
+    return plan;
+}
+
+void fftDestroyPlan(FFT_PLAN* plan) {
+    if (plan == NULL) return;
+    free(plan->memory);
+    free(plan->stages);
+    free(plan);
+}
+
+// One radix-4 butterfly: inputs a, b, c, d, outputs already multiplied by their twiddles
+#define RADIX4_SCALAR(ar, ai, br, bi, cr, ci, dr, di, w1r, w1i, w2r, w2i, w3r, w3i, y0r, y0i, y1r, y1i, y2r, y2i, y3r, y3i) { \
+    float apcr = ar + cr, apci = ai + ci, amcr = ar - cr, amci = ai - ci; \
+    float bpdr = br + dr, bpdi = bi + di, bmdr = br - dr, bmdi = bi - di; \
+    float t1r = amcr + bmdi, t1i = amci - bmdr; \
+    float t2r = apcr - bpdr, t2i = apci - bpdi; \
+    float t3r = amcr - bmdi, t3i = amci + bmdr; \
+    y0r = apcr + bpdr; y0i = apci + bpdi; \
+    y1r = w1r * t1r - w1i * t1i; y1i = w1r * t1i + w1i * t1r; \
+    y2r = w2r * t2r - w2i * t2i; y2i = w2r * t2i + w2i * t2r; \
+    y3r = w3r * t3r - w3i * t3i; y3i = w3r * t3i + w3i * t3r; \
+}
+
+#ifdef STEG_FFT_SSE
+#define CMUL_RE(ar, ai, br, bi) _mm_sub_ps(_mm_mul_ps(ar, br), _mm_mul_ps(ai, bi))
+#define CMUL_IM(ar, ai, br, bi) _mm_add_ps(_mm_mul_ps(ar, bi), _mm_mul_ps(ai, br))
+
+// Four butterflies at once; a..d and the twiddles are whole vectors
+static inline void radix4Vector(__m128 ar, __m128 ai, __m128 br, __m128 bi, __m128 cr, __m128 ci, __m128 dr, __m128 di,
+    __m128 w1r, __m128 w1i, __m128 w2r, __m128 w2i, __m128 w3r, __m128 w3i, __m128 y[8]) {
+    __m128 apcr = _mm_add_ps(ar, cr), apci = _mm_add_ps(ai, ci);
+    __m128 amcr = _mm_sub_ps(ar, cr), amci = _mm_sub_ps(ai, ci);
+    __m128 bpdr = _mm_add_ps(br, dr), bpdi = _mm_add_ps(bi, di);
+    __m128 bmdr = _mm_sub_ps(br, dr), bmdi = _mm_sub_ps(bi, di);
+    __m128 t1r = _mm_add_ps(amcr, bmdi), t1i = _mm_sub_ps(amci, bmdr);
+    __m128 t2r = _mm_sub_ps(apcr, bpdr), t2i = _mm_sub_ps(apci, bpdi);
+    __m128 t3r = _mm_sub_ps(amcr, bmdi), t3i = _mm_add_ps(amci, bmdr);
+    y[0] = _mm_add_ps(apcr, bpdr);
+    y[1] = _mm_add_ps(apci, bpdi);
+    y[2] = CMUL_RE(w1r, w1i, t1r, t1i);
+    y[3] = CMUL_IM(w1r, w1i, t1r, t1i);
+    y[4] = CMUL_RE(w2r, w2i, t2r, t2i);
+    y[5] = CMUL_IM(w2r, w2i, t2r, t2i);
+    y[6] = CMUL_RE(w3r, w3i, t3r, t3i);
+    y[7] = CMUL_IM(w3r, w3i, t3r, t3i);
+}
+#endif
+
+static void radix4Pass(const FFT_STAGE* stage, const float* xr, const float* xi, float* yr, float* yi) {
+    const int s = stage->stride;
+    const int m = stage->n / 4;
+#ifdef STEG_FFT_SSE
+    if (s == 1 && m % 4 == 0) {
+        // first pass: vectorize across p, then transpose so each output quad lands contiguously
+        for (int p = 0; p < m; p += 4) {
+            __m128 y[8];
+            radix4Vector(_mm_loadu_ps(xr + p), _mm_loadu_ps(xi + p), _mm_loadu_ps(xr + p + m), _mm_loadu_ps(xi + p + m),
+                _mm_loadu_ps(xr + p + 2 * m), _mm_loadu_ps(xi + p + 2 * m), _mm_loadu_ps(xr + p + 3 * m), _mm_loadu_ps(xi + p + 3 * m),
+                _mm_loadu_ps(stage->w1r + p), _mm_loadu_ps(stage->w1i + p), _mm_loadu_ps(stage->w2r + p), _mm_loadu_ps(stage->w2i + p),
+                _mm_loadu_ps(stage->w3r + p), _mm_loadu_ps(stage->w3i + p), y);
+            _MM_TRANSPOSE4_PS(y[0], y[2], y[4], y[6]);
+            _MM_TRANSPOSE4_PS(y[1], y[3], y[5], y[7]);
+            for (int l = 0; l < 4; l++) {
+                _mm_storeu_ps(yr + 4 * (p + l), y[2 * l]);
+                _mm_storeu_ps(yi + 4 * (p + l), y[2 * l + 1]);
+            }
+        }
+        return;
+    }
+    if (s % 4 == 0) {
+        // later passes: the q loop is contiguous, four butterflies per step
+        for (int p = 0; p < m; p++) {
+            __m128 w1r = _mm_set1_ps(stage->w1r[p]), w1i = _mm_set1_ps(stage->w1i[p]);
+            __m128 w2r = _mm_set1_ps(stage->w2r[p]), w2i = _mm_set1_ps(stage->w2i[p]);
+            __m128 w3r = _mm_set1_ps(stage->w3r[p]), w3i = _mm_set1_ps(stage->w3i[p]);
+            const float* ar = xr + s * p; const float* ai = xi + s * p;
+            const float* br = xr + s * (p + m); const float* bi = xi + s * (p + m);
+            const float* cr = xr + s * (p + 2 * m); const float* ci = xi + s * (p + 2 * m);
+            const float* dr = xr + s * (p + 3 * m); const float* di = xi + s * (p + 3 * m);
+            float* out = yr + s * 4 * p;
+            float* outi = yi + s * 4 * p;
+            for (int q = 0; q < s; q += 4) {
+                __m128 y[8];
+                radix4Vector(_mm_loadu_ps(ar + q), _mm_loadu_ps(ai + q), _mm_loadu_ps(br + q), _mm_loadu_ps(bi + q),
+                    _mm_loadu_ps(cr + q), _mm_loadu_ps(ci + q), _mm_loadu_ps(dr + q), _mm_loadu_ps(di + q),
+                    w1r, w1i, w2r, w2i, w3r, w3i, y);
+                for (int k = 0; k < 4; k++) {
+                    _mm_storeu_ps(out + s * k + q, y[2 * k]);
+                    _mm_storeu_ps(outi + s * k + q, y[2 * k + 1]);
+                }
+            }
+        }
+        return;
+    }
+#endif
+    for (int p = 0; p < m; p++) {
+        float w1r = stage->w1r[p], w1i = stage->w1i[p];
+        float w2r = stage->w2r[p], w2i = stage->w2i[p];
+        float w3r = stage->w3r[p], w3i = stage->w3i[p];
+        for (int q = 0; q < s; q++) {
+            int in = q + s * p;
+            int out = q + s * 4 * p;
+            RADIX4_SCALAR(xr[in], xi[in], xr[in + s * m], xi[in + s * m], xr[in + 2 * s * m], xi[in + 2 * s * m],
+                xr[in + 3 * s * m], xi[in + 3 * s * m], w1r, w1i, w2r, w2i, w3r, w3i,
+                yr[out], yi[out], yr[out + s], yi[out + s], yr[out + 2 * s], yi[out + 2 * s], yr[out + 3 * s], yi[out + 3 * s]);
+        }
+    }
+}
+
+// Last pass for odd powers of two: n = 2, no twiddles
+static void radix2Pass(int s, const float* xr, const float* xi, float* yr, float* yi) {
+    for (int q = 0; q < s; q++) {
+        float ar = xr[q], ai = xi[q], br = xr[q + s], bi = xi[q + s];
+        yr[q] = ar + br;
+        yi[q] = ai + bi;
+        yr[q + s] = ar - br;
+        yi[q + s] = ai - bi;
+    }
+}
+
+void fftComplex(FFT_PLAN* plan, float* re, float* im) {
+    // Stockham: every pass reads one buffer and writes the other, output comes out in natural order
+    float* xr = re; float* xi = im;
+    float* yr = plan->yr; float* yi = plan->yi;
+    for (int s = 0; s < plan->numStages; s++) {
+        radix4Pass(&plan->stages[s], xr, xi, yr, yi);
+        float* tr = xr; xr = yr; yr = tr;
+        float* ti = xi; xi = yi; yi = ti;
+    }
+    if (plan->finalRadix2) {
+        radix2Pass(plan->half / 2, xr, xi, yr, yi);
+        float* tr = xr; xr = yr; yr = tr;
+        float* ti = xi; xi = yi; yi = ti;
+    }
+    if (xr != re) {
+        memcpy(re, xr, plan->half * sizeof(float));
+        memcpy(im, xi, plan->half * sizeof(float));
+    }
+}
+
+void fftForwardReal(FFT_PLAN* plan, const float* in, float* re, float* im) {
+    const int half = plan->half;
+    float* zr = plan->zr;
+    float* zi = plan->zi;
+    // even samples as the real part, odd as the imaginary: one half-size complex FFT does both
+    for (int k = 0; k < half; k++) {
+        zr[k] = in[2 * k];
+        zi[k] = in[2 * k + 1];
+    }
+    fftComplex(plan, zr, zi);
+    float z0r = zr[0], z0i = zi[0];
+    for (int k = 1; k < half; k++) {
+        // X[k] = E - i W^k O, E/O the even/odd spectra recovered from Z[k] and conj(Z[half - k])
+        float er = 0.5f * (zr[k] + zr[half - k]), ei = 0.5f * (zi[k] - zi[half - k]);
+        float or_ = 0.5f * (zr[k] - zr[half - k]), oi = 0.5f * (zi[k] + zi[half - k]);
+        float wr = plan->realTwr[k], wi = plan->realTwi[k];
+        float wor = wr * or_ - wi * oi, woi = wr * oi + wi * or_;
+        re[k] = er + woi;
+        im[k] = ei - wor;
+    }
+    re[0] = z0r + z0i;
+    im[0] = 0.0f;
+    re[half] = z0r - z0i;
+    im[half] = 0.0f;
+}
+
+void fftInverseReal(FFT_PLAN* plan, const float* re, const float* im, float* out) {
+    const int half = plan->half;
+    float* zr = plan->zr;
+    float* zi = plan->zi;
+    for (int k = 0; k < half; k++) {
+        // even spectrum + i * odd spectrum, undoing the split in fftForwardReal
+        float fer = 0.5f * (re[k] + re[half - k]), fei = 0.5f * (im[k] - im[half - k]);
+        float dr = 0.5f * (re[k] - re[half - k]), di = 0.5f * (im[k] + im[half - k]);
+        float wr = plan->realTwr[k], wi = -plan->realTwi[k];
+        float forr = dr * wr - di * wi, foi = dr * wi + di * wr;
+        zr[k] = fer - foi;
+        zi[k] = fei + forr;
+    }
+    // swapping re and im turns the forward transform into the (unscaled) inverse
+    fftComplex(plan, zi, zr);
+    float scale = 1.0f / half;
+    for (int k = 0; k < half; k++) {
+        out[2 * k] = zr[k] * scale;
+        out[2 * k + 1] = zi[k] * scale;
+    }
+}
@@ -0,0 +1,40 @@
+//
+// Real-input FFT for the transform-domain audio modes.
+// Radix-4 Stockham passes (plus one radix-2 pass for odd powers of two) over split re/im arrays,
+// with SSE butterflies where available and every twiddle precomputed in the plan.
+//
+#ifndef STEG_FFT_H
+#define STEG_FFT_H
+
+typedef struct FftStage {
+    int n;          // sub-transform length at this pass
+    int stride;     // distance between its interleaved sub-transforms
+    float* w1r; float* w1i; // W^p, W^2p, W^3p for p < n/4, W = e^(-2 pi i / n)
+    float* w2r; float* w2i;
+    float* w3r; float* w3i;
+} FFT_STAGE;
+
+// A plan is reusable for any number of frames, but holds scratch space: one per thread.
+typedef struct FftPlan {
+    int size;        // real points
+    int half;        // complex points (size / 2)
+    int numStages;   // radix-4 passes
+    int finalRadix2; // one radix-2 pass at the end
+    FFT_STAGE* stages;
+    float* realTwr;  // e^(-2 pi i k / size) for the real <-> half-size complex split
+    float* realTwi;
+    float* zr; float* zi; // packed complex signal
+    float* yr; float* yi; // ping-pong buffer
+    float* memory;
+} FFT_PLAN;
+
+// Plan for real transforms of size points (a power of two, at least 8). NULL on failure.
+FFT_PLAN* fftCreatePlan(int size);
+void fftDestroyPlan(FFT_PLAN* plan);
+// In-place forward complex FFT of plan->half points. The inverse is the same call with re and im swapped (unscaled).
+void fftComplex(FFT_PLAN* plan, float* re, float* im);
+// size real samples -> size / 2 + 1 bins
+void fftForwardReal(FFT_PLAN* plan, const float* in, float* re, float* im);
+// size / 2 + 1 bins -> size real samples, scaled so it inverts fftForwardReal exactly
+void fftInverseReal(FFT_PLAN* plan, const float* re, const float* im, float* out);
+#endif //STEG_FFT_H
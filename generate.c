@@ -0,0 +1,490 @@
+#include "generate.h"
+#include "wave.h"
+#include "bmp.h"
+#include "stream.h"
+#include "getopt.h"
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#define GENERATE_PI 3.14159265358979323846
+#define NOISE_LANES 8
+
+// Eight independent xorshift32 generators stepped together
+typedef struct NoiseSource {
+    uint32_t lanes[NOISE_LANES];
+} NOISE_SOURCE;
+
+typedef struct PayloadReader {
+    FILE* file;
+    STREAM_PAYLOAD source; // header, then the payload bytes, as encode_Stream embeds them
+    uint8_t current;       // byte being spread over the next slots
+    int bit;               // next bit of current, 8 when a new byte is needed
+} PAYLOAD_READER;
+
+static void noiseSeed(NOISE_SOURCE* noise, uint32_t seed) {
+    for (int i = 0; i < NOISE_LANES; i++) {
+        // scramble so neighbouring seeds don't give related lanes
+        uint32_t x = seed + 0x9E3779B9u * (uint32_t)(i + 1);
+        x ^= x >> 16;
+        x *= 0x85EBCA6Bu;
+        x ^= x >> 13;
+        x *= 0xC2B2AE35u;
+        x ^= x >> 16;
+        noise->lanes[i] = x != 0 ? x : 1;
+    }
+}
+
+// n uniform values in [-1, 1). The lanes have no dependency on each other, so the inner loop vectorizes.
+static void noiseFill(NOISE_SOURCE* noise, float* out, size_t n) {
+    uint32_t lanes[NOISE_LANES];
+    float tail[NOISE_LANES];
+    memcpy(lanes, noise->lanes, sizeof(lanes));
+    for (size_t i = 0; i < n; i += NOISE_LANES) {
+        float* dest = i + NOISE_LANES <= n ? out + i : tail;
+        for (int j = 0; j < NOISE_LANES; j++) {
+            uint32_t x = lanes[j];
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            lanes[j] = x;
+            dest[j] = (float)(int32_t)x * (1.0f / 2147483648.0f);
+        }
+        if (dest == tail) memcpy(out + i, tail, (n - i) * sizeof(float));
+    }
+    memcpy(noise->lanes, lanes, sizeof(lanes));
+}
+
+static float noiseNext(NOISE_SOURCE* noise) {
+    float value;
+    noiseFill(noise, &value, 1);
+    return value;
+}
+
+static int payloadDone(const PAYLOAD_READER* reader) {
+    return reader->source.remaining == 0 && reader->bit == 8;
+}
+
+// Put the next payload bits into the LSB slots of a block that was just synthesized
+static void embedBlock(PAYLOAD_READER* reader, uint8_t* data, uint32_t stride, size_t numSlots) {
+    for (size_t slot = 0; slot < numSlots; slot++) {
+        if (reader->bit == 8) {
+            int c = streamPayloadNext(&reader->source);
+            if (c < 0) return;
+            reader->current = (uint8_t)c;
+            reader->bit = 0;
+        }
+        uint8_t* p = data + slot * stride;
+        *p = (*p & 0xFE) | ((reader->current >> reader->bit) & 1);
+        reader->bit++;
+    }
+}
+
+// Size the payload against the carrier about to be generated, one bit per slot
+static int openPayload(PAYLOAD_READER* reader, uint64_t numSlots) {
+    return streamPayloadOpen(&reader->source, reader->file, numSlots / 8);
+}
+
+static inline float clampUnit(float x) {
+    return x > 1.0f ? 1.0f : (x < -1.0f ? -1.0f : x);
+}
+
+// Float samples in [-1, 1] to little-endian PCM
+static void quantizeSamples(const float* in, uint8_t* out, size_t n, uint32_t bytesPerSample) {
+    switch (bytesPerSample) {
+    case 1:
+        // 8-bit WAV is unsigned
+        for (size_t i = 0; i < n; i++) {
+            out[i] = (uint8_t)(int32_t)(128.0f + clampUnit(in[i]) * 127.0f);
+        }
+        break;
+    case 2:
+        for (size_t i = 0; i < n; i++) {
+            int16_t v = (int16_t)(clampUnit(in[i]) * 32767.0f);
+            out[i * 2] = (uint8_t)v;
+            out[i * 2 + 1] = (uint8_t)(v >> 8);
+        }
+        break;
+    default:
+        for (size_t i = 0; i < n; i++) {
+            // largest float below 2^31, so full scale doesn't overflow
+            int32_t v = (int32_t)(clampUnit(in[i]) * 2147483520.0f);
+            out[i * 4] = (uint8_t)v;
+            out[i * 4 + 1] = (uint8_t)(v >> 8);
+            out[i * 4 + 2] = (uint8_t)(v >> 16);
+            out[i * 4 + 3] = (uint8_t)(v >> 24);
+        }
+        break;
+    }
+}
+
+typedef struct Tone {
+    double sine, cosine;             // phasor at the start of the current block
+    double blockSine, blockCosine;   // rotation over one full block
+    float amplitude;
+    float* sinTable;                 // sin/cos of w * i for i in one block
+    float* cosTable;
+} TONE;
+
+static int generateWAV(const GENERATE_OPTIONS* options, PAYLOAD_READER* reader, FILE* output) {
+    uint32_t bytesPerSample = options->bitsPerSample / 8;
+    uint32_t channels = options->channels;
+    uint64_t numFrames = (uint64_t)options->seconds * options->sampleRate;
+    uint64_t dataSize = numFrames * channels * bytesPerSample;
+    if (reader != NULL && !openPayload(reader, numFrames * channels)) return -1;
+
+    // header only: the samples never live in a WAV_FILE
+    WAV_FILE wav;
+    memset(&wav, 0, sizeof(WAV_FILE));
+    initRiffChunk(&wav.RIFF, dataSize);
+    initFmtChunk(&wav.FMT, (uint16_t)channels, options->sampleRate, options->bitsPerSample);
+    initDs64Chunk(&wav.DS64, dataSize, wav.FMT.BlockAlign);
+    wav.DATA.Subchunk2ID = 0x61746164; // "data" in big-endian form
+    wav.DATA.dataSize = dataSize;
+    wav.isRF64 = dataSize > RIFF_MAX_DATA_SIZE;
+    if (!writeHeader_WAV(output, &wav)) {
+        fprintf(stderr, "ERROR: Failed writing WAV header!\n");
+        return -1;
+    }
+
+    size_t blockSlots = (size_t)GENERATE_BLOCK_FRAMES * channels;
+    float* mono = (float*)malloc(GENERATE_BLOCK_FRAMES * sizeof(float));
+    float* white = (float*)malloc(blockSlots * sizeof(float));
+    float* mix = (float*)malloc(blockSlots * sizeof(float));
+    float* tables = (float*)malloc((size_t)GENERATE_TONES * 2 * GENERATE_BLOCK_FRAMES * sizeof(float));
+    uint8_t* bytes = (uint8_t*)malloc(blockSlots * bytesPerSample);
+    float* lowpass = (float*)calloc(channels, sizeof(float));
+    int result = 0;
+    if (mono == NULL || white == NULL || mix == NULL || tables == NULL || bytes == NULL || lowpass == NULL) {
+        fprintf(stderr, "Could not allocate generator buffers!\n");
+        result = -1;
+    }
+
+    NOISE_SOURCE noise;
+    noiseSeed(&noise, options->seed);
+    TONE tones[GENERATE_TONES];
+    for (int k = 0; result == 0 && k < GENERATE_TONES; k++) {
+        // 110-880 Hz, random phase, amplitudes summing to at most 0.6
+        double frequency = 110.0 * pow(2.0, 1.5 * (noiseNext(&noise) + 1.0));
+        double w = 2.0 * GENERATE_PI * frequency / options->sampleRate;
+        double phase = GENERATE_PI * noiseNext(&noise);
+        tones[k].sine = sin(phase);
+        tones[k].cosine = cos(phase);
+        tones[k].blockSine = sin(w * GENERATE_BLOCK_FRAMES);
+        tones[k].blockCosine = cos(w * GENERATE_BLOCK_FRAMES);
+        tones[k].amplitude = (0.6f / GENERATE_TONES) * (0.75f + 0.25f * noiseNext(&noise));
+        tones[k].sinTable = tables + (size_t)k * 2 * GENERATE_BLOCK_FRAMES;
+        tones[k].cosTable = tones[k].sinTable + GENERATE_BLOCK_FRAMES;
+        for (int i = 0; i < GENERATE_BLOCK_FRAMES; i++) {
+            tones[k].sinTable[i] = (float)sin(w * i);
+            tones[k].cosTable[i] = (float)cos(w * i);
+        }
+    }
+
+    for (uint64_t frame = 0; result == 0 && frame < numFrames; frame += GENERATE_BLOCK_FRAMES) {
+        size_t frames = numFrames - frame < GENERATE_BLOCK_FRAMES ? (size_t)(numFrames - frame) : GENERATE_BLOCK_FRAMES;
+        size_t slots = frames * channels;
+        noiseFill(&noise, white, slots);
+        if (options->pattern == PATTERN_TONES) {
+            memset(mono, 0, frames * sizeof(float));
+            for (int k = 0; k < GENERATE_TONES; k++) {
+                // sin(phase + w*i) from the block's starting phasor and the per-block tables
+                TONE* tone = &tones[k];
+                float s = (float)tone->sine * tone->amplitude;
+                float c = (float)tone->cosine * tone->amplitude;
+                for (size_t i = 0; i < frames; i++) {
+                    mono[i] += s * tone->cosTable[i] + c * tone->sinTable[i];
+                }
+                double sine = tone->sine * tone->blockCosine + tone->cosine * tone->blockSine;
+                double cosine = tone->cosine * tone->blockCosine - tone->sine * tone->blockSine;
+                double norm = 1.0 / sqrt(sine * sine + cosine * cosine);
+                tone->sine = sine * norm;
+                tone->cosine = cosine * norm;
+            }
+            // a little independent noise per channel so the low bits aren't a clean function of the tones
+            for (size_t i = 0; i < frames; i++) {
+                for (uint32_t ch = 0; ch < channels; ch++) {
+                    mix[i * channels + ch] = mono[i] + 0.01f * white[i * channels + ch];
+                }
+            }
+        }
+        else {
+            // one-pole low-pass per channel gives a darker, more natural noise floor
+            for (size_t i = 0; i < frames; i++) {
+                for (uint32_t ch = 0; ch < channels; ch++) {
+                    float x = white[i * channels + ch];
+                    lowpass[ch] += 0.05f * (x - lowpass[ch]);
+                    mix[i * channels + ch] = 3.0f * lowpass[ch] + 0.02f * x;
+                }
+            }
+        }
+        quantizeSamples(mix, bytes, slots, bytesPerSample);
+        if (reader != NULL) embedBlock(reader, bytes, bytesPerSample, slots);
+        if (fwrite(bytes, bytesPerSample, slots, output) != slots) {
+            fprintf(stderr, "ERROR: Failed writing WAV data!\n");
+            result = -1;
+        }
+    }
+    free(mono);
+    free(white);
+    free(mix);
+    free(tables);
+    free(bytes);
+    free(lowpass);
+    return result;
+}
+
+static int generateBMP(const GENERATE_OPTIONS* options, PAYLOAD_READER* reader, FILE* output) {
+    // whole 4-pixel groups keep 24-bit rows padding-free, which is what the rest of steg reads and writes
+    uint32_t width = (options->width + 3) & ~3u;
+    uint32_t height = options->height;
+    size_t rowBytes = (size_t)width * 3;
+    if (reader != NULL && !openPayload(reader, (uint64_t)rowBytes * height)) return -1;
+
+    BMP_FILE bmp;
+    initBmpInfoHeader(&bmp, width, height, 24);
+    bmp.info_header.colorsUsed = 0; // no palette
+    initBmpFileHeader(&bmp);
+    if (fwrite(&bmp.file_header, sizeof(BMP_FILE_HEADER), 1, output) != 1
+        || fwrite(&bmp.info_header, sizeof(BMP_INFO_HEADER), 1, output) != 1) {
+        fprintf(stderr, "ERROR: Failed writing BMP header!\n");
+        return -1;
+    }
+
+    float* white = (float*)malloc(rowBytes * sizeof(float));
+    float* xPart = (float*)malloc(rowBytes * sizeof(float));
+    float* yPart = (float*)malloc(rowBytes * sizeof(float));
+    float* field = (float*)calloc(rowBytes * 2, sizeof(float));
+    uint8_t* row = (uint8_t*)malloc(rowBytes);
+    if (white == NULL || xPart == NULL || yPart == NULL || field == NULL || row == NULL) {
+        fprintf(stderr, "Could not allocate generator buffers!\n");
+        free(white);
+        free(xPart);
+        free(yPart);
+        free(field);
+        free(row);
+        return -1;
+    }
+
+    NOISE_SOURCE noise;
+    noiseSeed(&noise, options->seed);
+    // per channel (B, G, R): value = base + dx * x/width + dy * y/height
+    float base[3], dx[3], dy[3];
+    for (int c = 0; c < 3; c++) {
+        base[c] = 128.0f + 96.0f * noiseNext(&noise);
+        dx[c] = 160.0f * noiseNext(&noise);
+        dy[c] = 160.0f * noiseNext(&noise);
+    }
+    for (uint32_t x = 0; x < width; x++) {
+        for (int c = 0; c < 3; c++) {
+            xPart[x * 3 + c] = base[c] + dx[c] * ((float)x / width - 0.5f);
+            yPart[x * 3 + c] = dy[c];
+        }
+    }
+
+    float* previous = field;
+    float* current = field + rowBytes;
+    int result = 0;
+    for (uint32_t y = 0; result == 0 && y < height; y++) {
+        float fy = (float)y / height - 0.5f;
+        noiseFill(&noise, white, rowBytes);
+        if (options->pattern == PATTERN_TEXTURE) {
+            // each row is a smoothed copy of the last one plus fresh noise: blobs that run both ways
+            for (size_t i = 3; i + 3 < rowBytes; i++) {
+                current[i] = 0.5f * previous[i] + 0.24f * (previous[i - 3] + previous[i + 3]) + 0.6f * white[i];
+            }
+            for (size_t i = 0; i < 3 && i < rowBytes; i++) {
+                current[i] = 0.74f * previous[i] + 0.6f * white[i];
+                current[rowBytes - 1 - i] = 0.74f * previous[rowBytes - 1 - i] + 0.6f * white[rowBytes - 1 - i];
+            }
+            for (size_t i = 0; i < rowBytes; i++) {
+                float v = xPart[i] + yPart[i] * fy + 6.0f * current[i];
+                v = v < 0.0f ? 0.0f : (v > 255.0f ? 255.0f : v);
+                row[i] = (uint8_t)(int32_t)v;
+            }
+            float* swap = previous;
+            previous = current;
+            current = swap;
+        }
+        else {
+            for (size_t i = 0; i < rowBytes; i++) {
+                // dither keeps the low bits from being a clean ramp
+                float v = xPart[i] + yPart[i] * fy + 2.0f * white[i];
+                v = v < 0.0f ? 0.0f : (v > 255.0f ? 255.0f : v);
+                row[i] = (uint8_t)(int32_t)v;
+            }
+        }
+        if (reader != NULL) embedBlock(reader, row, 1, rowBytes);
+        if (fwrite(row, 1, rowBytes, output) != rowBytes) {
+            fprintf(stderr, "ERROR: Failed writing BMP data!\n");
+            result = -1;
+        }
+    }
+    free(white);
+    free(xPart);
+    free(yPart);
+    free(field);
+    free(row);
+    return result;
+}
+
+int generate_Carrier(const GENERATE_OPTIONS* options, FILE* payload, FILE* output) {
+    PAYLOAD_READER* reader = NULL;
+    if (payload != NULL) {
+        reader = (PAYLOAD_READER*)calloc(1, sizeof(PAYLOAD_READER));
+        if (reader == NULL) {
+            fprintf(stderr, "Could not allocate payload buffer!\n");
+            return -1;
+        }
+        reader->file = payload;
+        reader->bit = 8;
+    }
+    int result;
+    if (options->type == TYPE_WAV) {
+        result = generateWAV(options, reader, output);
+    }
+    else {
+        result = generateBMP(options, reader, output);
+    }
+    if (result == 0 && reader != NULL && !payloadDone(reader)) {
+        // the payload was sized against the carrier up front, so this is only a safety net
+        fprintf(stderr, "ERROR: Generated carrier ended before the payload did!\n");
+        result = -1;
+    }
+    if (reader != NULL) streamPayloadClose(&reader->source);
+    free(reader);
+    return result;
+}
+
+static void printGenerateUsage() {
+    printf("Usage: ./steg.exe generate -t FILETYPE -o OUTPUT [-e INPUT] [-p PATTERN] [-S SEED]\n");
+    printf("                           [-s SECONDS] [-c CHANNELS] [-r RATE] [-b BITS] [-g WIDTHxHEIGHT]\n");
+    printf("\n\t-t FILETYPE\tFile type (wav, bmp)\n");
+    printf("\t-o OUTPUT\tGenerated carrier (- for stdout)\n");
+    printf("\t-e INPUT\tPayload to embed while generating (- for stdin)\n");
+    printf("\t-p PATTERN\twav: tones (default), noise | bmp: gradient (default), texture\n");
+    printf("\t-S SEED\t\tRandom seed (default: current time)\n");
+    printf("\t-s SECONDS\tWAV length\n");
+    printf("\t-c CHANNELS\tWAV channels\n");
+    printf("\t-r RATE\t\tWAV sample rate\n");
+    printf("\t-b BITS\t\tWAV bits per sample (8, 16, 32)\n");
+    printf("\t-g WIDTHxHEIGHT\tBMP size (width rounds up to a multiple of 4)\n");
+}
+
+int runGenerate(int argc, char* argv[], const GENERATE_OPTIONS* defaults) {
+    GENERATE_OPTIONS options = *defaults;
+    const char* inpath = NULL;
+    const char* outpath = NULL;
+    int seedGiven = 0;
+    int opt;
+    optind = 1;
+    while ((opt = getopt(argc, argv, "ht:o:e:p:S:s:c:r:b:g:")) != -1) {
+        switch (opt) {
+            case 'h':
+                printGenerateUsage();
+                return 0;
+            case 't':
+                if (strcmp(optarg, "bmp") == 0) options.type = TYPE_BMP;
+                else if (strcmp(optarg, "wav") == 0) options.type = TYPE_WAV;
+                else options.type = -1;
+                break;
+            case 'o':
+                outpath = optarg;
+                break;
+            case 'e':
+                inpath = optarg;
+                break;
+            case 'p':
+                if (strcmp(optarg, "tones") == 0) options.pattern = PATTERN_TONES;
+                else if (strcmp(optarg, "noise") == 0) options.pattern = PATTERN_NOISE;
+                else if (strcmp(optarg, "gradient") == 0) options.pattern = PATTERN_GRADIENT;
+                else if (strcmp(optarg, "texture") == 0) options.pattern = PATTERN_TEXTURE;
+                else {
+                    printf("Error: unknown pattern %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'S':
+                options.seed = (uint32_t)strtoul(optarg, NULL, 10);
+                seedGiven = 1;
+                break;
+            case 's':
+                options.seconds = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'c':
+                options.channels = (uint16_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                options.sampleRate = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'b':
+                options.bitsPerSample = (uint16_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'g':
+                if (sscanf(optarg, "%ux%u", &options.width, &options.height) != 2) {
+                    printf("Error: size must be WIDTHxHEIGHT\n");
+                    return -1;
+                }
+                break;
+            default:
+                printGenerateUsage();
+                return -1;
+        }
+    }
+    if (options.type == -1 || outpath == NULL) {
+        printGenerateUsage();
+        return -1;
+    }
+    if (options.pattern == -1) {
+        options.pattern = options.type == TYPE_WAV ? PATTERN_TONES : PATTERN_GRADIENT;
+    }
+    int wavPattern = options.pattern == PATTERN_TONES || options.pattern == PATTERN_NOISE;
+    if (wavPattern != (options.type == TYPE_WAV)) {
+        printf("Error: pattern doesn't match the file type\n");
+        return -1;
+    }
+    if (options.type == TYPE_WAV && (options.channels == 0 || options.sampleRate == 0
+        || (options.bitsPerSample != 8 && options.bitsPerSample != 16 && options.bitsPerSample != 32))) {
+        printf("Error: invalid WAV format\n");
+        return -1;
+    }
+    if (options.type == TYPE_BMP && (options.width == 0 || options.height == 0)) {
+        printf("Error: invalid BMP size\n");
+        return -1;
+    }
+    if (!seedGiven) options.seed = (uint32_t)time(NULL);
+
+    FILE* payload = NULL;
+    if (inpath != NULL) {
+        payload = strcmp(inpath, "-") == 0 ? stdin : fopen(inpath, "rb");
+        if (payload == NULL) {
+            printf("Error: Failed to open payload file\n");
+            return -1;
+        }
+    }
+    int toStdout = strcmp(outpath, "-") == 0;
+    FILE* output = toStdout ? stdout : fopen(outpath, "wb");
+    if (output == NULL) {
+        printf("Error: Failed to open %s\n", outpath);
+        if (payload != NULL && payload != stdin) fclose(payload);
+        return -1;
+    }
+#ifdef _WIN32
+    if (toStdout) _setmode(_fileno(stdout), _O_BINARY);
+    if (payload == stdin) _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    int result = generate_Carrier(&options, payload, output);
+    if (payload != NULL && payload != stdin) fclose(payload);
+    if (toStdout) fflush(stdout);
+    else fclose(output);
+    if (result == 0) {
+        // the carrier may be on stdout
+        fprintf(toStdout ? stderr : stdout, "|| Generated %s (seed %u)%s\n", outpath, options.seed,
+            payload != NULL ? " with embedded payload" : "");
+    }
+    return result;
+}
@@ -0,0 +1,41 @@
+//
+// Synthetic carriers: WAV/BMP generated block by block, with the payload embedded as each block is produced.
+//
+#ifndef STEG_GENERATE_H
+#define STEG_GENERATE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "carrier.h"
+
+// Audio frames (or one image row) synthesized per step
+#define GENERATE_BLOCK_FRAMES 4096
+// Sine components in the tone mixture
+#define GENERATE_TONES 4
+
+enum GeneratePatterns {
+    PATTERN_TONES,    // WAV: mixture of sine tones over a little noise
+    PATTERN_NOISE,    // WAV: low-passed (shaped) noise
+    PATTERN_GRADIENT, // BMP: colour gradient with dither
+    PATTERN_TEXTURE   // BMP: smoothed noise texture
+};
+
+typedef struct GenerateOptions {
+    int type;               // TYPE_WAV or TYPE_BMP
+    int pattern;            // -1 picks the default for the type
+    uint32_t seconds;       // WAV length
+    uint16_t channels;
+    uint32_t sampleRate;
+    uint16_t bitsPerSample; // 8, 16 or 32
+    uint32_t width;         // BMP size in pixels (24-bit)
+    uint32_t height;
+    uint32_t seed;
+} GENERATE_OPTIONS;
+
+// Write a synthesized carrier to output. If payload is non-NULL it is embedded (sequential layout, NUL terminated)
+// while the carrier is produced, so the carrier is never held in memory or read back.
+int generate_Carrier(const GENERATE_OPTIONS* options, FILE* payload, FILE* output);
+
+// "generate" subcommand; defaults supplies the audio format used when no option overrides it
+int runGenerate(int argc, char* argv[], const GENERATE_OPTIONS* defaults);
+#endif //STEG_GENERATE_H
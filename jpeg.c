@@ -0,0 +1,753 @@
+#include "jpeg.h"
+#include "carrier.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Payload stream layout: magic | 32-bit length | payload, one bit per usable AC coefficient in file order
+#define JPEG_MAGIC "JPGS"
+#define JPEG_PREFIX_SIZE 8
+// Coefficients at least this large keep their Huffman category (and stay non-zero) when the LSB changes
+#define JPEG_MIN_MAGNITUDE 2
+// Blocks in one interleaved MCU, as limited by the standard
+#define JPEG_MAX_MCU_BLOCKS 10
+
+#define MARKER_SOF0 0xC0
+#define MARKER_SOF1 0xC1
+#define MARKER_DHT 0xC4
+#define MARKER_RST0 0xD0
+#define MARKER_SOI 0xD8
+#define MARKER_EOI 0xD9
+#define MARKER_SOS 0xDA
+#define MARKER_DRI 0xDD
+#define MARKER_TEM 0x01
+
+typedef struct HuffTable {
+    int defined;
+    uint8_t counts[17];                  // codes of each length
+    uint8_t symbols[256];
+    int32_t maxCode[17];                 // largest code of each length, -1 if there are none
+    int32_t offset[17];                  // symbol index = code + offset[length]
+    uint16_t fast[1 << JPEG_FAST_BITS];  // (length << 8) | symbol for short codes, 0 for longer ones
+    int32_t fastAc[1 << JPEG_FAST_BITS]; // (value << 8) | (run << 4) | bits for AC code + extra bits that fit, else 0
+    uint16_t code[256];                  // encoder side: code and length of each symbol (length 0 = no code)
+    uint8_t size[256];
+} HUFF_TABLE;
+
+typedef struct JpegComponent {
+    int id;
+    int h;
+    int v;
+    int dcTable;
+    int acTable;
+    uint32_t blocksWide; // blocks covering the component, as walked by a non-interleaved scan
+    uint32_t blocksHigh;
+} JPEG_COMPONENT;
+
+// A block as it comes out of the entropy decoder: the DC difference (never changed) and the non-zero
+// AC coefficients with their zigzag positions, so the embedder and encoder never walk the zeros
+typedef struct SparseBlock {
+    int32_t dc;
+    int count;
+    uint8_t position[63];
+    int16_t value[63];
+} SPARSE_BLOCK;
+
+typedef struct JpegCodec {
+    int encoding;
+    FILE* in;
+    uint8_t* inBuffer;
+    size_t inPos;
+    size_t inLength;
+    FILE* out;
+    uint8_t* outBuffer;
+    size_t outLength;
+    int writeFailed;
+    // entropy decoder: bits are left-aligned in the accumulator
+    uint64_t bits;
+    int bitCount;
+    int marker;       // marker that ended the entropy data (-1 at end of file), 0 while there is more
+    // entropy encoder: the low outCount bits are pending
+    uint64_t outBits;
+    int outCount;
+    HUFF_TABLE dc[4];
+    HUFF_TABLE ac[4];
+    int frameSeen;
+    uint32_t width;
+    uint32_t height;
+    int numComponents;
+    JPEG_COMPONENT components[JPEG_MAX_COMPONENTS];
+    int hMax;
+    int vMax;
+    uint32_t restartInterval;
+    // payload stream (prefix + payload) and the next bit of it
+    uint8_t prefix[JPEG_PREFIX_SIZE];
+    uint8_t* stream;
+    uint64_t streamBits;
+    uint64_t bitIndex;
+    uint64_t payloadLength;
+    int done;         // every payload bit has been embedded / extracted
+    int finished;     // nothing left to parse
+    int pendingMarker;
+    uint8_t segment[65536];
+} JPEG_CODEC;
+
+static int refill(JPEG_CODEC* c) {
+    c->inLength = fread(c->inBuffer, 1, JPEG_IO_BUFFER, c->in);
+    c->inPos = 0;
+    return c->inLength > 0;
+}
+
+static inline int readByte(JPEG_CODEC* c) {
+    if (c->inPos == c->inLength && !refill(c)) return -1;
+    return c->inBuffer[c->inPos++];
+}
+
+static int flushOutput(JPEG_CODEC* c) {
+    if (c->outLength > 0 && fwrite(c->outBuffer, 1, c->outLength, c->out) != c->outLength) c->writeFailed = 1;
+    c->outLength = 0;
+    return c->writeFailed ? -1 : 0;
+}
+
+static inline void writeByte(JPEG_CODEC* c, uint8_t byte) {
+    if (c->outLength == JPEG_IO_BUFFER) flushOutput(c);
+    c->outBuffer[c->outLength++] = byte;
+}
+
+static void writeMarker(JPEG_CODEC* c, int marker) {
+    if (!c->encoding) return;
+    writeByte(c, 0xFF);
+    writeByte(c, (uint8_t)marker);
+}
+
+// Skip to the next marker, returning its code (-1 at end of file)
+static int nextMarker(JPEG_CODEC* c) {
+    int b = readByte(c);
+    while (b >= 0) {
+        if (b != 0xFF) {
+            b = readByte(c);
+            continue;
+        }
+        while (b == 0xFF) b = readByte(c);
+        // FF00 is a stuffed byte inside entropy data, not a marker
+        if (b > 0) return b;
+        if (b == 0) b = readByte(c);
+    }
+    return -1;
+}
+
+// Copy everything from the current input position to the output untouched
+static int copyRemainder(JPEG_CODEC* c) {
+    if (flushOutput(c) < 0) return -1;
+    do {
+        size_t length = c->inLength - c->inPos;
+        if (length > 0 && fwrite(c->inBuffer + c->inPos, 1, length, c->out) != length) return -1;
+        c->inPos = c->inLength;
+    } while (refill(c));
+    return ferror(c->in) ? -1 : 0;
+}
+
+// Read a length-prefixed segment into c->segment (copying it to the output). Returns its body length, -1 on error.
+static long readSegment(JPEG_CODEC* c, int marker) {
+    int hi = readByte(c);
+    int lo = readByte(c);
+    if (hi < 0 || lo < 0 || ((hi << 8) | lo) < 2) return -1;
+    long length = ((hi << 8) | lo) - 2;
+    for (long i = 0; i < length; i++) {
+        int b = readByte(c);
+        if (b < 0) return -1;
+        c->segment[i] = (uint8_t)b;
+    }
+    if (c->encoding) {
+        writeMarker(c, marker);
+        writeByte(c, (uint8_t)hi);
+        writeByte(c, (uint8_t)lo);
+        for (long i = 0; i < length; i++) writeByte(c, c->segment[i]);
+    }
+    return length;
+}
+
+// Canonical codes from the length counts (JPEG Annex C), for both directions
+static int buildHuffTable(HUFF_TABLE* table) {
+    uint32_t code = 0;
+    int k = 0;
+    memset(table->fast, 0, sizeof(table->fast));
+    memset(table->size, 0, sizeof(table->size));
+    for (int length = 1; length <= 16; length++) {
+        table->offset[length] = k - (int32_t)code;
+        for (int i = 0; i < table->counts[length]; i++, k++, code++) {
+            uint8_t symbol = table->symbols[k];
+            if (code >= (1u << length)) return 0;
+            table->code[symbol] = (uint16_t)code;
+            table->size[symbol] = (uint8_t)length;
+            if (length <= JPEG_FAST_BITS) {
+                uint32_t first = code << (JPEG_FAST_BITS - length);
+                uint32_t count = 1u << (JPEG_FAST_BITS - length);
+                for (uint32_t j = 0; j < count; j++) table->fast[first + j] = (uint16_t)((length << 8) | symbol);
+            }
+        }
+        table->maxCode[length] = table->counts[length] ? (int32_t)code - 1 : -1;
+        code <<= 1;
+    }
+    // AC coefficients whose code and extra bits fit in the lookup are decoded whole
+    for (uint32_t i = 0; i < (1u << JPEG_FAST_BITS); i++) {
+        int length = table->fast[i] >> 8;
+        int run = (table->fast[i] >> 4) & 15;
+        int size = table->fast[i] & 15;
+        table->fastAc[i] = 0;
+        if (length == 0 || size == 0 || length + size > JPEG_FAST_BITS) continue;
+        uint32_t extra = (i >> (JPEG_FAST_BITS - length - size)) & ((1u << size) - 1);
+        int32_t value = extra < (1u << (size - 1)) ? (int32_t)extra - (1 << size) + 1 : (int32_t)extra;
+        table->fastAc[i] = value * 256 + run * 16 + length + size;
+    }
+    table->defined = 1;
+    return 1;
+}
+
+static int parseHuffman(JPEG_CODEC* c, long length) {
+    long p = 0;
+    while (p < length) {
+        int tableClass = c->segment[p] >> 4;
+        int id = c->segment[p] & 15;
+        if (tableClass > 1 || id > 3 || p + 17 > length) return 0;
+        HUFF_TABLE* table = tableClass == 0 ? &c->dc[id] : &c->ac[id];
+        int total = 0;
+        table->counts[0] = 0;
+        for (int i = 1; i <= 16; i++) {
+            table->counts[i] = c->segment[p + i];
+            total += table->counts[i];
+        }
+        p += 17;
+        if (total > 256 || p + total > length) return 0;
+        memcpy(table->symbols, c->segment + p, total);
+        p += total;
+        if (!buildHuffTable(table)) return 0;
+    }
+    return 1;
+}
+
+static int parseFrame(JPEG_CODEC* c, long length) {
+    const uint8_t* s = c->segment;
+    if (c->frameSeen || length < 6) return 0;
+    int precision = s[0];
+    c->height = (uint32_t)((s[1] << 8) | s[2]);
+    c->width = (uint32_t)((s[3] << 8) | s[4]);
+    c->numComponents = s[5];
+    if ((precision != 8 && precision != 12) || c->width == 0 || c->numComponents < 1
+        || c->numComponents > JPEG_MAX_COMPONENTS || length != 6 + 3 * c->numComponents) return 0;
+    if (c->height == 0) {
+        fprintf(stderr, "Error: JPEGs with a DNL marker aren't supported\n");
+        return 0;
+    }
+    c->hMax = c->vMax = 1;
+    for (int i = 0; i < c->numComponents; i++) {
+        JPEG_COMPONENT* comp = &c->components[i];
+        comp->id = s[6 + 3 * i];
+        comp->h = s[7 + 3 * i] >> 4;
+        comp->v = s[7 + 3 * i] & 15;
+        if (comp->h < 1 || comp->h > 4 || comp->v < 1 || comp->v > 4) return 0;
+        if (comp->h > c->hMax) c->hMax = comp->h;
+        if (comp->v > c->vMax) c->vMax = comp->v;
+    }
+    for (int i = 0; i < c->numComponents; i++) {
+        JPEG_COMPONENT* comp = &c->components[i];
+        uint32_t samplesWide = (c->width * comp->h + c->hMax - 1) / c->hMax;
+        uint32_t samplesHigh = (c->height * comp->v + c->vMax - 1) / c->vMax;
+        comp->blocksWide = (samplesWide + 7) / 8;
+        comp->blocksHigh = (samplesHigh + 7) / 8;
+    }
+    c->frameSeen = 1;
+    return 1;
+}
+
+// Called when the last bit of the stream has been handled. Returns 1 once the whole payload is done,
+// 0 if the decoder has only finished the prefix, -1 on error.
+static int streamEnded(JPEG_CODEC* c) {
+    if (!c->encoding && c->stream == c->prefix) {
+        // prefix complete: check it and start on the payload itself
+        if (memcmp(c->prefix, JPEG_MAGIC, 4) != 0) {
+            fprintf(stderr, "Error: No JPEG payload found in carrier\n");
+            return -1;
+        }
+        c->payloadLength = (uint64_t)c->prefix[4] | ((uint64_t)c->prefix[5] << 8)
+            | ((uint64_t)c->prefix[6] << 16) | ((uint64_t)c->prefix[7] << 24);
+        if (c->payloadLength > 0) {
+            c->stream = calloc(c->payloadLength, 1);
+            if (c->stream == NULL) {
+                fprintf(stderr, "Error: Out of memory\n");
+                return -1;
+            }
+            c->streamBits = c->payloadLength * 8;
+            c->bitIndex = 0;
+            return 0;
+        }
+    }
+    c->done = 1;
+    return 1;
+}
+
+// Embed into (or extract from) the usable AC coefficients of one block, in zigzag order.
+// Returns 1 when the payload is complete, -1 on error.
+static int embedBlock(JPEG_CODEC* c, SPARSE_BLOCK* block) {
+    for (int i = 0; i < block->count; i++) {
+        int32_t value = block->value[i];
+        uint32_t magnitude = (uint32_t)(value < 0 ? -value : value);
+        if (magnitude < JPEG_MIN_MAGNITUDE) continue;
+        uint64_t bit = c->bitIndex++;
+        if (c->encoding) {
+            magnitude = (magnitude & ~1u) | ((c->stream[bit >> 3] >> (bit & 7)) & 1);
+            block->value[i] = (int16_t)(value < 0 ? -(int32_t)magnitude : (int32_t)magnitude);
+        }
+        else {
+            c->stream[bit >> 3] |= (uint8_t)((magnitude & 1) << (bit & 7));
+        }
+        if (c->bitIndex == c->streamBits) {
+            int state = streamEnded(c);
+            if (state != 0) return state;
+        }
+    }
+    return 0;
+}
+
+static void fillBits(JPEG_CODEC* c) {
+    // fast path: plain bytes straight from the buffer until an FF needs a closer look
+    if (c->marker == 0) {
+        const uint8_t* buffer = c->inBuffer;
+        size_t pos = c->inPos;
+        while (c->bitCount <= 56 && pos < c->inLength && buffer[pos] != 0xFF) {
+            c->bits |= (uint64_t)buffer[pos++] << (56 - c->bitCount);
+            c->bitCount += 8;
+        }
+        c->inPos = pos;
+    }
+    while (c->bitCount <= 56) {
+        int byte = 0;
+        if (c->marker == 0) {
+            byte = readByte(c);
+            if (byte == 0xFF) {
+                int next = readByte(c);
+                while (next == 0xFF) next = readByte(c);
+                if (next != 0) {
+                    // a marker: the entropy data is over, feed zeros from here on
+                    c->marker = next;
+                    byte = 0;
+                }
+            }
+            else if (byte < 0) {
+                c->marker = -1;
+                byte = 0;
+            }
+        }
+        c->bits |= (uint64_t)byte << (56 - c->bitCount);
+        c->bitCount += 8;
+    }
+}
+
+static inline void dropBits(JPEG_CODEC* c, int count) {
+    c->bits <<= count;
+    c->bitCount -= count;
+}
+
+static inline int decodeSymbol(JPEG_CODEC* c, const HUFF_TABLE* table) {
+    if (c->bitCount < 16) fillBits(c);
+    uint16_t entry = table->fast[c->bits >> (64 - JPEG_FAST_BITS)];
+    if (entry != 0) {
+        dropBits(c, entry >> 8);
+        return entry & 0xFF;
+    }
+    for (int length = JPEG_FAST_BITS + 1; length <= 16; length++) {
+        int32_t code = (int32_t)(c->bits >> (64 - length));
+        if (code <= table->maxCode[length]) {
+            dropBits(c, length);
+            return table->symbols[code + table->offset[length]];
+        }
+    }
+    return -1;
+}
+
+// Read size bits and sign-extend them (JPEG F.2.2.1)
+static inline int32_t receiveExtend(JPEG_CODEC* c, int size) {
+    if (size == 0) return 0;
+    if (c->bitCount < size) fillBits(c);
+    uint32_t value = (uint32_t)(c->bits >> (64 - size));
+    dropBits(c, size);
+    return value < (1u << (size - 1)) ? (int32_t)value - (1 << size) + 1 : (int32_t)value;
+}
+
+static int decodeBlock(JPEG_CODEC* c, const JPEG_COMPONENT* comp, SPARSE_BLOCK* block) {
+    int size = decodeSymbol(c, &c->dc[comp->dcTable]);
+    if (size < 0 || size > 15) return -1;
+    block->dc = receiveExtend(c, size);
+    block->count = 0;
+    const HUFF_TABLE* ac = &c->ac[comp->acTable];
+    for (int k = 1; k < 64; k++) {
+        if (c->bitCount < 16) fillBits(c);
+        int32_t fast = ac->fastAc[c->bits >> (64 - JPEG_FAST_BITS)];
+        if (fast != 0) {
+            k += (fast >> 4) & 15;
+            if (k > 63) return -1;
+            dropBits(c, fast & 15);
+            block->position[block->count] = (uint8_t)k;
+            block->value[block->count++] = (int16_t)(fast >> 8);
+            continue;
+        }
+        int symbol = decodeSymbol(c, ac);
+        if (symbol < 0) return -1;
+        int run = symbol >> 4;
+        size = symbol & 15;
+        if (size == 0) {
+            if (run != 15) break; // EOB
+            k += 15;              // ZRL
+            continue;
+        }
+        k += run;
+        if (k > 63) return -1;
+        block->position[block->count] = (uint8_t)k;
+        block->value[block->count++] = (int16_t)receiveExtend(c, size);
+    }
+    return 0;
+}
+
+static inline void putBits(JPEG_CODEC* c, uint32_t value, int length) {
+    c->outBits = (c->outBits << length) | value;
+    c->outCount += length;
+    if (c->outCount < 32) return;
+    uint32_t word = (uint32_t)(c->outBits >> (c->outCount - 32));
+    uint32_t inverted = ~word;
+    // four bytes at once unless one of them is FF and needs stuffing
+    if ((((inverted - 0x01010101u) & ~inverted & 0x80808080u) == 0) && c->outLength + 4 <= JPEG_IO_BUFFER) {
+        uint8_t* out = c->outBuffer + c->outLength;
+        out[0] = (uint8_t)(word >> 24);
+        out[1] = (uint8_t)(word >> 16);
+        out[2] = (uint8_t)(word >> 8);
+        out[3] = (uint8_t)word;
+        c->outLength += 4;
+        c->outCount -= 32;
+        return;
+    }
+    while (c->outCount >= 8) {
+        c->outCount -= 8;
+        uint8_t byte = (uint8_t)(c->outBits >> c->outCount);
+        writeByte(c, byte);
+        if (byte == 0xFF) writeByte(c, 0);
+    }
+}
+
+// Pad the last byte with 1 bits and write out everything pending (before a marker)
+static void flushBits(JPEG_CODEC* c) {
+    int pad = (8 - (c->outCount & 7)) & 7;
+    c->outBits = (c->outBits << pad) | ((1u << pad) - 1);
+    c->outCount += pad;
+    while (c->outCount >= 8) {
+        c->outCount -= 8;
+        uint8_t byte = (uint8_t)(c->outBits >> c->outCount);
+        writeByte(c, byte);
+        if (byte == 0xFF) writeByte(c, 0);
+    }
+}
+
+static inline int bitLength(uint32_t magnitude) {
+#if defined(__GNUC__)
+    return magnitude ? 32 - __builtin_clz(magnitude) : 0;
+#else
+    int length = 0;
+    while (magnitude) {
+        length++;
+        magnitude >>= 1;
+    }
+    return length;
+#endif
+}
+
+// Huffman code followed by the size extra bits of value, as one write
+static inline int putCoefficient(JPEG_CODEC* c, const HUFF_TABLE* table, int symbol, int size, int32_t value) {
+    int codeLength = table->size[symbol];
+    if (codeLength == 0) return -1;
+    uint32_t extra = (uint32_t)(value < 0 ? value - 1 : value) & ((1u << size) - 1);
+    putBits(c, ((uint32_t)table->code[symbol] << size) | extra, codeLength + size);
+    return 0;
+}
+
+static int encodeBlock(JPEG_CODEC* c, const JPEG_COMPONENT* comp, const SPARSE_BLOCK* block) {
+    int32_t value = block->dc;
+    int size = bitLength((uint32_t)(value < 0 ? -value : value));
+    if (putCoefficient(c, &c->dc[comp->dcTable], size, size, value) < 0) return -1;
+    const HUFF_TABLE* ac = &c->ac[comp->acTable];
+    int last = 0;
+    for (int i = 0; i < block->count; i++) {
+        int run = block->position[i] - last - 1;
+        for (; run > 15; run -= 16) {
+            if (putCoefficient(c, ac, 0xF0, 0, 0) < 0) return -1;
+        }
+        value = block->value[i];
+        size = bitLength((uint32_t)(value < 0 ? -value : value));
+        if (putCoefficient(c, ac, (run << 4) | size, size, value) < 0) return -1;
+        last = block->position[i];
+    }
+    if (last < 63 && putCoefficient(c, ac, 0x00, 0, 0) < 0) return -1;
+    return 0;
+}
+
+// Marker ending the current entropy-coded segment, with the bit reader reset for the next one
+static int endOfEntropyData(JPEG_CODEC* c) {
+    int marker = c->marker != 0 ? c->marker : nextMarker(c);
+    c->bits = 0;
+    c->bitCount = 0;
+    c->marker = 0;
+    return marker;
+}
+
+// Decode one scan MCU by MCU, embedding as we go and re-encoding straight to the output
+static int processScan(JPEG_CODEC* c, JPEG_COMPONENT** scan, int count) {
+    const JPEG_COMPONENT* blockComponent[JPEG_MAX_MCU_BLOCKS];
+    int blocksPerMcu = 0;
+    uint64_t mcus;
+    if (count == 1) {
+        // non-interleaved: one block per MCU over the component's own block grid
+        blockComponent[blocksPerMcu++] = scan[0];
+        mcus = (uint64_t)scan[0]->blocksWide * scan[0]->blocksHigh;
+    }
+    else {
+        for (int i = 0; i < count; i++) {
+            if (blocksPerMcu + scan[i]->h * scan[i]->v > JPEG_MAX_MCU_BLOCKS) {
+                fprintf(stderr, "Error: JPEG MCU has too many blocks\n");
+                return -1;
+            }
+            for (int j = 0; j < scan[i]->h * scan[i]->v; j++) blockComponent[blocksPerMcu++] = scan[i];
+        }
+        mcus = (uint64_t)((c->width + 8 * c->hMax - 1) / (8 * c->hMax)) * ((c->height + 8 * c->vMax - 1) / (8 * c->vMax));
+    }
+    SPARSE_BLOCK block;
+    uint32_t restartIndex = 0;
+    for (uint64_t m = 0; m < mcus; m++) {
+        if (c->restartInterval != 0 && m > 0 && m % c->restartInterval == 0) {
+            int marker = endOfEntropyData(c);
+            if (marker < MARKER_RST0 || marker > MARKER_RST0 + 7) {
+                fprintf(stderr, "Error: Expected a JPEG restart marker\n");
+                return -1;
+            }
+            if (c->encoding) {
+                flushBits(c);
+                writeMarker(c, MARKER_RST0 + (restartIndex & 7));
+                if (c->done) {
+                    // the rest of the file is unchanged from here
+                    c->finished = 1;
+                    return copyRemainder(c);
+                }
+            }
+            restartIndex++;
+        }
+        for (int b = 0; b < blocksPerMcu; b++) {
+            if (decodeBlock(c, blockComponent[b], &block) < 0) {
+                fprintf(stderr, "Error: Corrupt JPEG entropy data\n");
+                return -1;
+            }
+            if (!c->done) {
+                int state = embedBlock(c, &block);
+                if (state < 0) return -1;
+                if (state > 0 && !c->encoding) {
+                    c->finished = 1;
+                    return 0;
+                }
+            }
+            if (c->encoding && encodeBlock(c, blockComponent[b], &block) < 0) {
+                fprintf(stderr, "Error: JPEG Huffman table has no code for a coefficient\n");
+                return -1;
+            }
+        }
+    }
+    c->pendingMarker = endOfEntropyData(c);
+    if (c->encoding) flushBits(c);
+    return 0;
+}
+
+static int parseScan(JPEG_CODEC* c, long length) {
+    const uint8_t* s = c->segment;
+    JPEG_COMPONENT* scan[JPEG_MAX_COMPONENTS];
+    int count = length > 0 ? s[0] : 0;
+    if (!c->frameSeen || count < 1 || count > c->numComponents || length != 4 + 2 * count) {
+        fprintf(stderr, "Error: Invalid JPEG scan header\n");
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        scan[i] = NULL;
+        for (int j = 0; j < c->numComponents; j++) {
+            if (c->components[j].id == s[1 + 2 * i]) scan[i] = &c->components[j];
+        }
+        if (scan[i] == NULL) {
+            fprintf(stderr, "Error: JPEG scan refers to an unknown component\n");
+            return -1;
+        }
+        scan[i]->dcTable = s[2 + 2 * i] >> 4;
+        scan[i]->acTable = s[2 + 2 * i] & 15;
+        if (scan[i]->dcTable > 3 || scan[i]->acTable > 3
+            || !c->dc[scan[i]->dcTable].defined || !c->ac[scan[i]->acTable].defined) {
+            fprintf(stderr, "Error: JPEG scan uses an undefined Huffman table\n");
+            return -1;
+        }
+    }
+    if (s[1 + 2 * count] != 0 || s[2 + 2 * count] != 63 || s[3 + 2 * count] != 0) {
+        fprintf(stderr, "Error: Only sequential JPEG scans are supported\n");
+        return -1;
+    }
+    return processScan(c, scan, count);
+}
+
+// Walk the marker segments, copying them through and re-coding each scan
+static int processFile(JPEG_CODEC* c) {
+    if (readByte(c) != 0xFF || readByte(c) != MARKER_SOI) {
+        fprintf(stderr, "Error: Carrier is not a JPEG file\n");
+        return -1;
+    }
+    writeMarker(c, MARKER_SOI);
+    int marker = nextMarker(c);
+    while (!c->finished) {
+        long length = 0;
+        if (marker < 0) {
+            fprintf(stderr, "Error: JPEG ends before its EOI marker\n");
+            return -1;
+        }
+        if (marker == MARKER_EOI) {
+            writeMarker(c, marker);
+            // keep anything trailing the image
+            return c->encoding ? copyRemainder(c) : 0;
+        }
+        if ((marker >= MARKER_RST0 && marker <= MARKER_RST0 + 7) || marker == MARKER_TEM) {
+            writeMarker(c, marker);
+            marker = nextMarker(c);
+            continue;
+        }
+        if ((marker & 0xF0) == 0xC0 && marker != MARKER_SOF0 && marker != MARKER_SOF1 && marker != MARKER_DHT
+            && marker != 0xC8 && marker != 0xCC) {
+            fprintf(stderr, "Error: Only baseline and extended sequential Huffman JPEGs are supported (SOF%d)\n", marker - 0xC0);
+            return -1;
+        }
+        length = readSegment(c, marker);
+        if (length < 0) {
+            fprintf(stderr, "Error: Truncated JPEG segment\n");
+            return -1;
+        }
+        if ((marker == MARKER_SOF0 || marker == MARKER_SOF1) && !parseFrame(c, length)) {
+            fprintf(stderr, "Error: Invalid JPEG frame header\n");
+            return -1;
+        }
+        if (marker == 0xCC) {
+            fprintf(stderr, "Error: Arithmetic-coded JPEGs aren't supported\n");
+            return -1;
+        }
+        if (marker == MARKER_DHT && !parseHuffman(c, length)) {
+            fprintf(stderr, "Error: Invalid JPEG Huffman table\n");
+            return -1;
+        }
+        if (marker == MARKER_DRI) {
+            if (length != 2) {
+                fprintf(stderr, "Error: Invalid JPEG restart interval\n");
+                return -1;
+            }
+            c->restartInterval = (uint32_t)((c->segment[0] << 8) | c->segment[1]);
+        }
+        if (marker == MARKER_SOS) {
+            if (parseScan(c, length) < 0) return -1;
+            marker = c->pendingMarker;
+            if (c->encoding && c->done && !c->finished && marker > 0) {
+                // later scans are unchanged, copy them through rather than re-coding them
+                writeMarker(c, marker);
+                c->finished = 1;
+                return copyRemainder(c);
+            }
+            continue;
+        }
+        marker = nextMarker(c);
+    }
+    return 0;
+}
+
+static JPEG_CODEC* createCodec(FILE* carrier, FILE* output, int encoding) {
+    JPEG_CODEC* c = calloc(1, sizeof(JPEG_CODEC));
+    if (c == NULL) return NULL;
+    c->inBuffer = malloc(JPEG_IO_BUFFER);
+    c->outBuffer = encoding ? malloc(JPEG_IO_BUFFER) : NULL;
+    if (c->inBuffer == NULL || (encoding && c->outBuffer == NULL)) {
+        free(c->inBuffer);
+        free(c->outBuffer);
+        free(c);
+        return NULL;
+    }
+    c->encoding = encoding;
+    c->in = carrier;
+    c->out = output;
+    return c;
+}
+
+static void destroyCodec(JPEG_CODEC* c) {
+    if (c->stream != c->prefix) free(c->stream);
+    free(c->inBuffer);
+    free(c->outBuffer);
+    free(c);
+}
+
+int encode_JPEG(FILE* carrier, FILE* input_file, FILE* output) {
+    uint64_t length;
+    uint8_t* payload = readPayload(input_file, &length);
+    if (payload == NULL) {
+        fprintf(stderr, "Error: Failed to read payload\n");
+        return -1;
+    }
+    if (length > UINT32_MAX) {
+        fprintf(stderr, "Error: Payload too large for a JPEG carrier\n");
+        free(payload);
+        return -1;
+    }
+    JPEG_CODEC* c = createCodec(carrier, output, 1);
+    uint8_t* stream = malloc(JPEG_PREFIX_SIZE + length);
+    if (c == NULL || stream == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        if (c != NULL) destroyCodec(c);
+        free(stream);
+        free(payload);
+        return -1;
+    }
+    memcpy(stream, JPEG_MAGIC, 4);
+    for (int i = 0; i < 4; i++) stream[4 + i] = (uint8_t)(length >> (8 * i));
+    memcpy(stream + JPEG_PREFIX_SIZE, payload, length);
+    free(payload);
+    c->stream = stream;
+    c->streamBits = (JPEG_PREFIX_SIZE + length) * 8;
+    int result = processFile(c);
+    if (result == 0 && !c->done) {
+        fprintf(stderr, "Error: Carrier only has room for %llu of %llu payload bytes\n",
+            (unsigned long long)(c->bitIndex / 8 > JPEG_PREFIX_SIZE ? c->bitIndex / 8 - JPEG_PREFIX_SIZE : 0),
+            (unsigned long long)length);
+        result = -1;
+    }
+    if (flushOutput(c) < 0 || c->writeFailed) {
+        fprintf(stderr, "Error: Failed to write the encoded JPEG\n");
+        result = -1;
+    }
+    if (result == 0) {
+        fprintf(stderr, "|| Payload: %llu bytes in %llu AC coefficients\n", (unsigned long long)length,
+            (unsigned long long)c->streamBits);
+    }
+    destroyCodec(c);
+    return result;
+}
+
+int decode_JPEG(FILE* carrier, FILE* output) {
+    JPEG_CODEC* c = createCodec(carrier, NULL, 0);
+    if (c == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return -1;
+    }
+    c->stream = c->prefix;
+    c->streamBits = JPEG_PREFIX_SIZE * 8;
+    int result = processFile(c);
+    if (result == 0 && !c->done) {
+        fprintf(stderr, "Error: JPEG ends before the payload does\n");
+        result = -1;
+    }
+    if (result == 0 && c->payloadLength > 0 && fwrite(c->stream, 1, c->payloadLength, output) != c->payloadLength) {
+        fprintf(stderr, "Error: Failed to write payload\n");
+        result = -1;
+    }
+    destroyCodec(c);
+    return result;
+}
@@ -0,0 +1,20 @@
+//
+// JPEG carriers: the payload goes into the quantized DCT coefficients, which are entropy-decoded and
+// re-encoded with the file's own Huffman tables one MCU row at a time (no IDCT, no requantization).
+//
+#ifndef STEG_JPEG_H
+#define STEG_JPEG_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define JPEG_MAX_COMPONENTS 4
+// Huffman codes up to this long decode with a single table lookup
+#define JPEG_FAST_BITS 9
+#define JPEG_IO_BUFFER (64 * 1024)
+
+// Embed payload into a baseline or extended sequential Huffman JPEG. Returns 0 on success, -1 on error.
+int encode_JPEG(FILE* carrier, FILE* payload, FILE* output);
+// Extract a payload embedded by encode_JPEG. Returns 0 on success, -1 on error.
+int decode_JPEG(FILE* carrier, FILE* output);
+#endif //STEG_JPEG_H
@@ -6,11 +6,30 @@
 #include <time.h>
 #include "mathutilities.h"
 #include "bmp.h"
-
-enum FileTypes {
-    TYPE_WAV,
-    TYPE_BMP
-};
+#include "carrier.h"
+#include "stream.h"
+#include "scan.h"
+#include "adaptive.h"
+#include "update.h"
+#include "generate.h"
+#include "blockindex.h"
+#include "y4m.h"
+#include "transform.h"
+#include "spread.h"
+#include "metrics.h"
+#include "watch.h"
+#include "jpeg.h"
+#include "fec.h"
+#include "bitplane.h"
+#include "palette.h"
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#define fileno _fileno
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #define PI 3.14159265358979323846
 #define MAX_FILENAME_LENGTH 256
@@ -28,24 +47,492 @@ const uint32_t bitsPerSample = 16;
  * - maybe try diff algorithms
  */
 void printUsage() {
-    printf("Usage: ./steg.exe [-h] -t FILETYPE [-d] [-e TEXT] -f FILENAME\n");
+    printf("Usage: ./steg.exe [-h] -t FILETYPE [-d OUTPUT] [-e INPUT] -f FILENAME [-o OUTPUT] [-a] [-k PASSPHRASE] [-i] [-r OFFSET:LEN]\n");
+    printf("                [-p PLANES] [-j THREADS] [-m METHOD] [-b BITS] [-M FORMAT] [-q MIN_DB] [-F PARITY]\n");
     printf("\n\t-h\t\tShow usage\n");
-    printf("\t-t FILETYPE\tFile type (wav, bmp)\n");
-    printf("\t-d\t\tDecode mode\n");
-    printf("\t-e TEXT\t\tEncode TEXT to file\n");
+    printf("\t-t FILETYPE\tFile type (wav, bmp, y4m, jpg)\n");
+    printf("\t-d OUTPUT\tDecode mode, write payload to OUTPUT\n");
+    printf("\t-e INPUT\tEncode contents of INPUT to file\n");
     printf("\t-f FILENAME\tinput/output filename\n");
+    printf("\t-o OUTPUT\tEncoded carrier path (default: encoded_FILENAME)\n");
+    printf("\t-a\t\tAdaptive mode: embed in the busiest regions of the carrier first\n");
+    printf("\t-i\t\tIndexed layout: checksummed blocks behind an index, for random-access decoding\n");
+    printf("\t-r OFFSET:LEN\tDecode only LEN bytes from OFFSET of an indexed payload (implies -i)\n");
+    printf("\t-p PLANES\tY4M planes to embed into, some of y, u, v (default: y)\n");
+    printf("\t-j THREADS\tY4M and spread-spectrum worker threads (default: one per CPU)\n");
+    printf("\t-m METHOD\tEmbedding method: lsb (default), spread (spread spectrum, WAV/BMP; -k keys the chips),\n");
+    printf("\t\t\tphase (phase coding, WAV), echo (echo hiding, WAV) or image (INPUT is a BMP image, scaled\n");
+    printf("\t\t\tto the BMP carrier and kept in its low bit-planes; decoding writes it back out as a BMP)\n");
+    printf("\t-b BITS\t\tBit-planes -m image uses, 1-%d (default: %d); decode with the same BITS\n",
+        BITPLANE_MAX_BITS, BITPLANE_DEFAULT_BITS);
+    printf("\t-k PASSPHRASE\tEncrypt/decrypt the payload (ChaCha20-Poly1305, PBKDF2 key); with -m spread it only\n");
+    printf("\t\t\tkeys the chip sequence and the payload is embedded unencrypted\n");
+    printf("\t-M FORMAT\tReport distortion after encoding: SNR/max error (WAV) or PSNR/max error (BMP), as text or json\n");
+    printf("\t-q MIN_DB\tAbort encoding if the SNR (WAV) or PSNR (BMP) falls below MIN_DB\n");
+    printf("\t-F PARITY\tReed-Solomon code the payload with PARITY bytes per 255-byte codeword (%d-%d, e.g. %d);\n",
+        FEC_MIN_PARITY, FEC_MAX_PARITY, FEC_DEFAULT_PARITY);
+    printf("\t\t\tdecode with -F too (the carrier records the parity); up to PARITY/2 damaged bytes per codeword are corrected\n");
+    printf("\n\tAny of FILENAME, INPUT or OUTPUT may be - for stdin/stdout.\n");
+    printf("\n       ./steg.exe scan [-j THREADS] [-r REGION_BYTES] PATH...\n");
+    printf("       ./steg.exe update -t FILETYPE -e INPUT -f FILENAME [-p PREVIOUS]\n");
+    printf("       ./steg.exe generate -t FILETYPE -o OUTPUT [-e INPUT] [-p PATTERN] (see generate -h)\n");
+    printf("       ./steg.exe watch [-j THREADS] [-e PAYLOAD] [-o OUTDIR] [-l LOG] [-n COUNT] DIR (see watch -h)\n");
+}
+
+static int isStdio(const char* path) {
+    return path != NULL && strcmp(path, "-") == 0;
+}
+
+// Open a carrier for the streaming engines, "-" is stdin/stdout
+static int openStreamFd(const char* path, int writing) {
+    if (isStdio(path)) {
+        int fd = writing ? fileno(stdout) : fileno(stdin);
+#ifdef _WIN32
+        _setmode(fd, _O_BINARY);
+#endif
+        return fd;
+    }
+#ifdef _WIN32
+    return writing ? _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0644) : _open(path, _O_RDONLY | _O_BINARY);
+#else
+    return writing ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : open(path, O_RDONLY);
+#endif
+}
+
+// Close a descriptor from openStreamFd, leaving stdin/stdout open
+static void closeStreamFd(int fd, const char* path) {
+    if (fd < 0 || isStdio(path)) return;
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
+
+static FILE* openStreamFile(const char* path, const char* mode) {
+    if (isStdio(path)) {
+        FILE* file = mode[0] == 'r' ? stdin : stdout;
+#ifdef _WIN32
+        _setmode(_fileno(file), _O_BINARY);
+#endif
+        return file;
+    }
+    return fopen(path, mode);
+}
+
+// -M / -q: distortion report and quality limit for the encoders
+typedef struct MetricsOptions {
+    int format;        // METRICS_OFF, METRICS_TEXT or METRICS_JSON
+    int enforce;       // abort when the quality drops below minQuality
+    double minQuality; // dB: SNR for WAV, PSNR for BMP
+} METRICS_OPTIONS;
+
+static int metricsRequested(const METRICS_OPTIONS* options) {
+    return options->format != METRICS_OFF || options->enforce;
+}
+
+// Report the metrics, then apply the limit. Returns 0 if the encoded carrier may be kept.
+static int finishMetrics(const DISTORTION_METRICS* metrics, const METRICS_OPTIONS* options, const char* encodedPath) {
+    // keep stdout clean when the carrier itself is going there
+    if (options->format != METRICS_OFF) metricsReport(metrics, options->format, isStdio(encodedPath) ? stderr : stdout);
+    return options->enforce && metricsExceeded(metrics, options->minQuality) ? -1 : 0;
+}
+
+// The in-memory engines change samples all over the carrier (and some several times over), so they're measured
+// against a copy taken before encoding, in a single pass once they're done. NULL if no metrics were asked for.
+static uint8_t* snapshotCarrier(const CARRIER_LAYOUT* layout, const uint8_t* data, const METRICS_OPTIONS* options) {
+    if (!metricsRequested(options)) return NULL;
+    uint8_t* original = (uint8_t*)malloc(layout->dataSize ? layout->dataSize : 1);
+    if (original == NULL) {
+        // a -q limit can't be checked without the copy, measureCarrier fails the job
+        fprintf(stderr, options->enforce ? "Error: not enough memory to measure distortion for -q\n"
+            : "Warning: not enough memory to measure distortion\n");
+        return NULL;
+    }
+    memcpy(original, data, layout->dataSize);
+    return original;
+}
+
+static int measureCarrier(const CARRIER_LAYOUT* layout, const uint8_t* original, const uint8_t* data,
+    const METRICS_OPTIONS* options, const char* encodedPath) {
+    DISTORTION_METRICS metrics;
+    if (original == NULL) return metricsRequested(options) && options->enforce ? -1 : 0;
+    metricsInit(&metrics, layout);
+    metricsAccumulate(&metrics, original, data, layout->dataSize / layout->stride);
+    return finishMetrics(&metrics, options, encodedPath);
+}
+
+// Pipe-friendly path: everything goes through file descriptors and the streaming engines.
+static int runStream(int mode, int filetype, const char* inpath, const char* carrierPath, const char* encodedPath,
+    const METRICS_OPTIONS* metricsOptions) {
+    int result;
+    if (mode == 1) {
+        int carrier_fd = openStreamFd(carrierPath, 0);
+        FILE* output = openStreamFile(inpath, "wb");
+        if (carrier_fd < 0 || output == NULL) {
+            fprintf(stderr, "Error: Failed to open %s or %s\n", carrierPath, inpath);
+            closeStreamFd(carrier_fd, carrierPath);
+            if (output != NULL && output != stdout) fclose(output);
+            return -1;
+        }
+        result = decode_Stream(filetype, carrier_fd, output);
+        closeStreamFd(carrier_fd, carrierPath);
+        if (output != stdout) fclose(output);
+        return result;
+    }
+    if (isStdio(inpath) && isStdio(carrierPath)) {
+        fprintf(stderr, "Error: payload and carrier can't both come from stdin.\n");
+        return -1;
+    }
+    char buffer[MAX_FILENAME_LENGTH];
+    if (encodedPath == NULL) {
+        if (isStdio(carrierPath)) {
+            encodedPath = "-";
+        }
+        else {
+            snprintf(buffer, MAX_FILENAME_LENGTH, "encoded_%s", carrierPath);
+            encodedPath = buffer;
+        }
+    }
+    FILE* payload = openStreamFile(inpath, "rb");
+    int carrier_fd = openStreamFd(carrierPath, 0);
+    int out_fd = openStreamFd(encodedPath, 1);
+    if (payload == NULL || carrier_fd < 0 || out_fd < 0) {
+        fprintf(stderr, "Error: Failed to open input, carrier or output file\n");
+        if (payload != NULL && payload != stdin) fclose(payload);
+        closeStreamFd(carrier_fd, carrierPath);
+        closeStreamFd(out_fd, encodedPath);
+        return -1;
+    }
+    DISTORTION_METRICS metrics;
+    result = encode_Stream(filetype, carrier_fd, payload, out_fd, metricsRequested(metricsOptions) ? &metrics : NULL);
+    if (payload != stdin) fclose(payload);
+    closeStreamFd(carrier_fd, carrierPath);
+    closeStreamFd(out_fd, encodedPath);
+    if (result == 0 && metricsRequested(metricsOptions) && finishMetrics(&metrics, metricsOptions, encodedPath) != 0) {
+        result = -1;
+    }
+    // already streamed out; all that can be done is not leaving a broken or rejected file behind
+    if (result != 0 && !isStdio(encodedPath)) remove(encodedPath);
+    return result;
+}
+
+// Y4M video: streamed frame by frame, so carrier and output can be files or pipes
+static int runVideo(int mode, const char* inpath, const char* carrierPath, const char* encodedPath, const Y4M_OPTIONS* options) {
+    int result;
+    int carrier_fd = openStreamFd(carrierPath, 0);
+    if (carrier_fd < 0) {
+        fprintf(stderr, "Error: Failed to open %s\n", carrierPath);
+        return -1;
+    }
+    if (mode == 1) {
+        FILE* output = openStreamFile(inpath, "wb");
+        if (output == NULL) {
+            fprintf(stderr, "Error: Failed to open %s\n", inpath);
+            closeStreamFd(carrier_fd, carrierPath);
+            return -1;
+        }
+        result = decode_Y4M(carrier_fd, output, options);
+        closeStreamFd(carrier_fd, carrierPath);
+        if (output != stdout) fclose(output);
+        else fflush(stdout);
+        if (result == 0) fprintf(stderr, "Decoded data written to %s!\n", inpath);
+        return result;
+    }
+    if (isStdio(inpath)) {
+        fprintf(stderr, "Error: video mode needs a payload file (not -).\n");
+        closeStreamFd(carrier_fd, carrierPath);
+        return -1;
+    }
+    char buffer[MAX_FILENAME_LENGTH];
+    if (encodedPath == NULL) {
+        if (isStdio(carrierPath)) {
+            encodedPath = "-";
+        }
+        else {
+            snprintf(buffer, MAX_FILENAME_LENGTH, "encoded_%s", carrierPath);
+            encodedPath = buffer;
+        }
+    }
+    FILE* payload = fopen(inpath, "rb");
+    int out_fd = openStreamFd(encodedPath, 1);
+    if (payload == NULL || out_fd < 0) {
+        fprintf(stderr, "Error: Failed to open %s or %s\n", inpath, encodedPath);
+        if (payload != NULL) fclose(payload);
+        closeStreamFd(carrier_fd, carrierPath);
+        closeStreamFd(out_fd, encodedPath);
+        return -1;
+    }
+    result = encode_Y4M(carrier_fd, payload, out_fd, options);
+    fclose(payload);
+    closeStreamFd(carrier_fd, carrierPath);
+    closeStreamFd(out_fd, encodedPath);
+    return result;
+}
+
+static int runJpeg(int mode, const char* inpath, const char* carrierPath, const char* encodedPath) {
+    int result;
+    FILE* carrier = openStreamFile(carrierPath, "rb");
+    if (carrier == NULL) {
+        fprintf(stderr, "Error: Failed to open %s\n", carrierPath);
+        return -1;
+    }
+    if (mode == 1) {
+        FILE* output = openStreamFile(inpath, "wb");
+        if (output == NULL) {
+            fprintf(stderr, "Error: Failed to open %s\n", inpath);
+            if (carrier != stdin) fclose(carrier);
+            return -1;
+        }
+        result = decode_JPEG(carrier, output);
+        if (carrier != stdin) fclose(carrier);
+        if (output != stdout) fclose(output);
+        else fflush(stdout);
+        if (result == 0) fprintf(stderr, "Decoded data written to %s!\n", inpath);
+        return result;
+    }
+    if (isStdio(inpath) && isStdio(carrierPath)) {
+        fprintf(stderr, "Error: payload and carrier can't both come from stdin.\n");
+        return -1;
+    }
+    char buffer[MAX_FILENAME_LENGTH];
+    if (encodedPath == NULL) {
+        if (isStdio(carrierPath)) {
+            encodedPath = "-";
+        }
+        else {
+            snprintf(buffer, MAX_FILENAME_LENGTH, "encoded_%s", carrierPath);
+            encodedPath = buffer;
+        }
+    }
+    FILE* payload = openStreamFile(inpath, "rb");
+    FILE* output = openStreamFile(encodedPath, "wb");
+    if (payload == NULL || output == NULL) {
+        fprintf(stderr, "Error: Failed to open %s or %s\n", inpath, encodedPath);
+        if (payload != NULL && payload != stdin) fclose(payload);
+        if (output != NULL && output != stdout) fclose(output);
+        if (carrier != stdin) fclose(carrier);
+        return -1;
+    }
+    result = encode_JPEG(carrier, payload, output);
+    if (payload != stdin) fclose(payload);
+    if (carrier != stdin) fclose(carrier);
+    if (output != stdout) {
+        fclose(output);
+        // don't leave a half-written JPEG behind
+        if (result != 0) remove(encodedPath);
+    }
+    else {
+        fflush(stdout);
+    }
+    return result;
+}
+
+// Image-in-image: both BMPs are streamed a row at a time; the secret needs to be a file so its rows can be revisited
+static int runPlanes(int mode, const char* inpath, const char* carrierPath, const char* encodedPath, int bits,
+    const METRICS_OPTIONS* metricsOptions) {
+    int result;
+    FILE* carrier = openStreamFile(carrierPath, "rb");
+    if (carrier == NULL) {
+        fprintf(stderr, "Error: Failed to open %s\n", carrierPath);
+        return -1;
+    }
+    if (mode == 1) {
+        FILE* output = openStreamFile(inpath, "wb");
+        if (output == NULL) {
+            fprintf(stderr, "Error: Failed to open %s\n", inpath);
+            if (carrier != stdin) fclose(carrier);
+            return -1;
+        }
+        result = decodePlanes(carrier, output, bits);
+        if (carrier != stdin) fclose(carrier);
+        if (output != stdout) fclose(output);
+        else fflush(stdout);
+        if (result == 0) fprintf(stderr, "Decoded image written to %s!\n", inpath);
+        return result;
+    }
+    if (isStdio(inpath)) {
+        fprintf(stderr, "Error: -m image needs the secret image as a file (not -).\n");
+        if (carrier != stdin) fclose(carrier);
+        return -1;
+    }
+    char buffer[MAX_FILENAME_LENGTH];
+    if (encodedPath == NULL) {
+        if (isStdio(carrierPath)) {
+            encodedPath = "-";
+        }
+        else {
+            snprintf(buffer, MAX_FILENAME_LENGTH, "encoded_%s", carrierPath);
+            encodedPath = buffer;
+        }
+    }
+    FILE* secret = fopen(inpath, "rb");
+    FILE* output = openStreamFile(encodedPath, "wb");
+    if (secret == NULL || output == NULL) {
+        fprintf(stderr, "Error: Failed to open %s or %s\n", inpath, encodedPath);
+        if (secret != NULL) fclose(secret);
+        if (output != NULL && output != stdout) fclose(output);
+        if (carrier != stdin) fclose(carrier);
+        return -1;
+    }
+    DISTORTION_METRICS metrics;
+    result = encodePlanes(carrier, secret, output, bits, metricsRequested(metricsOptions) ? &metrics : NULL);
+    fclose(secret);
+    if (carrier != stdin) fclose(carrier);
+    if (output == stdout) fflush(stdout);
+    else fclose(output);
+    if (result == 0 && metricsRequested(metricsOptions) && finishMetrics(&metrics, metricsOptions, encodedPath) != 0) {
+        result = -1;
+    }
+    // don't leave a half-written (or rejected) image behind
+    if (result != 0 && !isStdio(encodedPath)) remove(encodedPath);
+    return result;
+}
+
+// Layouts embedded by runInMemory
+enum MemoryEngines {
+    ENGINE_ADAPTIVE,
+    ENGINE_INDEXED,
+    ENGINE_PHASE,
+    ENGINE_ECHO,
+    ENGINE_SPREAD
+};
+
+// Adaptive mode needs the whole carrier for its energy map and the indexed layout writes its index last,
+// so both encode through the in-memory engines. Indexed payloads are decoded straight from a mapped file instead.
+// Phase coding, echo hiding and spread spectrum work on whole frames or long chip runs, so they run here for both
+// directions. key and threads only apply to spread spectrum.
+static int runInMemory(int engine, int mode, int filetype, const char* inpath, const char* carrierPath, const char* encodedPath,
+    const char* key, int threads, const METRICS_OPTIONS* metricsOptions) {
+    CARRIER_LAYOUT layout;
+    WAV_FILE* wavData = NULL;
+    BMP_FILE* bmp = NULL;
+    uint8_t* data;
+    int result;
+    if (filetype == TYPE_WAV) {
+        wavData = readFromFile_WAV(carrierPath);
+        if (wavData == NULL) return -1;
+        layoutFromWAV(wavData, &layout);
+        data = wavData->DATA.byteArray;
+    }
+    else {
+        bmp = (BMP_FILE*)malloc(sizeof(BMP_FILE));
+        if (bmp == NULL || !readBMPFromFile(carrierPath, bmp)) {
+            free(bmp);
+            return -1;
+        }
+        layoutFromBMP(bmp, &layout);
+        data = bmp->data;
+    }
+
+    if (mode == 1) {
+        FILE* output_file = fopen(inpath, "wb");
+        if (output_file == NULL) {
+            printf("Error: Failed to open %s\n", inpath);
+            result = -1;
+        }
+        else {
+            if (engine == ENGINE_SPREAD) {
+                result = decodeSpread(&layout, data, output_file, key, threads);
+            }
+            else if (engine == ENGINE_PHASE || engine == ENGINE_ECHO) {
+                result = decodeTransform(engine == ENGINE_PHASE ? METHOD_PHASE : METHOD_ECHO, &layout, data, output_file);
+            }
+            else {
+                result = decodeAdaptive(&layout, data, output_file);
+            }
+            fclose(output_file);
+            if (result == 0) printf("Decoded data written to %s!\n", inpath);
+        }
+    }
+    else {
+        FILE* input_file = fopen(inpath, "rb");
+        char buffer[MAX_FILENAME_LENGTH];
+        if (encodedPath == NULL) {
+            snprintf(buffer, MAX_FILENAME_LENGTH, "encoded_%s", carrierPath);
+            encodedPath = buffer;
+        }
+        uint8_t* original = NULL;
+        if (input_file == NULL) {
+            printf("Error: Failed to open %s\n", inpath);
+            result = -1;
+        }
+        else {
+            original = snapshotCarrier(&layout, data, metricsOptions);
+            if (engine == ENGINE_INDEXED) {
+                printf("|| Encoding (indexed)...\n");
+                result = encodeIndexed(&layout, data, input_file);
+            }
+            else if (engine == ENGINE_SPREAD) {
+                printf("|| Encoding (spread spectrum)...\n");
+                result = encodeSpread(&layout, data, input_file, key, threads);
+            }
+            else if (engine == ENGINE_PHASE || engine == ENGINE_ECHO) {
+                printf("|| Encoding (%s)...\n", engine == ENGINE_PHASE ? "phase coding" : "echo hiding");
+                result = encodeTransform(engine == ENGINE_PHASE ? METHOD_PHASE : METHOD_ECHO, &layout, data, input_file);
+            }
+            else {
+                printf("|| Encoding (adaptive)...\n");
+                result = encodeAdaptive(&layout, data, input_file);
+            }
+            fclose(input_file);
+        }
+        if (result == 0) result = measureCarrier(&layout, original, data, metricsOptions, encodedPath);
+        free(original);
+        if (result == 0) {
+            printf("|| Writing file to %s\n", encodedPath);
+            if (wavData != NULL) {
+                FILE* output = fopen(encodedPath, "w+b");
+                result = writeToFile_WAV(output, wavData) ? 0 : -1;
+                if (output != NULL) fclose(output);
+            }
+            else {
+                result = writeBmpToFile(encodedPath, bmp) ? 0 : -1;
+            }
+        }
+    }
+    if (wavData != NULL) {
+        freeWAV(wavData);
+        free(wavData);
+    }
+    if (bmp != NULL) freeBMP(bmp);
+    return result;
 }
 
 int main(int argc, char* argv[]) {
 
     char* inpath = NULL;
     char* outpath = NULL;
+    char* encodedPath = NULL;
     int opt;
     int mode = 0; // 0: encode, 1: decode
     int filetype = -1;
+    int adaptive = 0;
+    int indexed = 0;
+    int method = METHOD_LSB;
+    METRICS_OPTIONS metricsOptions = { METRICS_OFF, 0, 0.0 };
+    int fecParity = 0;
+    int planeBits = BITPLANE_DEFAULT_BITS;
+    uint64_t rangeOffset = 0, rangeLength = INDEX_TO_END;
+    Y4M_OPTIONS videoOptions = { Y4M_PLANE_Y, 0 };
+    char* passphrase = NULL;
+    // subcommands
+    if (argc > 1 && strcmp(argv[1], "scan") == 0) {
+        return runScan(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "watch") == 0) {
+        return runWatch(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "update") == 0) {
+        return runUpdate(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "generate") == 0) {
+        GENERATE_OPTIONS defaults = { -1, -1, numSeconds, numChannels, sampleRate, bitsPerSample, 1024, 768, 0 };
+        return runGenerate(argc - 1, argv + 1, &defaults);
+    }
     // get clargs
     while(optind < argc) {
-        if ((opt = getopt(argc, argv, "ht:d:e:f:")) != -1);
+        if ((opt = getopt(argc, argv, "ht:d:e:f:o:ak:ir:p:j:m:b:M:q:F:")) != -1);
         switch(opt) {
             case 'h':
                 printUsage();
@@ -59,23 +546,116 @@ int main(int argc, char* argv[]) {
                 else if (strcmp(optarg, "wav") == 0) {
                     filetype = TYPE_WAV;
                 }
+                else if (strcmp(optarg, "y4m") == 0) {
+                    filetype = TYPE_Y4M;
+                }
+                else if (strcmp(optarg, "jpg") == 0 || strcmp(optarg, "jpeg") == 0) {
+                    filetype = TYPE_JPEG;
+                }
                 break;
             case 'd':
                 // decode mode
                 mode = 1;
                 if (optarg != NULL) inpath = optarg;
-                printf("Output file path: %s\n", inpath);
+                fprintf(stderr, "Output file path: %s\n", inpath);
                 break;
             case 'e':
                 // encode mode, get text.
                 mode = 0;
                 if(optarg != NULL) inpath = optarg;
-                printf("Input file path: %s\n", inpath);
+                fprintf(stderr, "Input file path: %s\n", inpath);
                 break;
             case 'f':
                 // Get file
                 outpath = optarg;
                 break;
+            case 'o':
+                // encoded carrier output
+                encodedPath = optarg;
+                break;
+            case 'a':
+                adaptive = 1;
+                break;
+            case 'k':
+                passphrase = optarg;
+                break;
+            case 'i':
+                indexed = 1;
+                break;
+            case 'p':
+                videoOptions.planes = parseY4MPlanes(optarg);
+                if (videoOptions.planes == 0) {
+                    printf("Error: planes must be some of y, u, v\n");
+                    return -1;
+                }
+                break;
+            case 'j':
+                videoOptions.threads = atoi(optarg);
+                break;
+            case 'm':
+                if (strcmp(optarg, "lsb") == 0) {
+                    method = METHOD_LSB;
+                }
+                else if (strcmp(optarg, "phase") == 0) {
+                    method = METHOD_PHASE;
+                }
+                else if (strcmp(optarg, "echo") == 0) {
+                    method = METHOD_ECHO;
+                }
+                else if (strcmp(optarg, "spread") == 0) {
+                    method = METHOD_SPREAD;
+                }
+                else if (strcmp(optarg, "image") == 0) {
+                    method = METHOD_IMAGE;
+                }
+                else {
+                    printf("Error: method must be lsb, phase, echo, spread or image\n");
+                    return -1;
+                }
+                break;
+            case 'b':
+                planeBits = atoi(optarg);
+                if (planeBits < 1 || planeBits > BITPLANE_MAX_BITS) {
+                    printf("Error: -b takes 1 to %d bit-planes\n", BITPLANE_MAX_BITS);
+                    return -1;
+                }
+                break;
+            case 'M':
+                if (strcmp(optarg, "text") == 0) {
+                    metricsOptions.format = METRICS_TEXT;
+                }
+                else if (strcmp(optarg, "json") == 0) {
+                    metricsOptions.format = METRICS_JSON;
+                }
+                else {
+                    printf("Error: metrics format must be text or json\n");
+                    return -1;
+                }
+                break;
+            case 'q':
+                metricsOptions.enforce = 1;
+                metricsOptions.minQuality = atof(optarg);
+                break;
+            case 'F':
+                // Reed-Solomon parity bytes per codeword; decoding reads the real value from the carrier
+                fecParity = atoi(optarg);
+                if (fecParity < FEC_MIN_PARITY || fecParity > FEC_MAX_PARITY) {
+                    printf("Error: -F takes %d to %d parity bytes per codeword\n", FEC_MIN_PARITY, FEC_MAX_PARITY);
+                    return -1;
+                }
+                break;
+            case 'r': {
+                // OFFSET:LEN, or OFFSET: for everything from OFFSET on
+                char* end;
+                indexed = 1;
+                rangeOffset = strtoull(optarg, &end, 0);
+                if (*end != ':') {
+                    printf("Error: range must be OFFSET:LEN\n");
+                    return -1;
+                }
+                if (end[1] != '\0') rangeLength = strtoull(end + 1, NULL, 0);
+                break;
+            }
             case ':':
                 printf("Error: option not provided!\n");
                 printUsage();
@@ -100,49 +680,227 @@ int main(int argc, char* argv[]) {
         printUsage();
         return -1;
     }
+    // indexed BMPs are only handled by the streaming palette engine
+    if (filetype == TYPE_BMP && !isStdio(outpath) && paletteCarrierFile(outpath)) {
+        if (method != METHOD_LSB || adaptive || indexed || passphrase != NULL || fecParity > 0) {
+            printf("Error: palette (1/2/4/8-bit) BMPs only take plain LSB payloads (no -a, -i/-r, -k, -m or -F).\n");
+            return -1;
+        }
+        if (inpath == NULL) {
+            printUsage();
+            return -1;
+        }
+        return runStream(mode, filetype, inpath, outpath, encodedPath, &metricsOptions) == 0 ? 0 : -1;
+    }
+    if (fecParity > 0) {
+        if (filetype == TYPE_Y4M || filetype == TYPE_JPEG || method != METHOD_LSB || adaptive || indexed || passphrase != NULL) {
+            printf("Error: -F needs a WAV or BMP carrier and can't be combined with -a, -i/-r, -k or -m.\n");
+            return -1;
+        }
+        if (inpath == NULL || isStdio(inpath) || isStdio(outpath) || isStdio(encodedPath)) {
+            printf("Error: -F needs file paths (not -).\n");
+            return -1;
+        }
+    }
+    if (filetype == TYPE_JPEG) {
+        if (method != METHOD_LSB || adaptive || indexed || passphrase != NULL || metricsRequested(&metricsOptions)) {
+            printf("Error: -a, -i/-r, -k, -m, -M and -q aren't available for JPEG carriers.\n");
+            return -1;
+        }
+        if (inpath == NULL) {
+            printUsage();
+            return -1;
+        }
+        return runJpeg(mode, inpath, outpath, encodedPath) == 0 ? 0 : -1;
+    }
+    if (method == METHOD_IMAGE) {
+        if (filetype != TYPE_BMP || adaptive || indexed || passphrase != NULL) {
+            printf("Error: -m image needs a BMP carrier and can't be combined with -a, -i/-r or -k.\n");
+            return -1;
+        }
+        if (inpath == NULL) {
+            printUsage();
+            return -1;
+        }
+        return runPlanes(mode, inpath, outpath, encodedPath, planeBits, &metricsOptions) == 0 ? 0 : -1;
+    }
+    if (method == METHOD_SPREAD) {
+        if (filetype == TYPE_Y4M || adaptive || indexed) {
+            printf("Error: -m spread needs a WAV or BMP carrier and can't be combined with -a or -i/-r.\n");
+            return -1;
+        }
+        if (inpath == NULL || isStdio(inpath) || isStdio(outpath) || isStdio(encodedPath)) {
+            printf("Error: -m spread needs file paths (not -).\n");
+            return -1;
+        }
+        // -k keys the chip sequence rather than encrypting
+        return runInMemory(ENGINE_SPREAD, mode, filetype, inpath, outpath, encodedPath, passphrase, videoOptions.threads, &metricsOptions) == 0 ? 0 : -1;
+    }
+    if (method != METHOD_LSB) {
+        if (filetype != TYPE_WAV || adaptive || indexed || passphrase != NULL) {
+            printf("Error: -m phase/echo needs a WAV carrier and can't be combined with -a, -i/-r or -k.\n");
+            return -1;
+        }
+        if (inpath == NULL || isStdio(inpath) || isStdio(outpath) || isStdio(encodedPath)) {
+            printf("Error: -m phase/echo needs file paths (not -).\n");
+            return -1;
+        }
+        return runInMemory(method == METHOD_PHASE ? ENGINE_PHASE : ENGINE_ECHO, mode, filetype, inpath, outpath, encodedPath, NULL, 0, &metricsOptions) == 0 ? 0 : -1;
+    }
+    if (filetype == TYPE_Y4M) {
+        if (metricsRequested(&metricsOptions)) {
+            printf("Error: -M and -q are only available for WAV and BMP carriers.\n");
+            return -1;
+        }
+        if (adaptive || indexed || passphrase != NULL) {
+            printf("Error: -a, -i/-r and -k aren't available for video carriers.\n");
+            return -1;
+        }
+        if (inpath == NULL) {
+            printUsage();
+            return -1;
+        }
+        return runVideo(mode, inpath, outpath, encodedPath, &videoOptions) == 0 ? 0 : -1;
+    }
+    if (indexed && (adaptive || passphrase != NULL)) {
+        printf("Error: -i/-r can't be combined with -a or -k.\n");
+        return -1;
+    }
+    if (passphrase != NULL && (adaptive || isStdio(inpath) || isStdio(outpath) || isStdio(encodedPath))) {
+        printf("Error: -k needs file paths (not -) and can't be combined with -a.\n");
+        return -1;
+    }
+    if (adaptive) {
+        if (inpath == NULL || isStdio(inpath) || isStdio(outpath) || isStdio(encodedPath)) {
+            printf("Error: adaptive mode needs file paths (not -).\n");
+            return -1;
+        }
+        return runInMemory(ENGINE_ADAPTIVE, mode, filetype, inpath, outpath, encodedPath, NULL, 0, &metricsOptions) == 0 ? 0 : -1;
+    }
+    if (indexed) {
+        if (inpath == NULL || isStdio(outpath) || (mode == 0 && (isStdio(inpath) || isStdio(encodedPath)))) {
+            printf("Error: indexed mode needs a carrier file (and a payload file to encode).\n");
+            return -1;
+        }
+        if (mode == 0) {
+            return runInMemory(ENGINE_INDEXED, mode, filetype, inpath, outpath, encodedPath, NULL, 0, &metricsOptions) == 0 ? 0 : -1;
+        }
+        // the carrier is mapped, so only the blocks under the range are ever read
+        FILE* output_file = openStreamFile(inpath, "wb");
+        if (output_file == NULL) {
+            printf("Error: Failed to open %s\n", inpath);
+            return -1;
+        }
+        int result = decodeIndexedFile(filetype, outpath, rangeOffset, rangeLength, output_file);
+        if (output_file != stdout) fclose(output_file);
+        else fflush(stdout);
+        return result == 0 ? 0 : -1;
+    }
+    // plain payloads go behind a length header, which the streaming engine writes and reads for files too
+    if (isStdio(inpath) || isStdio(outpath) || isStdio(encodedPath) || (passphrase == NULL && fecParity == 0)) {
+        if (inpath == NULL) {
+            printUsage();
+            return -1;
+        }
+        return runStream(mode, filetype, inpath, outpath, encodedPath, &metricsOptions) == 0 ? 0 : -1;
+    }
     // Decode
     if(mode == 1) {
         if (filetype == TYPE_BMP) {
             //decodeFromFile_BMP(outpath);
-            decode_ToFile_FromFile_BMP(outpath, inpath);
+            if (decode_ToFile_FromFile_BMP(outpath, inpath, passphrase, fecParity) != 0) return -1;
         }
         else if (filetype == TYPE_WAV) {
             //decodeFromFile_WAV(outpath);
-            decode_toFile_FromFile_WAV(outpath, inpath);
+            if (decode_toFile_FromFile_WAV(outpath, inpath, passphrase, fecParity) != 0) return -1;
         }
     } else if(inpath != NULL){
     // Encode
-        FILE* input_file = fopen(inpath, "rb+");
+        FILE* input_file = fopen(inpath, "rb");
+        if (input_file == NULL) {
+            printf("Error: Failed to open %s\n", inpath);
+            return -1;
+        }
 
         if (filetype == TYPE_WAV) {
             WAV_FILE* wavData = readFromFile_WAV(outpath);
+            if (wavData == NULL) {
+                printf("Could not read WAV file!\n");
+                fclose(input_file);
+                return -1;
+            }
             printf("|| Encoding...\n");
+            CARRIER_LAYOUT layout;
+            layoutFromWAV(wavData, &layout);
+            uint8_t* original = snapshotCarrier(&layout, wavData->DATA.byteArray, &metricsOptions);
             
             //encodeToFile_WAV(text, wavData);
-            encode_File_ToFile_WAV(input_file, wavData);
+            int encoded = encode_File_ToFile_WAV(input_file, wavData, passphrase, fecParity);
+            // the payload isn't needed past here, whether or not it went in
+            fclose(input_file);
+            if (encoded != 0) {
+                free(original);
+                freeWAV(wavData);
+                return -1;
+            }
+            char buffer[MAX_FILENAME_LENGTH];
+            if (encodedPath == NULL) {
+                snprintf(buffer, MAX_FILENAME_LENGTH, "encoded_%s", outpath);
+                encodedPath = buffer;
+            }
+            int measured = measureCarrier(&layout, original, wavData->DATA.byteArray, &metricsOptions, encodedPath);
+            free(original);
+            if (measured != 0) {
+                freeWAV(wavData);
+                return -1;
+            }
             printf("|| Saving...\n");
             FILE* output;
-            char buffer[MAX_FILENAME_LENGTH];
-            sprintf_s(buffer, MAX_FILENAME_LENGTH, "encoded_%s", outpath);
-            output = fopen(buffer, "w+b");
-            writeToFile_WAV(output, wavData);
+            output = fopen(encodedPath, "w+b");
+            int written = writeToFile_WAV(output, wavData);
 
-            fclose(output);
+            if (output != NULL) fclose(output);
             freeWAV(wavData);
+            if (!written) return -1;
         }
         else if (filetype == TYPE_BMP) {
 
 
             BMP_FILE* bmp = (BMP_FILE*) malloc(sizeof(BMP_FILE));
             //decodeFromFile_BMP("testbitmap_encoded.bmp");
-            readBMPFromFile(outpath, bmp);
+            if (bmp == NULL || !readBMPFromFile(outpath, bmp)) {
+                printf("Could not read BMP file!\n");
+                free(bmp);
+                fclose(input_file);
+                return -1;
+            }
+
+            CARRIER_LAYOUT layout;
+            layoutFromBMP(bmp, &layout);
+            uint8_t* original = snapshotCarrier(&layout, bmp->data, &metricsOptions);
 
             //encodeToFile_BMP(bmp, text);
-            encode_File_ToFile_BMP(bmp, input_file);
+            int encoded = encode_File_ToFile_BMP(bmp, input_file, passphrase, fecParity);
+            // the payload isn't needed past here, whether or not it went in
+            fclose(input_file);
+            if (encoded != 0) {
+                free(original);
+                freeBMP(bmp);
+                return -1;
+            }
             char buffer[MAX_FILENAME_LENGTH];
-            sprintf_s(buffer, MAX_FILENAME_LENGTH, "encoded_%s", outpath);
-            printf("|| Writing file to %s\n", buffer);
-            writeBmpToFile(buffer, bmp);
+            if (encodedPath == NULL) {
+                snprintf(buffer, MAX_FILENAME_LENGTH, "encoded_%s", outpath);
+                encodedPath = buffer;
+            }
+            int measured = measureCarrier(&layout, original, bmp->data, &metricsOptions, encodedPath);
+            free(original);
+            if (measured != 0) {
+                freeBMP(bmp);
+                return -1;
+            }
+            printf("|| Writing file to %s\n", encodedPath);
+            writeBmpToFile(encodedPath, bmp);
             freeBMP(bmp);
         }
         
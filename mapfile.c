@@ -0,0 +1,90 @@
+#include "mapfile.h"
+#include <string.h>
+#include <errno.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef _WIN32
+int mapFile(const char* path, int writable, MAPPED_FILE* map) {
+    memset(map, 0, sizeof(MAPPED_FILE));
+    HANDLE file = CreateFileA(path, writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+        FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "Failed to open %s!\n", path);
+        return 0;
+    }
+    LARGE_INTEGER size;
+    GetFileSizeEx(file, &size);
+    map->size = (uint64_t)size.QuadPart;
+    map->writable = writable;
+    map->fileHandle = file;
+    if (map->size == 0) return 1;
+    HANDLE mapping = CreateFileMappingA(file, NULL, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        fprintf(stderr, "Failed to map %s!\n", path);
+        CloseHandle(file);
+        return 0;
+    }
+    map->mappingHandle = mapping;
+    map->data = (uint8_t*)MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+    if (map->data == NULL) {
+        fprintf(stderr, "Failed to map %s!\n", path);
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return 0;
+    }
+    return 1;
+}
+
+void unmapFile(MAPPED_FILE* map) {
+    if (map->data != NULL) {
+        if (map->writable) FlushViewOfFile(map->data, 0);
+        UnmapViewOfFile(map->data);
+    }
+    if (map->mappingHandle != NULL) CloseHandle(map->mappingHandle);
+    if (map->fileHandle != NULL) CloseHandle(map->fileHandle);
+    memset(map, 0, sizeof(MAPPED_FILE));
+}
+#else
+int mapFile(const char* path, int writable, MAPPED_FILE* map) {
+    memset(map, 0, sizeof(MAPPED_FILE));
+    map->fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (map->fd < 0) {
+        fprintf(stderr, "Failed to open %s! (%s)\n", path, strerror(errno));
+        return 0;
+    }
+    struct stat info;
+    if (fstat(map->fd, &info) != 0) {
+        close(map->fd);
+        return 0;
+    }
+    map->size = (uint64_t)info.st_size;
+    map->writable = writable;
+    if (map->size == 0) return 1;
+    void* data = mmap(NULL, (size_t)map->size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, map->fd, 0);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s! (%s)\n", path, strerror(errno));
+        close(map->fd);
+        return 0;
+    }
+    map->data = (uint8_t*)data;
+    return 1;
+}
+
+void unmapFile(MAPPED_FILE* map) {
+    if (map->data != NULL) {
+        if (map->writable) msync(map->data, (size_t)map->size, MS_SYNC);
+        munmap(map->data, (size_t)map->size);
+    }
+    if (map->fd >= 0) close(map->fd);
+    map->fd = -1;
+    map->data = NULL;
+    map->size = 0;
+}
+#endif
@@ -0,0 +1,27 @@
+//
+// Memory-mapped file access for the engines that don't want to read a whole carrier.
+//
+#ifndef STEG_MAPFILE_H
+#define STEG_MAPFILE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+typedef struct MappedFile {
+    uint8_t* data;
+    uint64_t size;
+    int writable;
+#ifdef _WIN32
+    void* fileHandle;
+    void* mappingHandle;
+#else
+    int fd;
+#endif
+} MAPPED_FILE;
+
+// Map path into memory (shared, so writes go back to the file). Returns 1 on success.
+int mapFile(const char* path, int writable, MAPPED_FILE* map);
+// Flush and unmap a mapped file
+void unmapFile(MAPPED_FILE* map);
+#endif //STEG_MAPFILE_H
@@ -1,4 +1,5 @@
 #include "mathutilities.h"
+#include <math.h>
 
 float clamp(float value, float min, float max) {
     if (value >= min && value <= max) {
@@ -12,3 +13,43 @@ float clamp(float value, float min, float max) {
     }
     return value;
 }
+
+// Series expansion of P(a, x), good for x < a + 1
+static double gammaPSeries(double a, double x) {
+    double term = 1.0 / a;
+    double sum = term;
+    for (int n = 1; n < 1000; n++) {
+        term *= x / (a + n);
+        sum += term;
+        if (fabs(term) < fabs(sum) * 1e-15) break;
+    }
+    return sum * exp(-x + a * log(x) - lgamma(a));
+}
+
+// Continued fraction for Q(a, x) (modified Lentz), good for x >= a + 1
+static double gammaQFraction(double a, double x) {
+    const double tiny = 1e-300;
+    double b = x + 1.0 - a;
+    double c = 1.0 / tiny;
+    double d = 1.0 / b;
+    double h = d;
+    for (int i = 1; i < 1000; i++) {
+        double an = -i * (i - a);
+        b += 2.0;
+        d = an * d + b;
+        if (fabs(d) < tiny) d = tiny;
+        c = b + an / c;
+        if (fabs(c) < tiny) c = tiny;
+        d = 1.0 / d;
+        double delta = d * c;
+        h *= delta;
+        if (fabs(delta - 1.0) < 1e-15) break;
+    }
+    return exp(-x + a * log(x) - lgamma(a)) * h;
+}
+
+double regularizedGammaQ(double a, double x) {
+    if (x <= 0.0 || a <= 0.0) return 1.0;
+    if (x < a + 1.0) return 1.0 - gammaPSeries(a, x);
+    return gammaQFraction(a, x);
+}
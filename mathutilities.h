@@ -6,4 +6,6 @@
 #define STEG_MATHUTILITIES_H
 
 float clamp(float value, float min, float max);
+// Upper regularized incomplete gamma function Q(a, x), i.e. the chi-square survival function at (df/2, chi/2)
+double regularizedGammaQ(double a, double x);
 #endif //STEG_MATHUTILITIES_H
@@ -0,0 +1,187 @@
+#include "metrics.h"
+#include <math.h>
+#include <string.h>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define STEG_METRICS_SSE2
+#endif
+
+// Samples per SIMD block; the 64-bit lanes are folded into the doubles after each one so they can't overflow
+#define METRICS_BLOCK (64 * 1024)
+
+void metricsInit(DISTORTION_METRICS* metrics, const CARRIER_LAYOUT* layout) {
+    memset(metrics, 0, sizeof(DISTORTION_METRICS));
+    metrics->type = layout->type;
+    metrics->stride = layout->stride;
+}
+
+// 8-bit WAV is unsigned around 128; BMP bytes are left as they are (PSNR only needs the error)
+static inline int64_t sampleValue(const DISTORTION_METRICS* metrics, const uint8_t* p) {
+    switch (metrics->stride) {
+    case 1:
+        return metrics->type == TYPE_WAV ? (int64_t)p[0] - 128 : p[0];
+    case 2:
+        return (int16_t)(p[0] | (p[1] << 8));
+    default:
+        return (int32_t)((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+    }
+}
+
+static void accumulateScalar(DISTORTION_METRICS* metrics, const uint8_t* before, const uint8_t* after, uint64_t count) {
+    uint32_t stride = metrics->stride;
+    for (uint64_t i = 0; i < count; i++) {
+        int64_t x = sampleValue(metrics, before + i * stride);
+        int64_t e = sampleValue(metrics, after + i * stride) - x;
+        metrics->signalEnergy += (double)x * (double)x;
+        if (e != 0) {
+            uint64_t magnitude = (uint64_t)(e < 0 ? -e : e);
+            metrics->changed++;
+            metrics->noiseEnergy += (double)e * (double)e;
+            if (magnitude > metrics->maxError) metrics->maxError = magnitude;
+        }
+    }
+    metrics->samples += count;
+}
+
+#ifdef STEG_METRICS_SSE2
+typedef struct SseAccumulator {
+    __m128i signal;   // 2 x uint64 sums of squares
+    __m128i noise;
+    __m128i maxError; // 4 x int32
+    __m128i changed;  // 4 x int32, -1 per changed sample
+} SSE_ACCUMULATOR;
+
+static inline __m128i absEpi32(__m128i v) {
+    __m128i sign = _mm_srai_epi32(v, 31);
+    return _mm_sub_epi32(_mm_xor_si128(v, sign), sign);
+}
+
+// sum of squares of 4 non-negative int32 lanes (each < 2^17), into 2 uint64 lanes
+static inline __m128i addSquares(__m128i sums, __m128i v) {
+    sums = _mm_add_epi64(sums, _mm_mul_epu32(v, v));
+    __m128i odd = _mm_srli_epi64(v, 32);
+    return _mm_add_epi64(sums, _mm_mul_epu32(odd, odd));
+}
+
+// 4 original / encoded samples, already widened to int32
+static inline void accumulate4(SSE_ACCUMULATOR* acc, __m128i x, __m128i y) {
+    __m128i e = _mm_sub_epi32(y, x);
+    __m128i magnitude = absEpi32(e);
+    acc->signal = addSquares(acc->signal, absEpi32(x));
+    acc->noise = addSquares(acc->noise, magnitude);
+    __m128i greater = _mm_cmpgt_epi32(magnitude, acc->maxError);
+    acc->maxError = _mm_or_si128(_mm_and_si128(greater, magnitude), _mm_andnot_si128(greater, acc->maxError));
+    acc->changed = _mm_add_epi32(acc->changed, _mm_xor_si128(_mm_cmpeq_epi32(e, _mm_setzero_si128()), _mm_set1_epi32(-1)));
+}
+
+static void flushAccumulator(DISTORTION_METRICS* metrics, const SSE_ACCUMULATOR* acc) {
+    uint64_t signal[2], noise[2];
+    int32_t maxError[4], changed[4];
+    _mm_storeu_si128((__m128i*)signal, acc->signal);
+    _mm_storeu_si128((__m128i*)noise, acc->noise);
+    _mm_storeu_si128((__m128i*)maxError, acc->maxError);
+    _mm_storeu_si128((__m128i*)changed, acc->changed);
+    metrics->signalEnergy += (double)signal[0] + (double)signal[1];
+    metrics->noiseEnergy += (double)noise[0] + (double)noise[1];
+    for (int i = 0; i < 4; i++) {
+        if ((uint64_t)maxError[i] > metrics->maxError) metrics->maxError = (uint64_t)maxError[i];
+        metrics->changed -= (int64_t)changed[i];
+    }
+}
+
+// Whole vectors of 8- or 16-bit samples; returns how many were consumed
+static uint64_t accumulateSSE2(DISTORTION_METRICS* metrics, const uint8_t* before, const uint8_t* after, uint64_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi32(metrics->type == TYPE_WAV ? 128 : 0);
+    uint64_t done = 0;
+    while (count - done >= 16) {
+        SSE_ACCUMULATOR acc;
+        acc.signal = acc.noise = acc.maxError = acc.changed = zero;
+        uint64_t blockEnd = done + (count - done < METRICS_BLOCK ? (count - done) & ~(uint64_t)15 : METRICS_BLOCK);
+        for (; done < blockEnd; done += 16) {
+            if (metrics->stride == 1) {
+                __m128i xb = _mm_loadu_si128((const __m128i*)(before + done));
+                __m128i yb = _mm_loadu_si128((const __m128i*)(after + done));
+                __m128i xw[2] = { _mm_unpacklo_epi8(xb, zero), _mm_unpackhi_epi8(xb, zero) };
+                __m128i yw[2] = { _mm_unpacklo_epi8(yb, zero), _mm_unpackhi_epi8(yb, zero) };
+                for (int h = 0; h < 2; h++) {
+                    accumulate4(&acc, _mm_sub_epi32(_mm_unpacklo_epi16(xw[h], zero), bias),
+                        _mm_sub_epi32(_mm_unpacklo_epi16(yw[h], zero), bias));
+                    accumulate4(&acc, _mm_sub_epi32(_mm_unpackhi_epi16(xw[h], zero), bias),
+                        _mm_sub_epi32(_mm_unpackhi_epi16(yw[h], zero), bias));
+                }
+            }
+            else {
+                for (int h = 0; h < 2; h++) {
+                    __m128i xv = _mm_loadu_si128((const __m128i*)(before + 2 * done + 16 * h));
+                    __m128i yv = _mm_loadu_si128((const __m128i*)(after + 2 * done + 16 * h));
+                    // sign-extend int16 -> int32 by duplicating into the high half and shifting down
+                    accumulate4(&acc, _mm_srai_epi32(_mm_unpacklo_epi16(xv, xv), 16), _mm_srai_epi32(_mm_unpacklo_epi16(yv, yv), 16));
+                    accumulate4(&acc, _mm_srai_epi32(_mm_unpackhi_epi16(xv, xv), 16), _mm_srai_epi32(_mm_unpackhi_epi16(yv, yv), 16));
+                }
+            }
+        }
+        flushAccumulator(metrics, &acc);
+    }
+    metrics->samples += done;
+    return done;
+}
+#endif
+
+void metricsAccumulate(DISTORTION_METRICS* metrics, const uint8_t* before, const uint8_t* after, uint64_t count) {
+    uint64_t done = 0;
+#ifdef STEG_METRICS_SSE2
+    if (metrics->stride <= 2) done = accumulateSSE2(metrics, before, after, count);
+#endif
+    accumulateScalar(metrics, before + done * metrics->stride, after + done * metrics->stride, count - done);
+}
+
+void metricsAddSignal(DISTORTION_METRICS* metrics, const uint8_t* samples, uint64_t count) {
+    if (metrics->type != TYPE_WAV) {
+        // PSNR is relative to the peak, so BMP only needs the count
+        metrics->samples += count;
+        return;
+    }
+    metricsAccumulate(metrics, samples, samples, count);
+}
+
+void metricsAddFlips(DISTORTION_METRICS* metrics, uint64_t flips) {
+    metrics->changed += flips;
+    metrics->noiseEnergy += (double)flips;
+    if (flips > 0 && metrics->maxError < 1) metrics->maxError = 1;
+}
+
+double metricsQuality(const DISTORTION_METRICS* metrics) {
+    if (metrics->noiseEnergy == 0.0) return INFINITY;
+    if (metrics->type == TYPE_BMP) {
+        double mse = metrics->noiseEnergy / (double)(metrics->samples ? metrics->samples : 1);
+        return 10.0 * log10(255.0 * 255.0 / mse);
+    }
+    return 10.0 * log10(metrics->signalEnergy / metrics->noiseEnergy);
+}
+
+void metricsReport(const DISTORTION_METRICS* metrics, int format, FILE* output) {
+    double quality = metricsQuality(metrics);
+    double mse = metrics->samples ? metrics->noiseEnergy / (double)metrics->samples : 0.0;
+    const char* name = metrics->type == TYPE_BMP ? "psnr_db" : "snr_db";
+    if (format == METRICS_JSON) {
+        fprintf(output, "{\"carrier\": \"%s\", \"samples\": %llu, \"changed\": %llu, \"mse\": %.9g, \"max_error\": %llu, ",
+            metrics->type == TYPE_BMP ? "bmp" : "wav", (unsigned long long)metrics->samples,
+            (unsigned long long)metrics->changed, mse, (unsigned long long)metrics->maxError);
+        if (isinf(quality)) fprintf(output, "\"%s\": null}\n", name);
+        else fprintf(output, "\"%s\": %.4f}\n", name, quality);
+        return;
+    }
+    fprintf(output, "|| Distortion: %llu of %llu %s changed, MSE %.6g, max error %llu, %s %.2f dB\n",
+        (unsigned long long)metrics->changed, (unsigned long long)metrics->samples,
+        metrics->type == TYPE_BMP ? "bytes" : "samples", mse, (unsigned long long)metrics->maxError,
+        metrics->type == TYPE_BMP ? "PSNR" : "SNR", quality);
+}
+
+int metricsExceeded(const DISTORTION_METRICS* metrics, double minQuality) {
+    double quality = metricsQuality(metrics);
+    if (quality >= minQuality) return 0;
+    fprintf(stderr, "Error: %s of %.2f dB is below the %.2f dB limit, discarding the encoded carrier\n",
+        metrics->type == TYPE_BMP ? "PSNR" : "SNR", quality, minQuality);
+    return 1;
+}
@@ -0,0 +1,40 @@
+//
+// Distortion metrics accumulated while the encoders change the carrier:
+// SNR and peak error for WAV, PSNR and peak error for BMP.
+//
+#ifndef STEG_METRICS_H
+#define STEG_METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "carrier.h"
+
+enum MetricsFormats {
+    METRICS_OFF,
+    METRICS_TEXT,
+    METRICS_JSON
+};
+
+typedef struct DistortionMetrics {
+    int type;            // TYPE_WAV or TYPE_BMP
+    uint32_t stride;     // bytes per sample (1 for BMP)
+    uint64_t samples;    // samples (WAV) or bytes (BMP) accounted for
+    uint64_t changed;    // ... of which the encoder changed
+    double signalEnergy; // sum of squared original samples (WAV only)
+    double noiseEnergy;  // sum of squared errors
+    uint64_t maxError;   // largest absolute error, in sample units
+} DISTORTION_METRICS;
+
+void metricsInit(DISTORTION_METRICS* metrics, const CARRIER_LAYOUT* layout);
+// Account for count samples going from before to after (either may be the same buffer as the other)
+void metricsAccumulate(DISTORTION_METRICS* metrics, const uint8_t* before, const uint8_t* after, uint64_t count);
+// Samples passed through unchanged
+void metricsAddSignal(DISTORTION_METRICS* metrics, const uint8_t* samples, uint64_t count);
+// Samples whose LSB slot was flipped (error of exactly 1), already counted by metricsAddSignal
+void metricsAddFlips(DISTORTION_METRICS* metrics, uint64_t flips);
+// SNR (WAV) or PSNR (BMP) in dB; INFINITY if nothing changed
+double metricsQuality(const DISTORTION_METRICS* metrics);
+void metricsReport(const DISTORTION_METRICS* metrics, int format, FILE* output);
+// 1 if the quality is below minQuality dB (printing why), 0 otherwise
+int metricsExceeded(const DISTORTION_METRICS* metrics, double minQuality);
+#endif //STEG_METRICS_H
@@ -0,0 +1,689 @@
+#include "palette.h"
+#include "bmp.h"
+#include "carrier.h"
+#include "stream.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#define lseek _lseeki64
+#else
+#include <unistd.h>
+#endif
+// pshufb lookups need SSSE3 (AVX2 for 32 bytes at a time); picked at run time like the FEC kernels
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define STEG_PALETTE_SSSE3
+#endif
+
+typedef struct PaletteImage {
+    uint32_t width;
+    uint32_t height;
+    uint32_t bpp;
+    uint32_t rowStride;  // bytes per stored row, padding included
+    uint32_t pixelBytes; // bytes of each row that hold pixels
+    uint32_t infoSize;   // info header size (40, or more for V4/V5 headers)
+    uint32_t colors;     // colour table entries
+    uint32_t dataOffset;
+    uint32_t compression; // BMP_RGB, BMP_RLE8 or BMP_RLE4
+    uint32_t imageSize;   // bytes of RLE data (0 if the header doesn't say)
+} PALETTE_IMAGE;
+
+// Buffered reads from the carrier, rows being far smaller than a useful read()
+typedef struct PaletteReader {
+    int fd;
+    uint8_t buffer[STREAM_CHUNK_SIZE];
+    size_t position;
+    size_t length;
+    uint64_t consumed; // bytes handed out so far, header included
+} PALETTE_READER;
+
+typedef struct PaletteWriter {
+    int fd;
+    uint8_t buffer[STREAM_CHUNK_SIZE];
+    size_t length;
+    uint64_t written;
+    // RLE through a pipe: everything is held back until the header sizes are known
+    int holding;
+    uint8_t* held;
+    size_t heldLength;
+    size_t heldSize;
+} PALETTE_WRITER;
+
+// Where an RLE decode left off: rows and pixels passed over by a delta, or the end of the bitmap
+typedef struct RleState {
+    uint32_t skipRows;
+    uint32_t startX;
+    int ended;
+} RLE_STATE;
+
+// Payload header and bytes (see STREAM_PAYLOAD), low bit first
+typedef struct PayloadBits {
+    STREAM_PAYLOAD* source;
+    int value;
+    int bitIndex;
+} PAYLOAD_BITS;
+
+#ifdef STEG_PALETTE_SSSE3
+static int cpuChecked = 0;
+static int haveSsse3 = 0;
+static int haveAvx2 = 0;
+#endif
+
+int paletteHeader(const uint8_t* header) {
+    BMP_INFO_HEADER infoHeader;
+    memcpy(&infoHeader, header + sizeof(BMP_FILE_HEADER), sizeof(BMP_INFO_HEADER));
+    return header[0] == 'B' && header[1] == 'M' && infoHeader.bitsPerPixel > 0 && infoHeader.bitsPerPixel <= 8;
+}
+
+int paletteCarrierFile(const char* path) {
+    uint8_t header[BMP_HEADER_SIZE];
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return 0;
+    int indexed = fread(header, 1, BMP_HEADER_SIZE, file) == BMP_HEADER_SIZE && paletteHeader(header);
+    fclose(file);
+    return indexed;
+}
+
+static int parsePaletteHeader(const uint8_t* header, PALETTE_IMAGE* image) {
+    BMP_FILE_HEADER fileHeader;
+    BMP_INFO_HEADER infoHeader;
+    memcpy(&fileHeader, header, sizeof(BMP_FILE_HEADER));
+    memcpy(&infoHeader, header + sizeof(BMP_FILE_HEADER), sizeof(BMP_INFO_HEADER));
+    int32_t height = (int32_t)infoHeader.height;
+    uint32_t bpp = infoHeader.bitsPerPixel;
+    if (bpp != 1 && bpp != 2 && bpp != 4 && bpp != 8) {
+        fprintf(stderr, "Error: Indexed BMPs must have 1, 2, 4 or 8 bits per pixel!\n");
+        return 0;
+    }
+    if (infoHeader.compressionType != BMP_RGB && !(infoHeader.compressionType == BMP_RLE8 && bpp == 8)
+        && !(infoHeader.compressionType == BMP_RLE4 && bpp == 4)) {
+        fprintf(stderr, "ERROR: Only RLE8 (8-bit) and RLE4 (4-bit) compressed BMP files are supported.\n");
+        return 0;
+    }
+    if (infoHeader.infoHeaderSize < sizeof(BMP_INFO_HEADER) || infoHeader.width == 0 || height == 0
+        || infoHeader.width > (UINT32_MAX - 31) / bpp) {
+        fprintf(stderr, "Error: Unsupported BMP header!\n");
+        return 0;
+    }
+    image->width = infoHeader.width;
+    image->height = (uint32_t)(height < 0 ? -(int64_t)height : height);
+    image->bpp = bpp;
+    image->rowStride = (uint32_t)(((uint64_t)image->width * bpp + 31) / 32 * 4);
+    image->pixelBytes = (uint32_t)(((uint64_t)image->width * bpp + 7) / 8);
+    image->infoSize = infoHeader.infoHeaderSize;
+    image->colors = infoHeader.colorsUsed ? infoHeader.colorsUsed : 1u << bpp;
+    image->dataOffset = fileHeader.dataOffset;
+    image->compression = infoHeader.compressionType;
+    image->imageSize = infoHeader.imageSize;
+    if (image->colors > 1u << bpp || image->dataOffset > PALETTE_MAX_HEADER
+        || (uint64_t)sizeof(BMP_FILE_HEADER) + image->infoSize + 4ull * image->colors > image->dataOffset) {
+        fprintf(stderr, "Error: Bad BMP colour table!\n");
+        return 0;
+    }
+    return 1;
+}
+
+static int readerGet(PALETTE_READER* reader, uint8_t* out, size_t count) {
+    while (count > 0) {
+        if (reader->position == reader->length) {
+            long long n = readFull(reader->fd, reader->buffer, sizeof(reader->buffer));
+            if (n <= 0) return 0;
+            reader->position = 0;
+            reader->length = (size_t)n;
+        }
+        size_t take = reader->length - reader->position;
+        if (take > count) take = count;
+        memcpy(out, reader->buffer + reader->position, take);
+        reader->position += take;
+        reader->consumed += take;
+        out += take;
+        count -= take;
+    }
+    return 1;
+}
+
+// Next byte of the carrier, -1 at the end
+static inline int readerByte(PALETTE_READER* reader) {
+    uint8_t value;
+    if (reader->position < reader->length) {
+        reader->consumed++;
+        return reader->buffer[reader->position++];
+    }
+    return readerGet(reader, &value, 1) ? value : -1;
+}
+
+static void readerSkip(PALETTE_READER* reader, uint64_t count) {
+    uint8_t skip[4096];
+    while (count > 0) {
+        size_t want = count < sizeof(skip) ? (size_t)count : sizeof(skip);
+        if (!readerGet(reader, skip, want)) return;
+        count -= want;
+    }
+}
+
+static int writerPut(PALETTE_WRITER* writer, const uint8_t* data, size_t count) {
+    if (writer->holding) {
+        if (writer->heldLength + count > writer->heldSize) {
+            size_t size = writer->heldSize ? 2 * writer->heldSize : STREAM_CHUNK_SIZE;
+            while (size < writer->heldLength + count) size *= 2;
+            uint8_t* bigger = (uint8_t*)realloc(writer->held, size);
+            if (bigger == NULL) {
+                fprintf(stderr, "Error: not enough memory to hold the re-encoded RLE data\n");
+                return 0;
+            }
+            writer->held = bigger;
+            writer->heldSize = size;
+        }
+        memcpy(writer->held + writer->heldLength, data, count);
+        writer->heldLength += count;
+        writer->written += count;
+        return 1;
+    }
+    while (count > 0) {
+        if (writer->length == sizeof(writer->buffer)) {
+            if (!writeFull(writer->fd, writer->buffer, writer->length)) return 0;
+            writer->length = 0;
+        }
+        size_t take = sizeof(writer->buffer) - writer->length;
+        if (take > count) take = count;
+        memcpy(writer->buffer + writer->length, data, take);
+        writer->length += take;
+        writer->written += take;
+        data += take;
+        count -= take;
+    }
+    return 1;
+}
+
+static int writerFlush(PALETTE_WRITER* writer) {
+    int ok = writeFull(writer->fd, writer->buffer, writer->length);
+    writer->length = 0;
+    return ok;
+}
+
+// Write out everything held back, and stop holding
+static int writerRelease(PALETTE_WRITER* writer) {
+    int ok = writeFull(writer->fd, writer->held, writer->heldLength);
+    free(writer->held);
+    writer->held = NULL;
+    writer->heldLength = writer->heldSize = 0;
+    writer->holding = 0;
+    return ok;
+}
+
+// Header, extra info header fields, colour table and any gap up to the pixel data
+static uint8_t* readPaletteHeader(const uint8_t* header, PALETTE_READER* reader, const PALETTE_IMAGE* image) {
+    uint8_t* meta = (uint8_t*)malloc(image->dataOffset);
+    if (meta == NULL) {
+        fprintf(stderr, "Could not allocate BMP header!\n");
+        return NULL;
+    }
+    memcpy(meta, header, BMP_HEADER_SIZE);
+    if (!readerGet(reader, meta + BMP_HEADER_SIZE, image->dataOffset - BMP_HEADER_SIZE)) {
+        fprintf(stderr, "Error: Carrier ended early!\n");
+        free(meta);
+        return NULL;
+    }
+    return meta;
+}
+
+static inline uint32_t colorLuma(const uint8_t* bgra) {
+    return 29u * bgra[0] + 150u * bgra[1] + 77u * bgra[2];
+}
+
+// Perceptually weighted squared distance between two colour table entries
+static inline uint32_t colorDistance(const uint8_t* a, const uint8_t* b) {
+    int db = a[0] - b[0], dg = a[1] - b[1], dr = a[2] - b[2];
+    return (uint32_t)(3 * db * db + 4 * dg * dg + 2 * dr * dr);
+}
+
+// Order the colour table in pairs: the darkest colour left, then the entry closest to it, and so on. With keepZero,
+// index 0 (the colour viewers fill pixels an RLE image skips with) leads the first pair instead. remap gets each
+// old index's new one. An odd entry out is paired with a copy of itself, so sorted can have colors + 1 entries.
+static uint32_t pairColors(const uint8_t* palette, uint32_t colors, int keepZero, uint8_t* sorted, uint8_t* remap) {
+    uint8_t used[256] = { 0 };
+    uint32_t count = 0;
+    for (uint32_t paired = 0; paired < colors; ) {
+        uint32_t first = colors;
+        for (uint32_t i = 0; i < colors; i++) {
+            if (used[i]) continue;
+            if (first == colors || ((paired > 0 || !keepZero) && colorLuma(palette + 4 * i) < colorLuma(palette + 4 * first))) first = i;
+        }
+        uint32_t second = colors;
+        for (uint32_t i = 0; i < colors; i++) {
+            if (used[i] || i == first) continue;
+            if (second == colors || colorDistance(palette + 4 * i, palette + 4 * first)
+                < colorDistance(palette + 4 * second, palette + 4 * first)) second = i;
+        }
+        used[first] = 1;
+        remap[first] = (uint8_t)count;
+        memcpy(sorted + 4 * count++, palette + 4 * first, 4);
+        paired++;
+        if (second == colors) {
+            memcpy(sorted + 4 * count++, palette + 4 * first, 4);
+            break;
+        }
+        used[second] = 1;
+        remap[second] = (uint8_t)count;
+        memcpy(sorted + 4 * count++, palette + 4 * second, 4);
+        paired++;
+    }
+    return count;
+}
+
+// Per-byte form of the index remap, covering every pixel packed into the byte
+static int buildByteMap(const uint8_t* remap, uint32_t bpp, uint8_t* byteMap) {
+    uint32_t mask = (1u << bpp) - 1;
+    int identity = 1;
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t mapped = 0;
+        for (uint32_t shift = 0; shift < 8; shift += bpp) mapped |= (uint32_t)remap[(b >> shift) & mask] << shift;
+        byteMap[b] = (uint8_t)mapped;
+        identity &= mapped == b;
+    }
+    return identity;
+}
+
+#ifdef STEG_PALETTE_SSSE3
+// 256-entry lookup as 16 pshufbs over 16-entry slices: subtracting the slice base and adding 0x70 with unsigned
+// saturation leaves bytes in the slice at 0x70-0x7F and sets the high bit (pshufb's zeroing bit) of all others
+__attribute__((target("ssse3")))
+static size_t remapBytesSSSE3(uint8_t* data, size_t count, const uint8_t* byteMap) {
+    __m128i table[16];
+    for (int h = 0; h < 16; h++) table[h] = _mm_loadu_si128((const __m128i*)(byteMap + 16 * h));
+    const __m128i bias = _mm_set1_epi8(0x70);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i result = _mm_setzero_si128();
+        for (int h = 0; h < 16; h++) {
+            __m128i index = _mm_adds_epu8(_mm_sub_epi8(v, _mm_set1_epi8((char)(16 * h))), bias);
+            result = _mm_or_si128(result, _mm_shuffle_epi8(table[h], index));
+        }
+        _mm_storeu_si128((__m128i*)(data + i), result);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t remapBytesAVX2(uint8_t* data, size_t count, const uint8_t* byteMap) {
+    __m256i table[16];
+    for (int h = 0; h < 16; h++) table[h] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(byteMap + 16 * h)));
+    const __m256i bias = _mm256_set1_epi8(0x70);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m256i result = _mm256_setzero_si256();
+        for (int h = 0; h < 16; h++) {
+            __m256i index = _mm256_adds_epu8(_mm256_sub_epi8(v, _mm256_set1_epi8((char)(16 * h))), bias);
+            result = _mm256_or_si256(result, _mm256_shuffle_epi8(table[h], index));
+        }
+        _mm256_storeu_si256((__m256i*)(data + i), result);
+    }
+    return i;
+}
+#endif
+
+static void remapBytes(uint8_t* data, size_t count, const uint8_t* byteMap) {
+    size_t i = 0;
+#ifdef STEG_PALETTE_SSSE3
+    if (!cpuChecked) {
+        __builtin_cpu_init();
+        haveSsse3 = __builtin_cpu_supports("ssse3");
+        haveAvx2 = __builtin_cpu_supports("avx2");
+        cpuChecked = 1;
+    }
+    if (haveAvx2) i = remapBytesAVX2(data, count, byteMap);
+    else if (haveSsse3) i = remapBytesSSSE3(data, count, byteMap);
+#endif
+    for (; i < count; i++) data[i] = byteMap[data[i]];
+}
+
+static inline void putIndex(uint8_t* row, uint32_t x, uint32_t bpp, uint32_t value) {
+    if (bpp == 8) row[x] = (uint8_t)value;
+    else row[x >> 1] |= (uint8_t)(x & 1 ? value & 0x0F : value << 4);
+}
+
+// Decode one row of RLE8/RLE4 data into packed indices. Pixels the data skips over (deltas, early end of line or
+// bitmap) come out as index 0, the colour viewers fill them with. Returns 0 if the carrier ends mid-row.
+static int readRleRow(PALETTE_READER* reader, const PALETTE_IMAGE* image, RLE_STATE* state, uint8_t* row) {
+    int rle4 = image->compression == BMP_RLE4;
+    memset(row, 0, image->rowStride);
+    if (state->ended) return 1;
+    if (state->skipRows > 0) {
+        state->skipRows--;
+        return 1;
+    }
+    uint64_t x = state->startX;
+    state->startX = 0;
+    for (;;) {
+        int count = readerByte(reader);
+        int value = readerByte(reader);
+        if (count < 0 || value < 0) return 0;
+        if (count > 0) {
+            // encoded run; RLE4 alternates the two nibbles
+            for (int i = 0; i < count && x < image->width; i++, x++) {
+                putIndex(row, (uint32_t)x, image->bpp, (uint32_t)(rle4 ? (i & 1 ? value & 0x0F : value >> 4) : value));
+            }
+            continue;
+        }
+        if (value == 0) return 1;
+        if (value == 1) {
+            state->ended = 1;
+            return 1;
+        }
+        if (value == 2) {
+            int dx = readerByte(reader);
+            int dy = readerByte(reader);
+            if (dx < 0 || dy < 0) return 0;
+            x += (uint32_t)dx;
+            if (dy > 0) {
+                state->skipRows = (uint32_t)dy - 1;
+                state->startX = x < image->width ? (uint32_t)x : image->width;
+                return 1;
+            }
+            continue;
+        }
+        // absolute run of value pixels, padded to a 16-bit boundary
+        uint8_t literal[256];
+        uint32_t bytes = rle4 ? ((uint32_t)value + 1) / 2 : (uint32_t)value;
+        if (!readerGet(reader, literal, bytes + (bytes & 1))) return 0;
+        for (int i = 0; i < value && x < image->width; i++, x++) {
+            putIndex(row, (uint32_t)x, image->bpp, rle4 ? (i & 1 ? literal[i / 2] & 0x0F : literal[i / 2] >> 4) : literal[i]);
+        }
+    }
+}
+
+// Next stored row of pixel indices, whatever the compression
+static int readPaletteRow(PALETTE_READER* reader, const PALETTE_IMAGE* image, RLE_STATE* state, uint8_t* row) {
+    if (image->compression == BMP_RGB) return readerGet(reader, row, image->rowStride);
+    return readRleRow(reader, image, state, row);
+}
+
+// Re-encode a row of indices (one per byte in pixels) as RLE8/RLE4: runs of three or more identical pixels as
+// encoded runs, stretches in between as absolute runs, then end of line. RLE4 absolute runs are kept to an even
+// length, which some decoders get wrong otherwise; the odd pixels out go as two-colour encoded runs.
+static int writeRleRow(PALETTE_WRITER* writer, const uint8_t* pixels, const PALETTE_IMAGE* image) {
+    int rle4 = image->compression == BMP_RLE4;
+    uint8_t out[2 + 128 + 1];
+    uint32_t width = image->width;
+    for (uint32_t x = 0; x < width; ) {
+        uint32_t run = 1;
+        while (x + run < width && run < 255 && pixels[x + run] == pixels[x]) run++;
+        if (run >= 3) {
+            out[0] = (uint8_t)run;
+            out[1] = (uint8_t)(rle4 ? pixels[x] << 4 | pixels[x] : pixels[x]);
+            if (!writerPut(writer, out, 2)) return 0;
+            x += run;
+            continue;
+        }
+        uint32_t length = 0;
+        while (x + length < width && length < (rle4 ? 254u : 255u)) {
+            const uint8_t* p = pixels + x + length;
+            if (x + length + 2 < width && p[0] == p[1] && p[1] == p[2]) break;
+            length++;
+        }
+        uint32_t absolute = rle4 ? (length >= 4 ? length & ~1u : 0) : (length >= 3 ? length : 0);
+        if (absolute) {
+            uint32_t bytes = rle4 ? absolute / 2 : absolute;
+            out[0] = 0;
+            out[1] = (uint8_t)absolute;
+            if (!writerPut(writer, out, 2)) return 0;
+            if (rle4) {
+                for (uint32_t i = 0; i < bytes; i++) out[i] = (uint8_t)(pixels[x + 2 * i] << 4 | pixels[x + 2 * i + 1]);
+                out[bytes] = 0;
+                if (!writerPut(writer, out, bytes + (bytes & 1))) return 0;
+            }
+            else {
+                static const uint8_t pad = 0;
+                if (!writerPut(writer, pixels + x, bytes) || ((bytes & 1) && !writerPut(writer, &pad, 1))) return 0;
+            }
+        }
+        for (uint32_t i = absolute; i < length; ) {
+            uint32_t count = rle4 && i + 1 < length ? 2 : 1;
+            out[0] = (uint8_t)count;
+            out[1] = (uint8_t)(rle4 ? pixels[x + i] << 4 | (count == 2 ? pixels[x + i + 1] : 0) : pixels[x + i]);
+            if (!writerPut(writer, out, 2)) return 0;
+            i += count;
+        }
+        x += length;
+    }
+    out[0] = 0;
+    out[1] = 0;
+    return writerPut(writer, out, 2);
+}
+
+static inline uint32_t pixelIndex(const uint8_t* row, uint64_t x, uint32_t bpp) {
+    uint64_t position = x * bpp;
+    return (row[position >> 3] >> (8 - bpp - (position & 7))) & ((1u << bpp) - 1);
+}
+
+// -1 once the whole payload has gone out
+static inline int nextPayloadBit(PAYLOAD_BITS* bits) {
+    if (bits->bitIndex == 8) {
+        int c = streamPayloadNext(bits->source);
+        if (c < 0) return -1;
+        bits->value = c;
+        bits->bitIndex = 0;
+    }
+    return (bits->value >> bits->bitIndex++) & 1;
+}
+
+static inline int payloadDone(const PAYLOAD_BITS* bits) {
+    return bits->source->remaining == 0 && bits->bitIndex == 8;
+}
+
+static void embedRow(uint8_t* row, const PALETTE_IMAGE* image, PAYLOAD_BITS* bits) {
+    if (image->bpp == 8) {
+        for (uint32_t x = 0; x < image->width; x++) {
+            int bit = nextPayloadBit(bits);
+            if (bit < 0) return;
+            row[x] = (uint8_t)((row[x] & 0xFE) | bit);
+        }
+        return;
+    }
+    for (uint64_t x = 0; x < image->width; x++) {
+        int bit = nextPayloadBit(bits);
+        if (bit < 0) return;
+        uint64_t position = x * image->bpp;
+        int shift = 8 - (int)image->bpp - (int)(position & 7);
+        row[position >> 3] = (uint8_t)((row[position >> 3] & ~(1 << shift)) | (bit << shift));
+    }
+}
+
+// Colours of a row of indices, for the distortion metrics
+static void expandRow(const uint8_t* row, const PALETTE_IMAGE* image, const uint8_t* palette, uint32_t colors, uint8_t* bgr) {
+    for (uint64_t x = 0; x < image->width; x++) {
+        uint32_t index = pixelIndex(row, x, image->bpp);
+        const uint8_t* color = palette + 4 * (index < colors ? index : 0);
+        memcpy(bgr + 3 * x, color, 3);
+    }
+}
+
+int encodePalette(const uint8_t* header, int carrier_fd, FILE* payload, int out_fd, DISTORTION_METRICS* metrics) {
+    PALETTE_IMAGE image;
+    if (!parsePaletteHeader(header, &image)) return -1;
+    PALETTE_READER* reader = (PALETTE_READER*)malloc(sizeof(PALETTE_READER));
+    PALETTE_WRITER* writer = (PALETTE_WRITER*)malloc(sizeof(PALETTE_WRITER));
+    uint8_t* row = (uint8_t*)malloc(image.rowStride);
+    // RLE re-encoding works on one index per byte
+    uint8_t* pixels = image.compression == BMP_RLE4 ? (uint8_t*)malloc(image.width) : row;
+    uint8_t* before = metrics != NULL ? (uint8_t*)malloc(3 * (size_t)image.width) : NULL;
+    uint8_t* after = metrics != NULL ? (uint8_t*)malloc(3 * (size_t)image.width) : NULL;
+    uint8_t* meta = NULL;
+    STREAM_PAYLOAD source = { 0 };
+    int result = -1;
+    if (reader == NULL || writer == NULL || row == NULL || pixels == NULL || (metrics != NULL && (before == NULL || after == NULL))) {
+        fprintf(stderr, "Could not allocate stream buffer!\n");
+    }
+    else {
+        reader->fd = carrier_fd;
+        reader->position = reader->length = 0;
+        reader->consumed = BMP_HEADER_SIZE;
+        writer->fd = out_fd;
+        writer->length = 0;
+        writer->written = 0;
+        writer->holding = 0;
+        writer->held = NULL;
+        writer->heldLength = writer->heldSize = 0;
+        meta = readPaletteHeader(header, reader, &image);
+    }
+    // one bit per pixel
+    if (meta != NULL && streamPayloadOpen(&source, payload, (uint64_t)image.width * image.height / 8)) {
+        uint32_t tableOffset = (uint32_t)sizeof(BMP_FILE_HEADER) + image.infoSize;
+        const uint8_t* palette = meta + tableOffset;
+        uint8_t sorted[4 * 257];
+        uint8_t remap[256];
+        uint8_t byteMap[256];
+        for (uint32_t i = 0; i < 256; i++) remap[i] = (uint8_t)i;
+        uint32_t colors = pairColors(palette, image.colors, image.compression != BMP_RGB, sorted, remap);
+        int identity = buildByteMap(remap, image.bpp, byteMap);
+        // a duplicated odd entry out grows the colour table by one, which moves the pixel data along
+        uint32_t grow = 4 * (colors - image.colors);
+        BMP_FILE_HEADER fileHeader;
+        BMP_INFO_HEADER infoHeader;
+        memcpy(&fileHeader, meta, sizeof(BMP_FILE_HEADER));
+        memcpy(&infoHeader, meta + sizeof(BMP_FILE_HEADER), sizeof(BMP_INFO_HEADER));
+        if (grow) {
+            fileHeader.dataOffset += grow;
+            if (fileHeader.fileSize) fileHeader.fileSize += grow;
+            infoHeader.colorsUsed = colors;
+        }
+        if (metrics != NULL) {
+            CARRIER_LAYOUT layout = { TYPE_BMP, fileHeader.dataOffset, 0, 1, 3, 0 };
+            metricsInit(metrics, &layout);
+        }
+        PAYLOAD_BITS bits = { &source, 0, 8 };
+        RLE_STATE rle = { 0, 0, 0 };
+        // re-encoded RLE data rarely comes out the size it went in, so the size fields are patched afterwards;
+        // -1 if the output can't seek back (a pipe), in which case the output is held until they're known
+        long long headerPosition = image.compression != BMP_RGB ? (long long)lseek(out_fd, 0, SEEK_CUR) : -1;
+        writer->holding = image.compression != BMP_RGB && headerPosition < 0;
+        uint64_t dataStart = 0;
+        uint64_t rleSize = 0;
+        result = 0;
+        if (!writerPut(writer, (const uint8_t*)&fileHeader, sizeof(fileHeader))
+            || !writerPut(writer, (const uint8_t*)&infoHeader, sizeof(infoHeader))
+            || !writerPut(writer, meta + BMP_HEADER_SIZE, tableOffset - BMP_HEADER_SIZE)
+            || !writerPut(writer, sorted, 4 * (size_t)colors)
+            || !writerPut(writer, palette + 4 * image.colors, image.dataOffset - tableOffset - 4 * image.colors)) {
+            result = -1;
+        }
+        dataStart = writer->written;
+        for (uint32_t y = 0; y < image.height && result == 0; y++) {
+            // past the end of the bitmap with the payload in, the rest can stay skipped as it was
+            if (rle.ended && payloadDone(&bits)) break;
+            if (!readPaletteRow(reader, &image, &rle, row)) {
+                fprintf(stderr, "Error: Carrier ended early!\n");
+                result = -1;
+                break;
+            }
+            if (before != NULL) expandRow(row, &image, palette, image.colors, before);
+            if (!identity) remapBytes(row, image.pixelBytes, byteMap);
+            if (!payloadDone(&bits)) embedRow(row, &image, &bits);
+            if (after != NULL) {
+                expandRow(row, &image, sorted, colors, after);
+                metricsAccumulate(metrics, before, after, 3 * (uint64_t)image.width);
+            }
+            if (image.compression == BMP_RGB) {
+                if (!writerPut(writer, row, image.rowStride)) result = -1;
+                continue;
+            }
+            if (pixels != row) {
+                for (uint32_t x = 0; x < image.width; x++) pixels[x] = (uint8_t)pixelIndex(row, x, image.bpp);
+            }
+            if (!writeRleRow(writer, pixels, &image)) result = -1;
+        }
+        if (result == 0 && image.compression != BMP_RGB) {
+            static const uint8_t endOfBitmap[2] = { 0, 1 };
+            if (!writerPut(writer, endOfBitmap, 2)) result = -1;
+            // drop whatever padding followed the old RLE data
+            uint64_t oldEnd = (uint64_t)image.dataOffset + image.imageSize;
+            if (image.imageSize && reader->consumed < oldEnd) readerSkip(reader, oldEnd - reader->consumed);
+            rleSize = writer->written - dataStart;
+            if (result == 0 && writer->holding) {
+                // the file grows or shrinks by the change in RLE data, the bytes after it go through as they are
+                int64_t fileSize = (int64_t)fileHeader.fileSize + (int64_t)rleSize - (int64_t)(reader->consumed - image.dataOffset);
+                uint32_t fileSize32 = fileHeader.fileSize == 0 || fileSize <= 0 || fileSize > 0xFFFFFFFF ? 0 : (uint32_t)fileSize;
+                uint32_t rleSize32 = rleSize > 0xFFFFFFFF ? 0 : (uint32_t)rleSize;
+                memcpy(writer->held + 2, &fileSize32, 4);
+                memcpy(writer->held + sizeof(BMP_FILE_HEADER) + 20, &rleSize32, 4);
+                if (!writerRelease(writer)) result = -1;
+            }
+        }
+        if (result == 0 && !payloadDone(&bits)) {
+            fprintf(stderr, "ERROR: Encode data too large for carrier!\n");
+            result = -1;
+        }
+        // whatever follows the pixel data goes through as is
+        if (result == 0 && (!writerPut(writer, reader->buffer + reader->position, reader->length - reader->position)
+            || !writerFlush(writer) || !streamForward(carrier_fd, out_fd))) {
+            result = -1;
+        }
+        if (result == 0 && headerPosition >= 0) {
+            long long end = (long long)lseek(out_fd, 0, SEEK_CUR);
+            uint32_t rleSize32 = rleSize > 0xFFFFFFFF ? 0 : (uint32_t)rleSize;
+            uint32_t fileSize = end - headerPosition > 0xFFFFFFFF ? 0 : (uint32_t)(end - headerPosition);
+            if (end < 0 || lseek(out_fd, headerPosition + 2, SEEK_SET) < 0 || !writeFull(out_fd, &fileSize, 4)
+                || lseek(out_fd, headerPosition + sizeof(BMP_FILE_HEADER) + 20, SEEK_SET) < 0 || !writeFull(out_fd, &rleSize32, 4)
+                || lseek(out_fd, end, SEEK_SET) < 0) {
+                fprintf(stderr, "Error: Could not update the BMP header sizes\n");
+                result = -1;
+            }
+        }
+    }
+    streamPayloadClose(&source);
+    free(meta);
+    free(reader);
+    if (writer != NULL) free(writer->held);
+    free(writer);
+    if (pixels != row) free(pixels);
+    free(row);
+    free(before);
+    free(after);
+    return result;
+}
+
+int decodePalette(const uint8_t* header, int carrier_fd, FILE* output) {
+    PALETTE_IMAGE image;
+    if (!parsePaletteHeader(header, &image)) return -1;
+    PALETTE_READER* reader = (PALETTE_READER*)malloc(sizeof(PALETTE_READER));
+    uint8_t* row = (uint8_t*)malloc(image.rowStride);
+    uint8_t* meta = NULL;
+    if (reader == NULL || row == NULL) {
+        fprintf(stderr, "Could not allocate stream buffer!\n");
+    }
+    else {
+        reader->fd = carrier_fd;
+        reader->position = reader->length = 0;
+        reader->consumed = BMP_HEADER_SIZE;
+        meta = readPaletteHeader(header, reader, &image);
+    }
+    RLE_STATE rle = { 0, 0, 0 };
+    int result = meta != NULL ? 0 : -1;
+    STREAM_EXTRACT extract;
+    streamExtractInit(&extract, output, (uint64_t)image.width * image.height / 8);
+    uint8_t curChar = 0;
+    int bitIndex = 0;
+    int finished = 0;
+    for (uint32_t y = 0; y < image.height && result == 0 && !finished; y++) {
+        // a carrier cut short ends the payload early, as with decode_Stream
+        if (!readPaletteRow(reader, &image, &rle, row)) break;
+        for (uint64_t x = 0; x < image.width; x++) {
+            curChar |= (pixelIndex(row, x, image.bpp) & 1) << bitIndex;
+            if (++bitIndex < 8) continue;
+            if (!streamExtractByte(&extract, curChar)) {
+                finished = 1;
+                break;
+            }
+            curChar = 0;
+            bitIndex = 0;
+        }
+    }
+    if (result == 0) result = streamExtractFinish(&extract);
+    free(meta);
+    free(reader);
+    free(row);
+    return result;
+}
@@ -0,0 +1,26 @@
+//
+// Palette (1/2/4/8-bit indexed) BMP carriers. The colour table is reordered so that entries 2k and 2k+1 are the
+// closest pair of colours left, which makes flipping an index LSB swap between near-identical colours; the pixels
+// are remapped to the new order through a byte lookup table while the image streams through a row at a time.
+// RLE8/RLE4 images are decoded a row at a time too, and re-encoded as RLE on the way out.
+//
+#ifndef STEG_PALETTE_H
+#define STEG_PALETTE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "metrics.h"
+
+// Largest gap between the colour table and the pixel data that is carried through
+#define PALETTE_MAX_HEADER (1 << 20)
+
+// 1 if a BMP header (BMP_HEADER_SIZE bytes) describes an indexed image, which the palette engine handles
+int paletteHeader(const uint8_t* header);
+// Same, for a carrier on disk
+int paletteCarrierFile(const char* path);
+
+// Same payload format as encode_Stream (header, then payload bytes), one bit per pixel. header holds the
+// BMP_HEADER_SIZE bytes already read from carrier_fd. metrics (may be NULL) measures the rendered colours.
+int encodePalette(const uint8_t* header, int carrier_fd, FILE* payload, int out_fd, DISTORTION_METRICS* metrics);
+int decodePalette(const uint8_t* header, int carrier_fd, FILE* output);
+#endif //STEG_PALETTE_H
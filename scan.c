@@ -0,0 +1,468 @@
+#include "scan.h"
+#include "mapfile.h"
+#include "threadpool.h"
+#include "mathutilities.h"
+#include "getopt.h"
+#include <math.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+// groups of 4 samples per channel handled per block
+#define SCAN_BLOCK_GROUPS 1024
+
+typedef struct ScanContext {
+    THREAD_POOL* pool;
+    uint64_t regionBytes;
+    int printRegions;
+    pthread_mutex_t outputLock;
+    uint64_t skippedFiles; // files that weren't scanned, under outputLock
+} SCAN_CONTEXT;
+
+typedef struct ScanFile {
+    SCAN_CONTEXT* context;
+    char* path;
+    MAPPED_FILE map;
+    CARRIER_LAYOUT layout;
+    const uint8_t* data;
+    uint32_t bins;
+    pthread_mutex_t lock;
+    uint32_t* histogram; // whole-file totals
+    LSB_COUNTS counts;
+    uint64_t regionsLeft;
+    uint64_t regionsSkipped; // left out of the totals for lack of memory
+} SCAN_FILE;
+
+typedef struct ScanRegion {
+    SCAN_FILE* file;
+    uint64_t firstSlot;
+    uint64_t numSlots;
+} SCAN_REGION;
+
+uint32_t lsbHistogramBins(const CARRIER_LAYOUT* layout) {
+    return layout->stride == 1 ? 256 : 65536;
+}
+
+// 8-bit samples/pixels are unsigned, 16-bit samples are signed
+static inline int32_t loadValue(const uint8_t* p, uint32_t stride) {
+    if (stride == 1) return p[0];
+    return (int16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t spaX(int32_t r, int32_t s) {
+    return ((s & 1) == 0 && r < s) | ((s & 1) == 1 && r > s);
+}
+
+static inline uint32_t spaY(int32_t r, int32_t s) {
+    return ((s & 1) == 0 && r > s) | ((s & 1) == 1 && r < s);
+}
+
+static inline uint32_t spaK(int32_t r, int32_t s) {
+    return (r >> 1) == (s >> 1);
+}
+
+static inline int32_t flipNeg(int32_t x) {
+    return ((x + 1) ^ 1) - 1;
+}
+
+// Branch-free over structure-of-arrays groups so the compiler can vectorize it.
+static void countGroups(const int32_t* g0, const int32_t* g1, const int32_t* g2, const int32_t* g3, uint32_t n, LSB_COUNTS* counts) {
+    uint32_t rm = 0, sm = 0, rn = 0, sn = 0;
+    uint32_t frm = 0, fsm = 0, frn = 0, fsn = 0;
+    uint32_t x = 0, y = 0, k = 0;
+    for (uint32_t j = 0; j < n; j++) {
+        int32_t a = g0[j], b = g1[j], c = g2[j], d = g3[j];
+        int32_t f0 = abs(b - a) + abs(c - b) + abs(d - c);
+        int32_t b1 = b ^ 1, c1 = c ^ 1;
+        int32_t fm = abs(b1 - a) + abs(c1 - b1) + abs(d - c1);
+        int32_t bn = flipNeg(b), cn = flipNeg(c);
+        int32_t fn = abs(bn - a) + abs(cn - bn) + abs(d - cn);
+        rm += fm > f0;
+        sm += fm < f0;
+        rn += fn > f0;
+        sn += fn < f0;
+
+        // same group with every LSB flipped
+        int32_t a1 = a ^ 1, d1 = d ^ 1;
+        int32_t ff0 = abs(b1 - a1) + abs(c1 - b1) + abs(d1 - c1);
+        int32_t ffm = abs(b - a1) + abs(c - b) + abs(d1 - c);
+        int32_t bfn = flipNeg(b1), cfn = flipNeg(c1);
+        int32_t ffn = abs(bfn - a1) + abs(cfn - bfn) + abs(d1 - cfn);
+        frm += ffm > ff0;
+        fsm += ffm < ff0;
+        frn += ffn > ff0;
+        fsn += ffn < ff0;
+
+        x += spaX(a, b) + spaX(b, c) + spaX(c, d);
+        y += spaY(a, b) + spaY(b, c) + spaY(c, d);
+        k += spaK(a, b) + spaK(b, c) + spaK(c, d);
+    }
+    counts->groups += n;
+    counts->regularM += rm;
+    counts->singularM += sm;
+    counts->regularNegM += rn;
+    counts->singularNegM += sn;
+    counts->flippedRegularM += frm;
+    counts->flippedSingularM += fsm;
+    counts->flippedRegularNegM += frn;
+    counts->flippedSingularNegM += fsn;
+    counts->pairs += 3 * (uint64_t)n;
+    counts->pairX += x;
+    counts->pairY += y;
+    counts->pairK += k;
+}
+
+void lsbCount(const CARRIER_LAYOUT* layout, const uint8_t* data, uint64_t numSlots, uint32_t* histogram, LSB_COUNTS* counts) {
+    uint32_t stride = layout->stride;
+    uint32_t channels = layout->channels;
+    int32_t offset = stride == 1 ? 0 : 32768;
+    uint32_t groupsPerBlock = SCAN_BLOCK_GROUPS * channels;
+    uint64_t slotsPerBlock = (uint64_t)groupsPerBlock * 4;
+    int32_t* lanes = (int32_t*)malloc(4 * groupsPerBlock * sizeof(int32_t));
+    if (lanes == NULL) {
+        fprintf(stderr, "Could not allocate scan buffer!\n");
+        return;
+    }
+    int32_t* g0 = lanes;
+    int32_t* g1 = lanes + groupsPerBlock;
+    int32_t* g2 = lanes + 2 * groupsPerBlock;
+    int32_t* g3 = lanes + 3 * groupsPerBlock;
+
+    uint64_t slot = 0;
+    while (slot < numSlots) {
+        uint64_t left = numSlots - slot;
+        uint64_t blockSlots = left < slotsPerBlock ? left : slotsPerBlock;
+        // only whole groups of 4 samples per channel go through RS/SPA
+        uint32_t groupsPerChannel = (uint32_t)(blockSlots / (4 * channels));
+        const uint8_t* base = data + slot * stride;
+        for (uint32_t q = 0; q < groupsPerChannel * 4; q++) {
+            int32_t* lane = lanes + (q & 3) * groupsPerBlock;
+            for (uint32_t ch = 0; ch < channels; ch++) {
+                int32_t value = loadValue(base + ((uint64_t)q * channels + ch) * stride, stride);
+                lane[ch * groupsPerChannel + (q >> 2)] = value;
+                histogram[value + offset]++;
+            }
+        }
+        for (uint64_t i = (uint64_t)groupsPerChannel * 4 * channels; i < blockSlots; i++) {
+            histogram[loadValue(base + i * stride, stride) + offset]++;
+        }
+        countGroups(g0, g1, g2, g3, groupsPerChannel * channels, counts);
+        slot += blockSlots;
+    }
+    free(lanes);
+}
+
+static double chiSquareScore(const uint32_t* histogram, uint32_t bins) {
+    double chi = 0.0;
+    int categories = 0;
+    for (uint32_t i = 0; i + 1 < bins; i += 2) {
+        double a = histogram[i], b = histogram[i + 1];
+        // expected count (a + b) / 2 has to be big enough for the approximation to hold
+        if (a + b < 10.0) continue;
+        chi += (a - b) * (a - b) / (2.0 * (a + b));
+        categories++;
+    }
+    if (categories < 2) return 0.0;
+    return regularizedGammaQ((categories - 1) / 2.0, chi / 2.0);
+}
+
+static double rsScore(const LSB_COUNTS* c) {
+    if (c->groups == 0) return 0.0;
+    double n = (double)c->groups;
+    double d0 = (c->regularM - (double)c->singularM) / n;
+    double d1 = (c->flippedRegularM - (double)c->flippedSingularM) / n;
+    double dn0 = (c->regularNegM - (double)c->singularNegM) / n;
+    double dn1 = (c->flippedRegularNegM - (double)c->flippedSingularNegM) / n;
+    double a = 2.0 * (d1 + d0);
+    double b = dn0 - dn1 - d1 - 3.0 * d0;
+    double cc = d0 - dn0;
+    double z;
+    if (fabs(a) < 1e-12) {
+        if (fabs(b) < 1e-12) return 0.0;
+        z = -cc / b;
+    }
+    else {
+        double disc = b * b - 4.0 * a * cc;
+        if (disc < 0.0) disc = 0.0;
+        double z1 = (-b + sqrt(disc)) / (2.0 * a);
+        double z2 = (-b - sqrt(disc)) / (2.0 * a);
+        z = fabs(z1) < fabs(z2) ? z1 : z2;
+    }
+    if (fabs(z - 0.5) < 1e-12) return 1.0;
+    return clamp((float)(z / (z - 0.5)), 0.0f, 1.0f);
+}
+
+static double spaScore(const LSB_COUNTS* c) {
+    if (c->pairK == 0) return 0.0;
+    double a = 2.0 * c->pairK;
+    double b = 2.0 * (2.0 * c->pairX - (double)c->pairs);
+    double cc = (double)c->pairY - (double)c->pairX;
+    double disc = b * b - 4.0 * a * cc;
+    if (disc < 0.0) return 0.0;
+    double bp = (-b + sqrt(disc)) / (2.0 * a);
+    double bm = (-b - sqrt(disc)) / (2.0 * a);
+    // the root is beta = p / 2
+    return clamp((float)(2.0 * (bp < bm ? bp : bm)), 0.0f, 1.0f);
+}
+
+void lsbScore(const uint32_t* histogram, uint32_t bins, const LSB_COUNTS* counts, LSB_SCORES* scores) {
+    scores->chiSquare = chiSquareScore(histogram, bins);
+    scores->rs = rsScore(counts);
+    scores->spa = spaScore(counts);
+}
+
+static void printScores(SCAN_CONTEXT* context, const char* path, const char* region, const LSB_SCORES* scores) {
+    pthread_mutex_lock(&context->outputLock);
+    printf("%s\t%s\t%.4f\t%.4f\t%.4f\n", path, region, scores->chiSquare, scores->rs, scores->spa);
+    fflush(stdout);
+    pthread_mutex_unlock(&context->outputLock);
+}
+
+static void countSkipped(SCAN_CONTEXT* context) {
+    pthread_mutex_lock(&context->outputLock);
+    context->skippedFiles++;
+    pthread_mutex_unlock(&context->outputLock);
+}
+
+static void finishFile(SCAN_FILE* file) {
+    LSB_SCORES scores;
+    if (file->regionsSkipped > 0) {
+        fprintf(stderr, "Warning: %llu region(s) of %s not scanned (not enough memory)\n",
+            (unsigned long long)file->regionsSkipped, file->path);
+    }
+    lsbScore(file->histogram, file->bins, &file->counts, &scores);
+    printScores(file->context, file->path, "all", &scores);
+    unmapFile(&file->map);
+    pthread_mutex_destroy(&file->lock);
+    free(file->histogram);
+    free(file->path);
+    free(file);
+}
+
+static void scanRegionTask(void* arg) {
+    SCAN_REGION* region = (SCAN_REGION*)arg;
+    SCAN_FILE* file = region->file;
+    uint32_t* histogram = (uint32_t*)calloc(file->bins, sizeof(uint32_t));
+    LSB_COUNTS counts;
+    memset(&counts, 0, sizeof(counts));
+    if (histogram != NULL) {
+        lsbCount(&file->layout, file->data + region->firstSlot * file->layout.stride, region->numSlots, histogram, &counts);
+        if (file->context->printRegions) {
+            LSB_SCORES scores;
+            char name[64];
+            lsbScore(histogram, file->bins, &counts, &scores);
+            snprintf(name, sizeof(name), "%llu+%llu",
+                (unsigned long long)(region->firstSlot * file->layout.stride),
+                (unsigned long long)(region->numSlots * file->layout.stride));
+            printScores(file->context, file->path, name, &scores);
+        }
+    }
+
+    pthread_mutex_lock(&file->lock);
+    if (histogram == NULL) file->regionsSkipped++;
+    else {
+        for (uint32_t i = 0; i < file->bins; i++) {
+            file->histogram[i] += histogram[i];
+        }
+        uint64_t* total = (uint64_t*)&file->counts;
+        uint64_t* part = (uint64_t*)&counts;
+        for (size_t i = 0; i < sizeof(LSB_COUNTS) / sizeof(uint64_t); i++) {
+            total[i] += part[i];
+        }
+    }
+    int last = --file->regionsLeft == 0;
+    pthread_mutex_unlock(&file->lock);
+
+    free(histogram);
+    free(region);
+    if (last) finishFile(file);
+}
+
+static void scanFileTask(void* arg) {
+    SCAN_FILE* file = (SCAN_FILE*)arg;
+    SCAN_CONTEXT* context = file->context;
+    if (!mapFile(file->path, 0, &file->map)) {
+        countSkipped(context);
+        free(file->path);
+        free(file);
+        return;
+    }
+    int type = detectCarrierType(file->map.data, file->map.size);
+    if (type == -1 || file->map.size < carrierPeekSize(type)
+        || !parseCarrierHeader(type, file->map.data, file->map.size, &file->layout)) {
+        fprintf(stderr, "Skipping %s: not a supported WAV/BMP carrier\n", file->path);
+        countSkipped(context);
+        unmapFile(&file->map);
+        free(file->path);
+        free(file);
+        return;
+    }
+    if (file->layout.stride > 2) {
+        fprintf(stderr, "Skipping %s: only 8/16-bit samples can be scanned\n", file->path);
+        countSkipped(context);
+        unmapFile(&file->map);
+        free(file->path);
+        free(file);
+        return;
+    }
+    uint64_t available = file->map.size > file->layout.headerSize ? file->map.size - file->layout.headerSize : 0;
+    uint64_t dataSize = file->layout.dataSize < available ? file->layout.dataSize : available;
+    uint64_t numSlots = dataSize / file->layout.stride;
+    file->data = file->map.data + file->layout.headerSize;
+    file->bins = lsbHistogramBins(&file->layout);
+    file->histogram = (uint32_t*)calloc(file->bins, sizeof(uint32_t));
+    if (file->histogram == NULL) {
+        fprintf(stderr, "Skipping %s: not enough memory\n", file->path);
+        countSkipped(context);
+        unmapFile(&file->map);
+        free(file->path);
+        free(file);
+        return;
+    }
+    pthread_mutex_init(&file->lock, NULL);
+
+    // regions hold whole groups of 4 samples per channel
+    uint64_t groupSlots = 4 * (uint64_t)file->layout.channels;
+    uint64_t regionSlots = context->regionBytes / file->layout.stride;
+    regionSlots -= regionSlots % groupSlots;
+    if (regionSlots == 0) regionSlots = groupSlots;
+    uint64_t numRegions = numSlots == 0 ? 1 : (numSlots + regionSlots - 1) / regionSlots;
+    file->regionsLeft = numRegions;
+    for (uint64_t i = 0; i < numRegions; i++) {
+        SCAN_REGION* region = (SCAN_REGION*)malloc(sizeof(SCAN_REGION));
+        if (region != NULL) {
+            region->file = file;
+            region->firstSlot = i * regionSlots;
+            region->numSlots = numSlots - region->firstSlot < regionSlots ? numSlots - region->firstSlot : regionSlots;
+        }
+        // regions go on this worker's deque, idle workers steal them
+        if (region == NULL || !poolSubmit(context->pool, scanRegionTask, region)) {
+            free(region);
+            // the regions that never got queued still have to count down, or the file is never finished
+            pthread_mutex_lock(&file->lock);
+            file->regionsSkipped += numRegions - i;
+            file->regionsLeft -= numRegions - i;
+            int last = file->regionsLeft == 0;
+            pthread_mutex_unlock(&file->lock);
+            if (last) finishFile(file);
+            return;
+        }
+    }
+}
+
+static int hasCarrierExtension(const char* name) {
+    const char* dot = strrchr(name, '.');
+    if (dot == NULL) return 0;
+    char ext[8] = { 0 };
+    for (int i = 0; i < 7 && dot[i + 1] != '\0'; i++) {
+        ext[i] = (char)tolower((unsigned char)dot[i + 1]);
+    }
+    return strcmp(ext, "wav") == 0 || strcmp(ext, "bmp") == 0;
+}
+
+static void queueFile(SCAN_CONTEXT* context, const char* path) {
+    SCAN_FILE* file = (SCAN_FILE*)calloc(1, sizeof(SCAN_FILE));
+    char* copy = (char*)malloc(strlen(path) + 1);
+    if (file == NULL || copy == NULL) {
+        fprintf(stderr, "Skipping %s: not enough memory\n", path);
+        countSkipped(context);
+        free(file);
+        free(copy);
+        return;
+    }
+    file->context = context;
+    file->path = copy;
+    strcpy(file->path, path);
+    if (!poolSubmit(context->pool, scanFileTask, file)) {
+        fprintf(stderr, "Skipping %s: could not queue it\n", path);
+        countSkipped(context);
+        free(file->path);
+        free(file);
+    }
+}
+
+// Walk a directory tree, queueing every .wav/.bmp as soon as it's found
+static void queueTree(SCAN_CONTEXT* context, const char* path, int explicitPath) {
+    struct stat info;
+    if (stat(path, &info) != 0) {
+        fprintf(stderr, "Failed to open %s!\n", path);
+        return;
+    }
+    if (S_ISREG(info.st_mode)) {
+        if (explicitPath || hasCarrierExtension(path)) queueFile(context, path);
+        return;
+    }
+    if (!S_ISDIR(info.st_mode)) return;
+    DIR* dir = opendir(path);
+    if (dir == NULL) {
+        fprintf(stderr, "Failed to open %s!\n", path);
+        return;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        size_t length = strlen(path) + strlen(entry->d_name) + 2;
+        char* child = (char*)malloc(length);
+        if (child == NULL) {
+            fprintf(stderr, "Skipping %s/%s: not enough memory\n", path, entry->d_name);
+            countSkipped(context);
+            continue;
+        }
+        snprintf(child, length, "%s/%s", path, entry->d_name);
+        queueTree(context, child, 0);
+        free(child);
+    }
+    closedir(dir);
+}
+
+static void printScanUsage() {
+    printf("Usage: ./steg.exe scan [-j THREADS] [-r REGION_BYTES] PATH...\n");
+    printf("\n\t-j THREADS\tWorker threads (default: one per CPU)\n");
+    printf("\t-r BYTES\tAlso report a score for every region of BYTES carrier data\n");
+    printf("\n\tPrints: path, region, chi-square p, RS rate, SPA rate\n");
+}
+
+int runScan(int argc, char* argv[]) {
+    SCAN_CONTEXT context;
+    memset(&context, 0, sizeof(context));
+    context.regionBytes = SCAN_DEFAULT_REGION;
+    int threads = 0;
+    int opt;
+    optind = 1;
+    while ((opt = getopt(argc, argv, "hj:r:")) != -1) {
+        switch (opt) {
+            case 'h':
+                printScanUsage();
+                return 0;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'r':
+                context.regionBytes = strtoull(optarg, NULL, 10);
+                context.printRegions = 1;
+                break;
+            default:
+                printScanUsage();
+                return -1;
+        }
+    }
+    if (optind >= argc || context.regionBytes == 0) {
+        printScanUsage();
+        return -1;
+    }
+    context.pool = poolCreate(threads);
+    if (context.pool == NULL) return -1;
+    pthread_mutex_init(&context.outputLock, NULL);
+
+    printf("# path\tregion\tchi\trs\tspa\n");
+    for (int i = optind; i < argc; i++) {
+        queueTree(&context, argv[i], 1);
+    }
+    poolDestroy(context.pool);
+    pthread_mutex_destroy(&context.outputLock);
+    if (context.skippedFiles > 0) {
+        fprintf(stderr, "%llu file(s) not scanned\n", (unsigned long long)context.skippedFiles);
+    }
+    return 0;
+}
@@ -0,0 +1,38 @@
+//
+// Steganalysis: statistical LSB detectors over WAV/BMP carriers.
+//
+#ifndef STEG_SCAN_H
+#define STEG_SCAN_H
+
+#include <stdint.h>
+#include "carrier.h"
+
+// Work is split into regions of at most this many bytes so big files spread over the pool
+#define SCAN_DEFAULT_REGION (4 * 1024 * 1024)
+
+// Raw detector counts. They're additive, so regions can be merged into a whole-file result.
+typedef struct LsbCounts {
+    // RS analysis over groups of 4 samples, mask [0 1 1 0]
+    uint64_t groups;
+    uint64_t regularM, singularM, regularNegM, singularNegM;                  // as is
+    uint64_t flippedRegularM, flippedSingularM, flippedRegularNegM, flippedSingularNegM; // all LSBs flipped
+    // Sample pair analysis over adjacent samples
+    uint64_t pairs, pairX, pairY, pairK;
+} LSB_COUNTS;
+
+typedef struct LsbScores {
+    double chiSquare; // probability of embedding, Westfeld-Pfitzmann pairs of values
+    double rs;        // estimated embedding rate, Fridrich RS analysis
+    double spa;       // estimated embedding rate, sample pair analysis
+} LSB_SCORES;
+
+// Histogram size needed for a carrier's sample values
+uint32_t lsbHistogramBins(const CARRIER_LAYOUT* layout);
+// Accumulate detector counts and the value histogram for numSlots samples starting at data
+void lsbCount(const CARRIER_LAYOUT* layout, const uint8_t* data, uint64_t numSlots, uint32_t* histogram, LSB_COUNTS* counts);
+// Turn counts into scores
+void lsbScore(const uint32_t* histogram, uint32_t bins, const LSB_COUNTS* counts, LSB_SCORES* scores);
+
+// "scan" subcommand: scan [-j THREADS] [-r REGION_BYTES] PATH...
+int runScan(int argc, char* argv[]);
+#endif //STEG_SCAN_H
@@ -0,0 +1,313 @@
+#include "spread.h"
+#include "crypto.h"
+#include "threadpool.h"
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define STEG_SPREAD_SSE2
+#endif
+
+// One key bit per chip pair: the pair is (+1, -1) or (-1, +1), so every sequence sums to zero and
+// neighbouring samples, which move together, mostly cancel out of the correlation.
+#define SPREAD_KEY_BYTES (SPREAD_CHIPS / 16)
+
+typedef struct SpreadJob {
+    const CARRIER_LAYOUT* layout;
+    uint8_t* data;
+    uint64_t key[4];
+    int64_t strength;
+    // encode: length prefix + payload
+    uint8_t header[4];
+    const uint8_t* payload;
+    // decode: one byte per bit, from firstBit on
+    uint8_t* bits;
+    uint64_t firstBit;
+} SPREAD_JOB;
+
+typedef struct SpreadTask {
+    SPREAD_JOB* job;
+    uint64_t first;
+    uint64_t count;
+    uint64_t unsettled;
+} SPREAD_TASK;
+
+// chipTable[b] = the 16 chips of key byte b, as int16 for _mm_madd_epi16
+static int16_t chipTable[256][16];
+static int chipTableReady = 0;
+
+static void buildChipTable(void) {
+    if (chipTableReady) return;
+    for (int b = 0; b < 256; b++) {
+        for (int k = 0; k < 8; k++) {
+            int16_t s = (b >> k) & 1 ? -1 : 1;
+            chipTable[b][2 * k] = s;
+            chipTable[b][2 * k + 1] = (int16_t)-s;
+        }
+    }
+    chipTableReady = 1;
+}
+
+static inline uint64_t mix64(uint64_t z) {
+    z += 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Key bits for payload bit `bit`. Counter-based, so any bit's sequence can be made without the ones before it.
+// All 256 bits of the derived key go into every word.
+static void chipSequence(const uint64_t key[4], uint64_t bit, uint8_t sequence[SPREAD_KEY_BYTES]) {
+    for (int w = 0; w < SPREAD_KEY_BYTES / 8; w++) {
+        uint64_t counter = bit * (SPREAD_KEY_BYTES / 8) + w;
+        uint64_t v = mix64(key[0] ^ mix64(key[1] + counter) ^ mix64(key[3] ^ counter)) ^ key[2];
+        for (int i = 0; i < 8; i++) sequence[8 * w + i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static inline int chipAt(const uint8_t* sequence, int i) {
+    int s = (sequence[i >> 4] >> ((i >> 1) & 7)) & 1 ? -1 : 1;
+    return i & 1 ? -s : s;
+}
+
+static inline int64_t loadSlot(const uint8_t* p, uint32_t stride) {
+    switch (stride) {
+    case 1:
+        return p[0];
+    case 2:
+        return (int16_t)(p[0] | (p[1] << 8));
+    default:
+        return (int32_t)((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+    }
+}
+
+static inline void storeSlot(uint8_t* p, uint32_t stride, int64_t v) {
+    switch (stride) {
+    case 1:
+        p[0] = (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v));
+        break;
+    case 2:
+        v = v < INT16_MIN ? INT16_MIN : (v > INT16_MAX ? INT16_MAX : v);
+        p[0] = (uint8_t)v;
+        p[1] = (uint8_t)(v >> 8);
+        break;
+    default:
+        v = v < INT32_MIN ? INT32_MIN : (v > INT32_MAX ? INT32_MAX : v);
+        p[0] = (uint8_t)v;
+        p[1] = (uint8_t)(v >> 8);
+        p[2] = (uint8_t)(v >> 16);
+        p[3] = (uint8_t)(v >> 24);
+        break;
+    }
+}
+
+// Sum of chip * sample over one bit's SPREAD_CHIPS slots
+static int64_t correlate(const uint8_t* slots, uint32_t stride, const uint8_t* sequence) {
+#ifdef STEG_SPREAD_SSE2
+    if (stride <= 2) {
+        // 16 chips per key byte; madd multiplies and sums pairs in one go. int32 lanes can't overflow at 1024 chips.
+        __m128i acc = _mm_setzero_si128();
+        const __m128i zero = _mm_setzero_si128();
+        for (int i = 0; i < SPREAD_KEY_BYTES; i++) {
+            const __m128i* chips = (const __m128i*)chipTable[sequence[i]];
+            __m128i lo, hi;
+            if (stride == 1) {
+                __m128i x = _mm_loadu_si128((const __m128i*)(slots + 16 * i));
+                lo = _mm_unpacklo_epi8(x, zero);
+                hi = _mm_unpackhi_epi8(x, zero);
+            }
+            else {
+                lo = _mm_loadu_si128((const __m128i*)(slots + 32 * i));
+                hi = _mm_loadu_si128((const __m128i*)(slots + 32 * i + 16));
+            }
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(lo, _mm_loadu_si128(chips)));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(hi, _mm_loadu_si128(chips + 1)));
+        }
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(acc);
+    }
+#endif
+    int64_t sum = 0;
+    for (int i = 0; i < SPREAD_CHIPS; i++) {
+        sum += chipAt(sequence, i) * loadSlot(slots + (uint64_t)i * stride, stride);
+    }
+    return sum;
+}
+
+static void addChips(uint8_t* slots, uint32_t stride, const uint8_t* sequence, int64_t amount) {
+    for (int i = 0; i < SPREAD_CHIPS; i++) {
+        uint8_t* p = slots + (uint64_t)i * stride;
+        storeSlot(p, stride, loadSlot(p, stride) + chipAt(sequence, i) * amount);
+    }
+}
+
+static inline int payloadBit(const SPREAD_JOB* job, uint64_t i) {
+    uint64_t byteIndex = i / 8;
+    uint8_t byte = byteIndex < 4 ? job->header[byteIndex] : job->payload[byteIndex - 4];
+    return (byte >> (i % 8)) & 1;
+}
+
+static void encodeTask(void* arg) {
+    SPREAD_TASK* task = (SPREAD_TASK*)arg;
+    SPREAD_JOB* job = task->job;
+    uint32_t stride = job->layout->stride;
+    uint8_t sequence[SPREAD_KEY_BYTES];
+    int64_t target = job->strength * SPREAD_CHIPS;
+    for (uint64_t bit = task->first; bit < task->first + task->count; bit++) {
+        uint8_t* slots = job->data + bit * SPREAD_CHIPS * stride;
+        int sign = payloadBit(job, bit) ? -1 : 1;
+        chipSequence(job->key, bit, sequence);
+        // Only what the host signal doesn't already provide is added, so its own correlation can't flip the bit
+        for (int pass = 0; pass <= SPREAD_PASSES; pass++) {
+            int64_t sum = sign * correlate(slots, stride, sequence);
+            if (sum >= target - SPREAD_CHIPS / 2) break;
+            if (pass == SPREAD_PASSES) {
+                if (sum <= 0) task->unsettled++;
+                break;
+            }
+            int64_t amount = (target - sum + SPREAD_CHIPS / 2) / SPREAD_CHIPS;
+            addChips(slots, stride, sequence, sign * (amount > 0 ? amount : 1));
+        }
+    }
+}
+
+static void decodeTask(void* arg) {
+    SPREAD_TASK* task = (SPREAD_TASK*)arg;
+    SPREAD_JOB* job = task->job;
+    uint32_t stride = job->layout->stride;
+    uint8_t sequence[SPREAD_KEY_BYTES];
+    for (uint64_t bit = task->first; bit < task->first + task->count; bit++) {
+        chipSequence(job->key, bit, sequence);
+        job->bits[bit - job->firstBit] = correlate(job->data + bit * SPREAD_CHIPS * stride, stride, sequence) < 0;
+    }
+}
+
+// Run fn over bits [first, first + count) in SPREAD_BITS_PER_TASK chunks. Returns the unsettled bit count, -1 on failure.
+static int64_t runSpread(THREAD_POOL* pool, SPREAD_JOB* job, POOL_TASK_FN fn, uint64_t first, uint64_t count) {
+    uint64_t numTasks = (count + SPREAD_BITS_PER_TASK - 1) / SPREAD_BITS_PER_TASK;
+    SPREAD_TASK* tasks = (SPREAD_TASK*)calloc(numTasks ? numTasks : 1, sizeof(SPREAD_TASK));
+    if (tasks == NULL) {
+        fprintf(stderr, "Could not allocate spread tasks!\n");
+        return -1;
+    }
+    for (uint64_t t = 0; t < numTasks; t++) {
+        tasks[t].job = job;
+        tasks[t].first = first + t * SPREAD_BITS_PER_TASK;
+        tasks[t].count = count - t * SPREAD_BITS_PER_TASK < SPREAD_BITS_PER_TASK ? count - t * SPREAD_BITS_PER_TASK : SPREAD_BITS_PER_TASK;
+        poolSubmit(pool, fn, &tasks[t]);
+    }
+    poolWait(pool);
+    int64_t unsettled = 0;
+    for (uint64_t t = 0; t < numTasks; t++) unsettled += tasks[t].unsettled;
+    free(tasks);
+    return unsettled;
+}
+
+static void setupJob(SPREAD_JOB* job, const CARRIER_LAYOUT* layout, uint8_t* data, const char* passphrase) {
+    SHA256_CTX ctx;
+    uint8_t digest[32];
+    memset(job, 0, sizeof(SPREAD_JOB));
+    job->layout = layout;
+    job->data = data;
+    job->strength = layout->stride == 1 ? SPREAD_STRENGTH_8 : (layout->stride == 2 ? SPREAD_STRENGTH_16 : SPREAD_STRENGTH_32);
+    if (passphrase == NULL) passphrase = SPREAD_DEFAULT_KEY;
+    sha256Init(&ctx);
+    sha256Update(&ctx, (const uint8_t*)passphrase, strlen(passphrase));
+    sha256Final(&ctx, digest);
+    for (int i = 0; i < 4; i++) {
+        job->key[i] = 0;
+        for (int j = 0; j < 8; j++) job->key[i] |= (uint64_t)digest[8 * i + j] << (8 * j);
+    }
+    buildChipTable();
+}
+
+uint64_t spreadCapacityBits(const CARRIER_LAYOUT* layout) {
+    return layout->dataSize / layout->stride / SPREAD_CHIPS;
+}
+
+int encodeSpread(const CARRIER_LAYOUT* layout, uint8_t* data, FILE* input_file, const char* passphrase, int threads) {
+    SPREAD_JOB job;
+    uint64_t length;
+    uint8_t* payload = readPayload(input_file, &length);
+    if (payload == NULL) return -1;
+    uint64_t totalBits = (length + 4) * 8;
+    uint64_t capacity = spreadCapacityBits(layout);
+    if (length > 0xFFFFFFFFu || totalBits > capacity) {
+        fprintf(stderr, "ERROR: Encode data too large!\n");
+        fprintf(stderr, "payload bits: %llu | max bits: %llu\n", (unsigned long long)totalBits, (unsigned long long)capacity);
+        free(payload);
+        return -1;
+    }
+    setupJob(&job, layout, data, passphrase);
+    job.payload = payload;
+    for (int i = 0; i < 4; i++) job.header[i] = (uint8_t)(length >> (8 * i));
+
+    THREAD_POOL* pool = poolCreate(threads);
+    if (pool == NULL) {
+        fprintf(stderr, "Could not start worker threads!\n");
+        free(payload);
+        return -1;
+    }
+    int64_t unsettled = runSpread(pool, &job, encodeTask, 0, totalBits);
+    poolDestroy(pool);
+    free(payload);
+    if (unsettled > 0) {
+        fprintf(stderr, "Warning: %lld bit(s) sit on clipped samples and won't decode intact\n", (long long)unsettled);
+    }
+    return unsettled < 0 ? -1 : 0;
+}
+
+// Length prefix first, then exactly the bits it promises
+static int decodeWithPool(THREAD_POOL* pool, SPREAD_JOB* job, FILE* output_file) {
+    uint8_t header[32];
+    uint64_t capacity = spreadCapacityBits(job->layout);
+    job->bits = header;
+    job->firstBit = 0;
+    if (runSpread(pool, job, decodeTask, 0, 32) < 0) return -1;
+    uint64_t length = 0;
+    for (int i = 0; i < 32; i++) length |= (uint64_t)header[i] << i;
+    if ((length + 4) * 8 > capacity) {
+        fprintf(stderr, "Error: No payload found (bad length %llu)\n", (unsigned long long)length);
+        return -1;
+    }
+    uint8_t* bits = (uint8_t*)malloc(length * 8 + 1);
+    if (bits == NULL) {
+        fprintf(stderr, "Could not allocate payload buffer!\n");
+        return -1;
+    }
+    job->bits = bits;
+    job->firstBit = 32;
+    if (runSpread(pool, job, decodeTask, 32, length * 8) < 0) {
+        free(bits);
+        return -1;
+    }
+    // pack in place: byte i only reads bits 8i.. which are never behind it
+    for (uint64_t i = 0; i < length; i++) {
+        uint8_t byte = 0;
+        for (int b = 0; b < 8; b++) byte |= (uint8_t)(bits[8 * i + b] << b);
+        bits[i] = byte;
+    }
+    int result = fwrite(bits, 1, length, output_file) == length ? 0 : -1;
+    if (result != 0) fprintf(stderr, "Error: Failed to write the payload\n");
+    free(bits);
+    return result;
+}
+
+int decodeSpread(const CARRIER_LAYOUT* layout, const uint8_t* data, FILE* output_file, const char* passphrase, int threads) {
+    SPREAD_JOB job;
+    if (spreadCapacityBits(layout) < 32) {
+        fprintf(stderr, "Error: No payload found (carrier too small)\n");
+        return -1;
+    }
+    // decoding never writes, the job just shares its layout with the encoder
+    setupJob(&job, layout, (uint8_t*)data, passphrase);
+    THREAD_POOL* pool = poolCreate(threads);
+    if (pool == NULL) {
+        fprintf(stderr, "Could not start worker threads!\n");
+        return -1;
+    }
+    int result = decodeWithPool(pool, &job, output_file);
+    poolDestroy(pool);
+    return result;
+}
@@ -0,0 +1,31 @@
+//
+// Direct-sequence spread spectrum: each payload bit is spread over SPREAD_CHIPS carrier samples/bytes by a keyed
+// +-1 chip sequence and recovered by correlating against the same sequence, so it survives noise and requantization.
+//
+#ifndef STEG_SPREAD_H
+#define STEG_SPREAD_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "carrier.h"
+
+// Carrier samples (WAV) or bytes (BMP) per payload bit
+#define SPREAD_CHIPS 1024
+// Correlation each bit is embedded at, per sample, by sample width
+#define SPREAD_STRENGTH_8 2
+#define SPREAD_STRENGTH_16 24
+#define SPREAD_STRENGTH_32 (24 << 16)
+// Correction rounds for bits that clipping pulls back
+#define SPREAD_PASSES 4
+// Bits per pool task
+#define SPREAD_BITS_PER_TASK 64
+// Chip sequence key when no passphrase is given
+#define SPREAD_DEFAULT_KEY "steg"
+
+// Payload bits (including the 32-bit length prefix) the carrier can hold
+uint64_t spreadCapacityBits(const CARRIER_LAYOUT* layout);
+// Embed input_file (length-prefixed) with chips keyed by passphrase (NULL for the default key).
+// threads <= 0 uses one worker per CPU.
+int encodeSpread(const CARRIER_LAYOUT* layout, uint8_t* data, FILE* input_file, const char* passphrase, int threads);
+int decodeSpread(const CARRIER_LAYOUT* layout, const uint8_t* data, FILE* output_file, const char* passphrase, int threads);
+#endif //STEG_SPREAD_H
@@ -0,0 +1,393 @@
+#include "stream.h"
+#include "palette.h"
+#include <errno.h>
+#ifdef _WIN32
+#include <io.h>
+#define read _read
+#define write _write
+#else
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#endif
+
+long long readFull(int fd, void* buffer, size_t len) {
+    size_t total = 0;
+    while (total < len) {
+        long long n = read(fd, (uint8_t*)buffer + total, (unsigned)(len - total));
+        if (n == 0) break;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Error: read failed (%s)\n", strerror(errno));
+            return -1;
+        }
+        total += (size_t)n;
+    }
+    return (long long)total;
+}
+
+int writeFull(int fd, const void* buffer, size_t len) {
+    size_t total = 0;
+    while (total < len) {
+        long long n = write(fd, (const uint8_t*)buffer + total, (unsigned)(len - total));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Error: write failed (%s)\n", strerror(errno));
+            return 0;
+        }
+        total += (size_t)n;
+    }
+    return 1;
+}
+
+long long payloadLength(FILE* file) {
+    long start = ftell(file);
+    if (start < 0 || fseek(file, 0, SEEK_END) != 0) return -1;
+    long end = ftell(file);
+    fseek(file, start, SEEK_SET);
+    return end < 0 ? -1 : (long long)(end - start);
+}
+
+int streamPayloadOpen(STREAM_PAYLOAD* payload, FILE* file, uint64_t capacity) {
+    memset(payload, 0, sizeof(STREAM_PAYLOAD));
+    payload->file = file;
+    uint64_t room = capacity > STREAM_HEADER_SIZE ? capacity - STREAM_HEADER_SIZE : 0;
+    long long length = payloadLength(file);
+    if (length < 0) {
+        // a pipe: the length goes in first, so the payload has to be read before any of it is embedded
+        size_t size = 0, used = 0;
+        for (;;) {
+            if (used == size) {
+                size_t grow = size ? size * 2 : 4096;
+                uint8_t* bigger = (uint8_t*)realloc(payload->buffer, grow);
+                if (bigger == NULL) {
+                    fprintf(stderr, "Error: not enough memory to buffer the payload\n");
+                    streamPayloadClose(payload);
+                    return 0;
+                }
+                payload->buffer = bigger;
+                size = grow;
+            }
+            size_t want = size - used;
+            size_t n = fread(payload->buffer + used, 1, want, file);
+            used += n;
+            if (n < want || used > room) break;
+        }
+        length = (long long)used;
+    }
+    if ((uint64_t)length > room) {
+        fprintf(stderr, "ERROR: Encode data too large for carrier!\n");
+        fprintf(stderr, "max payload bytes: %llu\n", (unsigned long long)room);
+        streamPayloadClose(payload);
+        return 0;
+    }
+    memcpy(payload->header, STREAM_MAGIC, 4);
+    for (int i = 0; i < 8; i++) payload->header[4 + i] = (uint8_t)((uint64_t)length >> (8 * i));
+    payload->length = (uint64_t)length;
+    payload->remaining = STREAM_HEADER_SIZE + payload->length;
+    return 1;
+}
+
+int streamPayloadNext(STREAM_PAYLOAD* payload) {
+    if (payload->remaining == 0) return -1;
+    uint64_t at = payload->position++;
+    payload->remaining--;
+    if (at < STREAM_HEADER_SIZE) return payload->header[at];
+    if (payload->buffer != NULL) return payload->buffer[at - STREAM_HEADER_SIZE];
+    int c = fgetc(payload->file);
+    // the file shrank since it was measured; the header has already promised the bytes
+    return c == EOF ? 0 : c;
+}
+
+void streamPayloadClose(STREAM_PAYLOAD* payload) {
+    free(payload->buffer);
+    payload->buffer = NULL;
+}
+
+// STREAM_EXTRACT states
+#define EXTRACT_HEADER 0
+#define EXTRACT_SIZED 1
+#define EXTRACT_TERMINATED 2 // older payload, up to a NUL byte
+#define EXTRACT_DONE 3
+
+void streamExtractInit(STREAM_EXTRACT* extract, FILE* output, uint64_t capacity) {
+    memset(extract, 0, sizeof(STREAM_EXTRACT));
+    extract->output = output;
+    extract->capacity = capacity;
+    extract->state = EXTRACT_HEADER;
+}
+
+// No header after all: the bytes collected so far start an older NUL-terminated payload
+static void extractTerminated(STREAM_EXTRACT* extract) {
+    extract->state = EXTRACT_TERMINATED;
+    for (uint64_t i = 0; i < extract->count; i++) {
+        if (extract->header[i] == '\0') {
+            extract->state = EXTRACT_DONE;
+            return;
+        }
+        fputc(extract->header[i], extract->output);
+    }
+}
+
+int streamExtractByte(STREAM_EXTRACT* extract, uint8_t value) {
+    if (extract->state == EXTRACT_HEADER) {
+        extract->header[extract->count++] = value;
+        if (extract->count <= 4 && value != (uint8_t)STREAM_MAGIC[extract->count - 1]) {
+            extractTerminated(extract);
+        }
+        else if (extract->count == STREAM_HEADER_SIZE) {
+            uint64_t length = 0;
+            for (int i = 0; i < 8; i++) length |= (uint64_t)extract->header[4 + i] << (8 * i);
+            if (extract->capacity < STREAM_HEADER_SIZE || length > extract->capacity - STREAM_HEADER_SIZE) {
+                // a length the carrier couldn't hold, so this was never a header
+                extractTerminated(extract);
+            }
+            else {
+                extract->left = length;
+                extract->state = length > 0 ? EXTRACT_SIZED : EXTRACT_DONE;
+            }
+        }
+    }
+    else if (extract->state == EXTRACT_SIZED) {
+        fputc(value, extract->output);
+        if (--extract->left == 0) extract->state = EXTRACT_DONE;
+    }
+    else if (extract->state == EXTRACT_TERMINATED) {
+        if (value == '\0') extract->state = EXTRACT_DONE;
+        else fputc(value, extract->output);
+    }
+    return extract->state != EXTRACT_DONE;
+}
+
+int streamExtractFinish(STREAM_EXTRACT* extract) {
+    if (extract->state == EXTRACT_HEADER) extractTerminated(extract);
+    fflush(extract->output);
+    if (extract->state == EXTRACT_SIZED) {
+        fprintf(stderr, "Error: Carrier ended %llu bytes before the end of the payload!\n", (unsigned long long)extract->left);
+        return -1;
+    }
+    return 0;
+}
+
+// copy exactly len bytes through a user-space buffer
+static int copyBytes(int in_fd, int out_fd, uint64_t len) {
+    uint8_t buffer[4096];
+    while (len > 0) {
+        size_t want = len < sizeof(buffer) ? len : sizeof(buffer);
+        long long n = readFull(in_fd, buffer, want);
+        if (n != (long long)want) {
+            fprintf(stderr, "Error: Carrier ended early!\n");
+            return 0;
+        }
+        if (!writeFull(out_fd, buffer, want)) return 0;
+        len -= want;
+    }
+    return 1;
+}
+
+int streamForward(int in_fd, int out_fd) {
+#ifdef __linux__
+    // splice() needs one end to be a pipe, sendfile() needs a regular file as input.
+    // Either way the carrier bytes never pass through user space.
+    int moved = 0;
+    for (;;) {
+        ssize_t n = splice(in_fd, NULL, out_fd, NULL, 1 << 20, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n == 0) return 1;
+        if (n > 0) { moved = 1; continue; }
+        if (errno == EINTR) continue;
+        if (moved || errno != EINVAL) {
+            fprintf(stderr, "Error: splice failed (%s)\n", strerror(errno));
+            return 0;
+        }
+        break;
+    }
+    for (;;) {
+        ssize_t n = sendfile(out_fd, in_fd, NULL, 1 << 30);
+        if (n == 0) return 1;
+        if (n > 0) { moved = 1; continue; }
+        if (errno == EINTR) continue;
+        if (moved || (errno != EINVAL && errno != ENOSYS)) {
+            fprintf(stderr, "Error: sendfile failed (%s)\n", strerror(errno));
+            return 0;
+        }
+        break;
+    }
+#endif
+    uint8_t buffer[STREAM_CHUNK_SIZE];
+    for (;;) {
+        long long n = readFull(in_fd, buffer, sizeof(buffer));
+        if (n < 0) return 0;
+        if (n == 0) return 1;
+        if (!writeFull(out_fd, buffer, (size_t)n)) return 0;
+    }
+}
+
+// First carrierPeekSize bytes of the header, enough to tell which engine the carrier needs
+static int peekCarrierHeader(int type, int carrier_fd, uint8_t* header) {
+    uint32_t peek = carrierPeekSize(type);
+    if (readFull(carrier_fd, header, peek) != peek) {
+        fprintf(stderr, "Error: Could not read carrier header!\n");
+        return 0;
+    }
+    return 1;
+}
+
+// Parse the rest of the carrier header, passing it through to out_fd (or skipping it if out_fd < 0)
+static int readCarrierHeader(int type, uint8_t* header, int carrier_fd, int out_fd, CARRIER_LAYOUT* layout) {
+    uint32_t peek = carrierPeekSize(type);
+    uint32_t needed = carrierHeaderNeeded(type, header);
+    if (needed > peek) {
+        // RF64: the ds64 chunk pushes fmt and data further in
+        if (readFull(carrier_fd, header + peek, needed - peek) != needed - peek) {
+            fprintf(stderr, "Error: Could not read carrier header!\n");
+            return 0;
+        }
+        peek = needed;
+    }
+    if (!parseCarrierHeader(type, header, peek, layout)) return 0;
+    if (out_fd < 0) {
+        // decoding, just skip anything between the header and the data
+        uint8_t skip[4096];
+        uint64_t left = layout->headerSize - peek;
+        while (left > 0) {
+            uint32_t want = left < sizeof(skip) ? (uint32_t)left : (uint32_t)sizeof(skip);
+            if (readFull(carrier_fd, skip, want) != want) return 0;
+            left -= want;
+        }
+        return 1;
+    }
+    if (!writeFull(out_fd, header, peek)) return 0;
+    return copyBytes(carrier_fd, out_fd, layout->headerSize - peek);
+}
+
+// Forward len bytes of carrier data through user space, measuring the samples on the way
+static int forwardMeasured(int in_fd, int out_fd, uint64_t len, uint32_t stride, DISTORTION_METRICS* metrics) {
+    uint8_t buffer[STREAM_CHUNK_SIZE];
+    while (len > 0) {
+        size_t want = len < sizeof(buffer) ? (size_t)len : sizeof(buffer);
+        long long n = readFull(in_fd, buffer, want);
+        if (n != (long long)want) {
+            fprintf(stderr, "Error: Carrier ended early!\n");
+            return 0;
+        }
+        metricsAddSignal(metrics, buffer, want / stride);
+        if (!writeFull(out_fd, buffer, want)) return 0;
+        len -= want;
+    }
+    return 1;
+}
+
+int encode_Stream(int type, int carrier_fd, FILE* payload, int out_fd, DISTORTION_METRICS* metrics) {
+    CARRIER_LAYOUT layout;
+    uint8_t header[RF64_MAX_HEADER_SIZE];
+    if (!peekCarrierHeader(type, carrier_fd, header)) return -1;
+    // indexed BMPs need their colour table reordered, which the palette engine does as it streams
+    if (type == TYPE_BMP && paletteHeader(header)) return encodePalette(header, carrier_fd, payload, out_fd, metrics);
+    if (!readCarrierHeader(type, header, carrier_fd, out_fd, &layout)) return -1;
+    if (metrics != NULL) metricsInit(metrics, &layout);
+    STREAM_PAYLOAD source;
+    if (!streamPayloadOpen(&source, payload, layout.dataSize / layout.stride / 8)) return -1;
+
+    uint8_t* chunk = (uint8_t*)malloc(STREAM_CHUNK_SIZE);
+    if (chunk == NULL) {
+        fprintf(stderr, "Could not allocate stream buffer!\n");
+        streamPayloadClose(&source);
+        return -1;
+    }
+    uint64_t remaining = layout.dataSize;
+    int curChar = 0;
+    int bitIndex = 8;
+    int done = 0;
+    while (!done) {
+        uint32_t want = remaining < STREAM_CHUNK_SIZE ? (uint32_t)remaining : STREAM_CHUNK_SIZE;
+        want -= want % layout.stride;
+        if (want == 0) {
+            fprintf(stderr, "ERROR: Encode data too large for carrier!\n");
+            free(chunk);
+            streamPayloadClose(&source);
+            return -1;
+        }
+        if (readFull(carrier_fd, chunk, want) != want) {
+            fprintf(stderr, "Error: Carrier ended early!\n");
+            free(chunk);
+            streamPayloadClose(&source);
+            return -1;
+        }
+        // the chunk is still in cache, so measuring it here costs next to nothing
+        if (metrics != NULL) metricsAddSignal(metrics, chunk, want / layout.stride);
+        uint64_t flips = 0;
+        // LSB of the first byte of each sample, low bit of each character first
+        for (uint32_t offset = 0; offset < want; offset += layout.stride) {
+            if (bitIndex == 8) {
+                curChar = streamPayloadNext(&source);
+                if (curChar < 0) {
+                    done = 1;
+                    break;
+                }
+                bitIndex = 0;
+            }
+            uint8_t bit = (curChar >> bitIndex) & 1;
+            flips += (chunk[offset] & 1) ^ bit;
+            chunk[offset] = (chunk[offset] & 0xFE) | bit;
+            bitIndex++;
+        }
+        if (metrics != NULL) metricsAddFlips(metrics, flips);
+        if (source.remaining == 0 && bitIndex == 8) done = 1;
+        if (!writeFull(out_fd, chunk, want)) {
+            free(chunk);
+            streamPayloadClose(&source);
+            return -1;
+        }
+        remaining -= want;
+    }
+    free(chunk);
+    streamPayloadClose(&source);
+    // the rest of the samples still count towards the signal energy, so they can't bypass user space
+    if (metrics != NULL && !forwardMeasured(carrier_fd, out_fd, remaining - remaining % layout.stride, layout.stride, metrics)) {
+        return -1;
+    }
+    // nothing left to change, hand the rest of the carrier straight to the output
+    return streamForward(carrier_fd, out_fd) ? 0 : -1;
+}
+
+int decode_Stream(int type, int carrier_fd, FILE* output) {
+    CARRIER_LAYOUT layout;
+    uint8_t header[RF64_MAX_HEADER_SIZE];
+    if (!peekCarrierHeader(type, carrier_fd, header)) return -1;
+    if (type == TYPE_BMP && paletteHeader(header)) return decodePalette(header, carrier_fd, output);
+    if (!readCarrierHeader(type, header, carrier_fd, -1, &layout)) return -1;
+
+    uint8_t* chunk = (uint8_t*)malloc(STREAM_CHUNK_SIZE);
+    if (chunk == NULL) {
+        fprintf(stderr, "Could not allocate stream buffer!\n");
+        return -1;
+    }
+    uint64_t remaining = layout.dataSize;
+    STREAM_EXTRACT extract;
+    streamExtractInit(&extract, output, layout.dataSize / layout.stride / 8);
+    uint8_t curChar = 0;
+    int bitIndex = 0;
+    while (remaining >= layout.stride) {
+        uint32_t want = remaining < STREAM_CHUNK_SIZE ? (uint32_t)remaining : STREAM_CHUNK_SIZE;
+        want -= want % layout.stride;
+        long long got = readFull(carrier_fd, chunk, want);
+        if (got <= 0) break;
+        for (uint32_t offset = 0; offset + layout.stride <= (uint32_t)got; offset += layout.stride) {
+            curChar |= (chunk[offset] & 1) << bitIndex;
+            bitIndex++;
+            if (bitIndex == 8) {
+                if (!streamExtractByte(&extract, curChar)) {
+                    free(chunk);
+                    return streamExtractFinish(&extract);
+                }
+                curChar = 0;
+                bitIndex = 0;
+            }
+        }
+        remaining -= (uint64_t)got;
+    }
+    free(chunk);
+    return streamExtractFinish(&extract);
+}
@@ -0,0 +1,69 @@
+//
+// Streaming encode/decode over file descriptors, for use in pipelines ("-").
+//
+#ifndef STEG_STREAM_H
+#define STEG_STREAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "carrier.h"
+#include "metrics.h"
+
+// Size of the working buffer used while payload bits are being embedded
+#define STREAM_CHUNK_SIZE (64 * 1024)
+
+// Plain LSB payloads start with a header: magic, then the payload length (64-bit, little endian), then the bytes,
+// so binary payloads come back whole. Carriers from before the header end the payload with a NUL byte instead;
+// the decoders still read those.
+#define STREAM_MAGIC "LSB1"
+#define STREAM_HEADER_SIZE 12
+
+// Encoder side: header bytes, then the payload, one byte at a time
+typedef struct StreamPayload {
+    FILE* file;
+    uint8_t* buffer;    // whole payload, when it comes from a pipe and had to be measured first
+    uint8_t header[STREAM_HEADER_SIZE];
+    uint64_t length;    // payload bytes
+    uint64_t position;  // bytes handed out so far, header included
+    uint64_t remaining; // bytes still to hand out, header included
+} STREAM_PAYLOAD;
+
+// Decoder side: takes the embedded bytes in order and writes out the payload
+typedef struct StreamExtract {
+    FILE* output;
+    uint64_t capacity; // bytes the carrier can hold, to tell a real header from an old NUL-terminated payload
+    uint8_t header[STREAM_HEADER_SIZE];
+    uint64_t count;    // header bytes collected
+    uint64_t left;     // payload bytes still to come once the header checked out
+    int state;
+} STREAM_EXTRACT;
+
+// Read exactly len bytes, unless EOF comes first. Returns bytes read or -1.
+long long readFull(int fd, void* buffer, size_t len);
+// Write all len bytes. Returns 1 on success.
+int writeFull(int fd, const void* buffer, size_t len);
+// Bytes left in a payload file if it is seekable, -1 otherwise (a pipe)
+long long payloadLength(FILE* file);
+// Copy everything left in in_fd to out_fd, with splice() where the kernel allows it
+int streamForward(int in_fd, int out_fd);
+
+// Size up a payload for a carrier holding capacity bytes. Payloads that can't seek are read into memory
+// (no more than fits). Prints the error and returns 0 if the payload is too large.
+int streamPayloadOpen(STREAM_PAYLOAD* payload, FILE* file, uint64_t capacity);
+// Next byte to embed, -1 once the whole payload has gone out
+int streamPayloadNext(STREAM_PAYLOAD* payload);
+void streamPayloadClose(STREAM_PAYLOAD* payload);
+
+void streamExtractInit(STREAM_EXTRACT* extract, FILE* output, uint64_t capacity);
+// Take the next embedded byte. Returns 0 once the payload is complete.
+int streamExtractByte(STREAM_EXTRACT* extract, uint8_t value);
+// Carrier ran out: 0, or -1 (with a message) if it ended inside a payload whose length it gave
+int streamExtractFinish(STREAM_EXTRACT* extract);
+
+// Encode payload into the carrier read from carrier_fd, writing the result to out_fd.
+// The payload goes in behind its header; once it's embedded the rest of the carrier is forwarded untouched.
+// metrics (may be NULL) is initialised and filled in as the carrier streams through.
+int encode_Stream(int type, int carrier_fd, FILE* payload, int out_fd, DISTORTION_METRICS* metrics);
+// Decode a payload written by encode_Stream, or an older NUL-terminated one (encodeToFile_*).
+int decode_Stream(int type, int carrier_fd, FILE* output);
+#endif //STEG_STREAM_H
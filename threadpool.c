@@ -0,0 +1,225 @@
+#include "threadpool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+typedef struct WorkerArgs {
+    THREAD_POOL* pool;
+    int index;
+} WORKER_ARGS;
+
+// which deque the calling thread owns, so tasks can submit follow-up work locally
+static pthread_key_t workerKey;
+static pthread_once_t workerKeyOnce = PTHREAD_ONCE_INIT;
+
+static void createWorkerKey(void) {
+    pthread_key_create(&workerKey, NULL);
+}
+
+int poolDefaultThreads(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+static int dequeInit(WORK_DEQUE* deque) {
+    deque->capacity = 64;
+    deque->head = 0;
+    deque->count = 0;
+    deque->tasks = (POOL_TASK*)malloc(deque->capacity * sizeof(POOL_TASK));
+    pthread_mutex_init(&deque->lock, NULL);
+    return deque->tasks != NULL;
+}
+
+static int dequePushTail(WORK_DEQUE* deque, POOL_TASK task) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count == deque->capacity) {
+        // grow and unwrap the ring
+        POOL_TASK* grown = (POOL_TASK*)malloc(deque->capacity * 2 * sizeof(POOL_TASK));
+        if (grown == NULL) {
+            pthread_mutex_unlock(&deque->lock);
+            return 0;
+        }
+        for (int i = 0; i < deque->count; i++) {
+            grown[i] = deque->tasks[(deque->head + i) % deque->capacity];
+        }
+        free(deque->tasks);
+        deque->tasks = grown;
+        deque->head = 0;
+        deque->capacity *= 2;
+    }
+    deque->tasks[(deque->head + deque->count) % deque->capacity] = task;
+    deque->count++;
+    pthread_mutex_unlock(&deque->lock);
+    return 1;
+}
+
+// owner end: newest task first, keeps a worker on the data it just touched
+static int dequePopTail(WORK_DEQUE* deque, POOL_TASK* task) {
+    int found = 0;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count > 0) {
+        deque->count--;
+        *task = deque->tasks[(deque->head + deque->count) % deque->capacity];
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// thief end: oldest task, which tends to be the biggest chunk of remaining work
+static int dequeStealHead(WORK_DEQUE* deque, POOL_TASK* task) {
+    int found = 0;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count > 0) {
+        *task = deque->tasks[deque->head];
+        deque->head = (deque->head + 1) % deque->capacity;
+        deque->count--;
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static int findTask(THREAD_POOL* pool, int self, POOL_TASK* task) {
+    if (dequePopTail(&pool->deques[self], task)) return 1;
+    for (int i = 1; i < pool->numThreads; i++) {
+        if (dequeStealHead(&pool->deques[(self + i) % pool->numThreads], task)) return 1;
+    }
+    return 0;
+}
+
+static void* workerMain(void* arg) {
+    WORKER_ARGS* args = (WORKER_ARGS*)arg;
+    THREAD_POOL* pool = args->pool;
+    int self = args->index;
+    free(args);
+    pthread_setspecific(workerKey, &pool->deques[self]);
+
+    for (;;) {
+        POOL_TASK task;
+        if (findTask(pool, self, &task)) {
+            pthread_mutex_lock(&pool->lock);
+            pool->queued--;
+            pthread_mutex_unlock(&pool->lock);
+
+            task.fn(task.arg);
+
+            pthread_mutex_lock(&pool->lock);
+            pool->pending--;
+            if (pool->pending == 0) pthread_cond_broadcast(&pool->allDone);
+            pthread_mutex_unlock(&pool->lock);
+            continue;
+        }
+        pthread_mutex_lock(&pool->lock);
+        while (pool->queued <= 0 && !pool->shuttingDown) {
+            pthread_cond_wait(&pool->workAvailable, &pool->lock);
+        }
+        int stop = pool->shuttingDown && pool->queued <= 0;
+        pthread_mutex_unlock(&pool->lock);
+        if (stop) break;
+    }
+    return NULL;
+}
+
+THREAD_POOL* poolCreate(int numThreads) {
+    pthread_once(&workerKeyOnce, createWorkerKey);
+    if (numThreads <= 0) numThreads = poolDefaultThreads();
+    THREAD_POOL* pool = (THREAD_POOL*)calloc(1, sizeof(THREAD_POOL));
+    if (pool == NULL) return NULL;
+    pool->numThreads = numThreads;
+    pool->threads = (pthread_t*)calloc(numThreads, sizeof(pthread_t));
+    pool->deques = (WORK_DEQUE*)calloc(numThreads, sizeof(WORK_DEQUE));
+    if (pool->threads == NULL || pool->deques == NULL) {
+        fprintf(stderr, "Could not allocate thread pool!\n");
+        free(pool->threads);
+        free(pool->deques);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->workAvailable, NULL);
+    pthread_cond_init(&pool->allDone, NULL);
+    for (int i = 0; i < numThreads; i++) {
+        dequeInit(&pool->deques[i]);
+    }
+    for (int i = 0; i < numThreads; i++) {
+        WORKER_ARGS* args = (WORKER_ARGS*)malloc(sizeof(WORKER_ARGS));
+        args->pool = pool;
+        args->index = i;
+        pthread_create(&pool->threads[i], NULL, workerMain, args);
+    }
+    return pool;
+}
+
+int poolSubmit(THREAD_POOL* pool, POOL_TASK_FN fn, void* arg) {
+    POOL_TASK task = { fn, arg };
+    WORK_DEQUE* own = (WORK_DEQUE*)pthread_getspecific(workerKey);
+    WORK_DEQUE* target;
+    // only use the calling thread's deque if it belongs to this pool
+    if (own != NULL && own >= pool->deques && own < pool->deques + pool->numThreads) {
+        target = own;
+    }
+    else {
+        pthread_mutex_lock(&pool->lock);
+        target = &pool->deques[pool->nextDeque];
+        pool->nextDeque = (pool->nextDeque + 1) % pool->numThreads;
+        pthread_mutex_unlock(&pool->lock);
+    }
+    // count the task before it becomes visible so pending can't hit zero early
+    pthread_mutex_lock(&pool->lock);
+    pool->pending++;
+    pthread_mutex_unlock(&pool->lock);
+    if (!dequePushTail(target, task)) {
+        pthread_mutex_lock(&pool->lock);
+        pool->pending--;
+        pthread_mutex_unlock(&pool->lock);
+        fprintf(stderr, "Could not queue task!\n");
+        return 0;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->queued++;
+    pthread_cond_signal(&pool->workAvailable);
+    pthread_mutex_unlock(&pool->lock);
+    return 1;
+}
+
+void poolWait(THREAD_POOL* pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->allDone, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void poolDestroy(THREAD_POOL* pool) {
+    if (pool == NULL) return;
+    poolWait(pool);
+    pthread_mutex_lock(&pool->lock);
+    pool->shuttingDown = 1;
+    pthread_cond_broadcast(&pool->workAvailable);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->numThreads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    for (int i = 0; i < pool->numThreads; i++) {
+        free(pool->deques[i].tasks);
+        pthread_mutex_destroy(&pool->deques[i].lock);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->workAvailable);
+    pthread_cond_destroy(&pool->allDone);
+    free(pool->deques);
+    free(pool->threads);
+    free(pool);
+}
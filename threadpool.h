@@ -0,0 +1,48 @@
+//
+// Work-stealing thread pool.
+// Each worker owns a deque: it pushes/pops its own work at the tail and idle workers steal from the head.
+//
+#ifndef STEG_THREADPOOL_H
+#define STEG_THREADPOOL_H
+
+#include <pthread.h>
+
+typedef void (*POOL_TASK_FN)(void* arg);
+
+typedef struct PoolTask {
+    POOL_TASK_FN fn;
+    void* arg;
+} POOL_TASK;
+
+typedef struct WorkDeque {
+    POOL_TASK* tasks; // ring buffer
+    int capacity;
+    int head; // steal end
+    int count;
+    pthread_mutex_t lock;
+} WORK_DEQUE;
+
+typedef struct ThreadPool {
+    int numThreads;
+    pthread_t* threads;
+    WORK_DEQUE* deques;
+    pthread_mutex_t lock;
+    pthread_cond_t workAvailable;
+    pthread_cond_t allDone;
+    long queued;  // tasks sitting in deques
+    long pending; // tasks submitted but not finished
+    int nextDeque;
+    int shuttingDown;
+} THREAD_POOL;
+
+// Number of online CPUs, at least 1
+int poolDefaultThreads(void);
+// Start a pool with numThreads workers (<= 0 for one per CPU)
+THREAD_POOL* poolCreate(int numThreads);
+// Queue a task. Called from a worker, the task goes on that worker's own deque.
+int poolSubmit(THREAD_POOL* pool, POOL_TASK_FN fn, void* arg);
+// Block until every submitted task (and anything they submitted) has finished
+void poolWait(THREAD_POOL* pool);
+// Wait for outstanding work, then stop and free the pool
+void poolDestroy(THREAD_POOL* pool);
+#endif //STEG_THREADPOOL_H
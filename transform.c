@@ -0,0 +1,357 @@
+#include "transform.h"
+#include "fft.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRANSFORM_PI 3.14159265358979323846
+
+// Length prefix + payload, read bit by bit (LSB first)
+typedef struct BitSource {
+    uint8_t header[4];
+    const uint8_t* payload;
+    uint64_t totalBits;
+} BIT_SOURCE;
+
+// Collects decoded bits; the payload length is known once the first 32 have arrived
+typedef struct BitSink {
+    FILE* output;
+    uint64_t capacityBits;
+    uint64_t bits;
+    uint64_t totalBits; // UINT64_MAX until the prefix is in
+    uint32_t length;
+    uint8_t current;
+    int failed;
+} BIT_SINK;
+
+static inline int sourceBit(const BIT_SOURCE* source, uint64_t i) {
+    uint64_t byteIndex = i / 8;
+    uint8_t byte = byteIndex < 4 ? source->header[byteIndex] : source->payload[byteIndex - 4];
+    return (byte >> (i % 8)) & 1;
+}
+
+static void sinkBit(BIT_SINK* sink, int bit) {
+    if (sink->failed || sink->bits >= sink->totalBits) return;
+    uint64_t i = sink->bits++;
+    if (i < 32) {
+        sink->length |= (uint32_t)bit << i;
+        if (i == 31) {
+            sink->totalBits = ((uint64_t)sink->length + 4) * 8;
+            if (sink->totalBits > sink->capacityBits) {
+                fprintf(stderr, "Error: No payload found (bad length %u)\n", sink->length);
+                sink->failed = 1;
+            }
+        }
+        return;
+    }
+    sink->current |= (uint8_t)(bit << (i % 8));
+    if (i % 8 == 7) {
+        fputc(sink->current, sink->output);
+        sink->current = 0;
+    }
+}
+
+static inline int sinkDone(const BIT_SINK* sink) {
+    return sink->failed || sink->bits >= sink->totalBits;
+}
+
+static inline float loadSample(const uint8_t* p, uint32_t stride) {
+    switch (stride) {
+    case 1:
+        return ((int32_t)p[0] - 128) * (1.0f / 128.0f);
+    case 2:
+        return (int16_t)(p[0] | (p[1] << 8)) * (1.0f / 32768.0f);
+    default:
+        return (float)(int32_t)((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24))
+            * (1.0f / 2147483648.0f);
+    }
+}
+
+static inline void storeSample(uint8_t* p, uint32_t stride, float value) {
+    double v = value > 1.0f ? 1.0 : (value < -1.0f ? -1.0 : value);
+    switch (stride) {
+    case 1:
+        p[0] = (uint8_t)(int32_t)floor(128.0 + v * 127.0 + 0.5);
+        break;
+    case 2: {
+        int16_t s = (int16_t)floor(v * 32767.0 + 0.5);
+        p[0] = (uint8_t)s;
+        p[1] = (uint8_t)(s >> 8);
+        break;
+    }
+    default: {
+        int32_t s = (int32_t)floor(v * 2147483647.0 + 0.5);
+        p[0] = (uint8_t)s;
+        p[1] = (uint8_t)(s >> 8);
+        p[2] = (uint8_t)(s >> 16);
+        p[3] = (uint8_t)(s >> 24);
+        break;
+    }
+    }
+}
+
+// count samples of one channel, starting at frame first
+static void loadChannel(const CARRIER_LAYOUT* layout, const uint8_t* data, uint32_t channel, uint64_t first, int count, float* out) {
+    const uint8_t* p = data + (first * layout->channels + channel) * layout->stride;
+    uint64_t step = (uint64_t)layout->channels * layout->stride;
+    for (int i = 0; i < count; i++) {
+        out[i] = loadSample(p, layout->stride);
+        p += step;
+    }
+}
+
+static void storeChannel(const CARRIER_LAYOUT* layout, uint8_t* data, uint32_t channel, uint64_t first, int count, const float* in) {
+    uint8_t* p = data + (first * layout->channels + channel) * layout->stride;
+    uint64_t step = (uint64_t)layout->channels * layout->stride;
+    for (int i = 0; i < count; i++) {
+        storeSample(p, layout->stride, in[i]);
+        p += step;
+    }
+}
+
+static uint64_t channelFrames(const CARRIER_LAYOUT* layout) {
+    return layout->dataSize / layout->stride / layout->channels;
+}
+
+uint64_t transformCapacityBits(int method, const CARRIER_LAYOUT* layout) {
+    uint64_t frames = channelFrames(layout);
+    if (method == METHOD_PHASE) return frames / PHASE_FRAME * layout->channels * PHASE_BITS;
+    return frames / ECHO_SEGMENT * layout->channels;
+}
+
+// ---- phase coding ----
+
+static void phaseTaper(float* taper) {
+    for (int i = 0; i < PHASE_FRAME; i++) taper[i] = 1.0f;
+    for (int i = 0; i < PHASE_TAPER; i++) {
+        float w = (float)(0.5 - 0.5 * cos(TRANSFORM_PI * (i + 0.5) / PHASE_TAPER));
+        taper[i] = w;
+        taper[PHASE_FRAME - 1 - i] = w;
+    }
+}
+
+static int encodePhase(const CARRIER_LAYOUT* layout, uint8_t* data, const BIT_SOURCE* source) {
+    FFT_PLAN* plan = fftCreatePlan(PHASE_FRAME);
+    float* buffers = (float*)malloc((3 * PHASE_FRAME + 4 * (PHASE_FRAME / 2 + 1)) * sizeof(float));
+    if (plan == NULL || buffers == NULL) {
+        fprintf(stderr, "Could not allocate FFT plan!\n");
+        fftDestroyPlan(plan);
+        free(buffers);
+        return -1;
+    }
+    float* frame = buffers;
+    float* delta = frame + PHASE_FRAME;
+    float* taper = delta + PHASE_FRAME;
+    float* re = taper + PHASE_FRAME;
+    float* im = re + PHASE_FRAME / 2 + 1;
+    float* dre = im + PHASE_FRAME / 2 + 1;
+    float* dim = dre + PHASE_FRAME / 2 + 1;
+    float magnitudes[PHASE_BITS];
+    phaseTaper(taper);
+    const float minMagnitude = PHASE_MIN_AMPLITUDE * PHASE_FRAME / 2;
+
+    uint64_t numFrames = channelFrames(layout) / PHASE_FRAME;
+    uint64_t bit = 0, unsettled = 0;
+    for (uint64_t f = 0; f < numFrames && bit < source->totalBits; f++) {
+        for (uint32_t c = 0; c < layout->channels && bit < source->totalBits; c++) {
+            int count = source->totalBits - bit < PHASE_BITS ? (int)(source->totalBits - bit) : PHASE_BITS;
+            for (int pass = 0; pass <= PHASE_PASSES; pass++) {
+                loadChannel(layout, data, c, f * PHASE_FRAME, PHASE_FRAME, frame);
+                fftForwardReal(plan, frame, re, im);
+                // only the change goes back through the inverse FFT, so untouched bins come back bit-exact
+                memset(dre, 0, (PHASE_FRAME / 2 + 1) * sizeof(float));
+                memset(dim, 0, (PHASE_FRAME / 2 + 1) * sizeof(float));
+                int settled = 1, wrong = 0;
+                for (int b = 0; b < count; b++) {
+                    int k = PHASE_FIRST_BIN + 2 * b;
+                    if (pass == 0) {
+                        magnitudes[b] = sqrtf(re[k] * re[k] + im[k] * im[k]);
+                        if (magnitudes[b] < minMagnitude) magnitudes[b] = minMagnitude;
+                    }
+                    float target = sourceBit(source, bit + b) ? -magnitudes[b] : magnitudes[b];
+                    // the taper and requantization (or clipping) leak a little into the coded bins
+                    if (pass == 0 || target * im[k] < 0.5f * magnitudes[b] * magnitudes[b]) settled = 0;
+                    if (target * im[k] <= 0.0f) wrong = 1;
+                    dre[k] = -re[k];
+                    dim[k] = target - im[k];
+                }
+                if (settled) break;
+                if (pass == PHASE_PASSES) {
+                    unsettled += wrong;
+                    break;
+                }
+                fftInverseReal(plan, dre, dim, delta);
+                for (int i = 0; i < PHASE_FRAME; i++) {
+                    frame[i] += taper[i] * delta[i];
+                }
+                storeChannel(layout, data, c, f * PHASE_FRAME, PHASE_FRAME, frame);
+            }
+            bit += count;
+        }
+    }
+    if (unsettled > 0) {
+        fprintf(stderr, "Warning: %llu frame(s) clip too hard to hold their phase; the payload won't decode intact\n",
+            (unsigned long long)unsettled);
+    }
+    fftDestroyPlan(plan);
+    free(buffers);
+    return 0;
+}
+
+static int decodePhase(const CARRIER_LAYOUT* layout, const uint8_t* data, BIT_SINK* sink) {
+    FFT_PLAN* plan = fftCreatePlan(PHASE_FRAME);
+    float* buffers = (float*)malloc((PHASE_FRAME + 2 * (PHASE_FRAME / 2 + 1)) * sizeof(float));
+    if (plan == NULL || buffers == NULL) {
+        fprintf(stderr, "Could not allocate FFT plan!\n");
+        fftDestroyPlan(plan);
+        free(buffers);
+        return -1;
+    }
+    float* frame = buffers;
+    float* re = frame + PHASE_FRAME;
+    float* im = re + PHASE_FRAME / 2 + 1;
+    uint64_t numFrames = channelFrames(layout) / PHASE_FRAME;
+    for (uint64_t f = 0; f < numFrames && !sinkDone(sink); f++) {
+        for (uint32_t c = 0; c < layout->channels && !sinkDone(sink); c++) {
+            loadChannel(layout, data, c, f * PHASE_FRAME, PHASE_FRAME, frame);
+            fftForwardReal(plan, frame, re, im);
+            for (int b = 0; b < PHASE_BITS; b++) {
+                sinkBit(sink, im[PHASE_FIRST_BIN + 2 * b] < 0.0f);
+            }
+        }
+    }
+    fftDestroyPlan(plan);
+    free(buffers);
+    return 0;
+}
+
+// ---- echo hiding ----
+
+static inline float smoothStep(float u) {
+    return 0.5f - 0.5f * cosf((float)TRANSFORM_PI * u);
+}
+
+static int encodeEcho(const CARRIER_LAYOUT* layout, uint8_t* data, const BIT_SOURCE* source) {
+    float* original = (float*)malloc((ECHO_DELAY1 + ECHO_SEGMENT) * sizeof(float));
+    float* output = (float*)malloc(ECHO_SEGMENT * sizeof(float));
+    if (original == NULL || output == NULL) {
+        fprintf(stderr, "Could not allocate echo buffers!\n");
+        free(original);
+        free(output);
+        return -1;
+    }
+    uint64_t numSegments = channelFrames(layout) / ECHO_SEGMENT;
+    uint64_t usedSegments = (source->totalBits + layout->channels - 1) / layout->channels;
+    for (uint32_t c = 0; c < layout->channels; c++) {
+        // echo gains (delay 0, delay 1) of segment s; nothing once the payload has run out
+        float gains[3][2];
+        memset(original, 0, ECHO_DELAY1 * sizeof(float));
+        for (uint64_t s = 0; s < numSegments && s <= usedSegments; s++) {
+            for (int j = 0; j < 3; j++) {
+                uint64_t segment = s + j - 1; // previous, this, next
+                uint64_t bit = segment * layout->channels + c;
+                int used = (s > 0 || j > 0) && segment < numSegments && bit < source->totalBits;
+                int value = used ? sourceBit(source, bit) : 0;
+                gains[j][0] = used && !value ? ECHO_GAIN : 0.0f;
+                gains[j][1] = used && value ? ECHO_GAIN : 0.0f;
+            }
+            float* x = original + ECHO_DELAY1; // x[-ECHO_DELAY1] is still the previous segment's original
+            loadChannel(layout, data, c, s * ECHO_SEGMENT, ECHO_SEGMENT, x);
+            for (int i = 0; i < ECHO_SEGMENT; i++) {
+                // raised-cosine cross-fade of the echo kernel, centred on each segment boundary
+                float g0 = gains[1][0], g1 = gains[1][1];
+                if (i < ECHO_RAMP / 2) {
+                    float u = smoothStep((i + ECHO_RAMP / 2 + 0.5f) / ECHO_RAMP);
+                    g0 = gains[0][0] + (g0 - gains[0][0]) * u;
+                    g1 = gains[0][1] + (g1 - gains[0][1]) * u;
+                }
+                else if (i >= ECHO_SEGMENT - ECHO_RAMP / 2) {
+                    float u = smoothStep((i - (ECHO_SEGMENT - ECHO_RAMP / 2) + 0.5f) / ECHO_RAMP);
+                    g0 += (gains[2][0] - g0) * u;
+                    g1 += (gains[2][1] - g1) * u;
+                }
+                output[i] = x[i] + g0 * x[i - ECHO_DELAY0] + g1 * x[i - ECHO_DELAY1];
+            }
+            storeChannel(layout, data, c, s * ECHO_SEGMENT, ECHO_SEGMENT, output);
+            memmove(original, original + ECHO_SEGMENT, ECHO_DELAY1 * sizeof(float));
+        }
+    }
+    free(original);
+    free(output);
+    return 0;
+}
+
+static int decodeEcho(const CARRIER_LAYOUT* layout, const uint8_t* data, BIT_SINK* sink) {
+    FFT_PLAN* plan = fftCreatePlan(ECHO_SEGMENT);
+    float* buffers = (float*)malloc((2 * ECHO_SEGMENT + 2 * (ECHO_SEGMENT / 2 + 1)) * sizeof(float));
+    if (plan == NULL || buffers == NULL) {
+        fprintf(stderr, "Could not allocate FFT plan!\n");
+        fftDestroyPlan(plan);
+        free(buffers);
+        return -1;
+    }
+    float* segment = buffers;
+    float* cepstrum = segment + ECHO_SEGMENT;
+    float* re = cepstrum + ECHO_SEGMENT;
+    float* im = re + ECHO_SEGMENT / 2 + 1;
+    uint64_t numSegments = channelFrames(layout) / ECHO_SEGMENT;
+    for (uint64_t s = 0; s < numSegments && !sinkDone(sink); s++) {
+        for (uint32_t c = 0; c < layout->channels && !sinkDone(sink); c++) {
+            // real cepstrum: an echo at delay d shows up as a peak at quefrency d
+            loadChannel(layout, data, c, s * ECHO_SEGMENT, ECHO_SEGMENT, segment);
+            fftForwardReal(plan, segment, re, im);
+            for (int k = 0; k <= ECHO_SEGMENT / 2; k++) {
+                re[k] = 0.5f * logf(re[k] * re[k] + im[k] * im[k] + 1e-12f);
+                im[k] = 0.0f;
+            }
+            fftInverseReal(plan, re, im, cepstrum);
+            sinkBit(sink, cepstrum[ECHO_DELAY1] > cepstrum[ECHO_DELAY0]);
+        }
+    }
+    fftDestroyPlan(plan);
+    free(buffers);
+    return 0;
+}
+
+int encodeTransform(int method, const CARRIER_LAYOUT* layout, uint8_t* data, FILE* input_file) {
+    if (layout->type != TYPE_WAV) {
+        fprintf(stderr, "Error: Phase coding and echo hiding need a WAV carrier\n");
+        return -1;
+    }
+    uint64_t length;
+    uint8_t* payload = readPayload(input_file, &length);
+    if (payload == NULL) return -1;
+    BIT_SOURCE source;
+    source.payload = payload;
+    source.totalBits = (length + 4) * 8;
+    for (int i = 0; i < 4; i++) source.header[i] = (uint8_t)(length >> (8 * i));
+    uint64_t capacity = transformCapacityBits(method, layout);
+    if (length > 0xFFFFFFFFu || source.totalBits > capacity) {
+        fprintf(stderr, "ERROR: Encode data too large!\n");
+        fprintf(stderr, "payload bits: %llu | max bits: %llu\n",
+            (unsigned long long)source.totalBits, (unsigned long long)capacity);
+        free(payload);
+        return -1;
+    }
+    int result = method == METHOD_PHASE ? encodePhase(layout, data, &source) : encodeEcho(layout, data, &source);
+    free(payload);
+    return result;
+}
+
+int decodeTransform(int method, const CARRIER_LAYOUT* layout, const uint8_t* data, FILE* output_file) {
+    if (layout->type != TYPE_WAV) {
+        fprintf(stderr, "Error: Phase coding and echo hiding need a WAV carrier\n");
+        return -1;
+    }
+    BIT_SINK sink;
+    memset(&sink, 0, sizeof(BIT_SINK));
+    sink.output = output_file;
+    sink.capacityBits = transformCapacityBits(method, layout);
+    sink.totalBits = UINT64_MAX;
+    int result = method == METHOD_PHASE ? decodePhase(layout, data, &sink) : decodeEcho(layout, data, &sink);
+    if (result == 0 && !sink.failed && sink.bits < sink.totalBits) {
+        fprintf(stderr, "Error: Carrier ended before the whole payload was decoded\n");
+        result = -1;
+    }
+    return sink.failed ? -1 : result;
+}
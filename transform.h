@@ -0,0 +1,44 @@
+//
+// Transform-domain audio modes built on fft.c: phase coding and echo hiding.
+// Unlike LSB embedding these survive re-quantization and mild processing of the audio.
+//
+#ifndef STEG_TRANSFORM_H
+#define STEG_TRANSFORM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "carrier.h"
+
+// Phase coding: bit b of each frame sets the phase of bin PHASE_FIRST_BIN + 2b to +pi/2 (0) or -pi/2 (1)
+#define PHASE_FRAME 2048
+#define PHASE_FIRST_BIN 32
+#define PHASE_BITS 64
+// samples at each frame edge where the phase change is faded in/out, so frames join without clicks
+#define PHASE_TAPER 128
+// smallest bin magnitude used for a coded bin (as a sine amplitude), so quiet frames still decode
+#define PHASE_MIN_AMPLITUDE 0.003f
+// correction rounds per frame, for bins that requantization or clipping pushes back
+#define PHASE_PASSES 8
+
+// Echo hiding: one bit per segment and channel, as an echo at ECHO_DELAY0 (0) or ECHO_DELAY1 (1) samples
+#define ECHO_SEGMENT 4096
+#define ECHO_DELAY0 48
+#define ECHO_DELAY1 72
+#define ECHO_GAIN 0.4f
+// samples over which the echo kernel cross-fades between segments
+#define ECHO_RAMP 512
+
+enum TransformMethods {
+    METHOD_LSB, // the time-domain engines, not handled here
+    METHOD_PHASE,
+    METHOD_ECHO,
+    METHOD_SPREAD, // spread.c
+    METHOD_IMAGE // bitplane.c
+};
+
+// Payload bits (including the 32-bit length prefix) the carrier can hold with this method
+uint64_t transformCapacityBits(int method, const CARRIER_LAYOUT* layout);
+// Embed input_file (length-prefixed) into WAV samples in place
+int encodeTransform(int method, const CARRIER_LAYOUT* layout, uint8_t* data, FILE* input_file);
+int decodeTransform(int method, const CARRIER_LAYOUT* layout, const uint8_t* data, FILE* output_file);
+#endif //STEG_TRANSFORM_H
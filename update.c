@@ -0,0 +1,158 @@
+#include "update.h"
+#include "mapfile.h"
+#include "stream.h"
+#include "getopt.h"
+#include <string.h>
+
+// Payload byte `at` as currently embedded, low bit first
+static uint8_t embeddedByte(const uint8_t* data, uint32_t stride, uint64_t at) {
+    const uint8_t* slots = data + at * 8 * stride;
+    uint8_t value = 0;
+    for (int bit = 0; bit < 8; bit++) {
+        value |= (slots[bit * stride] & 1) << bit;
+    }
+    return value;
+}
+
+// Re-embed n bytes from payload byte `at` on, writing only the samples whose LSB is actually different.
+// Returns 1 if anything changed.
+static int rewriteBytes(uint8_t* data, uint32_t stride, uint64_t at, const uint8_t* bytes, size_t n, UPDATE_STATS* stats) {
+    int changed = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint8_t diff = embeddedByte(data, stride, at + i) ^ bytes[i];
+        if (diff == 0) continue;
+        changed = 1;
+        uint8_t* slots = data + (at + i) * 8 * stride;
+        for (int bit = 0; bit < 8; bit++) {
+            if ((diff >> bit) & 1) {
+                slots[bit * stride] ^= 1;
+                stats->flippedBits++;
+            }
+        }
+    }
+    return changed;
+}
+
+int update_InPlace(int type, const char* carrierPath, FILE* payload, FILE* previous, UPDATE_STATS* stats) {
+    memset(stats, 0, sizeof(UPDATE_STATS));
+    MAPPED_FILE map;
+    if (!mapFile(carrierPath, 1, &map)) return -1;
+    CARRIER_LAYOUT layout;
+    if (map.size < carrierPeekSize(type) || !parseCarrierHeader(type, map.data, map.size, &layout)) {
+        unmapFile(&map);
+        return -1;
+    }
+    uint64_t available = map.size > layout.headerSize ? map.size - layout.headerSize : 0;
+    uint64_t dataSize = layout.dataSize < available ? layout.dataSize : available;
+    uint64_t capacity = dataSize / layout.stride / 8;
+    uint8_t* data = map.data + layout.headerSize;
+
+    long long length = payloadLength(payload);
+    if (capacity < STREAM_HEADER_SIZE || (length >= 0 && (uint64_t)length > capacity - STREAM_HEADER_SIZE)) {
+        fprintf(stderr, "ERROR: Encode data too large for carrier!\n");
+        unmapFile(&map);
+        return -1;
+    }
+    if (previous != NULL) {
+        // the old payload only lines up block for block if it sits behind a header too
+        uint8_t header[STREAM_HEADER_SIZE];
+        uint64_t oldLength = 0;
+        for (int i = 0; i < STREAM_HEADER_SIZE; i++) header[i] = embeddedByte(data, layout.stride, i);
+        for (int i = 0; i < 8; i++) oldLength |= (uint64_t)header[4 + i] << (8 * i);
+        if (memcmp(header, STREAM_MAGIC, 4) != 0 || oldLength > capacity - STREAM_HEADER_SIZE) {
+            fprintf(stderr, "Warning: %s holds an older NUL-terminated payload, ignoring -p\n", carrierPath);
+            previous = NULL;
+        }
+    }
+
+    uint8_t newBlock[UPDATE_BLOCK_SIZE];
+    uint8_t oldBlock[UPDATE_BLOCK_SIZE];
+    uint64_t position = 0; // payload byte the block starts at
+    size_t n;
+    while ((n = fread(newBlock, 1, UPDATE_BLOCK_SIZE, payload)) > 0) {
+        stats->blocks++;
+        if (position + n > capacity - STREAM_HEADER_SIZE) {
+            fprintf(stderr, "ERROR: Encode data too large for carrier! (carrier updated up to byte %llu)\n",
+                (unsigned long long)position);
+            unmapFile(&map);
+            return -1;
+        }
+        if (previous != NULL) {
+            // the old payload is known: identical blocks never touch the carrier
+            size_t m = fread(oldBlock, 1, UPDATE_BLOCK_SIZE, previous);
+            if (m == n && memcmp(oldBlock, newBlock, n) == 0) {
+                position += n;
+                continue;
+            }
+        }
+        stats->changedBlocks += rewriteBytes(data, layout.stride, STREAM_HEADER_SIZE + position, newBlock, n, stats);
+        position += n;
+    }
+    // the header goes in last, so a payload from a pipe needn't be measured first
+    uint8_t header[STREAM_HEADER_SIZE];
+    memcpy(header, STREAM_MAGIC, 4);
+    for (int i = 0; i < 8; i++) header[4 + i] = (uint8_t)(position >> (8 * i));
+    rewriteBytes(data, layout.stride, 0, header, STREAM_HEADER_SIZE, stats);
+    unmapFile(&map);
+    return 0;
+}
+
+static void printUpdateUsage() {
+    printf("Usage: ./steg.exe update -t FILETYPE -e INPUT -f FILENAME [-p PREVIOUS]\n");
+    printf("\n\t-t FILETYPE\tFile type (wav, bmp)\n");
+    printf("\t-e INPUT\tNew payload (- for stdin)\n");
+    printf("\t-f FILENAME\tEncoded carrier, rewritten in place\n");
+    printf("\t-p PREVIOUS\tPayload currently embedded, lets unchanged blocks skip the carrier entirely\n");
+}
+
+int runUpdate(int argc, char* argv[]) {
+    const char* inpath = NULL;
+    const char* carrierPath = NULL;
+    const char* previousPath = NULL;
+    int filetype = -1;
+    int opt;
+    optind = 1;
+    while ((opt = getopt(argc, argv, "ht:e:f:p:")) != -1) {
+        switch (opt) {
+            case 'h':
+                printUpdateUsage();
+                return 0;
+            case 't':
+                if (strcmp(optarg, "bmp") == 0) filetype = TYPE_BMP;
+                else if (strcmp(optarg, "wav") == 0) filetype = TYPE_WAV;
+                break;
+            case 'e':
+                inpath = optarg;
+                break;
+            case 'f':
+                carrierPath = optarg;
+                break;
+            case 'p':
+                previousPath = optarg;
+                break;
+            default:
+                printUpdateUsage();
+                return -1;
+        }
+    }
+    if (filetype == -1 || inpath == NULL || carrierPath == NULL) {
+        printUpdateUsage();
+        return -1;
+    }
+    FILE* payload = strcmp(inpath, "-") == 0 ? stdin : fopen(inpath, "rb");
+    FILE* previous = previousPath != NULL ? fopen(previousPath, "rb") : NULL;
+    if (payload == NULL || (previousPath != NULL && previous == NULL)) {
+        printf("Error: Failed to open payload file\n");
+        return -1;
+    }
+    UPDATE_STATS stats;
+    int result = update_InPlace(filetype, carrierPath, payload, previous, &stats);
+    if (payload != stdin) fclose(payload);
+    if (previous != NULL) fclose(previous);
+    if (result == 0) {
+        printf("|| Updated %s: %llu/%llu blocks changed, %llu carrier bytes rewritten\n", carrierPath,
+            (unsigned long long)stats.changedBlocks, (unsigned long long)stats.blocks,
+            (unsigned long long)stats.flippedBits);
+    }
+    return result;
+}
@@ -0,0 +1,26 @@
+//
+// In-place re-encode: only carrier bytes whose LSB actually changes are rewritten.
+//
+#ifndef STEG_UPDATE_H
+#define STEG_UPDATE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "carrier.h"
+
+// Payload bytes compared per step
+#define UPDATE_BLOCK_SIZE 4096
+
+typedef struct UpdateStats {
+    uint64_t blocks;        // payload blocks compared
+    uint64_t changedBlocks; // blocks with at least one differing bit
+    uint64_t flippedBits;   // carrier bytes rewritten
+} UPDATE_STATS;
+
+// Re-embed payload (sequential layout, behind the header encode_Stream writes) into an encoded carrier in place.
+// If previous is non-NULL it is the payload already embedded, and unchanged blocks are skipped without touching the carrier.
+int update_InPlace(int type, const char* carrierPath, FILE* payload, FILE* previous, UPDATE_STATS* stats);
+
+// "update" subcommand: update -t FILETYPE -e INPUT -f FILENAME [-p PREVIOUS]
+int runUpdate(int argc, char* argv[]);
+#endif //STEG_UPDATE_H
@@ -0,0 +1,410 @@
+#include "watch.h"
+#include "getopt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include "stream.h"
+#include "threadpool.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// What is known about one carrier name. Entries live as long as the watcher.
+typedef struct WatchEntry {
+    char* name; // carrier file name
+    int haveCarrier;
+    int havePayload;
+    int queued; // queued at least once, so a rescan leaves it alone
+    struct WatchEntry* next;
+} WATCH_ENTRY;
+
+typedef struct WatchContext {
+    THREAD_POOL* pool;
+    const char* directory;
+    const char* outputDirectory;
+    const char* payloadPath; // fixed payload, NULL to pair NAME.payload files
+    const char* logName;     // file name of the log if it sits in the watched directory
+    int logFd;
+    WATCH_ENTRY* table[WATCH_TABLE_SIZE];
+    // backpressure: the watcher blocks while depth jobs are queued or running
+    pthread_mutex_t lock;
+    pthread_cond_t jobDone;
+    int inFlight;
+    int depth;
+    uint64_t maxJobs; // 0: no limit
+    uint64_t queuedJobs;
+    uint64_t failedJobs;
+} WATCH_CONTEXT;
+
+typedef struct WatchJob {
+    WATCH_CONTEXT* context;
+    int type;
+    char* name;
+    char* carrierPath;
+    char* payloadPath;
+    char* outputPath;
+    char* tempPath;
+    struct timespec arrived;
+} WATCH_JOB;
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void onStopSignal(int sig) {
+    (void)sig;
+    stopRequested = 1;
+}
+
+static char* joinPath(const char* directory, const char* prefix, const char* name, const char* suffix) {
+    size_t length = strlen(directory) + strlen(prefix) + strlen(name) + strlen(suffix) + 2;
+    char* path = (char*)malloc(length);
+    if (path != NULL) snprintf(path, length, "%s/%s%s%s", directory, prefix, name, suffix);
+    return path;
+}
+
+static int carrierTypeOf(const char* name) {
+    const char* dot = strrchr(name, '.');
+    if (dot == NULL) return -1;
+    char ext[8] = { 0 };
+    for (int i = 0; i < 7 && dot[i + 1] != '\0'; i++) {
+        ext[i] = (char)tolower((unsigned char)dot[i + 1]);
+    }
+    if (strcmp(ext, "wav") == 0) return TYPE_WAV;
+    if (strcmp(ext, "bmp") == 0) return TYPE_BMP;
+    return -1;
+}
+
+static double elapsedMs(const struct timespec* since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1e3 + (now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+static WATCH_ENTRY* findEntry(WATCH_CONTEXT* context, const char* name) {
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (const char* c = name; *c; c++) hash = (hash ^ (uint8_t)*c) * 16777619u;
+    WATCH_ENTRY** bucket = &context->table[hash % WATCH_TABLE_SIZE];
+    for (WATCH_ENTRY* entry = *bucket; entry != NULL; entry = entry->next) {
+        if (strcmp(entry->name, name) == 0) return entry;
+    }
+    WATCH_ENTRY* entry = (WATCH_ENTRY*)calloc(1, sizeof(WATCH_ENTRY));
+    if (entry == NULL) return NULL;
+    entry->name = strdup(name);
+    if (entry->name == NULL) {
+        free(entry);
+        return NULL;
+    }
+    entry->next = *bucket;
+    *bucket = entry;
+    return entry;
+}
+
+static void freeTable(WATCH_CONTEXT* context) {
+    for (int i = 0; i < WATCH_TABLE_SIZE; i++) {
+        WATCH_ENTRY* entry = context->table[i];
+        while (entry != NULL) {
+            WATCH_ENTRY* next = entry->next;
+            free(entry->name);
+            free(entry);
+            entry = next;
+        }
+    }
+}
+
+static void freeJob(WATCH_JOB* job) {
+    free(job->name);
+    free(job->carrierPath);
+    free(job->payloadPath);
+    free(job->outputPath);
+    free(job->tempPath);
+    free(job);
+}
+
+// One line per job, written with a single write() on an O_APPEND descriptor so lines from
+// different workers never interleave.
+static void logJob(WATCH_CONTEXT* context, const WATCH_JOB* job, int ok) {
+    char line[1024];
+    char stamp[32];
+    struct timespec now;
+    struct tm utc;
+    clock_gettime(CLOCK_REALTIME, &now);
+    gmtime_r(&now.tv_sec, &utc);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &utc);
+    int length = snprintf(line, sizeof(line), "%s.%03ldZ\t%s\t%s\t%.1fms\t%s\n", stamp, now.tv_nsec / 1000000,
+        job->name, ok ? "ok" : "failed", elapsedMs(&job->arrived), ok ? job->outputPath : "-");
+    if (length < 0) return;
+    if (length >= (int)sizeof(line)) length = (int)sizeof(line) - 1;
+    if (context->logFd >= 0) writeFull(context->logFd, line, (size_t)length);
+    fputs(line, stdout);
+    fflush(stdout);
+}
+
+static int encodeJob(WATCH_JOB* job) {
+    int carrier_fd = open(job->carrierPath, O_RDONLY | O_CLOEXEC);
+    FILE* payload = fopen(job->payloadPath, "rb");
+    int out_fd = open(job->tempPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int result = -1;
+    if (carrier_fd < 0 || payload == NULL || out_fd < 0) {
+        fprintf(stderr, "Error: Failed to open %s, %s or %s\n", job->carrierPath, job->payloadPath, job->tempPath);
+    }
+    else {
+        result = encode_Stream(job->type, carrier_fd, payload, out_fd, NULL);
+        // the rename below only publishes a complete file if the data reached the disk first
+        if (result == 0 && fsync(out_fd) != 0) result = -1;
+    }
+    if (carrier_fd >= 0) close(carrier_fd);
+    if (payload != NULL) fclose(payload);
+    if (out_fd >= 0 && close(out_fd) != 0) result = -1;
+    if (result == 0 && rename(job->tempPath, job->outputPath) != 0) {
+        fprintf(stderr, "Error: Failed to rename %s (%s)\n", job->tempPath, strerror(errno));
+        result = -1;
+    }
+    if (result != 0 && out_fd >= 0) unlink(job->tempPath);
+    return result;
+}
+
+static void watchJobTask(void* arg) {
+    WATCH_JOB* job = (WATCH_JOB*)arg;
+    WATCH_CONTEXT* context = job->context;
+    int ok = encodeJob(job) == 0;
+    logJob(context, job, ok);
+    pthread_mutex_lock(&context->lock);
+    if (!ok) context->failedJobs++;
+    context->inFlight--;
+    pthread_cond_signal(&context->jobDone);
+    pthread_mutex_unlock(&context->lock);
+    freeJob(job);
+}
+
+static void queueJob(WATCH_CONTEXT* context, const WATCH_ENTRY* entry, const struct timespec* arrived) {
+    WATCH_JOB* job = (WATCH_JOB*)calloc(1, sizeof(WATCH_JOB));
+    if (job == NULL) return;
+    job->context = context;
+    job->type = carrierTypeOf(entry->name);
+    job->name = strdup(entry->name);
+    job->carrierPath = joinPath(context->directory, "", entry->name, "");
+    job->payloadPath = context->payloadPath != NULL ? strdup(context->payloadPath)
+        : joinPath(context->directory, "", entry->name, WATCH_PAYLOAD_SUFFIX);
+    job->outputPath = joinPath(context->outputDirectory, WATCH_OUTPUT_PREFIX, entry->name, "");
+    // dot-prefixed, so neither this watcher nor most other tools pick up the partial file;
+    // numbered, so a carrier rewritten while its last job is still running doesn't share it
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%llu.tmp", (unsigned long long)context->queuedJobs);
+    job->tempPath = joinPath(context->outputDirectory, ".", entry->name, suffix);
+    job->arrived = *arrived;
+    if (job->name == NULL || job->carrierPath == NULL || job->payloadPath == NULL || job->outputPath == NULL
+        || job->tempPath == NULL) {
+        fprintf(stderr, "Could not allocate job for %s!\n", entry->name);
+        freeJob(job);
+        return;
+    }
+    // backpressure: while the pool is full, new events wait in the kernel's inotify queue
+    pthread_mutex_lock(&context->lock);
+    while (context->inFlight >= context->depth) {
+        pthread_cond_wait(&context->jobDone, &context->lock);
+    }
+    context->inFlight++;
+    context->queuedJobs++;
+    pthread_mutex_unlock(&context->lock);
+    poolSubmit(context->pool, watchJobTask, job);
+}
+
+// A file finished writing (or was found by a rescan). Queues a job once a carrier has its payload.
+static void fileArrived(WATCH_CONTEXT* context, const char* name, int fromScan) {
+    struct timespec arrived;
+    clock_gettime(CLOCK_MONOTONIC, &arrived);
+    if (context->maxJobs != 0 && context->queuedJobs >= context->maxJobs) return;
+    if (name[0] == '.' || strncmp(name, WATCH_OUTPUT_PREFIX, strlen(WATCH_OUTPUT_PREFIX)) == 0) return;
+    if (context->logName != NULL && strcmp(name, context->logName) == 0) return;
+
+    char carrierName[NAME_MAX + 1];
+    size_t length = strlen(name);
+    size_t suffixLength = strlen(WATCH_PAYLOAD_SUFFIX);
+    int isPayload = length > suffixLength && strcmp(name + length - suffixLength, WATCH_PAYLOAD_SUFFIX) == 0;
+    if (isPayload) {
+        if (context->payloadPath != NULL) return;
+        length -= suffixLength;
+    }
+    if (length > NAME_MAX) return;
+    memcpy(carrierName, name, length);
+    carrierName[length] = '\0';
+    if (carrierTypeOf(carrierName) < 0) return;
+
+    WATCH_ENTRY* entry = findEntry(context, carrierName);
+    if (entry == NULL) return;
+    if (fromScan && entry->queued) return;
+    if (isPayload) entry->havePayload = 1;
+    else entry->haveCarrier = 1;
+    if (entry->haveCarrier && (entry->havePayload || context->payloadPath != NULL)) {
+        entry->queued = 1;
+        queueJob(context, entry, &arrived);
+    }
+}
+
+// Pick up whatever is already there (at start-up, and after the event queue overflowed)
+static void rescanDirectory(WATCH_CONTEXT* context) {
+    DIR* dir = opendir(context->directory);
+    if (dir == NULL) {
+        fprintf(stderr, "Failed to open %s!\n", context->directory);
+        return;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL && !stopRequested) {
+        if (entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN) continue;
+        fileArrived(context, entry->d_name, 1);
+    }
+    closedir(dir);
+}
+
+static int watchLoop(WATCH_CONTEXT* context) {
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Error: inotify_init1 failed (%s)\n", strerror(errno));
+        return -1;
+    }
+    // close-write: a writer finished; moved-to: a file was renamed in whole, the usual way to drop one atomically
+    if (inotify_add_watch(fd, context->directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        fprintf(stderr, "Error: Can't watch %s (%s)\n", context->directory, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    // the watch is in place first, so a file finishing during the scan is seen by one or the other
+    rescanDirectory(context);
+
+    // aligned for struct inotify_event, room for a batch of events per read()
+    char buffer[64 * (sizeof(struct inotify_event) + NAME_MAX + 1)] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (!stopRequested && (context->maxJobs == 0 || context->queuedJobs < context->maxJobs)) {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Error: inotify read failed (%s)\n", strerror(errno));
+            break;
+        }
+        for (char* p = buffer; p < buffer + n; ) {
+            const struct inotify_event* event = (const struct inotify_event*)p;
+            if (event->mask & IN_Q_OVERFLOW) {
+                fprintf(stderr, "Warning: inotify queue overflowed, rescanning %s\n", context->directory);
+                rescanDirectory(context);
+            }
+            else if (event->len > 0 && !(event->mask & IN_ISDIR)) {
+                fileArrived(context, event->name, 0);
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+static void printWatchUsage() {
+    printf("Usage: ./steg.exe watch [-j THREADS] [-e PAYLOAD] [-o OUTDIR] [-l LOG] [-n COUNT] DIR\n");
+    printf("\n\tEncodes every NAME.wav / NAME.bmp written to DIR with NAME.wav" WATCH_PAYLOAD_SUFFIX " / NAME.bmp" WATCH_PAYLOAD_SUFFIX ",\n");
+    printf("\tinto OUTDIR/" WATCH_OUTPUT_PREFIX "NAME. Files already in DIR are picked up at start.\n");
+    printf("\n\t-j THREADS\tWorker threads (default: one per CPU)\n");
+    printf("\t-e PAYLOAD\tEmbed PAYLOAD into every carrier instead of pairing " WATCH_PAYLOAD_SUFFIX " files\n");
+    printf("\t-o OUTDIR\tWhere encoded carriers go (default: DIR)\n");
+    printf("\t-l LOG\t\tStatus log, one line per job (default: OUTDIR/" WATCH_DEFAULT_LOG ")\n");
+    printf("\t-n COUNT\tExit after COUNT jobs (default: run until interrupted)\n");
+}
+
+int runWatch(int argc, char* argv[]) {
+    WATCH_CONTEXT context;
+    memset(&context, 0, sizeof(context));
+    int threads = 0;
+    const char* logPath = NULL;
+    int opt;
+    optind = 1;
+    while ((opt = getopt(argc, argv, "hj:e:o:l:n:")) != -1) {
+        switch (opt) {
+            case 'h':
+                printWatchUsage();
+                return 0;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'e':
+                context.payloadPath = optarg;
+                break;
+            case 'o':
+                context.outputDirectory = optarg;
+                break;
+            case 'l':
+                logPath = optarg;
+                break;
+            case 'n':
+                context.maxJobs = strtoull(optarg, NULL, 10);
+                break;
+            default:
+                printWatchUsage();
+                return -1;
+        }
+    }
+    if (optind != argc - 1) {
+        printWatchUsage();
+        return -1;
+    }
+    context.directory = argv[optind];
+    if (context.outputDirectory == NULL) context.outputDirectory = context.directory;
+    char* defaultLog = NULL;
+    if (logPath == NULL) {
+        defaultLog = joinPath(context.outputDirectory, "", WATCH_DEFAULT_LOG, "");
+        logPath = defaultLog;
+        if (strcmp(context.outputDirectory, context.directory) == 0) context.logName = WATCH_DEFAULT_LOG;
+    }
+    context.logFd = logPath != NULL ? open(logPath, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644) : -1;
+    if (context.logFd < 0) {
+        fprintf(stderr, "Error: Failed to open log %s\n", logPath != NULL ? logPath : WATCH_DEFAULT_LOG);
+        free(defaultLog);
+        return -1;
+    }
+
+    context.pool = poolCreate(threads);
+    if (context.pool == NULL) {
+        close(context.logFd);
+        free(defaultLog);
+        return -1;
+    }
+    context.depth = context.pool->numThreads * WATCH_JOBS_PER_THREAD;
+    pthread_mutex_init(&context.lock, NULL);
+    pthread_cond_init(&context.jobDone, NULL);
+
+    // no SA_RESTART: the blocking read() has to return so the loop can wind down
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onStopSignal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    fprintf(stderr, "|| Watching %s (%d workers)\n", context.directory, context.pool->numThreads);
+    int result = watchLoop(&context);
+    // let queued jobs finish, their outputs are still published atomically
+    poolDestroy(context.pool);
+    pthread_cond_destroy(&context.jobDone);
+    pthread_mutex_destroy(&context.lock);
+    close(context.logFd);
+    freeTable(&context);
+    free(defaultLog);
+    if (result == 0 && context.failedJobs > 0) result = -1;
+    return result;
+}
+
+#else
+
+int runWatch(int argc, char* argv[]) {
+    (void)argc;
+    (void)argv;
+    fprintf(stderr, "Error: watch mode needs inotify (Linux only)\n");
+    return -1;
+}
+
+#endif
@@ -0,0 +1,17 @@
+//
+// Drop-folder mode: carriers and payloads arriving in a directory are paired up and encoded on a worker pool.
+//
+#ifndef STEG_WATCH_H
+#define STEG_WATCH_H
+
+// A carrier NAME.wav / NAME.bmp pairs with the payload NAME.wav.payload (or the -e payload for every carrier)
+#define WATCH_PAYLOAD_SUFFIX ".payload"
+#define WATCH_OUTPUT_PREFIX "encoded_"
+#define WATCH_DEFAULT_LOG "steg-watch.log"
+// Jobs queued or running per worker before the watcher stops taking new ones
+#define WATCH_JOBS_PER_THREAD 2
+#define WATCH_TABLE_SIZE 1024
+
+// "watch" subcommand: watch [-j THREADS] [-e PAYLOAD] [-o OUTDIR] [-l LOG] [-n COUNT] DIR
+int runWatch(int argc, char* argv[]);
+#endif //STEG_WATCH_H
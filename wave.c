@@ -1,4 +1,6 @@
 #include "wave.h"
+#include "crypto.h"
+#include "fec.h"
 // in stereo WAVs, left channel and right channel alternate every other sample
 // 16-bit sample: (24 17) < left (1e f3) < right
 // 8-bit sample: (24) < left (1e) < right
@@ -8,13 +10,30 @@ void freeWAV(WAV_FILE* wav) {
     free(wav->DATA.byteArray);
 }
 
-void initRiffChunk(RIFF_CHUNK* chunk, uint32_t SubChunk2Size)
+void initRiffChunk(RIFF_CHUNK* chunk, uint64_t SubChunk2Size)
 {
-    chunk->ChunkID = 0x46464952; // "RIFF" in big-endian form
-    chunk->ChunkSize = SubChunk2Size + 36;
+    if (SubChunk2Size > RIFF_MAX_DATA_SIZE) {
+        chunk->ChunkID = RF64_ID; // sizes are in the ds64 chunk
+        chunk->ChunkSize = 0xFFFFFFFF;
+    }
+    else {
+        chunk->ChunkID = RIFF_ID; // "RIFF" in big-endian form
+        chunk->ChunkSize = (uint32_t)SubChunk2Size + 36;
+    }
     chunk->Format = 0x45564157; // "WAVE" in big-endian form
 }
 
+// RF64 ds64 chunk, sizes as if the header were RIFF + ds64 + fmt + data
+void initDs64Chunk(DS64_CHUNK* chunk, uint64_t data_size, uint16_t blockAlign)
+{
+    chunk->ChunkID = DS64_ID; // "ds64" in big-endian form
+    chunk->ChunkSize = 28;
+    chunk->RiffSize = data_size + 4 + sizeof(DS64_CHUNK) + sizeof(FMT_CHUNK) + 8;
+    chunk->DataSize = data_size;
+    chunk->SampleCount = blockAlign > 0 ? data_size / blockAlign : 0;
+    chunk->TableLength = 0;
+}
+
 // Standard sample rates are 8000, 44100, 48000.
 // Standard Bits/Sample are 8, 16
 void initFmtChunk(FMT_CHUNK* chunk, uint16_t numChannels, uint32_t sampleRate, uint16_t bitsPerSample)
@@ -29,33 +48,36 @@ void initFmtChunk(FMT_CHUNK* chunk, uint16_t numChannels, uint32_t sampleRate, u
     chunk->BitsPerSample = bitsPerSample; // 8, 16 are standard
 }
 // data_size = NumSamples * NumChannels * BitsPerSample/8
-void initDataChunk(DATA_CHUNK* chunk, uint32_t data_size)
+void initDataChunk(DATA_CHUNK* chunk, uint64_t data_size)
 {
     chunk->Subchunk2ID = 0x61746164; // "data" in big-endian form
-    chunk->Subchunk2Size = data_size;
-    chunk->byteArray = (int8_t*)malloc(data_size);
+    chunk->Subchunk2Size = data_size > RIFF_MAX_DATA_SIZE ? 0xFFFFFFFF : (uint32_t)data_size;
+    chunk->dataSize = data_size;
+    chunk->byteArray = (int8_t*)malloc((size_t)data_size);
 }
 
 // initialize wave file data
 // data_size = NumSamples * NumChannels * BitsPerSample/8
 // Standard sample rates are 8000, 44100, 48000.
 // Standard Bits/Sample are 8, 16
-void initWavFile(WAV_FILE* wav, uint32_t data_size, uint16_t numChannels, uint32_t sampleRate, uint16_t bitsPerSample)
+void initWavFile(WAV_FILE* wav, uint64_t data_size, uint16_t numChannels, uint32_t sampleRate, uint16_t bitsPerSample)
 {
     initRiffChunk(&wav->RIFF, data_size);
     initFmtChunk(&wav->FMT, numChannels, sampleRate, bitsPerSample);
+    initDs64Chunk(&wav->DS64, data_size, wav->FMT.BlockAlign);
     initDataChunk(&wav->DATA, data_size);
+    wav->isRF64 = data_size > RIFF_MAX_DATA_SIZE;
 }
 
 
 // write a byte to a wave file's data section, at an int offset.
-int writeToWav8(WAV_FILE* wav, uint32_t offset, int8_t data)
+int writeToWav8(WAV_FILE* wav, uint64_t offset, int8_t data)
 {
     int success = 1;
-    if (offset >= wav->DATA.Subchunk2Size)
+    if (offset >= wav->DATA.dataSize)
     {
         // writing out of bounds
-        printf("ERROR: Writing out of data bounds! Intended offset: %u / Data size: %u\n", offset, wav->DATA.Subchunk2Size);
+        printf("ERROR: Writing out of data bounds! Intended offset: %llu / Data size: %llu\n", (unsigned long long)offset, (unsigned long long)wav->DATA.dataSize);
         success = 0;
     }
     else if (wav->DATA.byteArray == NULL) {
@@ -71,13 +93,13 @@ int writeToWav8(WAV_FILE* wav, uint32_t offset, int8_t data)
 
 
 
-int writeToWav16(WAV_FILE* wav, uint32_t offset, int16_t data)
+int writeToWav16(WAV_FILE* wav, uint64_t offset, int16_t data)
 {
     int success = 1;
-    if (offset >= wav->DATA.Subchunk2Size)
+    if (offset >= wav->DATA.dataSize)
     {
         // writing out of bounds
-        printf("ERROR: Writing out of data bounds! Intended offset: %u / Data size: %u\n", offset, wav->DATA.Subchunk2Size);
+        printf("ERROR: Writing out of data bounds! Intended offset: %llu / Data size: %llu\n", (unsigned long long)offset, (unsigned long long)wav->DATA.dataSize);
         success = 0;
     }
     else if (wav->DATA.byteArray == NULL) {
@@ -95,13 +117,13 @@ int writeToWav16(WAV_FILE* wav, uint32_t offset, int16_t data)
     return success;
 }
 
-int writeToWav32(WAV_FILE* wav, uint32_t offset, int32_t data)
+int writeToWav32(WAV_FILE* wav, uint64_t offset, int32_t data)
 {
     int success = 1;
-    if (offset >= wav->DATA.Subchunk2Size)
+    if (offset >= wav->DATA.dataSize)
     {
         // writing out of bounds
-        printf("ERROR: Writing out of data bounds! Intended offset: %u / Data size: %u\n", offset, wav->DATA.Subchunk2Size);
+        printf("ERROR: Writing out of data bounds! Intended offset: %llu / Data size: %llu\n", (unsigned long long)offset, (unsigned long long)wav->DATA.dataSize);
         success = 0;
     }
     else if (wav->DATA.byteArray == NULL) {
@@ -121,8 +143,8 @@ int writeToWav32(WAV_FILE* wav, uint32_t offset, int32_t data)
     return success;
 }
 
-int writeSample(WAV_FILE* wav, uint32_t sampleCount, double sample) {
-    uint32_t trueOffset = sampleCount * (wav->FMT.BitsPerSample / 8);
+int writeSample(WAV_FILE* wav, uint64_t sampleCount, double sample) {
+    uint64_t trueOffset = sampleCount * (wav->FMT.BitsPerSample / 8);
     uint8_t raster8;
     int16_t raster16;
     int32_t raster32;
@@ -146,8 +168,8 @@ int writeSample(WAV_FILE* wav, uint32_t sampleCount, double sample) {
     return 0;
 }
 
-int writeSampleEncoded(WAV_FILE* wav, uint32_t sampleCount, double sample, int bitValue) {
-    uint32_t trueOffset = sampleCount * (wav->FMT.BitsPerSample / 8);
+int writeSampleEncoded(WAV_FILE* wav, uint64_t sampleCount, double sample, int bitValue) {
+    uint64_t trueOffset = sampleCount * (wav->FMT.BitsPerSample / 8);
     uint8_t raster8;
     int16_t raster16;
     int32_t raster32;
@@ -174,6 +196,31 @@ int writeSampleEncoded(WAV_FILE* wav, uint32_t sampleCount, double sample, int b
     return 0;
 }
 
+int writeHeader_WAV(FILE* outFile, const WAV_FILE* wav)
+{
+    RIFF_CHUNK riff = wav->RIFF;
+    uint32_t dataSize32 = (uint32_t)wav->DATA.dataSize;
+    int rf64 = wav->isRF64 || wav->DATA.dataSize > RIFF_MAX_DATA_SIZE;
+    if (rf64) {
+        // RF64: 32-bit sizes are placeholders, the ds64 chunk holds the real ones
+        DS64_CHUNK ds64;
+        initDs64Chunk(&ds64, wav->DATA.dataSize, wav->FMT.BlockAlign);
+        riff.ChunkID = RF64_ID;
+        riff.ChunkSize = 0xFFFFFFFF;
+        dataSize32 = 0xFFFFFFFF;
+        fwrite(&riff, sizeof(RIFF_CHUNK), 1, outFile); // write RF64 header
+        fwrite(&ds64, sizeof(DS64_CHUNK), 1, outFile); // write ds64 sizes
+    }
+    else {
+        riff.ChunkID = RIFF_ID;
+        riff.ChunkSize = dataSize32 + 36;
+        fwrite(&riff, sizeof(RIFF_CHUNK), 1, outFile); // write RIFF header
+    }
+    fwrite(&(wav->FMT), sizeof(FMT_CHUNK), 1, outFile); // write FMT header
+    fwrite(&(wav->DATA).Subchunk2ID, sizeof(uint32_t), 1, outFile); // write data ID
+    return fwrite(&dataSize32, sizeof(uint32_t), 1, outFile) == 1; // write data header
+}
+
 int writeToFile_WAV(FILE* outFile, WAV_FILE* wav)
 {
     printf("Writing WAV to file...\n");
@@ -182,23 +229,38 @@ int writeToFile_WAV(FILE* outFile, WAV_FILE* wav)
         printf("ERROR: outFile is NULL!\n");
         return 0;
     }
-    fwrite(&(wav->RIFF), sizeof(RIFF_CHUNK), 1, outFile); // write RIFF header
-    fwrite(&(wav->FMT), sizeof(FMT_CHUNK), 1, outFile); // write FMT header
-    fwrite(&(wav->DATA).Subchunk2ID, sizeof(uint32_t), 1, outFile); // write data ID
-    fwrite(&(wav->DATA).Subchunk2Size, sizeof(uint32_t), 1, outFile); // write data header
-    fwrite(wav->DATA.byteArray, (size_t)wav->DATA.Subchunk2Size, 1, outFile); // write all bytes of byte array
+    writeHeader_WAV(outFile, wav);
+    // write all bytes of byte array, a piece at a time so huge arrays don't trip 32-bit fwrite sizes
+    uint64_t written = 0;
+    while (written < wav->DATA.dataSize) {
+        uint64_t piece = wav->DATA.dataSize - written;
+        if (piece > (1u << 30)) piece = 1u << 30;
+        if (fwrite(wav->DATA.byteArray + written, (size_t)piece, 1, outFile) != 1) {
+            printf("ERROR: Failed writing WAV data!\n");
+            return 0;
+        }
+        written += piece;
+    }
     return 1;
 }
 
 
-int encode_File_ToFile_WAV(FILE* input_file, WAV_FILE* wav)
+int encode_File_ToFile_WAV(FILE* input_file, WAV_FILE* wav, const char* passphrase, int parity)
 {
+    if (parity > 0) {
+        uint32_t bytesPerSample = wav->FMT.BitsPerSample / 8;
+        return fecEmbedPayload(wav->DATA.byteArray, bytesPerSample, wav->DATA.dataSize / bytesPerSample, input_file, parity);
+    }
+    if (passphrase != NULL) {
+        uint32_t bytesPerSample = wav->FMT.BitsPerSample / 8;
+        return sealPayload(wav->DATA.byteArray, bytesPerSample, wav->DATA.dataSize / bytesPerSample, input_file, passphrase);
+    }
     char curChar = '\0';
     uint8_t currentByte = 0;
     int charBitIndex = 0;
     int value = 0;
     int size_read = 0;
-    int progress = 0;
+    uint64_t progress = 0;
     while (!feof(input_file)) {
         // read a character into the file
         size_read = fread(&curChar, 1, 1, input_file);
@@ -224,14 +286,14 @@ int encode_File_ToFile_WAV(FILE* input_file, WAV_FILE* wav)
 int encodeToFile_WAV(const char* text, WAV_FILE* wav)
 {
     if (text == NULL) return 0;
-    int stringLengthBits = (strlen(text) + 1) * 8; // string length (including null)
+    uint64_t stringLengthBits = ((uint64_t)strlen(text) + 1) * 8; // string length (including null)
 
     char curChar = '\0';
     uint8_t currentByte = 0;
     int charBitIndex = 0;
     int value = 0;
     // keep track of which bit we're on, and encode that into the sample
-    for (int i = 0; i < stringLengthBits; i++) {
+    for (uint64_t i = 0; i < stringLengthBits; i++) {
         // get current sample
         currentByte = wav->DATA.byteArray[i];
         // get i'th bit of string
@@ -244,7 +306,7 @@ int encodeToFile_WAV(const char* text, WAV_FILE* wav)
 
 WAV_FILE* readFromFile_WAV(const char* path) {
     FILE* inFile;
-    fopen_s(&inFile, path, "r+b");
+    inFile = fopen(path, "r+b");
     RIFF_CHUNK riff = { 0 };
     if (inFile == NULL) {
         printf("Error: Failed to open %s\n", path);
@@ -252,11 +314,23 @@ WAV_FILE* readFromFile_WAV(const char* path) {
     }
     // read riff chunk
     fread(&riff, sizeof(RIFF_CHUNK), 1, inFile);
-    if (riff.ChunkID != 0x46464952 || riff.Format != 0x45564157) {
+    int rf64 = riff.ChunkID == RF64_ID || riff.ChunkID == BW64_ID;
+    if ((riff.ChunkID != RIFF_ID && !rf64) || riff.Format != 0x45564157) {
         printf("Invalid ChunkID or Format!\n");
         fclose(inFile);
         return NULL;
     }
+    DS64_CHUNK ds64 = { 0 };
+    if (rf64) {
+        // RF64/BW64 keeps 64-bit sizes in a ds64 chunk right after the header
+        fread(&ds64, sizeof(DS64_CHUNK), 1, inFile);
+        if (ds64.ChunkID != DS64_ID || ds64.ChunkSize < 28) {
+            printf("Error: RF64 file without a valid ds64 chunk!\n");
+            fclose(inFile);
+            return NULL;
+        }
+        fseek(inFile, (long)ds64.ChunkSize - 28, SEEK_CUR);
+    }
     FMT_CHUNK fmt = { 0 };
     fread(&fmt, sizeof(FMT_CHUNK), 1, inFile);
     if (fmt.Subchunk1ID != 0x20746D66 || fmt.Subchunk1Size != 16) {
@@ -276,22 +350,34 @@ WAV_FILE* readFromFile_WAV(const char* path) {
         return NULL;
     }
     fread(&data.Subchunk2Size, sizeof(uint32_t), 1, inFile);
-    data.byteArray = (int8_t*)malloc(data.Subchunk2Size);
+    data.dataSize = (rf64 && data.Subchunk2Size == 0xFFFFFFFF) ? ds64.DataSize : data.Subchunk2Size;
+    data.byteArray = (int8_t*)malloc((size_t)data.dataSize);
     // read waveform data from file
     if (data.byteArray == NULL) {
         printf("Could not allocate byte array memory!\n");
+        fclose(inFile);
         return NULL;
     }
-    fread(data.byteArray, data.Subchunk2Size, 1, inFile);
-    if (data.byteArray == NULL) {
+    uint64_t dataRead = 0;
+    while (dataRead < data.dataSize) {
+        uint64_t piece = data.dataSize - dataRead;
+        if (piece > (1u << 30)) piece = 1u << 30;
+        size_t n = fread(data.byteArray + dataRead, 1, (size_t)piece, inFile);
+        if (n == 0) break;
+        dataRead += n;
+    }
+    if (dataRead < data.dataSize) {
         printf("Error: No waveform data could be read!\n");
     }
+    fclose(inFile);
 
     WAV_FILE* wave = (WAV_FILE*)malloc(sizeof(WAV_FILE));
     if (wave != NULL) {
         wave->RIFF = riff;
+        wave->DS64 = ds64;
         wave->FMT = fmt;
         wave->DATA = data;
+        wave->isRF64 = rf64;
     }
     else {
         printf("Could not allocate memory for WAV file!\n");
@@ -308,7 +394,7 @@ int decodeFromFile_WAV(const char* path) {
         printf("Could not read WAV file!\n");
         return -1;
     }
-    uint32_t numBytes = wavData->DATA.Subchunk2Size;
+    uint64_t numBytes = wavData->DATA.dataSize;
     int bitsPerSample = wavData->FMT.BitsPerSample;
     char curChar = '\0';
     int charBitIndex = 0;
@@ -318,7 +404,7 @@ int decodeFromFile_WAV(const char* path) {
     // print the char
     int bytesPerSample = bitsPerSample / 8;
     int value = 0;
-    for (int i = 0; i < numBytes; i += bytesPerSample) {
+    for (uint64_t i = 0; i < numBytes; i += bytesPerSample) {
         // wav file is little endian, so read the first byte, then skip n bytes
         // where n is the bytes per sample, so bitspersample / 8
         currentByte = wavData->DATA.byteArray[i];
@@ -340,18 +426,36 @@ int decodeFromFile_WAV(const char* path) {
     return 0;
 }
 
-int decode_toFile_FromFile_WAV(const char* path, const char* output_path)
+int decode_toFile_FromFile_WAV(const char* path, const char* output_path, const char* passphrase, int parity)
 {
-
-    FILE* output_file = fopen(output_path, "wb+");
-
-
     WAV_FILE* wavData = readFromFile_WAV(path);
     if (wavData == NULL) {
         printf("Could not read WAV file!\n");
         return -1;
     }
-    uint32_t numBytes = wavData->DATA.Subchunk2Size;
+    FILE* output_file = fopen(output_path, "wb+");
+    if (output_file == NULL) {
+        printf("Error: Failed to open %s\n", output_path);
+        freeWAV(wavData);
+        return -1;
+    }
+    if (parity > 0) {
+        uint32_t bytesPerSample = wavData->FMT.BitsPerSample / 8;
+        int result = fecExtractPayload(wavData->DATA.byteArray, bytesPerSample, wavData->DATA.dataSize / bytesPerSample, output_file);
+        fclose(output_file);
+        freeWAV(wavData);
+        if (result == 0) printf("\nDecoded data written to %s!\n", output_path);
+        return result;
+    }
+    if (passphrase != NULL) {
+        uint32_t bytesPerSample = wavData->FMT.BitsPerSample / 8;
+        int result = openPayload(wavData->DATA.byteArray, bytesPerSample, wavData->DATA.dataSize / bytesPerSample, output_file, passphrase);
+        fclose(output_file);
+        freeWAV(wavData);
+        if (result == 0) printf("\nDecoded data written to %s!\n", output_path);
+        return result;
+    }
+    uint64_t numBytes = wavData->DATA.dataSize;
     int bitsPerSample = wavData->FMT.BitsPerSample;
     char curChar = '\0';
     int charBitIndex = 0;
@@ -361,7 +465,7 @@ int decode_toFile_FromFile_WAV(const char* path, const char* output_path)
     // print the char
     int bytesPerSample = bitsPerSample / 8;
     int value = 0;
-    for (int i = 0; i < numBytes; i += bytesPerSample) {
+    for (uint64_t i = 0; i < numBytes; i += bytesPerSample) {
         // wav file is little endian, so read the first byte, then skip n bytes
         // where n is the bytes per sample, so bitspersample / 8
         currentByte = wavData->DATA.byteArray[i];
@@ -16,6 +16,18 @@ typedef struct RiffHeader {
     uint32_t Format;
 } RIFF_CHUNK;
 
+// RF64/BW64: RIFF sizes are set to 0xFFFFFFFF and the real 64-bit sizes live here
+#pragma pack(1)
+typedef struct Ds64Chunk {
+    uint32_t ChunkID; // "ds64", big end.
+    uint32_t ChunkSize; // 28
+    uint64_t RiffSize;
+    uint64_t DataSize;
+    uint64_t SampleCount;
+    uint32_t TableLength; // no extra chunk sizes
+} DS64_CHUNK;
+#pragma pack()
+
 typedef struct FmtHeader {
     uint32_t Subchunk1ID; // big end.
     uint32_t Subchunk1Size;
@@ -29,47 +41,62 @@ typedef struct FmtHeader {
 
 typedef struct DataChunk {
     uint32_t Subchunk2ID; // big end.
-    uint32_t Subchunk2Size;
+    uint32_t Subchunk2Size; // 0xFFFFFFFF in RF64 files
     uint8_t *byteArray; // pointer to start of data
-    // data size is equal to subchunk2size
+    uint64_t dataSize; // real data size, from Subchunk2Size or the ds64 chunk
 } DATA_CHUNK;
 
 typedef struct WaveFile {
     RIFF_CHUNK RIFF;
+    DS64_CHUNK DS64; // only written for RF64
     FMT_CHUNK  FMT;
     DATA_CHUNK DATA;
+    int isRF64;
 } WAV_FILE;
 
+#define RIFF_ID 0x46464952 // "RIFF"
+#define RF64_ID 0x34364652 // "RF64"
+#define BW64_ID 0x34365742 // "BW64"
+#define DS64_ID 0x34367364 // "ds64"
+// data sizes past this need RF64
+#define RIFF_MAX_DATA_SIZE (0xFFFFFFFFull - 36)
+
 // Delete WAV from memory
 void freeWAV(WAV_FILE* wav);
 // Initialize WAV RIFF header
-void initRiffChunk(RIFF_CHUNK* chunk, uint32_t SubChunk2Size);
+void initRiffChunk(RIFF_CHUNK* chunk, uint64_t SubChunk2Size);
+// Initialize WAV ds64 chunk (RF64 sizes)
+void initDs64Chunk(DS64_CHUNK* chunk, uint64_t data_size, uint16_t blockAlign);
 // Initialize WAV FMT header
 void initFmtChunk(FMT_CHUNK* chunk, uint16_t numChannels, uint32_t sampleRate, uint16_t bitsPerSample);
 // Initialize WAV DATA section
-void initDataChunk(DATA_CHUNK* chunk, uint32_t data_size);
+void initDataChunk(DATA_CHUNK* chunk, uint64_t data_size);
 // Initialize WAV File
-void initWavFile(WAV_FILE* wav, uint32_t data_size, uint16_t numChannels, uint32_t sampleRate, uint16_t bitsPerSample);
+void initWavFile(WAV_FILE* wav, uint64_t data_size, uint16_t numChannels, uint32_t sampleRate, uint16_t bitsPerSample);
 // Write data to wav (8-bit)
-int writeToWav8(WAV_FILE* wav, uint32_t offset, int8_t data);
+int writeToWav8(WAV_FILE* wav, uint64_t offset, int8_t data);
 // Write data to wav (16-bit)
-int writeToWav16(WAV_FILE* wav, uint32_t offset, int16_t data);
+int writeToWav16(WAV_FILE* wav, uint64_t offset, int16_t data);
 // Write data to wav (32-bit)
-int writeToWav32(WAV_FILE* wav, uint32_t offset, int32_t data);
+int writeToWav32(WAV_FILE* wav, uint64_t offset, int32_t data);
 // Write sample to wav
-int writeSample(WAV_FILE* wav, uint32_t sampleCount, double sample);
+int writeSample(WAV_FILE* wav, uint64_t sampleCount, double sample);
 // Write sample encoded with steganographic data
-int writeSampleEncoded(WAV_FILE* wav, uint32_t sampleCount, double sample, int bitValue);
+int writeSampleEncoded(WAV_FILE* wav, uint64_t sampleCount, double sample, int bitValue);
+// Write just the RIFF/RF64, fmt and data headers, for writers that produce the samples themselves
+int writeHeader_WAV(FILE* outFile, const WAV_FILE* wav);
 // Write WAV to file
 int writeToFile_WAV(FILE* outFile, WAV_FILE* wav);
 
 // Encode steganographic data in WAV
 int encodeToFile_WAV(const char* text, WAV_FILE* wav);
-int encode_File_ToFile_WAV(FILE* input_file, WAV_FILE* wav);
+// passphrase encrypts the payload (ChaCha20-Poly1305), NULL embeds it as is;
+// parity > 0 Reed-Solomon codes it instead, with that many parity bytes per codeword
+int encode_File_ToFile_WAV(FILE* input_file, WAV_FILE* wav, const char* passphrase, int parity);
 
 // Read WAV from file
 WAV_FILE* readFromFile_WAV(const char* path);
 int decodeFromFile_WAV(const char* path);
-int decode_toFile_FromFile_WAV(const char* path, const char* output_path);
+int decode_toFile_FromFile_WAV(const char* path, const char* output_path, const char* passphrase, int parity);
 #endif //STEG_WAVE_H
 // hidden secret...
\ No newline at end of file
@@ -0,0 +1,403 @@
+#include "y4m.h"
+#include "carrier.h"
+#include "stream.h"
+#include "threadpool.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Payload stream layout: magic | 64-bit length | payload, spread over frames in order
+#define Y4M_MAGIC "Y4MS"
+#define Y4M_PREFIX_SIZE 12
+
+struct VideoJob;
+
+// One frame in flight: read by the main thread, embedded/extracted by a worker, then written out in order
+typedef struct FrameSlot {
+    struct VideoJob* job;
+    char line[Y4M_MAX_LINE + 1]; // FRAME line, newline included
+    size_t lineLength;
+    uint8_t* data;
+    uint8_t* payload;
+    uint64_t payloadBytes;
+    int busy;
+} FRAME_SLOT;
+
+typedef struct VideoJob {
+    Y4M_FORMAT format;
+    int planes;
+    int decoding;
+    uint64_t capacity; // payload bytes per frame
+    THREAD_POOL* pool;
+    FRAME_SLOT* slots;
+    uint64_t depth;    // frames in flight
+    pthread_mutex_t lock;
+    pthread_cond_t frameDone;
+} VIDEO_JOB;
+
+// Read one '\n'-terminated line. Returns its length, 0 at a clean end of stream, -1 on error.
+static long readLine(int fd, char* line, size_t max) {
+    size_t n = 0;
+    while (n < max) {
+        long long r = readFull(fd, line + n, 1);
+        if (r < 0) return -1;
+        if (r == 0) {
+            if (n == 0) return 0;
+            fprintf(stderr, "Error: Y4M stream ended mid-line\n");
+            return -1;
+        }
+        if (line[n++] == '\n') {
+            line[n] = '\0';
+            return (long)n;
+        }
+    }
+    fprintf(stderr, "Error: Y4M header line too long\n");
+    return -1;
+}
+
+int parseY4MHeader(const char* line, Y4M_FORMAT* format) {
+    if (strncmp(line, "YUV4MPEG2", 9) != 0) {
+        fprintf(stderr, "Error: Not a Y4M stream (missing YUV4MPEG2 signature)\n");
+        return 0;
+    }
+    char colour[32] = "420jpeg";
+    memset(format, 0, sizeof(Y4M_FORMAT));
+    const char* p = line + 9;
+    while (*p != '\0' && *p != '\n') {
+        if (*p == ' ') {
+            p++;
+            continue;
+        }
+        char tag = *p++;
+        const char* end = p;
+        while (*end != ' ' && *end != '\n' && *end != '\0') end++;
+        if (tag == 'W') format->width = (uint32_t)strtoul(p, NULL, 10);
+        else if (tag == 'H') format->height = (uint32_t)strtoul(p, NULL, 10);
+        else if (tag == 'C') {
+            size_t n = (size_t)(end - p) < sizeof(colour) - 1 ? (size_t)(end - p) : sizeof(colour) - 1;
+            memcpy(colour, p, n);
+            colour[n] = '\0';
+        }
+        // frame rate, interlacing, aspect and X tags don't change the frame layout
+        p = end;
+    }
+    if (format->width == 0 || format->height == 0) {
+        fprintf(stderr, "Error: Y4M header without a frame size\n");
+        return 0;
+    }
+    uint32_t w = format->width, h = format->height;
+    const char* depth;
+    if (strncmp(colour, "420", 3) == 0) {
+        format->chromaWidth = (w + 1) / 2;
+        format->chromaHeight = (h + 1) / 2;
+        depth = colour + 3;
+    }
+    else if (strncmp(colour, "422", 3) == 0) {
+        format->chromaWidth = (w + 1) / 2;
+        format->chromaHeight = h;
+        depth = colour + 3;
+    }
+    else if (strncmp(colour, "411", 3) == 0) {
+        format->chromaWidth = (w + 3) / 4;
+        format->chromaHeight = h;
+        depth = colour + 3;
+    }
+    else if (strncmp(colour, "444", 3) == 0 && strcmp(colour, "444alpha") != 0) {
+        format->chromaWidth = w;
+        format->chromaHeight = h;
+        depth = colour + 3;
+    }
+    else if (strncmp(colour, "mono", 4) == 0) {
+        depth = colour + 4;
+    }
+    else {
+        fprintf(stderr, "Error: Unsupported Y4M colour space %s\n", colour);
+        return 0;
+    }
+    // 420jpeg/420paldv/420mpeg2 are 8-bit siting variants; 420p10, mono16 etc. are 2 bytes per sample
+    if (*depth == 'p') depth++;
+    format->bytesPerSample = (*depth >= '0' && *depth <= '9' && atoi(depth) > 8) ? 2 : 1;
+    format->planeSize[0] = (uint64_t)w * h * format->bytesPerSample;
+    format->planeSize[1] = (uint64_t)format->chromaWidth * format->chromaHeight * format->bytesPerSample;
+    format->planeSize[2] = format->planeSize[1];
+    format->frameSize = format->planeSize[0] + format->planeSize[1] + format->planeSize[2];
+    return 1;
+}
+
+int parseY4MPlanes(const char* text) {
+    int planes = 0;
+    for (const char* p = text; *p != '\0'; p++) {
+        if (*p == 'y' || *p == 'Y') planes |= Y4M_PLANE_Y;
+        else if (*p == 'u' || *p == 'U') planes |= Y4M_PLANE_U;
+        else if (*p == 'v' || *p == 'V') planes |= Y4M_PLANE_V;
+        else return 0;
+    }
+    return planes;
+}
+
+uint64_t y4mFrameCapacity(const Y4M_FORMAT* format, int planes) {
+    uint64_t bytes = 0;
+    for (int p = 0; p < 3; p++) {
+        if (planes & (1 << p)) bytes += format->planeSize[p] / format->bytesPerSample / 8;
+    }
+    return bytes;
+}
+
+// Worker: embed into or extract from the selected planes, LSB of the low byte of each sample
+static void processFrame(void* arg) {
+    FRAME_SLOT* slot = (FRAME_SLOT*)arg;
+    VIDEO_JOB* job = slot->job;
+    uint32_t stride = job->format.bytesPerSample;
+    uint64_t planeOffset = 0, payloadOffset = 0;
+    for (int p = 0; p < 3 && payloadOffset < slot->payloadBytes; p++) {
+        uint64_t size = job->format.planeSize[p];
+        if (job->planes & (1 << p)) {
+            uint64_t bytes = size / stride / 8;
+            if (bytes > slot->payloadBytes - payloadOffset) bytes = slot->payloadBytes - payloadOffset;
+            if (job->decoding) {
+                lsbExtractBytes(slot->data + planeOffset, stride, 0, slot->payload + payloadOffset, (size_t)bytes);
+            }
+            else {
+                lsbEmbedBytes(slot->data + planeOffset, stride, 0, slot->payload + payloadOffset, (size_t)bytes);
+            }
+            payloadOffset += bytes;
+        }
+        planeOffset += size;
+    }
+    pthread_mutex_lock(&job->lock);
+    slot->busy = 0;
+    pthread_cond_broadcast(&job->frameDone);
+    pthread_mutex_unlock(&job->lock);
+}
+
+static void waitSlot(VIDEO_JOB* job, FRAME_SLOT* slot) {
+    pthread_mutex_lock(&job->lock);
+    while (slot->busy) pthread_cond_wait(&job->frameDone, &job->lock);
+    pthread_mutex_unlock(&job->lock);
+}
+
+static void submitSlot(VIDEO_JOB* job, FRAME_SLOT* slot) {
+    slot->busy = 1;
+    poolSubmit(job->pool, processFrame, slot);
+}
+
+static void stopVideo(VIDEO_JOB* job) {
+    if (job->pool != NULL) poolDestroy(job->pool);
+    if (job->slots != NULL) {
+        for (uint64_t i = 0; i < job->depth; i++) {
+            free(job->slots[i].data);
+            free(job->slots[i].payload);
+        }
+        free(job->slots);
+    }
+    pthread_mutex_destroy(&job->lock);
+    pthread_cond_destroy(&job->frameDone);
+}
+
+// Read the stream header (copying it to out_fd when encoding) and set up the workers and frame slots
+static int startVideo(VIDEO_JOB* job, int carrier_fd, int out_fd, const Y4M_OPTIONS* options, int decoding) {
+    char line[Y4M_MAX_LINE + 1];
+    memset(job, 0, sizeof(VIDEO_JOB));
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->frameDone, NULL);
+    job->planes = options->planes;
+    job->decoding = decoding;
+    long n = readLine(carrier_fd, line, Y4M_MAX_LINE);
+    if (n <= 0 || !parseY4MHeader(line, &job->format)) {
+        if (n == 0) fprintf(stderr, "Error: Empty Y4M stream\n");
+        stopVideo(job);
+        return 0;
+    }
+    if (out_fd >= 0 && !writeFull(out_fd, line, (size_t)n)) {
+        stopVideo(job);
+        return 0;
+    }
+    job->capacity = y4mFrameCapacity(&job->format, job->planes);
+    if (job->capacity == 0) {
+        fprintf(stderr, "Error: The selected planes can't hold any data in this video\n");
+        stopVideo(job);
+        return 0;
+    }
+    job->pool = poolCreate(options->threads);
+    if (job->pool == NULL) {
+        stopVideo(job);
+        return 0;
+    }
+    job->depth = (uint64_t)job->pool->numThreads * Y4M_FRAMES_PER_THREAD;
+    job->slots = (FRAME_SLOT*)calloc((size_t)job->depth, sizeof(FRAME_SLOT));
+    int allocated = job->slots != NULL;
+    for (uint64_t i = 0; allocated && i < job->depth; i++) {
+        job->slots[i].job = job;
+        job->slots[i].data = (uint8_t*)malloc((size_t)job->format.frameSize);
+        job->slots[i].payload = (uint8_t*)malloc((size_t)job->capacity);
+        allocated = job->slots[i].data != NULL && job->slots[i].payload != NULL;
+    }
+    if (!allocated) {
+        fprintf(stderr, "Could not allocate frame buffers!\n");
+        stopVideo(job);
+        return 0;
+    }
+    return 1;
+}
+
+// Next FRAME line and planes. Returns 1 for a frame, 0 at the end of the stream, -1 on error.
+static int readFrame(VIDEO_JOB* job, int carrier_fd, FRAME_SLOT* slot) {
+    long n = readLine(carrier_fd, slot->line, Y4M_MAX_LINE);
+    if (n <= 0) return (int)n;
+    if (strncmp(slot->line, "FRAME", 5) != 0) {
+        fprintf(stderr, "Error: Bad Y4M frame header\n");
+        return -1;
+    }
+    slot->lineLength = (size_t)n;
+    long long got = readFull(carrier_fd, slot->data, (size_t)job->format.frameSize);
+    if (got != (long long)job->format.frameSize) {
+        if (got >= 0) fprintf(stderr, "Error: Y4M stream ended mid-frame\n");
+        return -1;
+    }
+    return 1;
+}
+
+static int writeFrame(VIDEO_JOB* job, int out_fd, FRAME_SLOT* slot) {
+    return writeFull(out_fd, slot->line, slot->lineLength)
+        && writeFull(out_fd, slot->data, (size_t)job->format.frameSize);
+}
+
+int encode_Y4M(int carrier_fd, FILE* payload, int out_fd, const Y4M_OPTIONS* options) {
+    // the length prefix needs the payload size before the first frame goes out
+    if (fseek(payload, 0, SEEK_END) != 0) {
+        fprintf(stderr, "Error: Video mode needs a seekable payload file\n");
+        return -1;
+    }
+    long end = ftell(payload);
+    fseek(payload, 0, SEEK_SET);
+    if (end < 0) return -1;
+
+    VIDEO_JOB job;
+    if (!startVideo(&job, carrier_fd, out_fd, options, 0)) return -1;
+    uint8_t prefix[Y4M_PREFIX_SIZE];
+    memcpy(prefix, Y4M_MAGIC, 4);
+    for (int i = 0; i < 8; i++) prefix[4 + i] = (uint8_t)((uint64_t)end >> (8 * i));
+    uint64_t total = Y4M_PREFIX_SIZE + (uint64_t)end;
+    uint64_t queued = 0; // prefix + payload bytes handed to frames so far
+    uint64_t frame = 0, nextWrite = 0;
+    int result = 0;
+    while (result == 0 && queued < total) {
+        // a slot comes free once the frame it held has been written out, in order
+        while (result == 0 && nextWrite + job.depth <= frame) {
+            FRAME_SLOT* done = &job.slots[nextWrite++ % job.depth];
+            waitSlot(&job, done);
+            if (!writeFrame(&job, out_fd, done)) result = -1;
+        }
+        if (result != 0) break;
+        FRAME_SLOT* slot = &job.slots[frame % job.depth];
+        int r = readFrame(&job, carrier_fd, slot);
+        if (r <= 0) {
+            if (r == 0) fprintf(stderr, "ERROR: Encode data too large! (video ran out of frames)\n");
+            result = -1;
+            break;
+        }
+        uint64_t want = total - queued < job.capacity ? total - queued : job.capacity;
+        uint64_t n = 0;
+        for (; n < want && queued + n < Y4M_PREFIX_SIZE; n++) {
+            slot->payload[n] = prefix[queued + n];
+        }
+        if (n < want) {
+            size_t got = fread(slot->payload + n, 1, (size_t)(want - n), payload);
+            if (got != want - n) {
+                fprintf(stderr, "Error: Payload file changed while encoding\n");
+                result = -1;
+                break;
+            }
+            n += got;
+        }
+        slot->payloadBytes = n;
+        queued += n;
+        submitSlot(&job, slot);
+        frame++;
+    }
+    while (nextWrite < frame) {
+        FRAME_SLOT* done = &job.slots[nextWrite++ % job.depth];
+        waitSlot(&job, done);
+        if (result == 0 && !writeFrame(&job, out_fd, done)) result = -1;
+    }
+    // the rest of the video goes through untouched
+    if (result == 0 && !streamForward(carrier_fd, out_fd)) result = -1;
+    stopVideo(&job);
+    return result;
+}
+
+// Decoder state for handing extracted frames to the output in order
+typedef struct PayloadSink {
+    FILE* output;
+    uint8_t prefix[Y4M_PREFIX_SIZE];
+    uint64_t delivered; // prefix + payload bytes seen
+    uint64_t total;     // UINT64_MAX until the prefix is complete
+    int failed;
+} PAYLOAD_SINK;
+
+static void consumeFrame(PAYLOAD_SINK* sink, const FRAME_SLOT* slot) {
+    uint64_t i = 0;
+    for (; i < slot->payloadBytes && sink->delivered < Y4M_PREFIX_SIZE; i++) {
+        sink->prefix[sink->delivered++] = slot->payload[i];
+        if (sink->delivered == Y4M_PREFIX_SIZE) {
+            if (memcmp(sink->prefix, Y4M_MAGIC, 4) != 0) {
+                fprintf(stderr, "Error: No payload found in this video (check the plane selection)\n");
+                sink->failed = 1;
+                sink->total = Y4M_PREFIX_SIZE;
+                return;
+            }
+            uint64_t length = 0;
+            for (int b = 0; b < 8; b++) length |= (uint64_t)sink->prefix[4 + b] << (8 * b);
+            sink->total = Y4M_PREFIX_SIZE + length;
+        }
+    }
+    if (sink->failed || sink->delivered >= sink->total) return;
+    uint64_t n = slot->payloadBytes - i;
+    if (n > sink->total - sink->delivered) n = sink->total - sink->delivered;
+    if (n > 0 && fwrite(slot->payload + i, 1, (size_t)n, sink->output) != n) {
+        fprintf(stderr, "Error: Failed writing decoded data\n");
+        sink->failed = 1;
+    }
+    sink->delivered += n;
+}
+
+int decode_Y4M(int carrier_fd, FILE* output, const Y4M_OPTIONS* options) {
+    VIDEO_JOB job;
+    if (!startVideo(&job, carrier_fd, -1, options, 1)) return -1;
+    PAYLOAD_SINK sink;
+    memset(&sink, 0, sizeof(PAYLOAD_SINK));
+    sink.output = output;
+    sink.total = UINT64_MAX;
+    uint64_t extracted = 0; // bytes covered by the frames read so far
+    uint64_t frame = 0, nextWrite = 0;
+    int result = 0;
+    while (!sink.failed && extracted < sink.total) {
+        while (!sink.failed && nextWrite + job.depth <= frame) {
+            FRAME_SLOT* done = &job.slots[nextWrite++ % job.depth];
+            waitSlot(&job, done);
+            consumeFrame(&sink, done);
+        }
+        // the prefix may just have told us no more frames are needed
+        if (sink.failed || extracted >= sink.total) break;
+        FRAME_SLOT* slot = &job.slots[frame % job.depth];
+        int r = readFrame(&job, carrier_fd, slot);
+        if (r <= 0) {
+            if (r < 0) result = -1;
+            break;
+        }
+        slot->payloadBytes = job.capacity;
+        extracted += job.capacity;
+        submitSlot(&job, slot);
+        frame++;
+    }
+    while (nextWrite < frame) {
+        FRAME_SLOT* done = &job.slots[nextWrite++ % job.depth];
+        waitSlot(&job, done);
+        if (!sink.failed) consumeFrame(&sink, done);
+    }
+    if (result == 0 && !sink.failed && sink.delivered < sink.total) {
+        fprintf(stderr, "Error: Video ended before the whole payload was extracted\n");
+        result = -1;
+    }
+    stopVideo(&job);
+    return sink.failed ? -1 : result;
+}
@@ -0,0 +1,47 @@
+//
+// Y4M (YUV4MPEG2) video carriers, streamed frame by frame with frames embedded in parallel.
+//
+#ifndef STEG_Y4M_H
+#define STEG_Y4M_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Longest stream header or FRAME line accepted
+#define Y4M_MAX_LINE 1024
+// Frames in flight per worker thread; bounds memory to a few frames per thread
+#define Y4M_FRAMES_PER_THREAD 2
+
+// Plane selection bits
+#define Y4M_PLANE_Y 1
+#define Y4M_PLANE_U 2
+#define Y4M_PLANE_V 4
+
+typedef struct Y4mFormat {
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytesPerSample; // 1, or 2 (little-endian) for the p10/p12/p16 colour spaces
+    uint32_t chromaWidth;    // 0 for mono
+    uint32_t chromaHeight;
+    uint64_t planeSize[3];   // bytes of Y, U, V
+    uint64_t frameSize;      // bytes of planar data per frame
+} Y4M_FORMAT;
+
+typedef struct Y4mOptions {
+    int planes;  // Y4M_PLANE_* bits to embed into
+    int threads; // <= 0 for one per CPU
+} Y4M_OPTIONS;
+
+// Parse a "YUV4MPEG2 ..." stream header line. Returns 1 on success.
+int parseY4MHeader(const char* line, Y4M_FORMAT* format);
+// Parse a plane list such as "y", "uv" or "yuv" into Y4M_PLANE_* bits, 0 if invalid
+int parseY4MPlanes(const char* text);
+// Payload bytes one frame carries in the selected planes
+uint64_t y4mFrameCapacity(const Y4M_FORMAT* format, int planes);
+
+// Embed payload (length-prefixed, must be seekable) into the selected planes of the video read from carrier_fd.
+// Frames past the payload are forwarded untouched.
+int encode_Y4M(int carrier_fd, FILE* payload, int out_fd, const Y4M_OPTIONS* options);
+// Extract a payload written by encode_Y4M with the same plane selection
+int decode_Y4M(int carrier_fd, FILE* output, const Y4M_OPTIONS* options);
+#endif //STEG_Y4M_H